@@ -543,6 +543,36 @@ predict(int label,
     return optimized_predict_impl(label, fv, info, context);
 }
 
+void
+Classifier_Impl::
+predict(const float * rows, size_t n, float * out,
+        const Optimization_Info & info,
+        PredictionContext * context) const
+{
+    // Rows are converted and predicted a block at a time so that the
+    // converted features and the accumulators stay in the cache.
+    enum { BLOCK = 64 };
+
+    size_t nin = info.features_in(), nout = info.features_out();
+    int nl = label_count();
+
+    vector<float> fv(BLOCK * nout);
+    vector<double> accum(BLOCK * nl);
+
+    for (size_t i = 0;  i < n;  i += BLOCK) {
+        size_t nrows = std::min<size_t>(BLOCK, n - i);
+
+        for (unsigned j = 0;  j < nrows;  ++j)
+            info.apply(rows + (i + j) * nin, fv.data() + j * nout);
+
+        std::fill(accum.begin(), accum.end(), 0.0);
+        optimized_predict_batch_impl(fv.data(), nrows, info, accum.data(), 1.0,
+                                     context);
+
+        std::copy(accum.begin(), accum.begin() + nrows * nl, out + i * nl);
+    }
+}
+
 bool
 Classifier_Impl::
 optimize_impl(Optimization_Info & info)
@@ -597,6 +627,23 @@ optimized_predict_impl(int label,
     return predict(label, fset, context);
 }
 
+void
+Classifier_Impl::
+optimized_predict_batch_impl(const float * features,
+                             size_t n,
+                             const Optimization_Info & info,
+                             double * accum,
+                             double weight,
+                             PredictionContext * context) const
+{
+    size_t nf = info.features_out();
+    int nl = label_count();
+
+    for (unsigned i = 0;  i < n;  ++i)
+        optimized_predict_impl(features + i * nf, info, accum + i * nl,
+                               weight, context);
+}
+
 namespace {
 
 struct Accuracy_Job_Info {
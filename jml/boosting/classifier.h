@@ -360,6 +360,18 @@ public:
                           const Optimization_Info & info,
                           PredictionContext * context = 0) const;
 
+    /** Batch version of the optimized predict.  The n feature vectors are
+        laid out one after the other in rows, each one in the same order as
+        for predict(const float *, info).  The label_count() outputs for
+        each row are written one row after the other into out.
+
+        Classifiers that have an optimized_predict_batch_impl() evaluate
+        several rows at once; the others are called once per row.
+    */
+    virtual void predict(const float * rows, size_t n, float * out,
+                         const Optimization_Info & info,
+                         PredictionContext * context = 0) const;
+
     //protected:
 
     /** Function to override to perform the optimization.  Default will
@@ -391,6 +403,19 @@ public:
                            const float * features,
                            const Optimization_Info & info,
                            PredictionContext * context = 0) const;
+
+    /** Batch optimized predict over n dense feature vectors of
+        info.features_out() features each, adding weight times the
+        prediction of row i to accum[i * label_count()] onwards.  The
+        default implementation calls the single row version for each row.
+    */
+    virtual void
+    optimized_predict_batch_impl(const float * features,
+                                 size_t n,
+                                 const Optimization_Info & info,
+                                 double * accum,
+                                 double weight = 1.0,
+                                 PredictionContext * context = 0) const;
     
 public:
     /** Run the classifier over the entire dataset, calling the predict
@@ -178,6 +178,31 @@ optimized_predict_impl(int label,
     return result;
 }
 
+void
+Committee::
+optimized_predict_batch_impl(const float * features,
+                             size_t n,
+                             const Optimization_Info & info,
+                             double * accum,
+                             double weight,
+                             PredictionContext * context) const
+{
+    int nl = bias.size();
+
+    for (unsigned i = 0;  i < n;  ++i)
+        for (unsigned j = 0;  j < nl;  ++j)
+            accum[i * nl + j] += weight * bias[j];
+
+    // One classifier at a time over all of the rows, so that each one is
+    // only brought into the cache once per batch.
+    for (unsigned i = 0;  i < classifiers.size();  ++i) {
+        if (weights[i] == 0.0) continue;
+        classifiers[i]
+            ->optimized_predict_batch_impl(features, n, info, accum,
+                                           weight * weights[i], context);
+    }
+}
+
 Explanation
 Committee::
 explain(const Feature_Set & feature_set,
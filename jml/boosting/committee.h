@@ -101,6 +101,14 @@ public:
                            const Optimization_Info & info,
                            PredictionContext * context = 0) const;
 
+    virtual void
+    optimized_predict_batch_impl(const float * features,
+                                 size_t n,
+                                 const Optimization_Info & info,
+                                 double * accum,
+                                 double weight = 1.0,
+                                 PredictionContext * context = 0) const;
+
     virtual Explanation explain(const Feature_Set & feature_set,
                                 int label,
                                 double weight = 1.0,
@@ -30,14 +30,14 @@ namespace ML {
 /*****************************************************************************/
 
 Decision_Tree::Decision_Tree()
-    : encoding(OE_PROB), optimized_(false)
+    : encoding(OE_PROB), optimized_(false), flat_depth(0)
 {
 }
 
 Decision_Tree::
 Decision_Tree(DB::Store_Reader & store,
               const std::shared_ptr<const Feature_Space> & fs)
-    : optimized_(false)
+    : optimized_(false), flat_depth(0)
 {
     throw Exception("Decision_Tree constructor(reconst): not implemented");
 }
@@ -47,7 +47,8 @@ Decision_Tree(std::shared_ptr<const Feature_Space> feature_space,
               const Feature & predicted)
     : Classifier_Impl(feature_space, predicted),
       encoding(OE_PROB),
-      optimized_(false)
+      optimized_(false),
+      flat_depth(0)
 {
 }
     
@@ -64,6 +65,9 @@ swap(Decision_Tree & other)
     std::swap(tree, other.tree);
     std::swap(encoding, other.encoding);
     std::swap(optimized_, other.optimized_);
+    flat_nodes.swap(other.flat_nodes);
+    flat_preds.swap(other.flat_preds);
+    std::swap(flat_depth, other.flat_depth);
 }
 
 namespace {
@@ -207,6 +211,7 @@ Decision_Tree::
 optimize_impl(Optimization_Info & info)
 {
     optimize_recursive(info, tree.root);
+    flatten(info);
     optimized_ = true;
     return true;
 }
@@ -227,6 +232,66 @@ optimize_recursive(Optimization_Info & info,
     optimize_recursive(info, node.child_missing);
 }
 
+void
+Decision_Tree::
+flatten(const Optimization_Info & info)
+{
+    flat_nodes.clear();
+    flat_preds.clear();
+    flat_depth = 0;
+
+    flatten_recursive(info, tree.root, 0);
+}
+
+uint32_t
+Decision_Tree::
+flatten_recursive(const Optimization_Info & info,
+                  const Tree::Ptr & ptr,
+                  int depth)
+{
+    int nl = label_count();
+
+    uint32_t index = flat_nodes.size();
+    flat_nodes.push_back(Flat_Node());
+    flat_preds.resize(flat_preds.size() + nl, 0.0f);
+
+    if (!ptr.node()) {
+        // Leaf, or missing branch which predicts nothing.
+        Flat_Node & leaf = flat_nodes[index];
+        leaf.feature = 0;
+        leaf.split_val = 0.0f;
+        leaf.op = Split::NOT_MISSING;
+        std::fill(leaf.child, leaf.child + 3, index);
+
+        if (ptr) {
+            const Label_Dist & pred = ptr.leaf()->pred;
+            std::copy(pred.begin(), pred.begin() + std::min<int>(nl, pred.size()),
+                      flat_preds.begin() + index * nl);
+        }
+
+        flat_depth = std::max(flat_depth, depth);
+        return index;
+    }
+
+    const Tree::Node & node = *ptr.node();
+
+    uint32_t child_true = flatten_recursive(info, node.child_true, depth + 1);
+    uint32_t child_false = flatten_recursive(info, node.child_false, depth + 1);
+    uint32_t child_missing
+        = flatten_recursive(info, node.child_missing, depth + 1);
+
+    // The recursion may have moved the nodes around
+    Flat_Node & result = flat_nodes[index];
+    result.feature = info.get_optimized_index(node.split.feature());
+    result.split_val = node.split.split_val();
+    result.op = node.split.op();
+    result.child[false] = child_false;
+    result.child[true] = child_true;
+    result.child[MISSING] = child_missing;
+
+    return index;
+}
+
 Label_Dist
 Decision_Tree::
 optimized_predict_impl(const float * features,
@@ -271,6 +336,58 @@ optimized_predict_impl(int label,
     return results;
 }
 
+void
+Decision_Tree::
+optimized_predict_batch_impl(const float * features,
+                             size_t n,
+                             const Optimization_Info & info,
+                             double * accum,
+                             double weight,
+                             PredictionContext * context) const
+{
+    if (!optimized_ || flat_nodes.empty()) {
+        Classifier_Impl::optimized_predict_batch_impl(features, n, info, accum,
+                                                      weight, context);
+        return;
+    }
+
+    /* Rows are walked down the tree a block at a time, one level for all
+       of the rows before the next one.  Each row is a chain of dependent
+       loads, but the rows of a block are independent of each other which
+       lets the processor work on all of them at once.  A short last block
+       walks its last row several times over.
+    */
+    enum { BLOCK = 8 };
+
+    size_t nf = info.features_out();
+    int nl = label_count();
+    const Flat_Node * nodes = &flat_nodes[0];
+
+    for (size_t i = 0;  i < n;  i += BLOCK) {
+        const float * rows[BLOCK];
+        uint32_t current[BLOCK];
+        for (unsigned r = 0;  r < BLOCK;  ++r) {
+            rows[r] = features + std::min<size_t>(i + r, n - 1) * nf;
+            current[r] = 0;
+        }
+
+        for (int level = 0;  level < flat_depth;  ++level) {
+            for (unsigned r = 0;  r < BLOCK;  ++r) {
+                const Flat_Node & node = nodes[current[r]];
+                current[r] = node.next(rows[r][node.feature]);
+            }
+        }
+
+        size_t nrows = std::min<size_t>(BLOCK, n - i);
+        for (unsigned r = 0;  r < nrows;  ++r) {
+            const float * pred = &flat_preds[current[r] * nl];
+            double * out = accum + (i + r) * nl;
+            for (unsigned l = 0;  l < nl;  ++l)
+                out[l] += weight * pred[l];
+        }
+    }
+}
+
 template<class GetFeatures, class Results>
 void
 Decision_Tree::
@@ -633,6 +750,9 @@ reconstitute(DB::Store_Reader & store,
         throw Exception("Decision_Tree::reconstitute: read bad marker at end");
 
     optimized_ = false;
+    flat_nodes.clear();
+    flat_preds.clear();
+    flat_depth = 0;
 }
     
 std::string
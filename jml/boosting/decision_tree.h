@@ -83,6 +83,37 @@ public:
     void optimize_recursive(Optimization_Info & info,
                             const Tree::Ptr & ptr);
 
+    /** Flattened copy of the tree that optimize_impl() builds for the batch
+        optimized predict.  Nodes are stored depth first in a single array;
+        leafs are nodes whose children all point back to themselves, so
+        that a row can be walked down flat_depth levels without checking
+        whether it has already reached its leaf.
+    */
+    struct Flat_Node {
+        uint32_t feature;   ///< Optimized index of the feature to test
+        float split_val;    ///< Value to test against
+        uint32_t op;        ///< Split::Op of the test
+        uint32_t child[3];  ///< Next node for false, true and MISSING
+
+        /** Same as Split::apply() but without any branches. */
+        JML_ALWAYS_INLINE uint32_t next(float val) const
+        {
+            int all = (val < split_val) | ((val == split_val) << 1) | 4;
+            int branch = (all >> op) & 1;
+            return child[val != val ? MISSING : branch];
+        }
+    };
+
+    std::vector<Flat_Node> flat_nodes;
+    std::vector<float> flat_preds;  ///< label_count() values per node
+    int flat_depth;                 ///< Number of levels to the deepest leaf
+
+    void flatten(const Optimization_Info & info);
+
+    uint32_t flatten_recursive(const Optimization_Info & info,
+                               const Tree::Ptr & ptr,
+                               int depth);
+
     /** Optimized predict for a dense feature vector.
         This is the worker function that all classifiers that implement the
         optimized predict should override.  The default implementation will
@@ -105,6 +136,14 @@ public:
                            const Optimization_Info & info,
                            PredictionContext * context = 0) const;
 
+    virtual void
+    optimized_predict_batch_impl(const float * features,
+                                 size_t n,
+                                 const Optimization_Info & info,
+                                 double * accum,
+                                 double weight = 1.0,
+                                 PredictionContext * context = 0) const;
+
     template<class GetFeatures, class Results>
     void predict_recursive_impl(const GetFeatures & get_features,
                                 Results & results,
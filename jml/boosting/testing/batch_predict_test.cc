@@ -0,0 +1,192 @@
+/* batch_predict_test.cc
+   Copyright (c) 2013 Datacratic.  All rights reserved.
+
+   Test and benchmark of the batch optimized predict of boosted trees.
+*/
+
+#define BOOST_TEST_MAIN
+#define BOOST_TEST_DYN_LINK
+
+#include <boost/test/unit_test.hpp>
+#include <boost/timer.hpp>
+#include <vector>
+#include <iostream>
+
+#include "jml/boosting/decision_tree.h"
+#include "jml/boosting/committee.h"
+#include "jml/boosting/dense_features.h"
+#include "jml/boosting/feature_info.h"
+#include "jml/utils/smart_ptr_utils.h"
+
+using namespace ML;
+using namespace std;
+
+
+namespace {
+
+struct Random {
+    Random(unsigned seed) : state(seed) {}
+
+    unsigned operator () ()
+    {
+        state = state * 6364136223846793005ULL + 1442695040888963407ULL;
+        return state >> 33;
+    }
+
+    float uniform() { return (*this)() / float(1U << 31); }
+
+    uint64_t state;
+};
+
+Tree::Ptr
+randomTree(Tree & tree, const vector<Feature> & features, Random & rng,
+           int depth)
+{
+    // Some branches are left empty; they predict nothing.
+    if (rng() % 16 == 0) return Tree::Ptr();
+
+    if (depth == 0 || rng() % 8 == 0) {
+        distribution<float> pred(2);
+        pred[0] = rng.uniform();
+        pred[1] = 1.0 - pred[0];
+        return tree.new_leaf(pred, 1.0);
+    }
+
+    Tree::Node * node = tree.new_node();
+
+    // Mostly LESS, as the trees learnt on real valued features are.
+    Split::Op op = Split::LESS;
+    if (rng() % 8 == 0) op = Split::EQUAL;
+    else if (rng() % 8 == 0) op = Split::NOT_MISSING;
+
+    float split_val = op == Split::EQUAL ? rng() % 4 : rng.uniform();
+    if (op == Split::NOT_MISSING) split_val = 0.0;
+
+    node->split = Split(features[rng() % features.size()], split_val, op);
+    node->z = 0.0;
+    node->examples = 1.0;
+    node->pred = distribution<float>(2, 0.5);
+    node->child_true = randomTree(tree, features, rng, depth - 1);
+    node->child_false = randomTree(tree, features, rng, depth - 1);
+    node->child_missing = randomTree(tree, features, rng, depth - 1);
+
+    return node;
+}
+
+struct Model {
+    Model(int nfeatures, int ntrees, int depth, unsigned seed)
+        : rng(seed)
+    {
+        fs.add_feature("LABEL", Feature_Info(BOOLEAN, false, true));
+        for (unsigned i = 0;  i < nfeatures;  ++i)
+            features.push_back(fs.make_feature(format("f%d", i), REAL));
+
+        std::shared_ptr<Dense_Feature_Space> fsp = make_unowned_sp(fs);
+        Feature label = fs.features()[0];
+
+        committee.reset(new Committee(fsp, label));
+        committee->bias = distribution<float>(2, 0.1);
+
+        for (unsigned i = 0;  i < ntrees;  ++i) {
+            std::shared_ptr<Decision_Tree> tree(new Decision_Tree(fsp, label));
+            tree->tree.root = randomTree(tree->tree, features, rng, depth);
+            committee->classifiers.push_back(tree);
+            committee->weights.push_back(rng.uniform());
+        }
+
+        info = committee->optimize(features);
+    }
+
+    /** Rows of features, some of them missing and some of them small
+        integers so that the EQUAL splits are taken.
+    */
+    vector<float> rows(size_t n)
+    {
+        vector<float> result(n * features.size());
+        for (float & val: result) {
+            if (rng() % 10 == 0) val = numeric_limits<float>::quiet_NaN();
+            else if (rng() % 4 == 0) val = rng() % 4;
+            else val = rng.uniform();
+        }
+        return result;
+    }
+
+    Random rng;
+    Dense_Feature_Space fs;
+    vector<Feature> features;
+    std::shared_ptr<Committee> committee;
+    Optimization_Info info;
+};
+
+} // file scope
+
+BOOST_AUTO_TEST_CASE( test_batch_predict_matches )
+{
+    Model model(20, 50, 6, 1);
+    BOOST_REQUIRE(model.committee->predict_is_optimized());
+
+    // Not a multiple of the block sizes
+    size_t n = 1000 + 37;
+    size_t nf = model.features.size();
+    vector<float> rows = model.rows(n);
+
+    vector<float> out(n * 2);
+    model.committee->predict(&rows[0], n, &out[0], model.info);
+
+    for (unsigned i = 0;  i < n;  ++i) {
+        Label_Dist expected
+            = model.committee->predict(&rows[i * nf], model.info);
+
+        BOOST_REQUIRE_EQUAL(expected.size(), 2);
+        BOOST_CHECK_CLOSE(out[i * 2], expected[0], 1e-4);
+        BOOST_CHECK_CLOSE(out[i * 2 + 1], expected[1], 1e-4);
+    }
+}
+
+BOOST_AUTO_TEST_CASE( test_batch_predict_single_leaf )
+{
+    Model model(3, 0, 0, 2);
+
+    std::shared_ptr<Decision_Tree> tree
+        (new Decision_Tree(model.committee->feature_space(),
+                           model.committee->predicted()));
+    tree->tree.root = tree->tree.new_leaf(distribution<float>(2, 0.25), 1.0);
+    model.committee->classifiers.push_back(tree);
+    model.committee->weights.push_back(2.0);
+    model.info = model.committee->optimize(model.features);
+
+    vector<float> rows = model.rows(3);
+    vector<float> out(6);
+    model.committee->predict(&rows[0], 3, &out[0], model.info);
+
+    for (float val: out)
+        BOOST_CHECK_CLOSE(val, 0.6, 1e-4);
+}
+
+BOOST_AUTO_TEST_CASE( benchmark_batch_predict )
+{
+    Model model(100, 300, 8, 3);
+
+    size_t n = 10000;
+    size_t nf = model.features.size();
+    vector<float> rows = model.rows(n);
+    vector<float> out(n * 2);
+
+    double total = 0.0;
+
+    boost::timer timer;
+    for (unsigned i = 0;  i < n;  ++i)
+        total += model.committee->predict(&rows[i * nf], model.info)[1];
+    double single = timer.elapsed();
+
+    timer.restart();
+    model.committee->predict(&rows[0], n, &out[0], model.info);
+    double batch = timer.elapsed();
+
+    cerr << "predicting " << n << " rows with " << model.committee->classifiers.size()
+         << " trees: one at a time " << single << "s ("
+         << n / single << "/s), batch " << batch << "s ("
+         << n / batch << "/s), " << single / batch << "x" << endl;
+
+    BOOST_CHECK(total > 0.0);
+}
@@ -17,6 +17,9 @@
 #include "jml/utils/exc_assert.h"
 
 #include <boost/iostreams/concepts.hpp>
+#include <boost/iostreams/read.hpp>
+#include <boost/iostreams/write.hpp>
+#include <algorithm>
 #include <ios>
 #include <vector>
 #include <cstring>
@@ -78,6 +81,19 @@ void read(Source& src, T* typedData, size_t size)
     }
 }
 
+/** Same as read() but returns false if the source is already at its end. */
+template<typename Source, typename T>
+bool tryRead(Source& src, T* typedData, size_t size)
+{
+    char* data = (char*) typedData;
+
+    ssize_t read = boost::iostreams::read(src, data, size);
+    if (read < 0) return false;
+
+    lz4::read(src, data + read, size - read);
+    return true;
+}
+
 
 /******************************************************************************/
 /* HEADER                                                                     */
@@ -119,22 +135,36 @@ struct JML_PACKED Header
     {
         Header head;
         lz4::read(src, &head, sizeof(head));
+        head.validate();
+        return std::move(head);
+    }
 
-        if (head.magic != MagicConst)
-            throw lz4_error("invalid magic number");
-
-        if (head.version() != 1)
-            throw lz4_error("unsupported lz4 version");
+    /** Reads the header of the next frame, if there is one, skipping over
+        any skippable frames on the way.
+    */
+    template<typename Source>
+    static bool tryRead(Source& src, Header& head)
+    {
+        for (;;) {
+            if (!lz4::tryRead(src, &head.magic, sizeof(head.magic)))
+                return false;
 
-        if (!head.blockIndependence())
-            throw lz4_error("unsupported option: block dependence");
+            if ((head.magic & 0xFFFFFFF0) != SkippableMagicConst) break;
 
-        checkBlockId(head.blockId());
+            uint32_t size;
+            lz4::read(src, &size, sizeof(size));
 
-        if (head.checkBits != head.checksumOptions())
-            throw lz4_error("corrupted options");
+            char skipped[4096];
+            while (size > 0) {
+                size_t toSkip = std::min<size_t>(size, sizeof(skipped));
+                lz4::read(src, skipped, toSkip);
+                size -= toSkip;
+            }
+        }
 
-        return std::move(head);
+        lz4::read(src, &head.options, sizeof(head) - sizeof(head.magic));
+        head.validate();
+        return true;
     }
 
     template<typename Sink>
@@ -145,12 +175,30 @@ struct JML_PACKED Header
 
 private:
 
+    void validate() const
+    {
+        if (magic != MagicConst)
+            throw lz4_error("invalid magic number");
+
+        if (version() != 1)
+            throw lz4_error("unsupported lz4 version");
+
+        if (!blockIndependence())
+            throw lz4_error("unsupported option: block dependence");
+
+        checkBlockId(blockId());
+
+        if (checkBits != checksumOptions())
+            throw lz4_error("corrupted options");
+    }
+
     uint8_t checksumOptions() const
     {
         return XXH32(options, 2, ChecksumSeed) >> 8;
     }
 
     static constexpr uint32_t MagicConst = 0x184D2204;
+    static constexpr uint32_t SkippableMagicConst = 0x184D2A50;
     uint32_t magic;
     uint8_t options[2];
     uint8_t checkBits;
@@ -317,6 +365,15 @@ private:
                 if (checksum != expected) throw lz4_error("invalid checksum");
             }
 
+            // Frames can be concatenated, as the parallel log compressors
+            // do, in which case they're read back as a single stream.
+            if (lz4::Header::tryRead(src, head)) {
+                if (head.streamChecksum())
+                    streamChecksumState = XXH32_init(lz4::ChecksumSeed);
+                pos = toRead = 0;
+                return;
+            }
+
             done = true;
             return;
         }
@@ -336,14 +393,15 @@ private:
         }
 
         pos = 0;
+        buffer.resize(head.blockSize());
 
         if (notCompressed) {
+            if (compressedSize > buffer.size())
+                throw lz4_error("malformed lz4 stream");
             std::memcpy(buffer.data(), compressed, compressedSize);
             toRead = compressedSize;
         }
         else {
-            buffer.resize(head.blockSize());
-
             auto decompressed = LZ4_decompress_safe(
                     compressed,     buffer.data(),
                     compressedSize, buffer.size());
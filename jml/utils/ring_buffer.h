@@ -10,6 +10,8 @@
 #define __jml_utils__ring_buffer_h__
 
 #include <vector>
+#include <atomic>
+#include <memory>
 #include "jml/arch/futex.h"
 #include "jml/arch/spinlock.h"
 #include <mutex>
@@ -396,6 +398,129 @@ struct RingBufferSRMW : public RingBufferBase<Request> {
     }
 };
 
+
+/*****************************************************************************/
+/* RING BUFFER MULTIPLE WRITERS MULTIPLE READERS                             */
+/*****************************************************************************/
+
+/** Bounded lock-free ring buffer for any number of producers and consumers.
+
+    Each cell carries a sequence number which tells producers and consumers
+    whether it is ready for them, so the only shared writes are a single CAS
+    on the head or on the tail.  Neither side ever blocks: callers that want
+    to wait for work or for room need to arrange that themselves.
+
+    The size is rounded up to the next power of two.
+*/
+template<typename Request>
+struct RingBufferMWMR {
+
+    RingBufferMWMR(size_t size)
+    {
+        size_t numEntries = 2;
+        while (numEntries < size)
+            numEntries *= 2;
+
+        cells.reset(new Cell[numEntries]);
+        mask = numEntries - 1;
+        for (size_t i = 0;  i < numEntries;  ++i)
+            cells[i].sequence.store(i, std::memory_order_relaxed);
+
+        writePosition.store(0, std::memory_order_relaxed);
+        readPosition.store(0, std::memory_order_relaxed);
+    }
+
+    RingBufferMWMR(const RingBufferMWMR & other) = delete;
+    RingBufferMWMR & operator = (const RingBufferMWMR & other) = delete;
+
+    template<typename RequestT>
+    bool tryPush(RequestT && request)
+    {
+        Cell * cell;
+        size_t pos = writePosition.load(std::memory_order_relaxed);
+
+        for (;;) {
+            cell = &cells[pos & mask];
+            size_t seq = cell->sequence.load(std::memory_order_acquire);
+            intptr_t diff = (intptr_t)seq - (intptr_t)pos;
+
+            if (diff == 0) {
+                if (writePosition.compare_exchange_weak(
+                                pos, pos + 1, std::memory_order_relaxed))
+                    break;
+            }
+            else if (diff < 0) return false;  // full
+            else pos = writePosition.load(std::memory_order_relaxed);
+        }
+
+        cell->request = std::forward<RequestT>(request);
+        cell->sequence.store(pos + 1, std::memory_order_release);
+        return true;
+    }
+
+    bool tryPop(Request & result)
+    {
+        Cell * cell;
+        size_t pos = readPosition.load(std::memory_order_relaxed);
+
+        for (;;) {
+            cell = &cells[pos & mask];
+            size_t seq = cell->sequence.load(std::memory_order_acquire);
+            intptr_t diff = (intptr_t)seq - (intptr_t)(pos + 1);
+
+            if (diff == 0) {
+                if (readPosition.compare_exchange_weak(
+                                pos, pos + 1, std::memory_order_relaxed))
+                    break;
+            }
+            else if (diff < 0) return false;  // empty
+            else pos = readPosition.load(std::memory_order_relaxed);
+        }
+
+        result = std::move(cell->request);
+        cell->request = Request();
+        cell->sequence.store(pos + mask + 1, std::memory_order_release);
+        return true;
+    }
+
+    bool couldPop() const
+    {
+        return size() != 0;
+    }
+
+    /** Approximate number of elements in the buffer; only exact when there
+        are no concurrent operations.
+    */
+    size_t size() const
+    {
+        size_t w = writePosition.load(std::memory_order_relaxed);
+        size_t r = readPosition.load(std::memory_order_relaxed);
+        return w > r ? w - r : 0;
+    }
+
+    size_t capacity() const
+    {
+        return mask + 1;
+    }
+
+private:
+    struct Cell {
+        std::atomic<size_t> sequence;
+        Request request;
+    };
+
+    std::unique_ptr<Cell[]> cells;
+    size_t mask;
+
+    // Keep the two ends on separate cache lines so producers and consumers
+    // don't false share.
+    char pad0[64];
+    std::atomic<size_t> writePosition;
+    char pad1[64];
+    std::atomic<size_t> readPosition;
+    char pad2[64];
+};
+
 } // namespace ML
 
 #endif /* __jml_utils__ring_buffer_h__ */
@@ -0,0 +1,83 @@
+/* ring_buffer_test.cc
+   Copyright (c) 2013 Datacratic.  All rights reserved.
+
+   Test for the lock-free ring buffer.
+*/
+
+#define BOOST_TEST_MAIN
+#define BOOST_TEST_DYN_LINK
+
+#include "jml/utils/ring_buffer.h"
+#include <boost/test/unit_test.hpp>
+#include <thread>
+#include <atomic>
+#include <string>
+#include <vector>
+
+using namespace ML;
+using namespace std;
+
+BOOST_AUTO_TEST_CASE( test_mwmr_single_thread )
+{
+    RingBufferMWMR<string> buf(5);
+    BOOST_CHECK_EQUAL(buf.capacity(), 8);
+    BOOST_CHECK(!buf.couldPop());
+
+    string val;
+    BOOST_CHECK(!buf.tryPop(val));
+
+    for (unsigned i = 0;  i < 8;  ++i)
+        BOOST_CHECK(buf.tryPush(to_string(i)));
+    BOOST_CHECK(!buf.tryPush(string("full")));
+    BOOST_CHECK_EQUAL(buf.size(), 8);
+
+    for (unsigned i = 0;  i < 8;  ++i) {
+        BOOST_CHECK(buf.tryPop(val));
+        BOOST_CHECK_EQUAL(val, to_string(i));
+    }
+    BOOST_CHECK(!buf.tryPop(val));
+
+    // Wrap around a few times.
+    for (unsigned i = 0;  i < 100;  ++i) {
+        BOOST_CHECK(buf.tryPush(to_string(i)));
+        BOOST_CHECK(buf.tryPop(val));
+        BOOST_CHECK_EQUAL(val, to_string(i));
+    }
+}
+
+BOOST_AUTO_TEST_CASE( test_mwmr_multi_thread )
+{
+    enum { NumProducers = 4, NumConsumers = 4, PerProducer = 100000 };
+
+    RingBufferMWMR<uint64_t> buf(1024);
+    std::atomic<uint64_t> sum(0), popped(0);
+    std::atomic<bool> done(false);
+
+    vector<thread> threads;
+    for (unsigned i = 0;  i < NumConsumers;  ++i) {
+        threads.emplace_back([&] () {
+                uint64_t val;
+                while (!done || buf.couldPop()) {
+                    if (!buf.tryPop(val)) continue;
+                    sum += val;
+                    ++popped;
+                }
+            });
+    }
+
+    vector<thread> producers;
+    for (unsigned i = 0;  i < NumProducers;  ++i) {
+        producers.emplace_back([&] () {
+                for (uint64_t j = 1;  j <= PerProducer;  ++j)
+                    while (!buf.tryPush(j));
+            });
+    }
+
+    for (auto & th: producers) th.join();
+    done = true;
+    for (auto & th: threads) th.join();
+
+    uint64_t expected = NumProducers * (uint64_t(PerProducer) * (PerProducer + 1) / 2);
+    BOOST_CHECK_EQUAL(popped, NumProducers * PerProducer);
+    BOOST_CHECK_EQUAL(sum, expected);
+}
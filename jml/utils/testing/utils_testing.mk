@@ -13,3 +13,4 @@ $(eval $(call test,csv_parsing_test,arch utils,boost))
 
 $(eval $(call test,worker_task_test,worker_task ACE arch boost_thread pthread,boost))
 $(eval $(call test,json_parsing_test,utils arch,boost))
+$(eval $(call test,ring_buffer_test,arch,boost))
@@ -0,0 +1,282 @@
+/** auction_tracer.cc                                 -*- C++ -*-
+    Copyright (c) 2014 Datacratic.  All rights reserved.
+
+    Implementation of the auction tracer.
+
+*/
+
+#include "auction_tracer.h"
+#include "jml/arch/threads.h"
+#include "jml/arch/exception.h"
+#include "jml/utils/exc_check.h"
+#include "jml/utils/filter_streams.h"
+#include "soa/jsoncpp/json.h"
+
+#include <algorithm>
+#include <cstring>
+#include <unistd.h>
+
+using namespace std;
+using namespace Datacratic;
+
+namespace RTBKIT {
+
+namespace {
+
+std::atomic<uint64_t> generations(0);
+
+/** Ring of the calling thread for the tracer of the given generation. */
+__thread uint64_t cachedGeneration = 0;
+__thread void * cachedRing = nullptr;
+
+} // namespace anonymous
+
+
+/******************************************************************************/
+/* AUCTION TRACER                                                             */
+/******************************************************************************/
+
+AuctionTracer::Ring::
+Ring(size_t size, int tid) :
+    entries(size), head(0), tail(0), tid(tid)
+{
+}
+
+AuctionTracer::
+AuctionTracer() :
+    exported(0), dropped(0),
+    enabled_(false), keepAll(false), threshold(0),
+    ringSize(0), holdSeconds(0), generation(0),
+    first(true), pid(getpid()), stopExport(false)
+{
+}
+
+AuctionTracer::
+~AuctionTracer()
+{
+    shutdown();
+}
+
+AuctionTracer &
+AuctionTracer::
+instance()
+{
+    static AuctionTracer tracer;
+    return tracer;
+}
+
+void
+AuctionTracer::
+init(const std::string & filename,
+     double rate,
+     const std::vector<std::string> & triggers,
+     size_t ringSize,
+     double holdSeconds)
+{
+    ExcCheck(!enabled_, "auction tracer already initialized");
+    ExcCheck(rate >= 0.0 && rate <= 1.0, "invalid trace sampling rate");
+    ExcCheck(ringSize > 0, "trace ring can't be empty");
+
+    this->threshold = rate * Precision;
+    this->triggers = std::set<std::string>(triggers.begin(), triggers.end());
+    this->keepAll = !triggers.empty();
+    this->ringSize = ringSize;
+    this->holdSeconds = keepAll ? holdSeconds : 0.0;
+    this->generation = ++generations;
+
+    stream.reset(new ML::filter_ostream(filename));
+    *stream << "[";
+    first = true;
+
+    stopExport = false;
+    enabled_ = true;
+
+    exportThread = std::thread([=] {
+                std::unique_lock<std::mutex> guard(exportLock);
+                while (!stopExport) {
+                    exportCond.wait_for(guard, std::chrono::seconds(1));
+                    if (stopExport) break;
+
+                    guard.unlock();
+                    flush();
+                    guard.lock();
+                }
+            });
+}
+
+void
+AuctionTracer::
+shutdown()
+{
+    if (!enabled_) return;
+    enabled_ = false;
+
+    {
+        std::lock_guard<std::mutex> guard(exportLock);
+        stopExport = true;
+    }
+    exportCond.notify_all();
+    exportThread.join();
+
+    flush(true);
+
+    // The threads pick up a new ring after the next init() since it changes
+    // the generation.
+    {
+        std::lock_guard<std::mutex> guard(ringsLock);
+        rings.clear();
+    }
+
+    std::lock_guard<std::mutex> guard(streamLock);
+    *stream << "\n]\n";
+    stream.reset();
+}
+
+AuctionTracer::Ring &
+AuctionTracer::
+threadRing()
+{
+    if (JML_LIKELY(cachedGeneration == generation))
+        return *static_cast<Ring *>(cachedRing);
+
+    // Rings live as long as the tracer since the exporter needs to get at
+    // the spans of threads that may have exited in the meantime.
+    std::lock_guard<std::mutex> guard(ringsLock);
+    rings.emplace_back(new Ring(ringSize, gettid()));
+
+    cachedGeneration = generation;
+    cachedRing = rings.back().get();
+    return *rings.back();
+}
+
+void
+AuctionTracer::
+record(const char * name,
+       const Id & auctionId,
+       Date start,
+       Date end,
+       const char * detail)
+{
+    if (!wants(auctionId)) return;
+
+    Ring & ring = threadRing();
+
+    std::lock_guard<ML::Spinlock> guard(ring.lock);
+
+    if (ring.head - ring.tail == ring.entries.size()) {
+        ++ring.tail;
+        ++dropped;
+    }
+
+    Entry & entry = ring.entries[ring.head % ring.entries.size()];
+    entry.name = name;
+    entry.auctionId = auctionId;
+    entry.start = start;
+    entry.end = end;
+
+    size_t length = strnlen(detail, sizeof(entry.detail) - 1);
+    std::memcpy(entry.detail, detail, length);
+    entry.detail[length] = 0;
+
+    ++ring.head;
+}
+
+void
+AuctionTracer::
+trigger(const Id & auctionId, const std::string & name)
+{
+    if (!enabled_ || !triggers.count(name)) return;
+
+    std::lock_guard<std::mutex> guard(triggeredLock);
+    triggered.insert(make_pair(auctionId, Date::now()));
+}
+
+void
+AuctionTracer::
+flush(bool all)
+{
+    // Nothing was recorded if the tracer was never started.
+    if (!stream) return;
+
+    Date now = Date::now();
+    Date cutoff = now.plusSeconds(-holdSeconds);
+
+    std::vector<Ring *> toFlush;
+    {
+        std::lock_guard<std::mutex> guard(ringsLock);
+        for (auto & ring : rings) toFlush.push_back(ring.get());
+    }
+
+    std::vector<Entry> entries;
+
+    for (Ring * ring : toFlush) {
+        entries.clear();
+
+        {
+            std::lock_guard<ML::Spinlock> guard(ring->lock);
+
+            // Spans are recorded as they end so the ring is close enough to
+            // being ordered by end date that we can stop at the first one
+            // that hasn't been held long enough.
+            for (; ring->tail != ring->head; ++ring->tail) {
+                const Entry & entry =
+                    ring->entries[ring->tail % ring->entries.size()];
+                if (!all && entry.end > cutoff) break;
+                entries.push_back(entry);
+            }
+        }
+
+        for (const Entry & entry : entries) {
+            bool keep = sampled(entry.auctionId);
+            if (!keep) {
+                std::lock_guard<std::mutex> guard(triggeredLock);
+                keep = triggered.count(entry.auctionId);
+            }
+            if (keep) write(entry, ring->tid);
+        }
+    }
+
+    {
+        std::lock_guard<std::mutex> guard(streamLock);
+        stream->flush();
+    }
+
+    // Whatever was recorded for a triggered auction has been exported by
+    // the time its trigger is twice the holding period old.
+    Date expiry = now.plusSeconds(-2.0 * holdSeconds);
+
+    std::lock_guard<std::mutex> guard(triggeredLock);
+    for (auto it = triggered.begin(); it != triggered.end();) {
+        if (it->second < expiry) it = triggered.erase(it);
+        else ++it;
+    }
+}
+
+void
+AuctionTracer::
+write(const Entry & entry, int tid)
+{
+    string auctionId = entry.auctionId.toString();
+
+    Json::Value event;
+    event["name"] = entry.detail[0]
+        ? string(entry.name) + " " + entry.detail
+        : string(entry.name);
+    event["cat"] = "auction";
+    event["ph"] = "X";
+    // jsoncpp writes doubles with a trailing dot which trace viewers reject.
+    double duration = std::max(0.0, entry.end.secondsSince(entry.start));
+    event["ts"] = Json::UInt(entry.start.secondsSinceEpoch() * 1000000.0);
+    event["dur"] = Json::UInt(duration * 1000000.0 + 0.5);
+    event["pid"] = pid;
+    event["tid"] = tid;
+    event["args"]["auction"] = auctionId;
+    if (entry.detail[0]) event["args"]["detail"] = entry.detail;
+
+    std::lock_guard<std::mutex> guard(streamLock);
+    *stream << (first ? "\n" : ",\n") << event.toStringNoNewLine();
+    first = false;
+    ++exported;
+}
+
+} // namespace RTBKIT
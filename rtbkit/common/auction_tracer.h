@@ -0,0 +1,207 @@
+/** auction_tracer.h                                 -*- C++ -*-
+    Copyright (c) 2014 Datacratic.  All rights reserved.
+
+    Sampled tracing of where the time goes for individual auctions.
+
+*/
+
+#pragma once
+
+#include "soa/types/id.h"
+#include "soa/types/date.h"
+#include "jml/arch/spinlock.h"
+#include "jml/compiler/compiler.h"
+
+#include <atomic>
+#include <condition_variable>
+#include <memory>
+#include <mutex>
+#include <set>
+#include <string>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+
+namespace ML { class filter_ostream; }
+
+namespace RTBKIT {
+
+/******************************************************************************/
+/* AUCTION TRACER                                                             */
+/******************************************************************************/
+
+/** Records spans, named sections of the work done on an auction optionally
+    qualified by an agent or augmentor name, into a ring buffer owned by the
+    recording thread. A background thread periodically exports them to a file
+    in the Chrome trace event format (chrome://tracing, Perfetto).
+
+    Auctions are sampled on the hash of their id so that every process on the
+    path of an auction (exchange connector, router, post auction loop) traces
+    the same ones without having to coordinate.
+
+    When triggers are configured the spans of every auction are kept in the
+    rings for holdSeconds before being exported or discarded. An auction that
+    turns out to be interesting, because it timed out for example, can then be
+    exported in full once the trigger is fired for it. Triggers are local to
+    the process in which they're fired.
+ */
+struct AuctionTracer
+{
+    AuctionTracer();
+    ~AuctionTracer();
+
+    /** Tracer shared by everything in the process. */
+    static AuctionTracer & instance();
+
+    /** Starts exporting the spans to the given file.
+
+        rate is the ratio of the auctions that are sampled while triggers are
+        the names of the triggers which will export an auction regardless of
+        the sampling. Every recording thread gets a ring of ringSize spans.
+     */
+    void init(const std::string & filename,
+              double rate,
+              const std::vector<std::string> & triggers
+                  = std::vector<std::string>(),
+              size_t ringSize = 1 << 14,
+              double holdSeconds = 1.0);
+
+    /** Exports whatever is left in the rings, frees them and closes the
+        file. Nothing may be recorded while it runs.
+     */
+    void shutdown();
+
+    bool enabled() const { return enabled_; }
+
+    bool sampled(const Datacratic::Id & auctionId) const
+    {
+        // Integer ids hash to themselves so the bits need to be mixed
+        // before they can be compared against the threshold.
+        uint64_t hash = auctionId.hash() * 0x9e3779b97f4a7c15ULL;
+        return (hash >> 32) % Precision < threshold;
+    }
+
+    /** Whether the spans of the auction need to be recorded at all. */
+    bool wants(const Datacratic::Id & auctionId) const
+    {
+        if (JML_LIKELY(!enabled_)) return false;
+        return keepAll || sampled(auctionId);
+    }
+
+    /** Records a span that went from start to end. Does nothing if the
+        auction isn't wanted. The detail is copied, truncated to what fits
+        in a ring entry.
+     */
+    void record(const char * name,
+                const Datacratic::Id & auctionId,
+                Datacratic::Date start,
+                Datacratic::Date end,
+                const char * detail = "");
+
+    /** Exports the auction even if it wasn't sampled provided that the
+        trigger was configured.
+     */
+    void trigger(const Datacratic::Id & auctionId, const std::string & name);
+
+    /** Exports the spans that have been held long enough, or all of them if
+        all is true. Called periodically by the export thread.
+     */
+    void flush(bool all = false);
+
+    /** Spans written to the file. */
+    std::atomic<uint64_t> exported;
+
+    /** Spans overwritten in a ring before they could be exported. */
+    std::atomic<uint64_t> dropped;
+
+    /** Records the time spent in its scope as a span. The detail is only
+        copied when the span ends so it must outlive the span; nothing is
+        built or copied for the auctions that aren't wanted.
+     */
+    struct Span
+    {
+        Span(const char * name,
+             const Datacratic::Id & auctionId,
+             const char * detail = "") :
+            name(nullptr)
+        {
+            if (JML_LIKELY(!instance().wants(auctionId))) return;
+
+            this->name = name;
+            this->auctionId = auctionId;
+            this->detail = detail;
+            start = Datacratic::Date::now();
+        }
+
+        ~Span()
+        {
+            if (JML_LIKELY(!name)) return;
+            instance().record(
+                    name, auctionId, start, Datacratic::Date::now(), detail);
+        }
+
+    private:
+        const char * name;
+        Datacratic::Id auctionId;
+        const char * detail;
+        Datacratic::Date start;
+    };
+
+private:
+
+    enum { Precision = 1000000 };
+
+    struct Entry
+    {
+        const char * name;
+        Datacratic::Id auctionId;
+        Datacratic::Date start;
+        Datacratic::Date end;
+        char detail[48];
+    };
+
+    struct Ring
+    {
+        Ring(size_t size, int tid);
+
+        ML::Spinlock lock;
+        std::vector<Entry> entries;
+        uint64_t head;  ///< spans written
+        uint64_t tail;  ///< spans exported or discarded
+        int tid;
+    };
+
+    Ring & threadRing();
+
+    void write(const Entry & entry, int tid);
+
+    std::atomic<bool> enabled_;
+    bool keepAll;
+    uint64_t threshold;
+    std::set<std::string> triggers;
+    size_t ringSize;
+    double holdSeconds;
+
+    /** Unique to every call to init so that the threads can tell when the
+        ring they cached belongs to a previous run.
+     */
+    uint64_t generation;
+
+    std::mutex ringsLock;
+    std::vector< std::unique_ptr<Ring> > rings;
+
+    std::mutex triggeredLock;
+    std::unordered_map<Datacratic::Id, Datacratic::Date> triggered;
+
+    std::mutex streamLock;
+    std::unique_ptr<ML::filter_ostream> stream;
+    bool first;
+    int pid;
+
+    std::mutex exportLock;
+    std::condition_variable exportCond;
+    bool stopExport;
+    std::thread exportThread;
+};
+
+} // namespace RTBKIT
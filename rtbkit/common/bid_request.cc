@@ -714,7 +714,7 @@ void
 UserIds::
 add(const Id & id, IdDomain domain)
 {
-    if (!insert(make_pair(domainToString(domain), id)).second)
+    if (!insert(make_pair(domainToInterned(domain), id)).second)
         throw ML::Exception("attempt to double add id %s for %s",
                             id.toString().c_str(), domainToString(domain));
     setStatic(id, domain);
@@ -722,7 +722,7 @@ add(const Id & id, IdDomain domain)
 
 void
 UserIds::
-add(const Id & id, const std::string & domain1, IdDomain domain2)
+add(const Id & id, const InternedString & domain1, IdDomain domain2)
 {
     add(id, domain1);
     add(id, domain2);
@@ -730,10 +730,10 @@ add(const Id & id, const std::string & domain1, IdDomain domain2)
 
 void
 UserIds::
-add(const Id & id, const std::string & domain)
+add(const Id & id, const InternedString & domain)
 {
     if (!insert(make_pair(domain, id)).second)
-        throw ML::Exception("attempt to double add id " + id.toString() +" for " + domain);
+        throw ML::Exception("attempt to double add id " + id.toString() +" for " + domain.str());
     setStatic(id, domain);
 }
 
@@ -748,13 +748,26 @@ domainToString(IdDomain domain)
     }
 }
 
+const InternedString &
+UserIds::
+domainToInterned(IdDomain domain)
+{
+    static const InternedString domains[ID_MAX + 1] = {
+        InternedString::intern(domainToString(ID_PROVIDER)),
+        InternedString::intern(domainToString(ID_EXCHANGE)),
+        InternedString::intern(domainToString(ID_MAX))
+    };
+
+    return domains[domain < ID_MAX ? domain : ID_MAX];
+}
+
 void
 UserIds::
-setStatic(const Id & id, const std::string & domain)
+setStatic(const Id & id, const InternedString & domain)
 {
-    if (domain == "prov")
+    if (domain == domainToInterned(ID_PROVIDER))
         providerId = id;
-    else if (domain == "xchg")
+    else if (domain == domainToInterned(ID_EXCHANGE))
         exchangeId = id;
 }
 
@@ -771,7 +784,7 @@ setStatic(const Id & id, IdDomain domain)
 
 void
 UserIds::
-set(const Id & id, const std::string & domain)
+set(const Id & id, const InternedString & domain)
 {
     (*this)[domain] = id;
 }
@@ -838,7 +851,8 @@ UserIds::
 serialize(ML::DB::Store_Writer & store) const
 {
     unsigned char version = 0;
-    store << version << (map<std::string, Id> &)(*this);
+    store << version;
+    InternedMap<Id>::serialize(store);
 }
 
 void
@@ -849,7 +863,7 @@ reconstitute(ML::DB::Store_Reader & store)
     store >> version;
     if (version != 0)
         throw ML::Exception("invalid UserIds version");
-    store >> (map<std::string, Id> &)*this;
+    InternedMap<Id>::reconstitute(store);
 }
 
 struct UserIdsDescription
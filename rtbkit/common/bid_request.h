@@ -18,6 +18,7 @@
 #include "soa/types/id.h"
 #include "soa/types/url.h"
 #include "rtbkit/common/segments.h"
+#include "rtbkit/common/interned_string.h"
 #include <set>
 #include "rtbkit/common/currency.h"
 #include "tags.h"
@@ -173,15 +174,18 @@ enum IdDomain {
 /* USER IDS                                                                  */
 /*****************************************************************************/
 
-/** Information known about a user and passed in as part of the bid */
+/** Information known about a user and passed in as part of the bid.  The
+    id domains are interned and the ids are stored inline, so that building
+    one for a bid request doesn't allocate anything in the common case.
+*/
 
-struct UserIds : public std::map<std::string, Id> {
+struct UserIds : public InternedMap<Id> {
 
     void add(const Id & id, IdDomain domain);
-    void add(const Id & id, const std::string & domain);
-    void add(const Id & id, const std::string & domain, IdDomain domain2);
+    void add(const Id & id, const InternedString & domain);
+    void add(const Id & id, const InternedString & domain, IdDomain domain2);
 
-    void set(const Id & id, const std::string & domain);
+    void set(const Id & id, const InternedString & domain);
     
     // These are always present
     Id exchangeId;
@@ -204,10 +208,11 @@ struct UserIds : public std::map<std::string, Id> {
     static UserIds createFromJson(const Json::Value & json);
 
     /** Update the static entry belonging to a given domain. */
-    void setStatic(const Id & id, const std::string & domain);
+    void setStatic(const Id & id, const InternedString & domain);
     void setStatic(const Id & id, IdDomain domain);
 
     static const char * domainToString(IdDomain domain);
+    static const InternedString & domainToInterned(IdDomain domain);
 
     std::string serializeToString() const;
     static UserIds createFromString(const std::string & str);
@@ -3,6 +3,7 @@
 LIBBIDREQUEST_SOURCES := \
 	bid_request.cc \
 	segments.cc \
+	interned_string.cc \
 	json_holder.cc \
 	currency.cc \
 	expand_variable.cc
@@ -21,10 +22,12 @@ LIBRTB_SOURCES := \
 	exchange_connector.cc \
 	bidder_interface.cc \
 	win_cost_model.cc \
-	post_auction_proxy.cc
+	post_auction_proxy.cc \
+	consistent_hash_ring.cc \
+	auction_tracer.cc
 
 LIBRTB_LINK := \
-	ACE arch utils jsoncpp boost_thread endpoint boost_regex zmq opstats bid_request
+	ACE arch utils jsoncpp boost_thread endpoint boost_regex zmq opstats bid_request cityhash
 
 $(eval $(call library,rtb,$(LIBRTB_SOURCES),$(LIBRTB_LINK)))
 
@@ -0,0 +1,126 @@
+/** consistent_hash_ring.cc                                 -*- C++ -*-
+    Copyright (c) 2014 Datacratic.  All rights reserved.
+
+    Consistent hashing implementation.
+
+*/
+
+#include "consistent_hash_ring.h"
+#include "jml/arch/exception.h"
+#include "jml/arch/format.h"
+
+#include <city.h>
+#include <algorithm>
+
+using namespace std;
+
+namespace RTBKIT {
+
+
+/******************************************************************************/
+/* CONSISTENT HASH RING                                                       */
+/******************************************************************************/
+
+ConsistentHashRing::
+ConsistentHashRing(unsigned pointsPerNode) :
+    pointsPerNode(pointsPerNode)
+{
+    if (!pointsPerNode)
+        throw ML::Exception("consistent hash ring needs at least one point");
+}
+
+bool
+ConsistentHashRing::
+add(const std::string & node)
+{
+    auto it = lower_bound(nodeNames.begin(), nodeNames.end(), node);
+    if (it != nodeNames.end() && *it == node) return false;
+
+    nodeNames.insert(it, node);
+    rebuild();
+    return true;
+}
+
+bool
+ConsistentHashRing::
+remove(const std::string & node)
+{
+    auto it = lower_bound(nodeNames.begin(), nodeNames.end(), node);
+    if (it == nodeNames.end() || *it != node) return false;
+
+    nodeNames.erase(it);
+    rebuild();
+    return true;
+}
+
+void
+ConsistentHashRing::
+set(const std::vector<std::string> & nodes)
+{
+    nodeNames = nodes;
+    sort(nodeNames.begin(), nodeNames.end());
+    nodeNames.erase(unique(nodeNames.begin(), nodeNames.end()), nodeNames.end());
+    rebuild();
+}
+
+bool
+ConsistentHashRing::
+has(const std::string & node) const
+{
+    return binary_search(nodeNames.begin(), nodeNames.end(), node);
+}
+
+void
+ConsistentHashRing::
+rebuild()
+{
+    points.clear();
+    points.reserve(nodeNames.size() * pointsPerNode);
+
+    for (unsigned i = 0; i < nodeNames.size(); ++i) {
+        for (unsigned j = 0; j < pointsPerNode; ++j) {
+            string point = ML::format("%s#%u", nodeNames[i].c_str(), j);
+            points.emplace_back(CityHash64(point.c_str(), point.size()), i);
+        }
+    }
+
+    // Ties are broken by node index so that the order doesn't depend on the
+    // order in which the nodes were added.
+    sort(points.begin(), points.end());
+}
+
+const std::string &
+ConsistentHashRing::
+find(uint64_t hash) const
+{
+    if (points.empty())
+        throw ML::Exception("no nodes in the consistent hash ring");
+
+    auto it = lower_bound(points.begin(), points.end(), make_pair(hash, 0u));
+    if (it == points.end()) it = points.begin();
+    return nodeNames[it->second];
+}
+
+double
+ConsistentHashRing::
+share(const std::string & node) const
+{
+    if (points.empty()) return 0.0;
+
+    auto it = lower_bound(nodeNames.begin(), nodeNames.end(), node);
+    if (it == nodeNames.end() || *it != node) return 0.0;
+    unsigned index = it - nodeNames.begin();
+
+    // Each point owns the hashes between the previous point and itself.
+    double owned = 0.0;
+    for (size_t i = 0; i < points.size(); ++i) {
+        if (points[i].second != index) continue;
+        uint64_t prev = i ? points[i - 1].first : points.back().first;
+        owned += double(points[i].first - prev);
+    }
+
+    if (points.size() == pointsPerNode) return 1.0;
+    return owned / 18446744073709551616.0;
+}
+
+} // namespace RTBKIT
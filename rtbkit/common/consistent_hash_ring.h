@@ -0,0 +1,80 @@
+/** consistent_hash_ring.h                                 -*- C++ -*-
+    Copyright (c) 2014 Datacratic.  All rights reserved.
+
+    Consistent hashing of keys over a set of named nodes.
+
+*/
+
+#pragma once
+
+#include <string>
+#include <vector>
+#include <utility>
+#include <cstdint>
+
+namespace RTBKIT {
+
+
+/******************************************************************************/
+/* CONSISTENT HASH RING                                                       */
+/******************************************************************************/
+
+/** Maps 64 bit hashes onto a set of nodes such that adding or removing a node
+    only moves the hashes that the node gains or loses.  Each node is placed
+    at a number of points on the ring and owns the hashes that fall right
+    before each of its points.
+
+    The placement only depends on the node names and the number of points so
+    every process that knows the same set of nodes agrees on who owns what.
+ */
+struct ConsistentHashRing
+{
+    enum { DefaultPoints = 128 };
+
+    ConsistentHashRing(unsigned pointsPerNode = DefaultPoints);
+
+    /** Adds a node; returns false if it was already there. */
+    bool add(const std::string & node);
+
+    /** Removes a node; returns false if it wasn't there. */
+    bool remove(const std::string & node);
+
+    /** Replaces the set of nodes. */
+    void set(const std::vector<std::string> & nodes);
+
+    bool has(const std::string & node) const;
+
+    size_t size() const { return nodeNames.size(); }
+    bool empty() const { return nodeNames.empty(); }
+
+    /** Sorted names of the nodes on the ring. */
+    const std::vector<std::string> & nodes() const { return nodeNames; }
+
+    /** Node that owns the hash.  Throws if the ring is empty. */
+    const std::string & find(uint64_t hash) const;
+
+    /** Fraction of the hash space owned by the node. */
+    double share(const std::string & node) const;
+
+    bool operator == (const ConsistentHashRing & other) const
+    {
+        return pointsPerNode == other.pointsPerNode
+            && nodeNames == other.nodeNames;
+    }
+
+    bool operator != (const ConsistentHashRing & other) const
+    {
+        return !operator == (other);
+    }
+
+private:
+    void rebuild();
+
+    unsigned pointsPerNode;
+    std::vector<std::string> nodeNames;
+
+    /** Points on the ring, sorted by hash, with the index of their node. */
+    std::vector< std::pair<uint64_t, unsigned> > points;
+};
+
+} // namespace RTBKIT
@@ -9,6 +9,8 @@
 #include <string>
 #include <vector>
 #include <map>
+#include <mutex>
+#include <unordered_map>
 
 #include <boost/thread.hpp>
 
@@ -16,6 +18,7 @@
 #include "rtbkit/common/auction.h"
 #include "rtbkit/common/expand_variable.h"
 #include "rtbkit/common/creative_field.h"
+#include "soa/gc/rcu_protected.h"
 
 namespace RTBKIT {
 
@@ -43,7 +46,7 @@ public:
     struct Expander;
 
     CreativeConfiguration(const std::string& exchange)
-    : exchange_(exchange)
+    : exchange_(exchange), expanders_(expandersGc_)
     {
         expanderDict_ = {
         {
@@ -145,6 +148,12 @@ public:
 
     }
 
+    ~CreativeConfiguration()
+    {
+        // Nobody can be expanding anymore so there's no need to defer.
+        expanders_.replace(nullptr, false);
+    }
+
     Field & addField(const std::string & name,
                      typename Field::Handler handler)
     {
@@ -170,14 +179,27 @@ public:
     }
 
 private:
+    struct ExpansionState;
+
+    /** Appends the value of a variable to the output. */
+    typedef std::function<void (const Context &, ExpansionState &,
+                                std::string &)> VariableWriter;
+
+    typedef std::unordered_map<std::string, Expander> CompiledSnippets;
+
     std::vector<ExpandVariable>
     extractVariables(const std::string& snippet) const;
 
     Expander
-    generateExpander(const std::vector<ExpandVariable>& variables) const;
+    generateExpander(const std::string& snippet,
+                     const std::vector<ExpandVariable>& variables) const;
 
-    ExpanderCallable getAssociatedCallable(ExpandVariable const& var) const;
+    void addExpander(const std::string& snippet) const;
+
+    VariableWriter getAssociatedCallable(ExpandVariable const& var) const;
     std::string jsonValueToStr(Json::Value const& val) const;
+    void appendJsonPath(Json::Value const& json, ExpandVariable const& var,
+                        std::string& out) const;
 
     ExpanderMap expanderDict_;
     ExpanderFilterMap filters_;
@@ -186,12 +208,13 @@ private:
     const std::string exchange_;
 
     /**
-     * The map is mutable because it is populated in the
-     * getCreativeCompatibility and this member function is required to be
-     * const
+     * Snippets are compiled in handleCreativeCompatibility, which is
+     * required to be const, and looked up on every win so the map is only
+     * ever replaced by a new copy and is read without locking.
      */
-    mutable std::unordered_map<std::string, Expander> expanders_;
-    mutable boost::shared_mutex mutex_;
+    mutable GcLock expandersGc_;
+    mutable RcuProtected<CompiledSnippets> expanders_;
+    mutable std::mutex expandersWriteLock_;
 };
 
 template <typename CreativeData>
@@ -271,10 +294,7 @@ CreativeConfiguration<CreativeData>::handleCreativeCompatibility(
 
             if (field.isSnippet()) {
                 // assume string
-                auto const& snippet = value.asString();
-                auto expander = generateExpander(extractVariables(snippet));
-                boost::unique_lock<boost::shared_mutex> lock(mutex_);
-                expanders_[snippet] = expander;
+                addExpander(value.asString());
             }
         }
     }
@@ -311,56 +331,81 @@ CreativeConfiguration<CreativeData>::extractVariables(
 }
 
 template <typename CreativeData>
-typename CreativeConfiguration<CreativeData>::ExpanderCallable
+void
+CreativeConfiguration<CreativeData>::addExpander(
+    const std::string& snippet) const
+{
+    std::lock_guard<std::mutex> guard(expandersWriteLock_);
+
+    auto current = expanders_();
+    if (current->count(snippet)) {
+        return;
+    }
+
+    auto expander = generateExpander(snippet, extractVariables(snippet));
+
+    std::unique_ptr<CompiledSnippets> newExpanders(
+            new CompiledSnippets(*current));
+    newExpanders->insert(std::make_pair(snippet, std::move(expander)));
+
+    current.unlock();
+    expanders_.replace(newExpanders.release());
+}
+
+template <typename CreativeData>
+typename CreativeConfiguration<CreativeData>::VariableWriter
 CreativeConfiguration<CreativeData>::getAssociatedCallable(
     ExpandVariable const& var) const
 {
     auto it = expanderDict_.find(var.getVariable());
     if (it != expanderDict_.end()) {
-        return it->second;
+        auto callable = it->second;
+        return [callable](const Context & context, ExpansionState &,
+                          std::string & out)
+        {
+            out += callable(context);
+        };
     }
 
     auto const& path = var.getPath();
     auto const& section = path[0];
 
-    auto getter = [this, var](Json::Value const & jsonVal,
-                              const Context & context)->std::string
-    {
-
-        auto const& path = var.getPath();
-        auto val = jsonVal;
-        for (auto it = std::begin(path) + 1, end = std::end(path);
-             val != Json::Value::null && it != end;
-             ++it) {
-            val = val[*it];
-        }
-
-        if (val != Json::Value::null) {
-            return this->jsonValueToStr(val);
-        }
-
-        return "";
-    };
-
     if (section == "creative") {
-        return [getter](const Context & context) {
-            return getter(context.creative.toJson(), context);
+        return [this, var](const Context &, ExpansionState & state,
+                           std::string & out)
+        {
+            this->appendJsonPath(state.creative(), var, out);
         };
     } else if (section == "bidrequest") {
-        return [getter](const Context & context) {
-            return getter(context.bidrequest.toJson(), context);
+        /* Fields of the bid request are read straight out of it; only
+         * those that aren't described go through its JSON form.
+         */
+        static const Datacratic::DefaultDescription<BidRequest> desc;
+
+        auto accessor = std::make_shared<FieldPathAccessor>();
+        if (accessor->compile(desc, path, 1)) {
+            return [this, var, accessor](const Context & context,
+                                         ExpansionState &,
+                                         std::string & out)
+            {
+                if (!accessor->write(&context.bidrequest, out)) {
+                    std::cerr << this->exchange_ << ": Cannot convert "
+                              << var.getVariable() << " to string"
+                              << std::endl;
+                }
+            };
+        }
+
+        return [this, var](const Context &, ExpansionState & state,
+                           std::string & out)
+        {
+            this->appendJsonPath(state.bidrequest(), var, out);
         };
     } else if (section == "meta") {
-        return [this, getter](const Context & context) {
-            Json::Reader reader;
-            Json::Value val;
-            if (!reader.parse(context.response.meta, val)) {
-                std::cerr << "Failed to parse meta information for exchange:"
-                          << this->exchange_
-                          << ", meta: " << context.response.meta << std::endl;
-            }
-
-            return getter(val, context);
+        return [this, var](const Context &, ExpansionState & state,
+                           std::string & out)
+        {
+            this->appendJsonPath(state.meta(), var, out);
         };
     }
 
@@ -371,13 +416,16 @@ CreativeConfiguration<CreativeData>::getAssociatedCallable(
 template <typename CreativeData>
 typename CreativeConfiguration<CreativeData>::Expander
 CreativeConfiguration<CreativeData>::generateExpander(
+    const std::string& snippet,
     const std::vector<ExpandVariable>& variables) const
 {
     Expander expander;
+    size_t position = 0;
+
     for (auto const& variable : variables) {
-        auto callable = getAssociatedCallable(variable);
+        auto writer = getAssociatedCallable(variable);
 
-        ExpanderFilterCallable filterFn;
+        std::vector<ExpanderFilterCallable> filterChain;
 
         auto const& filters = variable.getFilters();
         for (auto const& filter : filters) {
@@ -386,33 +434,34 @@ CreativeConfiguration<CreativeData>::generateExpander(
                 throw std::runtime_error("Invalid filter: " + filter);
             }
 
-            auto currentFilter = it->second;
-            if (filterFn) {
-                filterFn = [currentFilter, filterFn](std::string& value)
-                    -> std::string&
-                {
-                    return currentFilter(filterFn(value));
-                };
-            } else {
-                filterFn = currentFilter;
-            }
+            filterChain.push_back(it->second);
         }
 
-        if (filterFn) {
-
-            expander.addFunctor(
-                    variable,
-                    [filterFn, callable](Context const & ctx) {
-                        std::string result = callable(ctx);
-                        filterFn(result);
-                        return result;
-            });
-        } else {
-            expander.addFunctor(variable, callable);
+        if (!filterChain.empty()) {
+            auto unfiltered = writer;
+            writer = [unfiltered, filterChain](const Context & context,
+                                               ExpansionState & state,
+                                               std::string & out)
+            {
+                std::string value;
+                unfiltered(context, state, value);
+                for (auto const& filter : filterChain) {
+                    filter(value);
+                }
+                out += value;
+            };
         }
+
+        auto const& location = variable.getReplaceLocation();
+        expander.addSegment(
+                snippet.substr(position, location.first - position), writer);
+        position = location.second;
+    }
+
+    if (position < snippet.size()) {
+        expander.addSegment(snippet.substr(position), nullptr);
     }
 
-    expander.finalize();
     return expander;
 }
 
@@ -439,48 +488,142 @@ std::string CreativeConfiguration<CreativeData>::jsonValueToStr(
     return "";
 }
 
+template <typename CreativeData>
+void CreativeConfiguration<CreativeData>::appendJsonPath(
+    Json::Value const& json, ExpandVariable const& var, std::string& out) const
+{
+    auto const& path = var.getPath();
+    const Json::Value * val = &json;
+    for (auto it = std::begin(path) + 1, end = std::end(path);
+         it != end;
+         ++it) {
+        if (!val->isObject() || !val->isMember(*it)) {
+            return;
+        }
+        val = &(*val)[*it];
+    }
+
+    if (*val != Json::Value::null) {
+        out += jsonValueToStr(*val);
+    }
+}
+
 template <typename CreativeData>
 std::string
 CreativeConfiguration<CreativeData>::expand(const std::string& templateString,
                                             const Context& context) const
 {
-    boost::shared_lock<boost::shared_mutex> lock(mutex_);
-    auto const& expander = expanders_[templateString];
-    return expander.expand(templateString, context);
+    auto expanders = expanders_();
+    auto it = expanders->find(templateString);
+    if (it == expanders->end()) {
+        return templateString;
+    }
+
+    return it->second.expand(*this, context);
 }
 
+/** JSON forms of the creative, bid request and meta, generated at most once
+ *  per expansion and only if a variable needs them.
+ */
 template <typename CreativeData>
-struct CreativeConfiguration<CreativeData>::Expander
+struct CreativeConfiguration<CreativeData>::ExpansionState
 {
-    typedef std::vector<std::pair<ExpandVariable, ExpanderCallable>> FunctorCollection;
+    ExpansionState(const CreativeConfiguration & config,
+                   const Context & context)
+        : config(config), context(context),
+          hasCreative(false), hasBidRequest(false), hasMeta(false)
+    {
+    }
 
-    void addFunctor(const ExpandVariable& var, ExpanderCallable fn)
+    const Json::Value & creative()
     {
-        collection.push_back(std::make_pair(var, fn));
+        if (!hasCreative) {
+            creativeJson = context.creative.toJson();
+            hasCreative = true;
+        }
+        return creativeJson;
     }
 
-    void finalize()
+    const Json::Value & bidrequest()
     {
-        std::reverse(collection.begin(), collection.end());
+        if (!hasBidRequest) {
+            bidRequestJson = context.bidrequest.toJson();
+            hasBidRequest = true;
+        }
+        return bidRequestJson;
     }
 
-    std::string expand(std::string toExpand, const Context& ctx) const
+    const Json::Value & meta()
     {
-        for (auto& element : collection) {
-            auto const& var = element.first;
-            auto const& fn = element.second;
+        if (!hasMeta) {
+            Json::Reader reader;
+            if (!reader.parse(context.response.meta, metaJson)) {
+                std::cerr << "Failed to parse meta information for exchange:"
+                          << config.exchange_
+                          << ", meta: " << context.response.meta << std::endl;
+            }
+            hasMeta = true;
+        }
+        return metaJson;
+    }
+
+    const CreativeConfiguration & config;
+    const Context & context;
+
+    bool hasCreative, hasBidRequest, hasMeta;
+    Json::Value creativeJson, bidRequestJson, metaJson;
+};
+
+/** Snippet compiled into the literal pieces of text found between its
+ *  variables and the writers of those variables.
+ */
+template <typename CreativeData>
+struct CreativeConfiguration<CreativeData>::Expander
+{
+    struct Segment {
+        std::string literal;
+        VariableWriter writer;  // null for the text after the last variable
+    };
 
-            auto const& location = var.getReplaceLocation();
+    Expander()
+        : literalSize(0), numVariables(0)
+    {
+    }
 
-            toExpand.replace(
-                location.first, location.second - location.first, fn(ctx));
+    void addSegment(std::string literal, VariableWriter writer)
+    {
+        literalSize += literal.size();
+        if (writer) {
+            ++numVariables;
         }
 
-        return toExpand;
+        Segment segment;
+        segment.literal = std::move(literal);
+        segment.writer = std::move(writer);
+        segments.push_back(std::move(segment));
     }
 
-    FunctorCollection collection;
+    std::string expand(const CreativeConfiguration & config,
+                       const Context& ctx) const
+    {
+        ExpansionState state(config, ctx);
+
+        std::string result;
+        result.reserve(literalSize + numVariables * 64);
+
+        for (auto const& segment : segments) {
+            result += segment.literal;
+            if (segment.writer) {
+                segment.writer(ctx, state, result);
+            }
+        }
+
+        return result;
+    }
 
+    std::vector<Segment> segments;
+    size_t literalSize;
+    size_t numVariables;
 };
 
 } // namespace RTBKIT
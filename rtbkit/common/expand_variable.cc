@@ -5,6 +5,12 @@
 
 #include <boost/algorithm/string.hpp>
 #include "rtbkit/common/expand_variable.h"
+#include "soa/types/value_description.h"
+#include "soa/types/id.h"
+#include "soa/jsoncpp/json.h"
+
+using Datacratic::ValueDescription;
+using Datacratic::ValueKind;
 
 namespace RTBKIT {
 
@@ -38,4 +44,125 @@ void ExpandVariable::parseVariable()
     variable_ = std::move(variable);
 }
 
+namespace {
+
+bool appendJson(const Json::Value & val, std::string & out)
+{
+    if (val.isNull())
+        return true;
+    if (val.isUInt())
+        out += std::to_string(val.asUInt());
+    else if (val.isIntegral())
+        out += std::to_string(val.asInt());
+    else if (val.isString())
+        out += val.asString();
+    else return false;
+    return true;
+}
+
+} // file scope
+
+FieldPathAccessor::FieldPathAccessor()
+: leaf_(nullptr)
+{
+}
+
+bool FieldPathAccessor::compile(const ValueDescription& desc,
+                                const std::vector<std::string>& path,
+                                size_t begin)
+{
+    steps_.clear();
+    jsonPath_.clear();
+
+    auto follow = [&](const ValueDescription * current)
+    {
+        while (current->kind == ValueKind::OPTIONAL
+               || current->kind == ValueKind::LINK) {
+            Step step;
+            step.type = current->kind == ValueKind::OPTIONAL
+                ? Step::OPTIONAL : Step::LINK;
+            step.offset = 0;
+            step.desc = current;
+            steps_.push_back(step);
+            current = &current->contained();
+        }
+        return current;
+    };
+
+    const ValueDescription * current = follow(&desc);
+    for (size_t i = begin; i < path.size(); ++i) {
+        if (*current->type == typeid(Json::Value)) {
+            jsonPath_.assign(path.begin() + i, path.end());
+            break;
+        }
+
+        if (current->kind != ValueKind::STRUCTURE)
+            return false;
+
+        auto field = current->hasField(nullptr, path[i]);
+        if (!field)
+            return false;
+
+        Step step;
+        step.type = Step::FIELD;
+        step.offset = field->offset;
+        step.desc = nullptr;
+        steps_.push_back(step);
+        current = follow(field->description.get());
+    }
+
+    leaf_ = current;
+    return true;
+}
+
+bool FieldPathAccessor::write(const void* obj, std::string& out) const
+{
+    for (auto const& step : steps_) {
+        if (step.type == Step::FIELD) {
+            obj = static_cast<const char *>(obj) + step.offset;
+            continue;
+        }
+
+        if (step.desc->isDefault(obj))
+            return true;
+        obj = step.type == Step::OPTIONAL
+            ? step.desc->optionalGetValue(obj)
+            : step.desc->getLink(const_cast<void *>(obj));
+    }
+
+    auto const& type = *leaf_->type;
+
+    if (type == typeid(Json::Value)) {
+        const Json::Value * val = static_cast<const Json::Value *>(obj);
+        for (auto const& member : jsonPath_) {
+            if (!val->isObject() || !val->isMember(member))
+                return true;
+            val = &(*val)[member];
+        }
+        return appendJson(*val, out);
+    }
+
+    if (leaf_->isDefault(obj))
+        return true;
+
+    if (type == typeid(std::string)) {
+        out += *static_cast<const std::string *>(obj);
+        return true;
+    }
+
+    if (type == typeid(Datacratic::Id)) {
+        out += static_cast<const Datacratic::Id *>(obj)->toString();
+        return true;
+    }
+
+    // Integers such as the location's dma and metro use -1 for unset, which
+    // their toJson() leaves out; do the same here.
+    if (type == typeid(int) && *static_cast<const int *>(obj) == -1)
+        return true;
+
+    Datacratic::StructuredJsonPrintingContext context;
+    leaf_->printJson(obj, context);
+    return appendJson(context.output, out);
+}
+
 } // namespace RTBKIT
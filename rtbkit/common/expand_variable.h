@@ -7,6 +7,10 @@
 #include <string>
 #include <vector>
 
+namespace Datacratic {
+struct ValueDescription;
+} // namespace Datacratic
+
 namespace RTBKIT {
 
 class ExpandVariable
@@ -50,4 +54,41 @@ private:
     int endIndex_;
 };
 
+
+/** Reads the value at the end of a path of field names straight out of an
+    object through its ValueDescription, which spares converting the whole
+    object to JSON to look up a single value.  Optional and pointer fields
+    along the way are followed and Json::Value fields are walked by member
+    name.
+*/
+class FieldPathAccessor
+{
+public:
+    FieldPathAccessor();
+
+    /** Resolves path[begin..end) against the description.  Returns false if
+        one of the fields isn't described, in which case the accessor can't
+        be used.
+    */
+    bool compile(const Datacratic::ValueDescription & desc,
+                 const std::vector<std::string> & path, size_t begin = 0);
+
+    /** Appends the value found in obj to out; nothing is appended if it's
+        missing, has its default value or is an int set to -1 (unset).
+        Returns false if the value is neither a string nor an integer.
+    */
+    bool write(const void * obj, std::string & out) const;
+
+private:
+    struct Step {
+        enum Type { FIELD, OPTIONAL, LINK } type;
+        int offset;
+        const Datacratic::ValueDescription * desc;
+    };
+
+    std::vector<Step> steps_;
+    const Datacratic::ValueDescription * leaf_;
+    std::vector<std::string> jsonPath_;
+};
+
 } // namespace RTBKIT
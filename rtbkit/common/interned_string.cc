@@ -0,0 +1,249 @@
+/* interned_string.cc
+   Copyright (c) 2013 Datacratic.  All rights reserved.
+
+   Process-wide table of interned strings.
+*/
+
+#include "rtbkit/common/interned_string.h"
+#include "jml/arch/spinlock.h"
+#include "jml/arch/exception.h"
+#include <atomic>
+#include <memory>
+#include <mutex>
+#include <vector>
+
+using namespace std;
+using namespace ML;
+
+
+namespace RTBKIT {
+
+
+/*****************************************************************************/
+/* INTERN TABLE                                                              */
+/*****************************************************************************/
+
+namespace {
+
+size_t hashString(const std::string & str)
+{
+    return std::hash<std::string>()(str);
+}
+
+/** Strings are stored in chunks that never move once allocated, so that a
+    handle can be turned back into its string without taking the lock: the
+    handle can only have been obtained after its entry was written.
+
+    Lookups don't take the lock either.  The handles are found through an
+    open addressed index whose slots are only ever set, and only after the
+    entry they point to was written.  When it fills up a bigger index is
+    built and swapped in; the old ones are kept around until the table goes
+    away since a reader may still be probing them.  A reader that misses a
+    string that's being interned at the same time makes a copy, which
+    compares and hashes the same as the interned string.
+*/
+struct InternTable {
+
+    enum {
+        ChunkBits = 10,
+        ChunkSize = 1 << ChunkBits,
+        MaxChunks = 1 << 12
+    };
+
+    struct Entry {
+        std::string str;
+        size_t hash;
+    };
+
+    /** Slots hold the handle plus one so that zero means empty. */
+    struct Index {
+        Index(size_t capacity)
+            : mask(capacity - 1), slots(new std::atomic<uint32_t>[capacity])
+        {
+            for (size_t i = 0;  i < capacity;  ++i)
+                slots[i] = 0;
+        }
+
+        size_t capacity() const { return mask + 1; }
+
+        size_t mask;
+        std::unique_ptr<std::atomic<uint32_t>[]> slots;
+    };
+
+    InternTable()
+        : size(0)
+    {
+        std::fill(chunks, chunks + MaxChunks, nullptr);
+        indexes.emplace_back(new Index(ChunkSize));
+        index = indexes.back().get();
+        intern("");
+    }
+
+    ~InternTable()
+    {
+        for (unsigned i = 0;  i < MaxChunks;  ++i)
+            delete[] chunks[i];
+    }
+
+    uint32_t intern(const std::string & str)
+    {
+        size_t hash = hashString(str);
+
+        std::lock_guard<ML::Spinlock> guard(lock);
+
+        uint32_t handle;
+        if (find(str, hash, handle))
+            return handle;
+
+        handle = size;
+        if (handle == ChunkSize * MaxChunks)
+            throw ML::Exception("too many interned strings");
+
+        Entry *& chunk = chunks[handle >> ChunkBits];
+        if (!chunk)
+            chunk = new Entry[ChunkSize];
+        Entry & entry = chunk[handle & (ChunkSize - 1)];
+        entry.str = str;
+        entry.hash = hash;
+
+        Index * current = index.load(std::memory_order_relaxed);
+        if (2 * (handle + 1) > current->capacity()) {
+            indexes.emplace_back(new Index(2 * current->capacity()));
+            current = indexes.back().get();
+            for (uint32_t i = 0;  i < handle;  ++i)
+                add(*current, i);
+            index.store(current, std::memory_order_release);
+        }
+        add(*current, handle);
+
+        size.store(handle + 1, std::memory_order_release);
+        return handle;
+    }
+
+    bool find(const std::string & str, size_t hash, uint32_t & handle) const
+    {
+        const Index * current = index.load(std::memory_order_acquire);
+        for (size_t i = hash & current->mask;;  i = (i + 1) & current->mask) {
+            uint32_t slot = current->slots[i].load(std::memory_order_acquire);
+            if (!slot)
+                return false;
+            const Entry & found = entry(slot - 1);
+            if (found.hash == hash && found.str == str) {
+                handle = slot - 1;
+                return true;
+            }
+        }
+    }
+
+    const Entry & entry(uint32_t handle) const
+    {
+        return chunks[handle >> ChunkBits][handle & (ChunkSize - 1)];
+    }
+
+    mutable ML::Spinlock lock;
+    std::vector<std::unique_ptr<Index> > indexes;
+    std::atomic<Index *> index;
+    Entry * chunks[MaxChunks];
+    std::atomic<uint32_t> size;
+
+private:
+    void add(Index & current, uint32_t handle)
+    {
+        size_t i = entry(handle).hash & current.mask;
+        while (current.slots[i].load(std::memory_order_relaxed))
+            i = (i + 1) & current.mask;
+        current.slots[i].store(handle + 1, std::memory_order_release);
+    }
+};
+
+InternTable & table()
+{
+    static InternTable result;
+    return result;
+}
+
+} // file scope
+
+
+/*****************************************************************************/
+/* INTERNED STRING                                                           */
+/*****************************************************************************/
+
+InternedString
+InternedString::
+intern(const std::string & str)
+{
+    InternedString result;
+    result.handle_ = insert(str);
+    return result;
+}
+
+void
+InternedString::
+lookup(const std::string & str)
+{
+    if (!table().find(str, hashString(str), handle_)) {
+        handle_ = Copy;
+        copy_ = std::make_shared<const std::string>(str);
+    }
+}
+
+uint32_t
+InternedString::
+insert(const std::string & str)
+{
+    return table().intern(str);
+}
+
+const std::string &
+InternedString::
+name(uint32_t handle)
+{
+    return table().entry(handle).str;
+}
+
+bool
+InternedString::
+find(const std::string & str, InternedString & result)
+{
+    InternedString found;
+    if (!table().find(str, hashString(str), found.handle_))
+        return false;
+    result = found;
+    return true;
+}
+
+size_t
+InternedString::
+hash() const
+{
+    // Hash the contents so that a copy hashes the same before and after its
+    // string gets interned.
+    if (isCopy()) return hashString(*copy_);
+    return table().entry(handle_).hash;
+}
+
+size_t
+InternedString::
+tableSize()
+{
+    return table().size.load(std::memory_order_acquire);
+}
+
+void
+InternedString::
+serialize(ML::DB::Store_Writer & store) const
+{
+    store << str();
+}
+
+void
+InternedString::
+reconstitute(ML::DB::Store_Reader & store)
+{
+    std::string s;
+    store >> s;
+    *this = InternedString(s);
+}
+
+} // namespace RTBKIT
@@ -0,0 +1,314 @@
+/* interned_string.h                                               -*- C++ -*-
+   Copyright (c) 2013 Datacratic.  All rights reserved.
+
+   Strings from a small vocabulary (id domains, segment sources) that are
+   handled as small integers.
+*/
+
+#pragma once
+
+#include "jml/utils/compact_vector.h"
+#include "jml/db/persistent.h"
+#include "jml/compiler/compiler.h"
+#include <memory>
+#include <string>
+#include <cstring>
+#include <iostream>
+
+
+namespace RTBKIT {
+
+
+/*****************************************************************************/
+/* INTERNED STRING                                                           */
+/*****************************************************************************/
+
+/** Handle on a string that was entered in a process-wide table.  Copying
+    one or comparing two for equality is an integer operation; the string
+    itself is only looked at to order them, so that containers sorted on
+    them iterate in the same order as they would on the strings.
+
+    Entries are never removed from the table, so only intern() adds to it and
+    it's meant to be called with names that come from the configuration
+    (agent configs, filters).  Constructing one from a string only looks it
+    up, without locking or allocating when it's found: strings that aren't in the table, like the ones that come in with
+    bid requests, are kept as a private copy instead.  They compare on
+    their string and so never grow the table no matter what the exchanges
+    send.  The handle of the empty string is 0.
+*/
+struct InternedString {
+
+    InternedString()
+        : handle_(0)
+    {
+    }
+
+    InternedString(const std::string & str)
+    {
+        lookup(str);
+    }
+
+    InternedString(const char * str)
+    {
+        lookup(str);
+    }
+
+    /** Adds the string to the table if it isn't already there. */
+    static InternedString intern(const std::string & str);
+
+    /** Looks up the string without adding it to the table.  Returns false if
+        it was never interned, meaning that nothing can be keyed on it.
+    */
+    static bool find(const std::string & str, InternedString & result);
+
+    const std::string & str() const
+    {
+        return JML_UNLIKELY(isCopy()) ? *copy_ : name(handle_);
+    }
+
+    const char * c_str() const { return str().c_str(); }
+    operator const std::string & () const { return str(); }
+
+    bool empty() const { return handle_ == 0; }
+
+    /** Handle in the table or Copy if the string wasn't interned. */
+    uint32_t handle() const { return handle_; }
+
+    bool isCopy() const { return handle_ == Copy; }
+
+    /** Hash of the string, so the same for equal strings whether they
+        were interned or not.
+    */
+    size_t hash() const;
+
+    /** Number of strings in the table. */
+    static size_t tableSize();
+
+    bool operator == (const InternedString & other) const
+    {
+        // A copy may have been made before its string was interned.
+        if (JML_UNLIKELY(isCopy() || other.isCopy()))
+            return str() == other.str();
+        return handle_ == other.handle_;
+    }
+
+    bool operator != (const InternedString & other) const
+    {
+        return !operator == (other);
+    }
+
+    bool operator < (const InternedString & other) const
+    {
+        return *this != other && str() < other.str();
+    }
+
+    bool operator == (const std::string & other) const
+    {
+        return str() == other;
+    }
+
+    bool operator != (const std::string & other) const
+    {
+        return str() != other;
+    }
+
+    bool operator == (const char * other) const
+    {
+        return strcmp(c_str(), other) == 0;
+    }
+
+    bool operator != (const char * other) const
+    {
+        return !operator == (other);
+    }
+
+    void serialize(ML::DB::Store_Writer & store) const;
+    void reconstitute(ML::DB::Store_Reader & store);
+
+    enum { Copy = 0xffffffff };
+
+private:
+    void lookup(const std::string & str);
+    static uint32_t insert(const std::string & str);
+    static const std::string & name(uint32_t handle);
+
+    uint32_t handle_;
+    std::shared_ptr<const std::string> copy_;  ///< when handle_ == Copy
+};
+
+IMPL_SERIALIZE_RECONSTITUTE(InternedString);
+
+inline std::ostream &
+operator << (std::ostream & stream, const InternedString & str)
+{
+    return stream << str.str();
+}
+
+
+/*****************************************************************************/
+/* INTERNED MAP                                                              */
+/*****************************************************************************/
+
+/** Small map keyed on interned strings, stored as a flat vector of entries
+    that lives inline up to Inline entries.  It's meant for the handful of
+    entries of the per bid request maps, where a std::map would allocate a
+    node and a string per entry.
+
+    Entries are kept in string order so that iterating over it gives the
+    same results as it used to with a std::map; lookups are linear scans
+    comparing handles.  Lookups by string don't add anything to the intern
+    table.
+*/
+template<typename T, size_t Inline = 4>
+struct InternedMap {
+
+    typedef InternedString key_type;
+    typedef T mapped_type;
+    typedef std::pair<InternedString, T> value_type;
+    typedef ML::compact_vector<value_type, Inline, uint32_t> Entries;
+    typedef typename Entries::iterator iterator;
+    typedef typename Entries::const_iterator const_iterator;
+
+    iterator begin() { return entries.begin(); }
+    iterator end() { return entries.end(); }
+    const_iterator begin() const { return entries.begin(); }
+    const_iterator end() const { return entries.end(); }
+
+    size_t size() const { return entries.size(); }
+    bool empty() const { return entries.empty(); }
+    void clear() { entries.clear(); }
+
+    void swap(InternedMap & other) { entries.swap(other.entries); }
+
+    iterator find(const InternedString & key)
+    {
+        for (auto it = begin(), e = end();  it != e;  ++it)
+            if (it->first == key) return it;
+        return end();
+    }
+
+    const_iterator find(const InternedString & key) const
+    {
+        for (auto it = begin(), e = end();  it != e;  ++it)
+            if (it->first == key) return it;
+        return end();
+    }
+
+    iterator find(const std::string & key)
+    {
+        InternedString interned;
+        if (InternedString::find(key, interned)) return find(interned);
+
+        // Only the keys that weren't interned can match.
+        for (auto it = begin(), e = end();  it != e;  ++it)
+            if (it->first.isCopy() && it->first.str() == key) return it;
+        return end();
+    }
+
+    const_iterator find(const std::string & key) const
+    {
+        return const_cast<InternedMap *>(this)->find(key);
+    }
+
+    iterator find(const char * key) { return find(std::string(key)); }
+    const_iterator find(const char * key) const { return find(std::string(key)); }
+
+    template<typename Key>
+    size_t count(const Key & key) const
+    {
+        return find(key) != end();
+    }
+
+    /** Same as std::map::insert(): does nothing if the key is already
+        there.
+    */
+    template<typename Key, typename Value>
+    std::pair<iterator, bool> insert(const std::pair<Key, Value> & entry)
+    {
+        InternedString key(entry.first);
+        auto it = find(key);
+        if (it != end())
+            return std::make_pair(it, false);
+        return std::make_pair(insertNew(key, entry.second), true);
+    }
+
+    T & operator [] (const InternedString & key)
+    {
+        auto it = find(key);
+        if (it == end())
+            it = insertNew(key, T());
+        return it->second;
+    }
+
+    iterator erase(iterator it)
+    {
+        return entries.erase(it);
+    }
+
+    size_t erase(const InternedString & key)
+    {
+        auto it = find(key);
+        if (it == end()) return 0;
+        entries.erase(it);
+        return 1;
+    }
+
+    bool operator == (const InternedMap & other) const
+    {
+        return entries.size() == other.entries.size()
+            && std::equal(begin(), end(), other.begin());
+    }
+
+    bool operator != (const InternedMap & other) const
+    {
+        return !operator == (other);
+    }
+
+    /** Same format as a std::map<std::string, T>. */
+    void serialize(ML::DB::Store_Writer & store) const
+    {
+        store << ML::DB::compact_size_t(size());
+        for (auto & entry: entries)
+            store << entry.first << entry.second;
+    }
+
+    void reconstitute(ML::DB::Store_Reader & store)
+    {
+        ML::DB::compact_size_t sz(store);
+
+        InternedMap result;
+        for (unsigned i = 0;  i < sz;  ++i) {
+            InternedString key;
+            T value;
+            store >> key >> value;
+            result.insert(std::make_pair(key, std::move(value)));
+        }
+        swap(result);
+    }
+
+private:
+    iterator insertNew(const InternedString & key, const T & value)
+    {
+        auto it = begin(), e = end();
+        while (it != e && it->first < key)
+            ++it;
+        return entries.insert(it, value_type(key, value));
+    }
+
+    Entries entries;
+};
+
+} // namespace RTBKIT
+
+
+namespace std {
+
+template<>
+struct hash<RTBKIT::InternedString> {
+    size_t operator () (const RTBKIT::InternedString & str) const
+    {
+        return str.hash();
+    }
+};
+
+} // namespace std
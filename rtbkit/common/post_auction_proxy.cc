@@ -17,9 +17,12 @@ namespace RTBKIT {
 /* POST AUCTION PROXY                                                         */
 /******************************************************************************/
 
+const std::string PostAuctionProxy::RingPath = "postAuctionRing";
+
 PostAuctionProxy::
 PostAuctionProxy(shared_ptr<ServiceProxies> proxies) :
     shards(proxies->params.get("postAuctionShards", 1).asInt()),
+    useRing(proxies->params.get("postAuctionRing", false).asBool()),
     proxies(proxies)
 {}
 
@@ -29,12 +32,73 @@ init()
 {
     toPostAuction.init(proxies->config);
     toPostAuction.connectAllServiceProviders("rtbPostAuctionService", "events");
+
+    if (useRing) {
+        ringWatch.init([=] (const std::string & path,
+                        ConfigurationService::ChangeType change)
+                {
+                    onRingChanged();
+                });
+        onRingChanged();
+    }
+}
+
+void
+PostAuctionProxy::
+onRingChanged()
+{
+    // Zookeeper watches only fire once so this also re-arms the watch.
+    vector<string> children = proxies->config->getChildren(RingPath, ringWatch);
+
+    vector<string> nodes;
+    for (const auto& child : children) {
+        Json::Value value = proxies->config->getJson(RingPath + "/" + child);
+        if (value.isNull()) continue;
+        nodes.push_back(value["serviceName"].asString());
+    }
+
+    ConsistentHashRing newRing;
+    newRing.set(nodes);
+
+    {
+        std::lock_guard<ML::Spinlock> guard(ringLock);
+        if (newRing == hashRing) return;
+        hashRing = newRing;
+    }
+
+    if (onRingChange) onRingChange(newRing);
+}
+
+ConsistentHashRing
+PostAuctionProxy::
+ring() const
+{
+    std::lock_guard<ML::Spinlock> guard(ringLock);
+    return hashRing;
+}
+
+std::string
+PostAuctionProxy::
+owner(const Id & auctionId) const
+{
+    std::lock_guard<ML::Spinlock> guard(ringLock);
+    if (hashRing.empty()) return "";
+    return hashRing.find(auctionId.hash());
 }
 
 bool
 PostAuctionProxy::
 isConnected() const
 {
+    if (useRing) {
+        auto current = ring();
+        if (current.empty()) return false;
+
+        for (const auto& node : current.nodes())
+            if (!toPostAuction.isConnectedTo(node)) return false;
+        return true;
+    }
+
     for (size_t shard = 0; shard < shards; ++shard) {
         if (!toPostAuction.isConnectedToShard(shard)) return false;
     }
@@ -46,10 +110,16 @@ void
 PostAuctionProxy::
 sendAuction(SubmittedAuctionEvent event)
 {
-    size_t shard = event.auctionId.hash() % shards;
     string str = ML::DB::serializeToString(event);
 
     // we intentionally drop the message if the shard isn't up.
+    if (useRing) {
+        (void) toPostAuction.trySendMessage(
+                owner(event.auctionId), "AUCTION", move(str));
+        return;
+    }
+
+    size_t shard = event.auctionId.hash() % shards;
     (void) toPostAuction.sendMessageToShard(shard, "AUCTION", move(str));
 }
 
@@ -57,12 +127,28 @@ void
 PostAuctionProxy::
 sendEvent(PostAuctionEvent event)
 {
-    size_t shard = event.auctionId.hash() % shards;
     string str = ML::DB::serializeToString(event);
 
     // we intentionally drop the message if the shard isn't up.
+    if (useRing) {
+        (void) toPostAuction.trySendMessage(
+                owner(event.auctionId), print(event.type), str);
+        return;
+    }
+
+    size_t shard = event.auctionId.hash() % shards;
     (void) toPostAuction.sendMessageToShard(shard, print(event.type), str);
 }
 
+bool
+PostAuctionProxy::
+sendToNode(
+        const std::string & node,
+        const std::string & topic,
+        const std::vector<std::string> & parts)
+{
+    return toPostAuction.trySendMessage(node, topic, parts);
+}
+
 
 } // namepsace RTBKIT
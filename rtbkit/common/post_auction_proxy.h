@@ -9,6 +9,7 @@
 #pragma once
 
 #include "rtbkit/common/auction_events.h"
+#include "rtbkit/common/consistent_hash_ring.h"
 #include "soa/service/service_base.h"
 #include "soa/service/zmq_endpoint.h"
 
@@ -25,11 +26,19 @@ namespace RTBKIT {
     Requires that the postAuctionShard configuration parameter be provided in
     the bootstrap.json to determine the number of active post auction shards. If
     not present, assumes that there's only one active post auction shard.
+
+    If the postAuctionRing parameter is true then the shards are instead the
+    post auction services found under RingPath in the configuration service,
+    and auctions are spread over them with a consistent hash ring that follows
+    the services as they come and go.
  */
 struct PostAuctionProxy
 {
     PostAuctionProxy(std::shared_ptr<Datacratic::ServiceProxies> proxies);
 
+    /** Where the post auction services of the ring register themselves. */
+    static const std::string RingPath;
+
     void init();
 
     // Returns true only the proxy is connected to all shards.
@@ -41,8 +50,42 @@ struct PostAuctionProxy
     // Sends an event to the post auction loop.
     void sendEvent(PostAuctionEvent event);
 
+
+    /************************************************************************/
+    /* HASH RING                                                            */
+    /************************************************************************/
+
+    bool hasRing() const { return useRing; }
+
+    /** Current state of the ring; empty until a service registers. */
+    ConsistentHashRing ring() const;
+
+    /** Called from the configuration service's thread whenever the set of
+        services on the ring changes.
+    */
+    std::function<void (const ConsistentHashRing & ring)> onRingChange;
+
+    /** Sends a message that was already routed to the given service. The
+        message parts are sent as is after the topic.  Returns false if
+        we're not connected to the service.
+    */
+    bool sendToNode(const std::string & node,
+                    const std::string & topic,
+                    const std::vector<std::string> & parts);
+
 private:
+    void onRingChanged();
+
+    /** Service owning the auction, or empty if there's no one on the ring. */
+    std::string owner(const Id & auctionId) const;
+
     size_t shards;
+    bool useRing;
+
+    mutable ML::Spinlock ringLock;
+    ConsistentHashRing hashRing;
+    Datacratic::ConfigurationService::Watch ringWatch;
+
     std::shared_ptr<Datacratic::ServiceProxies> proxies;
     Datacratic::ZmqMultipleNamedClientBusProxy toPostAuction;
 
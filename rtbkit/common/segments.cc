@@ -13,6 +13,7 @@
 #include "jml/utils/exc_assert.h"
 #include "soa/types/value_description.h"
 #include "jml/db/persistent.h"
+#include "city.h"
 #include <boost/make_shared.hpp>
 #include <boost/algorithm/string.hpp>
 
@@ -364,6 +365,7 @@ add(const std::string & str, float weight)
     int i = parseSegmentNum(str);
     if (i == -1) {
         strings.push_back(str);
+        stringHashes.push_back(hashString(str));
         if (weight != 1.0 || !weights.empty()) {
             if (weights.empty())
                 weights.resize(size() - 1, 1.0);
@@ -395,6 +397,22 @@ parseSegmentNum(const std::string & str)
     return -1;
 }
 
+uint64_t
+SegmentList::
+hashString(const std::string & str)
+{
+    return CityHash64(str.c_str(), str.length());
+}
+
+void
+SegmentList::
+hashStrings()
+{
+    stringHashes.resize(strings.size());
+    for (unsigned i = 0;  i < strings.size();  ++i)
+        stringHashes[i] = hashString(strings[i]);
+}
+
 void
 SegmentList::
 sort()
@@ -424,6 +442,8 @@ sort()
             weights[i + ints.size()] = ssorted[i].second;
         }
     }
+
+    hashStrings();
 }
 
 void
@@ -443,6 +463,7 @@ reconstitute(ML::DB::Store_Reader & store)
     if (version > 0)
         throw ML::Exception("unknown SegmentList version");
     store >> ints >> strings >> weights;
+    hashStrings();
 }
 
 std::string
@@ -504,20 +525,40 @@ sortAll()
 
 const SegmentList &
 SegmentsBySource::
-get(const std::string & str) const
+get(const InternedString & source) const
 {
     static const SegmentList NONE;
     
-    auto it = find(str);
+    auto it = find(source);
     if (it == end()) return NONE;
     if (!it->second)
         throw ML::Exception("invalid segment list in segments");
     return *it->second;
 }
 
+const SegmentList &
+SegmentsBySource::
+get(const std::string & source) const
+{
+    static const SegmentList NONE;
+
+    auto it = find(source);
+    if (it == end()) return NONE;
+    if (!it->second)
+        throw ML::Exception("invalid segment list in segments");
+    return *it->second;
+}
+
+const SegmentList &
+SegmentsBySource::
+get(const char * source) const
+{
+    return get(std::string(source));
+}
+
 void
 SegmentsBySource::
-addSegment(const std::string & source,
+addSegment(const InternedString & source,
            const std::shared_ptr<SegmentList> & segs)
 {
     if (!insert(make_pair(source, segs)).second)
@@ -526,7 +567,7 @@ addSegment(const std::string & source,
 
 void
 SegmentsBySource::
-addInts(const std::string & source,
+addInts(const InternedString & source,
         const std::vector<int> & segs)
 {
     if (!insert(make_pair(source, std::make_shared<SegmentList>(segs))).second)
@@ -535,7 +576,7 @@ addInts(const std::string & source,
 
 void
 SegmentsBySource::
-addStrings(const std::string & source,
+addStrings(const InternedString & source,
            const std::vector<string> & segs)
 {
     if (!insert(make_pair(source, std::make_shared<SegmentList>(segs))).second)
@@ -544,7 +585,7 @@ addStrings(const std::string & source,
 
 void
 SegmentsBySource::
-addWeightedInts(const std::string & source,
+addWeightedInts(const InternedString & source,
                 const std::vector<pair<int, float> > & segs)
 {
     if (!insert(make_pair(source, std::make_shared<SegmentList>(segs))).second)
@@ -553,7 +594,7 @@ addWeightedInts(const std::string & source,
 
 void
 SegmentsBySource::
-add(const std::string & source, const std::string & segment, float weight)
+add(const InternedString & source, const std::string & segment, float weight)
 {
     auto & entry = (*this)[source];
     if (!entry) entry.reset(new SegmentList());
@@ -562,7 +603,7 @@ add(const std::string & source, const std::string & segment, float weight)
 
 void
 SegmentsBySource::
-add(const std::string & source, int segment, float weight)
+add(const InternedString & source, int segment, float weight)
 {
     auto & entry = (*this)[source];
     if (!entry) entry.reset(new SegmentList());
@@ -575,7 +616,7 @@ toJson() const
 {
     Json::Value result;
     for (auto it = begin(), end = this->end();  it != end;  ++it)
-        result[it->first] = it->second->toJson();
+        result[it->first.str()] = it->second->toJson();
     return result;
 }
 
@@ -603,7 +644,7 @@ serialize(ML::DB::Store_Writer & store) const
     store << version;
     store << compact_size_t(size());
     for (auto it = begin(), end = this->end();  it != end;  ++it) {
-        store << it->first;
+        store << it->first.str();
         it->second->serialize(store);
     }
 }
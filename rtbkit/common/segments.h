@@ -6,6 +6,7 @@
 
 #include "jml/utils/compact_vector.h"
 #include "jml/db/persistent_fwd.h"
+#include "rtbkit/common/interned_string.h"
 #include "soa/jsoncpp/json.h"
 #include "soa/types/value_description.h"
 #include "soa/types/value_description_fwd.h"
@@ -29,6 +30,9 @@ enum SegmentResult {
 
 /** A set of integral "segments".
     Immutable once created.
+
+    Segments that aren't integers are also kept as a 64 bit hash so that
+    they can be looked up as integers; see hashString().
 */
 
 struct SegmentList {
@@ -67,6 +71,9 @@ struct SegmentList {
 
     static int parseSegmentNum(const std::string & str);
 
+    /** Hash under which a string segment is kept in stringHashes. */
+    static uint64_t hashString(const std::string & str);
+
     /** Return true if there are only integers in the list. */
     bool intsOnly() const { return strings.empty(); }
 
@@ -77,12 +84,16 @@ struct SegmentList {
     //private:    
     ML::compact_vector<int, 7> ints;          ///< Categories
     std::vector<std::string> strings;         ///< Those that aren't an integer
+    ML::compact_vector<uint64_t, 3> stringHashes; ///< hashString() of strings
     ML::compact_vector<float, 5> weights;     ///< Weights over ints and strings
     
     void serialize(ML::DB::Store_Writer & store) const;
     void reconstitute(ML::DB::Store_Reader & store);
     std::string serializeToString() const;
     static SegmentList reconstituteFromString(const std::string & str);
+
+private:
+    void hashStrings();
 };
 
 IMPL_SERIALIZE_RECONSTITUTE(SegmentList);
@@ -98,10 +109,12 @@ operator << (std::ostream & stream, const SegmentList & segs)
 /* SEGMENTS BY SOURCE                                                        */
 /*****************************************************************************/
 
-typedef std::map<std::string, std::shared_ptr<SegmentList> >
+typedef InternedMap<std::shared_ptr<SegmentList> >
 SegmentsBySourceBase;
 
-/** A set of segments per segment provider. */
+/** A set of segments per segment provider.  The sources are interned and the
+    lists of the first few of them are stored inline.
+*/
 
 struct SegmentsBySource
     : public SegmentsBySourceBase {
@@ -111,35 +124,37 @@ struct SegmentsBySource
     SegmentsBySource(SegmentsBySourceBase && other);
     SegmentsBySource(const SegmentsBySourceBase & other);
 
-    const SegmentList & get(const std::string & str) const;
+    const SegmentList & get(const InternedString & source) const;
+    const SegmentList & get(const std::string & source) const;
+    const SegmentList & get(const char * source) const;
 
     void sortAll();
     
-    void add(const std::string & source,
+    void add(const InternedString & source,
              const std::shared_ptr<SegmentList> & segs)
     {
         addSegment(source, segs);
     }
 
-    void addSegment(const std::string & source,
+    void addSegment(const InternedString & source,
                     const std::shared_ptr<SegmentList> & segs);
-    void addInts(const std::string & source,
+    void addInts(const InternedString & source,
                  const std::vector<int> & segs);
-    void addWeightedInts(const std::string & source,
+    void addWeightedInts(const InternedString & source,
                          const std::vector<std::pair<int, float> > & segs);
-    void addStrings(const std::string & source,
+    void addStrings(const InternedString & source,
                     const std::vector<std::string> & segs);
 
     /** Add the given segment to the given source, creating if it didn't
         exist already.
     */
-    void add(const std::string & source, const std::string & segment,
+    void add(const InternedString & source, const std::string & segment,
                 float weight = 1.0);
 
     /** Add the given segment to the given source, creating if it didn't
         exist already.
     */
-    void add(const std::string & source, int segment,
+    void add(const InternedString & source, int segment,
              float weight = 1.0);
 
     Json::Value toJson() const;
@@ -0,0 +1,152 @@
+/** auction_tracer_test.cc                                 -*- C++ -*-
+    Copyright (c) 2014 Datacratic.  All rights reserved.
+
+    Tests for the auction tracer.
+
+*/
+
+#define BOOST_TEST_MAIN
+#define BOOST_TEST_DYN_LINK
+
+#include "rtbkit/common/auction_tracer.h"
+#include "soa/jsoncpp/json.h"
+#include "jml/utils/file_functions.h"
+
+#include <boost/test/unit_test.hpp>
+#include <set>
+
+using namespace std;
+using namespace RTBKIT;
+using namespace Datacratic;
+
+namespace {
+
+Json::Value readTrace(const string & filename)
+{
+    ML::File_Read_Buffer buf(filename);
+    return Json::parse(string(buf.start(), buf.end()));
+}
+
+} // namespace anonymous
+
+BOOST_AUTO_TEST_CASE( test_disabled )
+{
+    AuctionTracer tracer;
+    BOOST_CHECK(!tracer.enabled());
+    BOOST_CHECK(!tracer.wants(Id(1)));
+
+    Date now = Date::now();
+    tracer.record("test", Id(1), now, now);
+    tracer.flush(true);
+    BOOST_CHECK_EQUAL(tracer.exported, 0);
+}
+
+BOOST_AUTO_TEST_CASE( test_sampling )
+{
+    string filename = "build/x86_64/tmp/auction_tracer_sampling.json";
+
+    AuctionTracer tracer;
+    tracer.init(filename, 0.1);
+
+    // The decision only depends on the id so every process agrees on it.
+    size_t sampled = 0;
+    for (unsigned i = 1; i <= 10000; ++i) {
+        Id id(i);
+        BOOST_REQUIRE_EQUAL(tracer.sampled(id), tracer.sampled(Id(i)));
+        BOOST_REQUIRE_EQUAL(tracer.wants(id), tracer.sampled(id));
+        if (tracer.sampled(id)) ++sampled;
+
+        Date start = Date::now();
+        tracer.record("test", id, start, start.plusSeconds(0.001), "agent");
+    }
+    BOOST_CHECK_GT(sampled, 800);
+    BOOST_CHECK_LT(sampled, 1200);
+
+    tracer.shutdown();
+    BOOST_CHECK_EQUAL(tracer.exported, sampled);
+
+    Json::Value trace = readTrace(filename);
+    BOOST_REQUIRE(trace.isArray());
+    BOOST_REQUIRE_EQUAL(trace.size(), sampled);
+
+    const Json::Value & event = trace[0];
+    BOOST_CHECK_EQUAL(event["name"].asString(), "test agent");
+    BOOST_CHECK_EQUAL(event["ph"].asString(), "X");
+    BOOST_CHECK_CLOSE(event["dur"].asDouble(), 1000.0, 1.0);
+    BOOST_CHECK_EQUAL(event["args"]["detail"].asString(), "agent");
+}
+
+BOOST_AUTO_TEST_CASE( test_triggers )
+{
+    string filename = "build/x86_64/tmp/auction_tracer_triggers.json";
+
+    AuctionTracer tracer;
+    tracer.init(filename, 0.0, { "timeout" }, 1 << 10, 60.0);
+
+    // Everything is recorded in case it gets triggered later on.
+    BOOST_CHECK(tracer.wants(Id(1)));
+
+    Date now = Date::now();
+    for (unsigned i = 1; i <= 100; ++i) {
+        tracer.record("first", Id(i), now, now);
+        tracer.record("second", Id(i), now, now);
+    }
+
+    tracer.trigger(Id(7), "timeout");
+    tracer.trigger(Id(8), "unknown");
+
+    // Nothing has been held long enough yet.
+    tracer.flush();
+    BOOST_CHECK_EQUAL(tracer.exported, 0);
+
+    tracer.shutdown();
+    BOOST_CHECK_EQUAL(tracer.exported, 2);
+
+    Json::Value trace = readTrace(filename);
+    BOOST_REQUIRE_EQUAL(trace.size(), 2);
+    for (const auto & event : trace)
+        BOOST_CHECK_EQUAL(event["args"]["auction"].asString(), Id(7).toString());
+}
+
+BOOST_AUTO_TEST_CASE( test_ring_overflow )
+{
+    string filename = "build/x86_64/tmp/auction_tracer_overflow.json";
+
+    AuctionTracer tracer;
+    tracer.init(filename, 1.0, {}, 16);
+
+    Date now = Date::now();
+    for (unsigned i = 1; i <= 100; ++i)
+        tracer.record("test", Id(i), now, now);
+
+    tracer.shutdown();
+    BOOST_CHECK_EQUAL(tracer.dropped + tracer.exported, 100);
+    BOOST_CHECK_LE(tracer.dropped, 84);
+}
+
+BOOST_AUTO_TEST_CASE( test_restart )
+{
+    string filename = "build/x86_64/tmp/auction_tracer_restart.json";
+
+    AuctionTracer tracer;
+    Date now = Date::now();
+
+    // The rings of the first run are freed on shutdown and the next run
+    // only exports its own spans.
+    tracer.init(filename, 1.0, {}, 16);
+    for (unsigned i = 1; i <= 10; ++i)
+        tracer.record("first", Id(i), now, now);
+    tracer.shutdown();
+    BOOST_CHECK_EQUAL(tracer.exported, 10);
+
+    tracer.init(filename, 1.0, {}, 16);
+    for (unsigned i = 1; i <= 5; ++i)
+        tracer.record("second", Id(i), now, now);
+    tracer.shutdown();
+    BOOST_CHECK_EQUAL(tracer.exported, 15);
+
+    Json::Value trace = readTrace(filename);
+    BOOST_REQUIRE_EQUAL(trace.size(), 5);
+    for (const auto & event : trace)
+        BOOST_CHECK_EQUAL(event["name"].asString(), "second");
+}
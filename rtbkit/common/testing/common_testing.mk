@@ -4,3 +4,6 @@ $(eval $(call library,bid_request_synth,bid_request_synth.cc,arch utils jsoncpp)
 $(eval $(call test,bid_request_synth_test,bid_request_synth,boost))
 $(eval $(call test,currency_test,bid_request,boost))
 $(eval $(call test,filter_test,filter_registry,boost))
+$(eval $(call test,interned_string_test,bid_request,boost))
+$(eval $(call test,consistent_hash_ring_test,rtb,boost))
+$(eval $(call test,auction_tracer_test,rtb,boost))
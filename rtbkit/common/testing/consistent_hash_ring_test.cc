@@ -0,0 +1,104 @@
+/** consistent_hash_ring_test.cc                                 -*- C++ -*-
+    Copyright (c) 2014 Datacratic.  All rights reserved.
+
+    Tests for the consistent hash ring.
+
+*/
+
+#define BOOST_TEST_MAIN
+#define BOOST_TEST_DYN_LINK
+
+#include "rtbkit/common/consistent_hash_ring.h"
+#include "soa/types/id.h"
+#include "jml/arch/exception.h"
+
+#include <boost/test/unit_test.hpp>
+#include <iostream>
+#include <map>
+
+using namespace std;
+using namespace RTBKIT;
+using namespace Datacratic;
+
+BOOST_AUTO_TEST_CASE( test_empty_ring )
+{
+    ConsistentHashRing ring;
+    BOOST_CHECK(ring.empty());
+    BOOST_CHECK_THROW(ring.find(1234), ML::Exception);
+    BOOST_CHECK_EQUAL(ring.share("a"), 0.0);
+
+    BOOST_CHECK(ring.add("a"));
+    BOOST_CHECK(!ring.add("a"));
+    BOOST_CHECK_EQUAL(ring.find(1234), "a");
+    BOOST_CHECK_EQUAL(ring.share("a"), 1.0);
+
+    BOOST_CHECK(ring.remove("a"));
+    BOOST_CHECK(!ring.remove("a"));
+    BOOST_CHECK(ring.empty());
+}
+
+BOOST_AUTO_TEST_CASE( test_order_independence )
+{
+    ConsistentHashRing ring1;
+    ring1.add("pal-0");
+    ring1.add("pal-1");
+    ring1.add("pal-2");
+
+    ConsistentHashRing ring2;
+    ring2.set({ "pal-2", "pal-0", "pal-1", "pal-0" });
+
+    BOOST_CHECK(ring1 == ring2);
+    BOOST_CHECK_EQUAL(ring2.size(), 3);
+
+    for (size_t i = 1; i <= 10000; ++i) {
+        uint64_t hash = Id(i).hash();
+        BOOST_REQUIRE_EQUAL(ring1.find(hash), ring2.find(hash));
+    }
+}
+
+BOOST_AUTO_TEST_CASE( test_balance_and_movement )
+{
+    enum { Keys = 100000 };
+
+    ConsistentHashRing ring;
+    for (unsigned i = 0; i < 4; ++i)
+        ring.add("pal-" + to_string(i));
+
+    double shares = 0.0;
+    for (const auto& node : ring.nodes()) shares += ring.share(node);
+    BOOST_CHECK_CLOSE(shares, 1.0, 1e-6);
+
+    vector<string> before(Keys);
+    map<string, size_t> counts;
+    for (size_t i = 0; i < Keys; ++i) {
+        before[i] = ring.find(Id(i + 1).hash());
+        counts[before[i]]++;
+    }
+
+    for (const auto& entry : counts) {
+        cerr << entry.first << ": " << entry.second << endl;
+        BOOST_CHECK_GT(entry.second, Keys / 4 * 0.7);
+        BOOST_CHECK_LT(entry.second, Keys / 4 * 1.3);
+    }
+
+    // Only the keys that go to the new node should move.
+    ring.add("pal-4");
+
+    size_t moved = 0;
+    for (size_t i = 0; i < Keys; ++i) {
+        const string & node = ring.find(Id(i + 1).hash());
+        if (node == before[i]) continue;
+
+        BOOST_REQUIRE_EQUAL(node, "pal-4");
+        ++moved;
+    }
+
+    cerr << "moved " << moved << " keys" << endl;
+    BOOST_CHECK_GT(moved, Keys / 5 * 0.7);
+    BOOST_CHECK_LT(moved, Keys / 5 * 1.3);
+
+    // And removing it moves them back.
+    ring.remove("pal-4");
+    for (size_t i = 0; i < Keys; ++i)
+        BOOST_REQUIRE_EQUAL(ring.find(Id(i + 1).hash()), before[i]);
+}
@@ -0,0 +1,214 @@
+/** interned_string_test.cc                          -*- C++ -*-
+    Copyright (c) 2013 Datacratic.  All rights reserved.
+
+    Tests for interned strings and the per bid request maps keyed on them.
+
+*/
+
+#define BOOST_TEST_MAIN
+#define BOOST_TEST_DYN_LINK
+
+#include "rtbkit/common/bid_request.h"
+#include "jml/db/persistent.h"
+#include "jml/arch/format.h"
+
+#include <boost/test/unit_test.hpp>
+#include <iostream>
+#include <atomic>
+#include <future>
+
+using namespace std;
+using namespace ML;
+using namespace Datacratic;
+using namespace RTBKIT;
+
+BOOST_AUTO_TEST_CASE( test_interned_string )
+{
+    InternedString empty;
+    BOOST_CHECK(empty.empty());
+    BOOST_CHECK_EQUAL(empty.str(), "");
+    BOOST_CHECK_EQUAL(InternedString(""), empty);
+
+    InternedString a = InternedString::intern("test-a");
+    InternedString a2(string("test-a"));
+    InternedString b = InternedString::intern("test-b");
+    BOOST_CHECK(!a2.isCopy());
+    BOOST_CHECK_EQUAL(a, a2);
+    BOOST_CHECK_EQUAL(a.handle(), a2.handle());
+    BOOST_CHECK_NE(a, b);
+    BOOST_CHECK(a < b);
+    BOOST_CHECK(!(b < a));
+    BOOST_CHECK(!(a < a2));
+    BOOST_CHECK(a == "test-a");
+    BOOST_CHECK(a == string("test-a"));
+
+    InternedString found;
+    BOOST_CHECK(InternedString::find("test-b", found));
+    BOOST_CHECK_EQUAL(found, b);
+
+    // Looking up doesn't add to the table
+    size_t size = InternedString::tableSize();
+    BOOST_CHECK(!InternedString::find("test-never-interned", found));
+    BOOST_CHECK_EQUAL(InternedString::tableSize(), size);
+}
+
+BOOST_AUTO_TEST_CASE( test_uninterned_strings )
+{
+    // Strings from bid requests are never added to the table.
+    size_t size = InternedString::tableSize();
+
+    InternedString copy("test-from-request");
+    BOOST_CHECK(copy.isCopy());
+    BOOST_CHECK(!copy.empty());
+    BOOST_CHECK_EQUAL(copy.str(), "test-from-request");
+    BOOST_CHECK_EQUAL(copy, InternedString("test-from-request"));
+    BOOST_CHECK_NE(copy, InternedString("test-other-request"));
+
+    SegmentsBySource segs;
+    for (unsigned i = 0;  i < 1000;  ++i)
+        segs.add(ML::format("test-source-%d", i), 1);
+    BOOST_CHECK_EQUAL(segs.size(), 1000);
+    BOOST_CHECK(segs.get("test-source-10").contains(1));
+
+    auto segs2 = DB::reconstituteFromString<SegmentsBySource>(
+            DB::serializeToString(segs));
+    BOOST_CHECK_EQUAL(segs2.size(), 1000);
+
+    BOOST_CHECK_EQUAL(InternedString::tableSize(), size);
+
+    // Interning the string later on doesn't change how the copies compare
+    // or hash.
+    InternedString interned = InternedString::intern("test-from-request");
+    BOOST_CHECK(!interned.isCopy());
+    BOOST_CHECK_EQUAL(copy, interned);
+    BOOST_CHECK_EQUAL(std::hash<InternedString>()(copy),
+                      std::hash<InternedString>()(interned));
+    BOOST_CHECK_EQUAL(std::hash<InternedString>()(copy),
+                      std::hash<std::string>()("test-from-request"));
+    BOOST_CHECK_EQUAL(InternedString::tableSize(), size + 1);
+}
+
+BOOST_AUTO_TEST_CASE( test_concurrent_lookups )
+{
+    // Lookups run while the table is being grown underneath them; a string
+    // is either found or copied but always reads back the same.
+    enum { NumStrings = 5000 };
+    std::atomic<bool> finished(false);
+
+    auto lookups = [&] ()
+        {
+            unsigned errors = 0;
+            while (!finished) {
+                for (unsigned i = 0;  i < NumStrings;  i += 7) {
+                    string name = ML::format("test-concurrent-%d", i);
+                    InternedString str(name);
+                    if (str != name || str.hash() != std::hash<string>()(name))
+                        ++errors;
+                }
+            }
+            return errors;
+        };
+
+    std::vector<std::future<unsigned> > readers;
+    for (unsigned i = 0;  i < 4;  ++i)
+        readers.push_back(std::async(std::launch::async, lookups));
+
+    for (unsigned i = 0;  i < NumStrings;  ++i)
+        InternedString::intern(ML::format("test-concurrent-%d", i));
+    finished = true;
+
+    for (auto & reader: readers)
+        BOOST_CHECK_EQUAL(reader.get(), 0);
+
+    for (unsigned i = 0;  i < NumStrings;  ++i) {
+        InternedString str(ML::format("test-concurrent-%d", i));
+        BOOST_CHECK(!str.isCopy());
+    }
+}
+
+BOOST_AUTO_TEST_CASE( test_user_ids )
+{
+    UserIds ids;
+    ids.add(Id("0828398c-5965-11e0-84c8-0026b937c8e1"), ID_EXCHANGE);
+    ids.add(Id(1234), "zzz");
+    ids.add(Id(5678), "aaa", ID_PROVIDER);
+
+    BOOST_CHECK_EQUAL(ids.size(), 4);
+    BOOST_CHECK_EQUAL(ids.exchangeId, Id("0828398c-5965-11e0-84c8-0026b937c8e1"));
+    BOOST_CHECK_EQUAL(ids.providerId, Id(5678));
+    BOOST_CHECK_EQUAL(ids.count("zzz"), 1);
+    BOOST_CHECK_EQUAL(ids.count("yyy"), 0);
+    BOOST_CHECK_THROW(ids.add(Id(1), "zzz"), ML::Exception);
+
+    // Iterates in the same order as a std::map would
+    vector<string> domains;
+    for (auto & entry: ids)
+        domains.push_back(entry.first);
+    BOOST_CHECK(domains == (vector<string>{ "aaa", "prov", "xchg", "zzz" }));
+
+    ids.set(Id(4321), "zzz");
+    BOOST_CHECK_EQUAL(ids.find("zzz")->second, Id(4321));
+
+    BOOST_CHECK_EQUAL(ids.toJsonStr(), UserIds::createFromJson(ids.toJson()).toJsonStr());
+
+    auto ids2 = DB::reconstituteFromString<UserIds>(DB::serializeToString(ids));
+    BOOST_CHECK(ids2 == ids);
+}
+
+BOOST_AUTO_TEST_CASE( test_user_ids_serialization_format )
+{
+    // Same bytes as the std::map it replaced
+    std::map<std::string, Id> asMap;
+    asMap["prov"] = Id(1234);
+    asMap["abc"] = Id("hello");
+
+    std::ostringstream stream;
+    {
+        DB::Store_Writer store(stream);
+        unsigned char version = 0;
+        store << version << asMap;
+    }
+
+    auto ids = DB::reconstituteFromString<UserIds>(stream.str());
+    BOOST_CHECK_EQUAL(ids.size(), 2);
+    BOOST_CHECK_EQUAL(ids.find("abc")->second, Id("hello"));
+    BOOST_CHECK_EQUAL(DB::serializeToString(ids), stream.str());
+}
+
+BOOST_AUTO_TEST_CASE( test_segments_by_source )
+{
+    SegmentsBySource segs;
+    segs.addStrings("b-source", { "one", "two", "12" });
+    segs.add("a-source", 3);
+    segs.add("a-source", "three");
+
+    BOOST_CHECK_EQUAL(segs.size(), 2);
+    BOOST_CHECK_EQUAL(segs.begin()->first, "a-source");
+    BOOST_CHECK(segs.get("b-source").contains("two"));
+    BOOST_CHECK(segs.get("b-source").contains(12));
+    BOOST_CHECK(segs.get("no-such-source").empty());
+    BOOST_CHECK(segs.get(string("no-such-source")).empty());
+
+    // An unknown source doesn't pick up the list of the empty source.
+    segs.add("", 5);
+    BOOST_CHECK(segs.get(string("no-such-source")).empty());
+    BOOST_CHECK_THROW(segs.addInts("b-source", { 1 }), ML::Exception);
+
+    auto segs2 = SegmentsBySource::createFromJson(segs.toJson());
+    BOOST_CHECK_EQUAL(segs2.toJson(), segs.toJson());
+}
+
+BOOST_AUTO_TEST_CASE( test_segment_string_hashes )
+{
+    SegmentList segs(vector<string>{ "zulu", "alpha", "7", "mike" });
+    BOOST_CHECK_EQUAL(segs.strings.size(), 3);
+    BOOST_CHECK_EQUAL(segs.stringHashes.size(), 3);
+
+    for (unsigned i = 0;  i < segs.strings.size();  ++i)
+        BOOST_CHECK_EQUAL(segs.stringHashes[i],
+                          SegmentList::hashString(segs.strings[i]));
+
+    SegmentList segs2
+        = SegmentList::reconstituteFromString(segs.serializeToString());
+    BOOST_CHECK(segs2.stringHashes == segs.stringHashes);
+}
@@ -7,11 +7,14 @@
 #include "agent_config.h"
 #include "jml/arch/exception.h"
 #include "jml/utils/string_functions.h"
+#include "jml/utils/exc_check.h"
 #include <boost/lexical_cast.hpp>
 #include "rtbkit/common/auction.h"
 #include "rtbkit/core/router/router_types.h"
 #include "rtbkit/common/exchange_connector.h"
 
+#include <city.h>
+
 #define CRYPTOPP_ENABLE_NAMESPACE_WEAK 1
 #include "crypto++/md5.h"
 
@@ -402,9 +405,21 @@ fromJson(const Json::Value & json)
     *this = createFromJson(json);
 }
 
+namespace {
+
+template<typename Filter>
+void parseFilter(Filter & filter, const Json::Value & json,
+                 const std::string & name, AgentConfigCache * cache)
+{
+    if (cache) cache->parse(filter, json, name);
+    else filter.fromJson(json, name);
+}
+
+} // namespace anonymous
+
 AgentConfig
 AgentConfig::
-createFromJson(const Json::Value & json)
+createFromJson(const Json::Value & json, AgentConfigCache * cache)
 {
     AgentConfig newConfig;
     newConfig.augmentations.clear();
@@ -451,7 +466,9 @@ createFromJson(const Json::Value & json)
             for (unsigned i = 0;
                  i < newConfig.creatives.size();  ++i) {
                 try {
-                    newConfig.creatives[i].fromJson((*it)[i]);
+                    if (cache)
+                        cache->parse(newConfig.creatives[i], (*it)[i]);
+                    else newConfig.creatives[i].fromJson((*it)[i]);
                 } catch (const std::exception & exc) {
                     throw Exception("parsing creative %d: %s",
                                     i, exc.what());
@@ -484,13 +501,13 @@ createFromJson(const Json::Value & json)
             newConfig.userPartition.fromJson(*it);
         }
         else if (it.memberName() == "urlFilter")
-            newConfig.urlFilter.fromJson(*it, "urlFilter");
+            parseFilter(newConfig.urlFilter, *it, "urlFilter", cache);
         else if (it.memberName() == "hostFilter")
-            newConfig.hostFilter.fromJson(*it, "hostFilter");
+            parseFilter(newConfig.hostFilter, *it, "hostFilter", cache);
         else if (it.memberName() == "locationFilter")
-            newConfig.locationFilter.fromJson(*it, "locationFilter");
+            parseFilter(newConfig.locationFilter, *it, "locationFilter", cache);
         else if (it.memberName() == "languageFilter")
-            newConfig.languageFilter.fromJson(*it, "languageFilter");
+            parseFilter(newConfig.languageFilter, *it, "languageFilter", cache);
         else if (it.memberName() == "exchangeFilter")
             newConfig.exchangeFilter.fromJson(*it, "exchangeFilter");
         else if (it.memberName() == "segmentFilter") {
@@ -768,5 +785,161 @@ addAugmentation(AugmentationConfig info)
     std::sort(augmentations.begin(), augmentations.end());
 }
 
+
+/*****************************************************************************/
+/* AGENT CONFIG CACHE                                                        */
+/*****************************************************************************/
+
+AgentConfigCache::
+AgentConfigCache(size_t maxEntries) :
+    maxEntries(maxEntries), hits(0), misses(0)
+{
+    ExcCheckGreater(maxEntries, 0, "cache can't be empty");
+}
+
+template<typename T, typename Fn>
+void
+AgentConfigCache::
+get(Store<T> & store, const Json::Value & json, T & value, const Fn & parseFn)
+{
+    string str = json.toStringNoNewLine();
+    uint64_t hash = CityHash64(str.c_str(), str.size());
+
+    auto it = store.current.find(hash);
+    if (it != store.current.end() && it->second.json == str) {
+        ++hits;
+        value = it->second.value;
+        return;
+    }
+
+    auto jt = store.previous.find(hash);
+    if (jt != store.previous.end() && jt->second.json == str) {
+        ++hits;
+        value = jt->second.value;
+    }
+    else {
+        ++misses;
+        parseFn(value);
+    }
+
+    if (store.current.size() >= maxEntries) {
+        store.previous = std::move(store.current);
+        store.current.clear();
+    }
+
+    // On a hash collision, the last one parsed wins.
+    auto& entry = store.current[hash];
+    entry.json = std::move(str);
+    entry.value = value;
+}
+
+void
+AgentConfigCache::
+parse(Creative & creative, const Json::Value & json)
+{
+    get(creatives, json, creative, [&] (Creative & value) {
+                value.fromJson(json);
+            });
+}
+
+void
+AgentConfigCache::
+parse(IncludeExclude<DomainMatcher> & filter,
+      const Json::Value & json, const std::string & name)
+{
+    get(hostFilters, json, filter, [&] (IncludeExclude<DomainMatcher> & value) {
+                value.fromJson(json, name);
+            });
+}
+
+void
+AgentConfigCache::
+parse(IncludeExclude<CachedRegex<boost::regex, std::string> > & filter,
+      const Json::Value & json, const std::string & name)
+{
+    typedef IncludeExclude<CachedRegex<boost::regex, std::string> > Filter;
+    get(regexFilters, json, filter, [&] (Filter & value) {
+                value.fromJson(json, name);
+            });
+}
+
+void
+AgentConfigCache::
+parse(IncludeExclude<CachedRegex<boost::u32regex, Datacratic::UnicodeString> > & filter,
+      const Json::Value & json, const std::string & name)
+{
+    typedef IncludeExclude<CachedRegex<boost::u32regex, Datacratic::UnicodeString> >
+        Filter;
+    get(u32RegexFilters, json, filter, [&] (Filter & value) {
+                value.fromJson(json, name);
+            });
+}
+
+void
+AgentConfigCache::
+clear()
+{
+    creatives = Store<Creative>();
+    hostFilters = decltype(hostFilters)();
+    regexFilters = decltype(regexFilters)();
+    u32RegexFilters = decltype(u32RegexFilters)();
+}
+
+
+/*****************************************************************************/
+/* AGENT CONFIG PATCH                                                        */
+/*****************************************************************************/
+
+Json::Value
+diffAgentConfig(const Json::Value & from, const Json::Value & to)
+{
+    Json::Value patch(Json::arrayValue);
+
+    auto addOp = [&] (const char * op, const string & member) -> Json::Value & {
+        Json::Value & entry = patch[patch.size()];
+        entry["op"] = op;
+        entry["path"] = "/" + member;
+        return entry;
+    };
+
+    for (const auto & member : from.getMemberNames()) {
+        if (!to.isMember(member))
+            addOp("remove", member);
+    }
+
+    for (const auto & member : to.getMemberNames()) {
+        if (!from.isMember(member))
+            addOp("add", member)["value"] = to[member];
+        else if (from[member] != to[member])
+            addOp("replace", member)["value"] = to[member];
+    }
+
+    return patch;
+}
+
+Json::Value
+patchAgentConfig(Json::Value config, const Json::Value & patch)
+{
+    if (!patch.isArray())
+        throw ML::Exception("agent config patch must be an array");
+
+    for (const auto & entry : patch) {
+        string op = entry["op"].asString();
+        string path = entry["path"].asString();
+
+        if (path.size() < 2 || path[0] != '/' || path.find('/', 1) != string::npos)
+            throw ML::Exception("invalid agent config patch path: " + path);
+        string member = path.substr(1);
+
+        if (op == "add" || op == "replace")
+            config[member] = entry["value"];
+        else if (op == "remove")
+            config.removeMember(member);
+        else throw ML::Exception("invalid agent config patch op: " + op);
+    }
+
+    return config;
+}
+
 } // namespace RTBKIT
 
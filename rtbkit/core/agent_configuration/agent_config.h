@@ -9,6 +9,7 @@
 #include <string>
 #include <vector>
 #include <set>
+#include <unordered_map>
 #include "jml/arch/spinlock.h"
 #include "soa/jsoncpp/json.h"
 #include <boost/regex.hpp>
@@ -230,10 +231,16 @@ void fromJson(BidResultFormat & fmt, const Json::Value & j);
 /** Describes the configuration state of an RTB agent.  Passed through by
     a agent to the router to describe how the routes should be set up.
 */
+struct AgentConfigCache;
+
 struct AgentConfig {
     AgentConfig();
 
-    static AgentConfig createFromJson(const Json::Value & json);
+    /** Parses the config. If a cache is given, the creatives and filters
+        that it already knows are copied from it instead of being parsed.
+    */
+    static AgentConfig createFromJson(const Json::Value & json,
+                                      AgentConfigCache * cache = nullptr);
 
     void parse(const std::string & jsonStr);
     void fromJson(const Json::Value & json);
@@ -371,6 +378,79 @@ struct AgentConfig {
 };
 
 
+/*****************************************************************************/
+/* AGENT CONFIG CACHE                                                        */
+/*****************************************************************************/
+
+/** Parsed creatives and filters of agent configurations keyed by the hash of
+    their JSON. Configs that share them, and successive versions of the same
+    config, then don't have to compile their regexes again.
+
+    Entries that go unused for a generation are dropped, a generation ending
+    every maxEntries insertions. Not thread safe.
+*/
+struct AgentConfigCache {
+    AgentConfigCache(size_t maxEntries = 1 << 14);
+
+    void parse(Creative & creative, const Json::Value & json);
+
+    void parse(IncludeExclude<DomainMatcher> & filter,
+               const Json::Value & json, const std::string & name);
+    void parse(IncludeExclude<CachedRegex<boost::regex, std::string> > & filter,
+               const Json::Value & json, const std::string & name);
+    void parse(IncludeExclude<CachedRegex<boost::u32regex, Datacratic::UnicodeString> > & filter,
+               const Json::Value & json, const std::string & name);
+
+    void clear();
+
+    size_t maxEntries;
+    size_t hits;
+    size_t misses;
+
+private:
+
+    template<typename T>
+    struct Store
+    {
+        struct Entry
+        {
+            std::string json;
+            T value;
+        };
+
+        typedef std::unordered_map<uint64_t, Entry> Map;
+        Map current, previous;
+    };
+
+    template<typename T, typename Fn>
+    void get(Store<T> & store, const Json::Value & json, T & value,
+             const Fn & parseFn);
+
+    Store<Creative> creatives;
+    Store< IncludeExclude<DomainMatcher> > hostFilters;
+    Store< IncludeExclude<CachedRegex<boost::regex, std::string> > > regexFilters;
+    Store< IncludeExclude<CachedRegex<boost::u32regex, Datacratic::UnicodeString> > >
+        u32RegexFilters;
+};
+
+
+/*****************************************************************************/
+/* AGENT CONFIG PATCH                                                        */
+/*****************************************************************************/
+
+/** Returns the operations that turn the JSON config from into the JSON config
+    to. Follows JSON patch (RFC 6902) but only ever touches the top level
+    members of the config:
+
+        [ { "op": "replace", "path": "/bidProbability", "value": 0.5 },
+          { "op": "remove", "path": "/urlFilter" } ]
+*/
+Json::Value diffAgentConfig(const Json::Value & from, const Json::Value & to);
+
+/** Applies a patch created by diffAgentConfig to config. */
+Json::Value patchAgentConfig(Json::Value config, const Json::Value & patch);
+
+
 } // namespace RTBKIT
 
 #endif /* __rtb_agent_config_h__ */
@@ -66,21 +66,54 @@ onMessage(const std::vector<std::string> & message)
     using namespace std;
 
     const std::string & topic = message.at(0);
-    if (topic != "CONFIG") {
+    const std::string & agent = message.at(1);
+
+    if (topic == "CONFIG") {
+        const std::string & configStr = message.at(2);
+
+        if (configStr.empty()) {
+            versions.erase(agent);
+            onConfig(agent, nullptr);
+            return;
+        }
+
+        ConfigVersion & entry = versions[agent];
+        entry.json = Json::parse(configStr);
+        entry.version = message.size() > 3 ? stoull(message[3]) : 0;
+    }
+
+    else if (topic == "CONFIGPATCH") {
+        uint64_t base = stoull(message.at(2));
+        uint64_t version = stoull(message.at(3));
+
+        auto it = versions.find(agent);
+        if (it == versions.end() || it->second.version != base) {
+            cerr << "missed configuration of agent " << agent
+                 << "; asking for all of it" << endl;
+            configEndpoint.sendMessage("RESYNC", agent);
+            return;
+        }
+
+        it->second.json = patchAgentConfig(
+                std::move(it->second.json), Json::parse(message.at(4)));
+        it->second.version = version;
+    }
+
+    else {
         cerr << "unknown message for agent configuration listener" << endl;
         cerr << message;
         return;
     }
-    const std::string & agent = message.at(1);
-    const std::string & configStr = message.at(2);
-
-    std::shared_ptr<AgentConfig> config;
 
-    if (!configStr.empty()) {
-        Json::Value j = Json::parse(configStr);
-        config.reset(new AgentConfig(AgentConfig::createFromJson(j)));
-    }
+    std::shared_ptr<AgentConfig> config(new AgentConfig(
+                    AgentConfig::createFromJson(versions[agent].json, &configCache)));
+    onConfig(agent, std::move(config));
+}
 
+void
+AgentConfigurationListener::
+onConfig(const std::string & agent, std::shared_ptr<AgentConfig> config)
+{
     /* Now, update the current configuration list */
 
     GcLock::SharedGuard guard(allAgentsGc);
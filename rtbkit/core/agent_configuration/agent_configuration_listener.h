@@ -9,6 +9,7 @@
 
 #include "soa/service/zmq_endpoint.h"
 #include "rtbkit/core/router/router_types.h"
+#include "rtbkit/core/agent_configuration/agent_config.h"
 #include "soa/gc/rcu_protected.h"
 
 
@@ -115,10 +116,24 @@ struct AgentConfigurationListener: public MessageLoop {
 
 private:
     void onMessage(const std::vector<std::string> & message);
+    void onConfig(const std::string & agent,
+                  std::shared_ptr<AgentConfig> config);
 
     AllAgentConfig * allAgents;
     mutable GcLock allAgentsGc;
 
+    /** Last JSON config received for each agent which is what the patches
+        sent by the configuration service apply to. Only touched from the
+        message loop.
+    */
+    struct ConfigVersion {
+        Json::Value json;
+        uint64_t version;
+    };
+    std::unordered_map<std::string, ConfigVersion> versions;
+
+    AgentConfigCache configCache;
+
     ZmqNamedClientBusProxy configEndpoint;
 };
 
@@ -7,6 +7,7 @@
 
 #include "jml/utils/string_functions.h"
 #include "agent_configuration_service.h"
+#include "agent_config.h"
 #include "soa/service/rest_request_binding.h"
 
 using namespace std;
@@ -67,8 +68,7 @@ init()
             // we got a new listener...
             for (auto & a: agentInfo) {
                 if (!a.second.config.isNull())
-                    listeners.sendMessage(listener, "CONFIG", a.first,
-                                          a.second.config.toString());
+                    sendConfig(listener, a.first, a.second);
             }
         };
 
@@ -81,12 +81,18 @@ init()
 
     listeners.clientMessageHandler = [=] (const std::vector<std::string> & message)
         {
+            // A listener that missed a patch asks for the full config.
+            if (message.at(1) == "RESYNC") {
+                const std::string & agent = message.at(2);
+                auto it = agentInfo.find(agent);
+                if (it == agentInfo.end())
+                    listeners.sendMessage(message[0], "CONFIG", agent, "");
+                else sendConfig(message[0], agent, it->second);
+                return;
+            }
+
             cerr << "listeners got client message " << message << endl;
             throw ML::Exception("unexpected listener message");
-            //const std::string & agent = message.at(2);
-            //Json::Value j = Json::parse(message.at(3));
-
-            //handleAgentConfig(agent, j);
         };
 
     agents.clientMessageHandler = [=] (const std::vector<std::string> & message)
@@ -122,7 +128,7 @@ init()
                        {"GET"},
                        "List all agents that are configured",
                        "Array of names",
-                       [] (const std::vector<std::string> & v) { return jsonEncode(v); },
+                       [] (const std::vector<std::string> & v) { return Datacratic::jsonEncode(v); },
                        &AgentConfigurationService::handleGetAgentList,
                        this);
     
@@ -237,11 +243,37 @@ handleAgentConfig(const std::string & agent,
     if (info.config == config)
         return;
 
+    // Listeners that have the previous version only need the difference.
+    std::string patch;
+    if (!info.config.isNull())
+        patch = diffAgentConfig(info.config, config).toString();
+
     info.config = config;
+    info.configStr = config.toString();
+    uint64_t base = info.version++;
+
+    if (patch.empty() || patch.size() >= info.configStr.size()) {
+        for (auto & l: listenerInfo)
+            sendConfig(l.first, agent, info);
+        return;
+    }
 
-    // Broadcast the configuration to all listeners
-    for (auto & l: listenerInfo)
-        listeners.sendMessage(l.first, "CONFIG", agent, config.toString());
+    // Broadcast the change to all listeners
+    for (auto & l: listenerInfo) {
+        listeners.sendMessage(l.first, "CONFIGPATCH", agent,
+                              to_string(base), to_string(info.version),
+                              patch);
+    }
+}
+
+void
+AgentConfigurationService::
+sendConfig(const std::string & listener,
+           const std::string & agent,
+           const AgentInfo & info)
+{
+    listeners.sendMessage(listener, "CONFIG", agent, info.configStr,
+                          to_string(info.version));
 }
 
 void
@@ -104,11 +104,19 @@ struct AgentConfigurationService : public RestServiceEndpoint,
     std::unordered_map<std::string, ListenerInfo> listenerInfo;
 
     struct AgentInfo {
+        AgentInfo() : version(0) {}
+
         Json::Value config;
         std::string configStr;
         Date lastHeartbeat;
+        uint64_t version;   ///< Bumped on every change of config
     };
 
+    /** Sends the full configuration of the given agent to the listener. */
+    void sendConfig(const std::string & listener,
+                    const std::string & agent,
+                    const AgentInfo & info);
+
     std::unordered_map<std::string, AgentInfo> agentInfo;
 
     /* Reponds to Monitor requests */
@@ -8,24 +8,64 @@
 #include "blacklist.h"
 #include "agent_config.h"
 
+#include <city.h>
+#include <cmath>
+
 namespace RTBKIT {
 
+namespace {
+
+uint64_t agentKey(const std::string & agent)
+{
+    return Hash128to64(std::make_pair(std::hash<std::string>()(agent), 1));
+}
+
+uint64_t accountKey(const AccountKey & account)
+{
+    return Hash128to64(std::make_pair(
+                    std::hash<std::string>()(account.toString()), 2));
+}
+
+BlacklistInfo::Entry
+makeEntry(const BidRequest & bidRequest,
+          const std::string & agent,
+          const AgentConfig & config)
+{
+    BlacklistInfo::Entry entry;
+    entry.agent = agent;
+    entry.account = config.account;
+    entry.site = bidRequest.url.toString();
+    entry.expiry = Date::now().plusSeconds(config.blacklistTime);
+    entry.agentHash = agentKey(agent);
+    entry.accountHash = accountKey(config.account);
+    return entry;
+}
+
+} // namespace anonymous
+
+
+/*****************************************************************************/
+/* BLACKLIST INFO                                                            */
+/*****************************************************************************/
+
 Date
 BlacklistInfo::
 add(const BidRequest & bidRequest,
     const std::string & agent,
     const AgentConfig & config)
 {
-    Entry entry;
-    entry.agent = agent;
-    entry.account = config.account;
-    entry.site = bidRequest.url.toString();
-    entry.expiry = Date::now().plusSeconds(config.blacklistTime);
+    return add(makeEntry(bidRequest, agent, config));
+}
 
-    entries.push_back(entry);
+Date
+BlacklistInfo::
+add(Entry entry)
+{
+    entries.push_back(std::move(entry));
 
-    if (entries.size() == 1 || entry.expiry < earliestExpiry) {
-        earliestExpiry = entry.expiry;
+    const Date & expiry = entries.back().expiry;
+    if (entries.size() == 1 || expiry < earliestExpiry) {
+        earliestExpiry = expiry;
         return earliestExpiry;
     }
 
@@ -34,11 +74,12 @@ add(const BidRequest & bidRequest,
 
 Date
 BlacklistInfo::
-expire(Date now)
+expire(Date now, const std::function<void (const Entry &)> & onExpired)
 {
     Date result = Date();
     for (unsigned i = 0;  i < entries.size();  /* no inc */) {
         if (entries[i].expiry <= now) {
+            if (onExpired) onExpired(entries[i]);
             std::swap(entries[i], entries.back());
             entries.pop_back();
             // no increment
@@ -95,19 +136,234 @@ matches(const BidRequest & bidRequest,
     }
 }
 
+
+/*****************************************************************************/
+/* BLACKLIST FILTER                                                          */
+/*****************************************************************************/
+
+BlacklistFilter::
+BlacklistFilter(size_t counters, unsigned hashes) :
+    counters(counters), mask(counters - 1), hashes(hashes)
+{
+    if (!counters || (counters & (counters - 1)))
+        throw ML::Exception("blacklist filter size must be a power of 2");
+    if (!hashes)
+        throw ML::Exception("blacklist filter needs at least one hash");
+}
+
+uint64_t
+BlacklistFilter::
+key(const Id & user, uint64_t owner)
+{
+    return Hash128to64(std::make_pair(user.hash(), owner));
+}
+
+template<typename Fn>
+void
+BlacklistFilter::
+forEachCounter(uint64_t key, const Fn & fn) const
+{
+    // Double hashing: the i-th counter is h1 + i * h2.
+    uint64_t h1 = key;
+    uint64_t h2 = ((key >> 32) | (key << 32)) | 1;
+
+    for (unsigned i = 0; i < hashes; ++i)
+        fn((h1 + i * h2) & mask);
+}
+
 void
+BlacklistFilter::
+insert(uint64_t key)
+{
+    forEachCounter(key, [&] (uint64_t i) {
+                if (counters[i] != 0xFF) ++counters[i];
+            });
+}
+
+void
+BlacklistFilter::
+remove(uint64_t key)
+{
+    forEachCounter(key, [&] (uint64_t i) {
+                if (counters[i] != 0 && counters[i] != 0xFF) --counters[i];
+            });
+}
+
+bool
+BlacklistFilter::
+mayContain(uint64_t key) const
+{
+    bool result = true;
+    forEachCounter(key, [&] (uint64_t i) {
+                if (!counters[i]) result = false;
+            });
+    return result;
+}
+
+
+/*****************************************************************************/
+/* BLACKLIST                                                                 */
+/*****************************************************************************/
+
 Blacklist::
-doExpiries()
+Blacklist(size_t filterCounters, size_t wheelSlots) :
+    slots(1 << 10),
+    used(0),
+    filter(filterCounters),
+    wheel(wheelSlots),
+    currentTick(tickOf(Date::now()) - 1)
 {
-    Date start = Date::now();
+    if (wheelSlots < 2)
+        throw ML::Exception("blacklist expiry wheel needs at least 2 slots");
+}
 
-    auto onBlacklistFinished = [&] (const Id & userId,
-                                    BlacklistInfo & info)
-        {
-            return info.expire(start);
-        };
+uint64_t
+Blacklist::
+ownerHash(const std::string & agent, const AgentConfig & config)
+{
+    switch (config.blacklistScope) {
+    case BL_AGENT: return agentKey(agent);
+    case BL_ACCOUNT: return accountKey(config.account);
+    default:
+        throw ML::Exception("invalid blacklist scope");
+    }
+}
 
-    entries.expire(onBlacklistFinished, start);
+uint64_t
+Blacklist::
+tickOf(Date date) const
+{
+    return uint64_t(std::floor(date.secondsSinceEpoch()));
+}
+
+size_t
+Blacklist::
+findIndex(const Id & user) const
+{
+    size_t mask = slots.size() - 1;
+    size_t i = user.hash() & mask;
+
+    // Linear probing; the table is never more than half full.
+    while (slots[i].user && slots[i].user != user)
+        i = (i + 1) & mask;
+
+    return i;
+}
+
+const BlacklistInfo *
+Blacklist::
+find(const Id & user) const
+{
+    const Slot & slot = slots[findIndex(user)];
+    return slot.user ? &slot.info : nullptr;
+}
+
+BlacklistInfo &
+Blacklist::
+insert(const Id & user)
+{
+    if ((used + 1) * 2 > slots.size()) grow();
+
+    Slot & slot = slots[findIndex(user)];
+    if (!slot.user) {
+        slot.user = user;
+        slot.info = BlacklistInfo();
+        ++used;
+    }
+
+    return slot.info;
+}
+
+void
+Blacklist::
+grow()
+{
+    std::vector<Slot> old(slots.size() * 2);
+    slots.swap(old);
+
+    for (Slot & slot : old) {
+        if (!slot.user) continue;
+        slots[findIndex(slot.user)] = std::move(slot);
+    }
+}
+
+void
+Blacklist::
+erase(size_t index)
+{
+    size_t mask = slots.size() - 1;
+    size_t hole = index;
+
+    // Backward shift: move up the entries of the run that can't be found
+    // anymore once the hole is there.
+    for (size_t i = (hole + 1) & mask; slots[i].user; i = (i + 1) & mask) {
+        size_t home = slots[i].user.hash() & mask;
+
+        bool reachable = hole <= i
+            ? (hole < home && home <= i)
+            : (hole < home || home <= i);
+        if (reachable) continue;
+
+        slots[hole] = std::move(slots[i]);
+        hole = i;
+    }
+
+    slots[hole] = Slot();
+    --used;
+}
+
+void
+Blacklist::
+schedule(const Id & user, BlacklistInfo & info)
+{
+    if (info.entries.empty()) return;
+
+    uint64_t tick = uint64_t(std::ceil(info.earliestExpiry.secondsSinceEpoch()));
+    tick = std::max(tick, currentTick + 1);
+    tick = std::min(tick, currentTick + wheel.size());
+
+    // Already scheduled early enough; stale slots are skipped on expiry.
+    if (info.wheelTick && info.wheelTick <= tick) return;
+
+    info.wheelTick = tick;
+    wheel[tick % wheel.size()].push_back(Expiry{ user, tick });
+}
+
+void
+Blacklist::
+doExpiries(Date now)
+{
+    uint64_t nowTick = tickOf(now);
+    uint64_t last = std::min(nowTick, currentTick + wheel.size());
+
+    while (currentTick < last) {
+        ++currentTick;
+
+        std::vector<Expiry> expiring;
+        expiring.swap(wheel[currentTick % wheel.size()]);
+
+        for (const Expiry & expiry : expiring) {
+            size_t index = findIndex(expiry.user);
+            if (!slots[index].user) continue;
+
+            BlacklistInfo & info = slots[index].info;
+            if (info.wheelTick != expiry.tick) continue;
+            info.wheelTick = 0;
+
+            auto onExpired = [&] (const BlacklistInfo::Entry & entry)
+                {
+                    filter.remove(BlacklistFilter::key(expiry.user, entry.agentHash));
+                    filter.remove(BlacklistFilter::key(expiry.user, entry.accountHash));
+                };
+            info.earliestExpiry = info.expire(now, onExpired);
+
+            if (info.entries.empty()) erase(index);
+            else schedule(expiry.user, info);
+        }
+    }
+
+    // Fell behind by more than a turn of the wheel; all of it was expired.
+    currentTick = std::max(currentTick, nowTick);
 }
 
 bool
@@ -115,29 +371,20 @@ Blacklist::
 matches(const BidRequest & bidRequest, const std::string & agentName,
         const AgentConfig & config) const
 {  
-    bool blocked = false;
-    const Id & exchangeId = bidRequest.userIds.exchangeId;
-    if (!blocked && exchangeId) {
-        // TODO: read lock
-        auto bit = entries.find(exchangeId);
-        if (bit != entries.end()) {
-            const BlacklistInfo & binfo = bit->second;
-            if (binfo.matches(bidRequest, agentName, config))
-                blocked = true;
-        }
-    }
-    const Id & providerId = bidRequest.userIds.providerId;
-    if (!blocked && providerId) {
-        // TODO: read lock
-        auto bit = entries.find(providerId);
-        if (bit != entries.end()) {
-            const BlacklistInfo & binfo = bit->second;
-            if (binfo.matches(bidRequest, agentName, config))
-                blocked = true;
-        }
-    }
+    uint64_t owner = ownerHash(agentName, config);
+
+    auto matchesUser = [&] (const Id & user)
+        {
+            if (!user) return false;
+            if (!filter.mayContain(BlacklistFilter::key(user, owner)))
+                return false;
+
+            const BlacklistInfo * info = find(user);
+            return info && info->matches(bidRequest, agentName, config);
+        };
 
-    return blocked;
+    return matchesUser(bidRequest.userIds.exchangeId)
+        || matchesUser(bidRequest.userIds.providerId);
 }
 
 void
@@ -145,26 +392,34 @@ Blacklist::
 add(const BidRequest & bidRequest, const std::string & agent,
     const AgentConfig & agentConfig)
 {
+    auto entry = makeEntry(bidRequest, agent, agentConfig);
+
     auto addToBlacklist = [&] (const Id & id)
         {
             if (!id) return;
-
-            auto it = this->entries.find(id);
-            if (it != this->entries.end()) {
-                Date newExpiry
-                    = it->second.add(bidRequest, agent, agentConfig);
-                if (newExpiry != Date())
-                    this->entries.updateTimeout(it, newExpiry);
-            }
-            else {
-                BlacklistInfo binfo;
-                Date timeout = binfo.add(bidRequest, agent, agentConfig);
-                this->entries.insert(id, binfo, timeout);
-            }
+            add(id, entry);
+            if (onAdd) onAdd(id, entry);
         };
     
     addToBlacklist(bidRequest.userIds.exchangeId);
     addToBlacklist(bidRequest.userIds.providerId);
 }
 
+void
+Blacklist::
+add(const Id & user, BlacklistInfo::Entry entry)
+{
+    if (!user) return;
+
+    entry.agentHash = agentKey(entry.agent);
+    entry.accountHash = accountKey(entry.account);
+
+    filter.insert(BlacklistFilter::key(user, entry.agentHash));
+    filter.insert(BlacklistFilter::key(user, entry.accountHash));
+
+    BlacklistInfo & info = insert(user);
+    info.add(std::move(entry));
+    schedule(user, info);
+}
+
 } // namespace RTBKIT
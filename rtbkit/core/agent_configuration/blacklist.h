@@ -12,7 +12,7 @@
 #include <vector>
 #include "rtbkit/common/bid_request.h"
 #include "rtbkit/core/router/router_types.h"
-#include "soa/service/timeout_map.h"
+#include <functional>
 
 
 namespace RTBKIT {
@@ -28,15 +28,25 @@ struct AgentConfig;
     for how much time.
 */
 struct BlacklistInfo {
+    BlacklistInfo() : wheelTick(0) {}
+
     struct Entry {
+        Entry() : agentHash(0), accountHash(0) {}
+
         std::string agent;
         AccountKey account;
         std::string site;
         Date expiry;
+
+        uint64_t agentHash;    ///< Key of the agent in the filter
+        uint64_t accountHash;  ///< Key of the account in the filter
     };
     std::vector<Entry> entries;
     Date earliestExpiry;
 
+    /// Tick of the expiry wheel the user is scheduled on or 0 if none.
+    uint64_t wheelTick;
+
     /* Does the given agent and bid request match the blacklist? */
     bool matches(const BidRequest & request,
                  const std::string & agent,
@@ -49,11 +59,46 @@ struct BlacklistInfo {
     Date add(const BidRequest & bidRequest,
              const std::string & agent,
              const AgentConfig & agentConfig);
+
+    /** Same as above with an entry that was already built. */
+    Date add(Entry entry);
         
     /* Expire any that need to be expired, and return the next lowest
-       expiry date or an empty date if none.
+       expiry date or an empty date if none. Expired entries are passed to
+       onExpired if given.
     */
-    Date expire(Date now);
+    Date expire(Date now,
+                const std::function<void (const Entry &)> & onExpired = nullptr);
+};
+
+
+/*****************************************************************************/
+/* BLACKLIST FILTER                                                          */
+/*****************************************************************************/
+
+/** Counting bloom filter of the (user, agent) and (user, account) pairs
+    that are blacklisted. Lets most lookups skip the user table entirely
+    since most users aren't blacklisted by anyone.
+
+    Counters that saturate are never decremented which only costs a few
+    false positives.
+*/
+struct BlacklistFilter {
+    BlacklistFilter(size_t counters = 1 << 22, unsigned hashes = 3);
+
+    void insert(uint64_t key);
+    void remove(uint64_t key);
+    bool mayContain(uint64_t key) const;
+
+    static uint64_t key(const Id & user, uint64_t owner);
+
+private:
+    template<typename Fn>
+    void forEachCounter(uint64_t key, const Fn & fn) const;
+
+    std::vector<uint8_t> counters;
+    uint64_t mask;
+    unsigned hashes;
 };
 
 
@@ -61,11 +106,19 @@ struct BlacklistInfo {
 /* BLACKLIST                                                                 */
 /*****************************************************************************/
 
-/** Indexed on user ID */
+/** Indexed on user ID.
+
+    Users live in an open addressing table and their expiries on a timing
+    wheel with one slot per second. Expiries further away than the wheel
+    goes are parked in its last slot and rescheduled when it comes around
+    so both adding and expiring a user is O(1).
+*/
 struct Blacklist {
-    void doExpiries();
+    Blacklist(size_t filterCounters = 1 << 22, size_t wheelSlots = 1 << 12);
+
+    void doExpiries(Date now = Date::now());
 
-    size_t size() const { return entries.size(); }
+    size_t size() const { return used; }
     
     bool matches(const BidRequest & request,
                  const std::string & agentName,
@@ -74,9 +127,48 @@ struct Blacklist {
     void add(const BidRequest & bidRequest,
              const std::string & agent,
              const AgentConfig & agentConfig);
-    
-    typedef TimeoutMap<Id, BlacklistInfo> Entries;
-    Entries entries;
+
+    /** Adds an entry that was blacklisted elsewhere, eg. by another router
+        that onAdd forwarded it from.
+    */
+    void add(const Id & user, BlacklistInfo::Entry entry);
+
+    /** Called for every entry added by add() so that it can be shared. */
+    std::function<void (const Id & user, const BlacklistInfo::Entry &)> onAdd;
+
+    /** Hash of the agent or account under which the config looks up its
+        blacklist entries.
+    */
+    static uint64_t ownerHash(const std::string & agent,
+                              const AgentConfig & config);
+
+private:
+
+    struct Slot {
+        Id user;
+        BlacklistInfo info;
+    };
+
+    const BlacklistInfo * find(const Id & user) const;
+    BlacklistInfo & insert(const Id & user);
+    void erase(size_t index);
+    void grow();
+
+    size_t findIndex(const Id & user) const;
+    void schedule(const Id & user, BlacklistInfo & info);
+    uint64_t tickOf(Date date) const;
+
+    std::vector<Slot> slots;
+    size_t used;
+
+    BlacklistFilter filter;
+
+    struct Expiry {
+        Id user;
+        uint64_t tick;
+    };
+    std::vector< std::vector<Expiry> > wheel;
+    uint64_t currentTick;
 };
 
 } // namespace RTBKIT
@@ -113,6 +113,55 @@ struct EventMatcher : public EventRecorder
 
     virtual void initStatePersistence(const std::string & path) {}
 
+    /** Moves finished auctions older than spillAge seconds out of memory
+        and into an on-disk store under path.  Not all matchers spill.
+    */
+    virtual void initFinishedSpill(double spillAge, const std::string & path) {}
+
+
+    /************************************************************************/
+    /* HAND OFF                                                             */
+    /************************************************************************/
+
+    /** Piece of state moved from one matcher to another, usually in another
+        process, when the auctions it belongs to change owner.  The key and
+        value are opaque to everyone but the matcher.
+    */
+    struct HandOff
+    {
+        enum Kind {
+            SUBMITTED,  ///< Auction waiting for its win or loss
+            FINISHED,   ///< Auction waiting for its campaign events
+            EVENT       ///< Early event still waiting for its auction
+        };
+
+        HandOff() : kind(SUBMITTED) {}
+
+        Kind kind;
+        Id auctionId;
+        std::string key;
+        std::string value;
+        Amount amount;  ///< Detached from the banker for SUBMITTED entries
+    };
+
+    typedef std::function<bool (const Id & auctionId)> IsOwned;
+    typedef std::function<void (HandOff && entry)> OnHandOff;
+
+    /** Removes everything that belongs to auctions that aren't owned anymore
+        and passes it on to onHandOff, which can be called from other
+        threads.  Not all matchers can hand off their state.
+    */
+    virtual void handOff(const IsOwned & isOwned, const OnHandOff & onHandOff)
+    {
+        throw ML::Exception("matcher can't hand off its state");
+    }
+
+    /** Takes over an entry handed off by another matcher. */
+    virtual void takeOver(HandOff && entry)
+    {
+        throw ML::Exception("matcher can't take over state");
+    }
+
 
 protected:
 
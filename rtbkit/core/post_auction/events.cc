@@ -45,7 +45,7 @@ initFinishedInfo(const FinishedInfo& info)
     response = info.bid;
     requestStr = info.bidRequestStr;
     requestStrFormat = info.bidRequestStrFormat;
-    request = info.bidRequest;
+    spotIndex = info.spotIndex;
     meta = info.winMeta;
     augmentations = info.augmentations;
 }
@@ -123,7 +123,7 @@ size_t
 MatchedWinLoss::
 impIndex() const
 {
-    return request->findAdSpotIndex(impId);
+    return spotIndex;
 }
 
 
@@ -183,8 +183,8 @@ MatchedCampaignEvent(std::string label, const FinishedInfo& info) :
     impId(info.adSpotId),
     account(info.bid.account),
     requestStr(info.bidRequestStr),
-    request(info.bidRequest),
     requestStrFormat(info.bidRequestStrFormat),
+    spotIndex(info.spotIndex),
     bid(info.bidToJson()),
     win(info.winToJson()),
     campaignEvents(info.campaignEvents.toJson()),
@@ -204,7 +204,7 @@ size_t
 MatchedCampaignEvent::
 impIndex() const
 {
-    return request->findAdSpotIndex(impId);
+    return spotIndex;
 }
 
 void
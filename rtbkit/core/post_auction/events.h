@@ -53,7 +53,7 @@ struct MatchedWinLoss
 
     Datacratic::UnicodeString requestStr;
     std::string requestStrFormat;
-    std::shared_ptr<BidRequest> request;
+    int spotIndex;
 
     UserIds uids;
     std::string meta;
@@ -102,8 +102,8 @@ struct MatchedCampaignEvent
     Datacratic::Date timestamp;
 
     Datacratic::UnicodeString requestStr;
-    std::shared_ptr<BidRequest> request;
     std::string requestStrFormat;
+    int spotIndex;
 
     Json::Value bid;
     Json::Value win;
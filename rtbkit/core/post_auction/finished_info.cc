@@ -106,9 +106,9 @@ serializeToString() const
 {
     ostringstream stream;
     ML::DB::Store_Writer writer(stream);
-    int version = 6;
+    int version = 7;
     writer << version
-           << auctionTime << auctionId << adSpotId
+           << auctionTime << auctionId << adSpotId << spotIndex
            << bidRequestStr << bidTime <<bidRequestStrFormat;
     bid.serialize(writer);
     writer << winTime
@@ -129,15 +129,15 @@ reconstituteFromString(const std::string & str)
     ML::DB::Store_Reader store(stream);
     int version, istatus;
     store >> version;
-    if (version > 6)
+    if (version > 7)
         throw ML::Exception("bad version %d", version);
     if (version < 6)
         throw ML::Exception("version %d no longer supported", version);
 
-    string auctionIdStr, adSpotIdStr;
-
-    store >> auctionTime >> auctionId >> adSpotId
-          >> bidRequestStr >> bidTime;
+    store >> auctionTime >> auctionId >> adSpotId;
+    if (version > 6)
+        store >> spotIndex;
+    store >> bidRequestStr >> bidTime >> bidRequestStrFormat;
     bid.reconstitute(store);
 
     store >> winTime >> istatus >> winPrice >> winMeta;
@@ -157,7 +157,12 @@ reconstituteFromString(const std::string & str)
 
     reportedStatus = (BidStatus)istatus;
 
-    bidRequest.reset(BidRequest::parse(bidRequestStrFormat, bidRequestStr));
+    // Older versions didn't keep the index, so it needs the request.
+    if (version == 6) {
+        std::unique_ptr<BidRequest> request
+            (BidRequest::parse(bidRequestStrFormat, bidRequestStr));
+        spotIndex = request->findAdSpotIndex(adSpotId);
+    }
 }
 
 
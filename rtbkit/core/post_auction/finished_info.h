@@ -24,19 +24,22 @@ namespace RTBKIT {
     (either won or lost).  We keep this around for an hour waiting for
     impressions, clicks or conversions; this structure contains the
     information necessary to join them up.
+
+    Since there are a lot of them, only what's needed to match the events
+    and notify the agents is kept: the bid request is kept as the string it
+    came in, and not parsed.
 */
 
 struct FinishedInfo {
     FinishedInfo()
-        : fromOldRouter(false)
+        : spotIndex(-1), fromOldRouter(false)
     {
     }
 
     Date auctionTime;            ///< Time at which the auction started
     Id auctionId;       ///< Auction ID from host
     Id adSpotId;          ///< Spot ID from host
-    int spotIndex;
-    std::shared_ptr<BidRequest> bidRequest;  ///< What we bid on
+    int spotIndex;               ///< Index of adSpotId in the bid request
     Datacratic::UnicodeString bidRequestStr;
     std::string bidRequestStrFormat;
     JsonHolder augmentations;
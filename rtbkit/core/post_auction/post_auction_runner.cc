@@ -7,6 +7,7 @@
 #include "post_auction_runner.h"
 #include "post_auction_service.h"
 #include "rtbkit/core/banker/slave_banker.h"
+#include "rtbkit/common/auction_tracer.h"
 #include "soa/service/service_utils.h"
 #include "soa/service/process_stats.h"
 #include "soa/utils/print_utils.h"
@@ -33,12 +34,16 @@ static Json::Value loadJsonFromFile(const std::string & filename)
 PostAuctionRunner::
 PostAuctionRunner() :
     shard(0),
+    matcherShards(1),
     auctionTimeout(EventMatcher::DefaultAuctionTimeout),
     winTimeout(EventMatcher::DefaultWinTimeout),
     bidderConfigurationFile("rtbkit/examples/bidder-config.json"),
     winLossPipeTimeout(PostAuctionService::DefaultWinLossPipeTimeout),
     campaignEventPipeTimeout(PostAuctionService::DefaultCampaignEventPipeTimeout),
-    useHttpBanker(false)
+    useHttpBanker(false),
+    spillSeconds(0.0),
+    traceRate(0.001),
+    traceRingSize(1 << 14)
 {
 }
 
@@ -57,6 +62,10 @@ doOptions(int argc, char ** argv,
          "Communicate with the MasterBanker over http")
         ("shard,s", value<size_t>(&shard),
          "Shard index starting at 0 for this post auction loop")
+        ("matcher-shards", value<size_t>(&matcherShards),
+         "Number of threads to split the event matching over")
+        ("matcher-cpus", value<vector<int> >(&matcherCpus)->multitoken(),
+         "Cpus to pin the event matching threads to")
         ("win-seconds", value<float>(&winTimeout),
          "Timeout for storing win auction")
         ("auction-seconds", value<float>(&auctionTimeout),
@@ -64,7 +73,19 @@ doOptions(int argc, char ** argv,
         ("winlossPipe-seconds", value<int>(&winLossPipeTimeout),
          "Timeout before sending error on WinLoss pipe")
         ("campaignEventPipe-seconds", value<int>(&campaignEventPipeTimeout),
-         "Timeout before sending error on CampaignEvent pipe");
+         "Timeout before sending error on CampaignEvent pipe")
+        ("state-path", value<string>(&statePath),
+         "Directory where pending auctions are kept across restarts")
+        ("spill-seconds", value<double>(&spillSeconds),
+         "Age after which finished auctions are moved from memory to disk")
+        ("spill-path", value<string>(&spillPath),
+         "Directory for finished auctions moved to disk without --state-path")
+        ("trace-file", value<string>(&traceFile),
+         "File to export per-auction traces to (chrome trace format)")
+        ("trace-rate", value<double>(&traceRate),
+         "Ratio of the auctions that are traced; matches the router's sampling")
+        ("trace-ring-size", value<size_t>(&traceRingSize),
+         "Spans kept per thread until they're exported (default 16384)");
 
     options_description all_opt = opts;
     all_opt
@@ -94,17 +115,26 @@ init()
     auto proxies = serviceArgs.makeServiceProxies();
     auto serviceName = serviceArgs.serviceName("PostAuctionLoop");
 
+    if (!traceFile.empty())
+        AuctionTracer::instance().init(
+                traceFile, traceRate, vector<string>(), traceRingSize);
+
     auto bidderConfig = loadJsonFromFile(bidderConfigurationFile);
 
     postAuctionLoop = std::make_shared<PostAuctionService>(proxies, serviceName);
     postAuctionLoop->initBidderInterface(bidderConfig);
-    postAuctionLoop->init(shard);
+    postAuctionLoop->init(shard, matcherShards, matcherCpus);
 
     postAuctionLoop->setWinTimeout(winTimeout);
     postAuctionLoop->setAuctionTimeout(auctionTimeout);
     postAuctionLoop->setWinLossPipeTimeout(winLossPipeTimeout);
     postAuctionLoop->setCampaignEventPipeTimeout(campaignEventPipeTimeout);
 
+    if (!statePath.empty())
+        postAuctionLoop->initStatePersistence(statePath);
+    if (spillSeconds > 0.0)
+        postAuctionLoop->initFinishedSpill(spillSeconds, spillPath);
+
     LOG(PostAuctionService::print) << "win timeout is " << winTimeout << std::endl;
     LOG(PostAuctionService::print) << "auction timeout is " << auctionTimeout << std::endl;
     LOG(PostAuctionService::print) << "winLoss pipe timeout is " << winLossPipeTimeout << std::endl;
@@ -144,6 +174,7 @@ shutdown()
 {
     postAuctionLoop->shutdown();
     banker->shutdown();
+    AuctionTracer::instance().shutdown();
 }
 
 
@@ -27,6 +27,8 @@ struct PostAuctionRunner {
     ServiceProxyArguments serviceArgs;
 
     size_t shard;
+    size_t matcherShards;
+    std::vector<int> matcherCpus;
     float auctionTimeout;
     float winTimeout;
     std::string bidderConfigurationFile;
@@ -34,6 +36,12 @@ struct PostAuctionRunner {
     int winLossPipeTimeout;
     int campaignEventPipeTimeout;
     bool useHttpBanker;
+    std::string statePath;
+    double spillSeconds;
+    std::string spillPath;
+    std::string traceFile;
+    double traceRate;
+    size_t traceRingSize;
 
     void doOptions(int argc, char ** argv,
                    const boost::program_options::options_description & opts
@@ -10,6 +10,7 @@
 #include "simple_event_matcher.h"
 #include "sharded_event_matcher.h"
 #include "rtbkit/common/messages.h"
+#include "rtbkit/common/auction_tracer.h"
 
 using namespace std;
 using namespace Datacratic;
@@ -47,7 +48,10 @@ PostAuctionService(
       logger(getZmqContext()),
       endpoint(getZmqContext()),
       bridge(getZmqContext()),
-      router(!!getZmqContext())
+      router(!!getZmqContext()),
+
+      ringChanges(1 << 4),
+      handOffPending(false)
 {
     monitorProviderClient.addProvider(this);
 }
@@ -69,7 +73,10 @@ PostAuctionService(ServiceBase & parent, const std::string & serviceName)
       logger(getZmqContext()),
       endpoint(getZmqContext()),
       bridge(getZmqContext()),
-      router(!!getZmqContext())
+      router(!!getZmqContext()),
+
+      ringChanges(1 << 4),
+      handOffPending(false)
 {
     monitorProviderClient.addProvider(this);
 }
@@ -86,7 +93,8 @@ bindTcp()
 
 void
 PostAuctionService::
-init(size_t externalShard, size_t internalShards)
+init(size_t externalShard, size_t internalShards,
+     const std::vector<int> & shardCpus)
 {
     // Loop monitor is purely for monitoring purposes. There's no message we can
     // just drop in the PAL to alleviate the load.
@@ -99,7 +107,7 @@ init(size_t externalShard, size_t internalShards)
         initBidderInterface(json);
     }
 
-    initMatcher(internalShards);
+    initMatcher(internalShards, shardCpus);
     initConnections(externalShard);
     monitorProviderClient.init(getServices()->config);
 }
@@ -114,7 +122,7 @@ initBidderInterface(Json::Value const & json)
 
 void
 PostAuctionService::
-initMatcher(size_t shards)
+initMatcher(size_t shards, const std::vector<int> & cpus)
 {
     if (shards <= 1) {
         LOG(print) << "Creating SimpleEventMatcher" << endl;
@@ -127,7 +135,7 @@ initMatcher(size_t shards)
 
         ShardedEventMatcher* m;
         matcher.reset(m = new ShardedEventMatcher(serviceName(), getServices()));
-        m->init(shards);
+        m->init(shards, cpus);
         loop.addSource("PostAuctionService::matcher", *m);
     }
 
@@ -157,7 +165,10 @@ initConnections(size_t shard)
     using std::placeholders::_1;
     using std::placeholders::_2;
 
-    registerShardedServiceProvider(serviceName(), { "rtbPostAuctionService" }, shard);
+    bool useRing = getServices()->params.get("postAuctionRing", false).asBool();
+    if (useRing)
+        registerServiceProvider(serviceName(), { "rtbPostAuctionService" });
+    else registerShardedServiceProvider(serviceName(), { "rtbPostAuctionService" }, shard);
 
     LOG(print) << "post auction logger on " << serviceName() + "/logger" << endl;
     logger.init(getServices()->config, serviceName() + "/logger");
@@ -176,6 +187,8 @@ initConnections(size_t shard)
     router.bind("WIN", std::bind(&PostAuctionService::doWinMessage, this, _1));
     router.bind("LOSS", std::bind(&PostAuctionService::doLossMessage, this,_1));
     router.bind("EVENT", std::bind(&PostAuctionService::doCampaignEventMessage, this, _1));
+    router.bind("FORWARDED", std::bind(&PostAuctionService::doForwardedMessage, this, _1));
+    router.bind("HANDOFF", std::bind(&PostAuctionService::doHandOffMessage, this, _1));
     router.defaultHandler = [=](const std::vector<std::string> & message) {
         LOG(error) << "unroutable message: " << message[0] << std::endl;
     };
@@ -202,6 +215,44 @@ initConnections(size_t shard)
     loop.addPeriodic("PostAuctionService::checkExpiredAuctions", 0.1,
             std::bind(&EventMatcher::checkExpiredAuctions, matcher.get()));
 
+    // Spans lost because the rings were too small for the export period.
+    loop.addPeriodic("PostAuctionService::recordTracerStats", 10.0,
+            [=] (uint64_t) {
+                if (AuctionTracer::instance().enabled())
+                    recordLevel(AuctionTracer::instance().dropped, "tracer.dropped");
+            });
+
+    if (useRing) initRing();
+}
+
+void
+PostAuctionService::
+initRing()
+{
+    using std::placeholders::_1;
+
+    peers.reset(new PostAuctionProxy(getServices()));
+
+    // Called from the configuration service's thread.
+    peers->onRingChange = [=] (const ConsistentHashRing & newRing) {
+        ringChanges.push(std::make_shared<const ConsistentHashRing>(newRing));
+    };
+
+    ringChanges.onEvent = std::bind(&PostAuctionService::doRingChange, this, _1);
+    loop.addSource("PostAuctionService::ringChanges", ringChanges);
+
+    loop.addPeriodic("PostAuctionService::checkHandOff", 1.0,
+            [=] (uint64_t) { checkHandOff(); });
+
+    peers->init();
+
+    // Joining the ring is what makes the others hand off our share to us.
+    Json::Value json;
+    json["serviceName"] = serviceName();
+    getServices()->config->setUnique(
+            PostAuctionProxy::RingPath + "/" + serviceName(), json);
+
+    LOG(print) << "joined the post auction ring as " << serviceName() << endl;
 }
 
 void
@@ -254,6 +305,7 @@ doAuctionMessage(const std::vector<std::string> & message)
     recordHit("messages.AUCTION");
     auto event = std::make_shared<SubmittedAuctionEvent>(
             ML::DB::reconstituteFromString<SubmittedAuctionEvent>(message.at(2)));
+    if (forwardToOwner(event->auctionId, message)) return;
     doAuction(std::move(event));
 }
 
@@ -264,6 +316,7 @@ doWinMessage(const std::vector<std::string> & message)
     recordHit("messages.WIN");
     auto event = std::make_shared<PostAuctionEvent>(
             ML::DB::reconstituteFromString<PostAuctionEvent>(message.at(2)));
+    if (forwardToOwner(event->auctionId, message)) return;
     doEvent(event);
 }
 
@@ -274,6 +327,7 @@ doLossMessage(const std::vector<std::string> & message)
     recordHit("messages.LOSS");
     auto event = std::make_shared<PostAuctionEvent>(
             ML::DB::reconstituteFromString<PostAuctionEvent>(message.at(2)));
+    if (forwardToOwner(event->auctionId, message)) return;
     doEvent(event);
 }
 
@@ -284,10 +338,138 @@ doCampaignEventMessage(const std::vector<std::string> & message)
     auto event = std::make_shared<PostAuctionEvent>(
             ML::DB::reconstituteFromString<PostAuctionEvent>(message.at(2)));
     recordHit("messages.EVENT." + event->label);
+    if (forwardToOwner(event->auctionId, message)) return;
     doEvent(event);
 }
 
 
+/******************************************************************************/
+/* HASH RING                                                                  */
+/******************************************************************************/
+
+/* Until everyone sees the same ring, messages can reach a service that isn't
+   the owner of their auction anymore; those are forwarded once to the owner.
+   Forwarded messages are never forwarded again so two services that briefly
+   disagree on the ring can't bounce a message back and forth.
+
+   When the ring changes, each service hands off what it has for the auctions
+   it doesn't own anymore: [ "HANDOFF", kind, auction id, key, value,
+   amount ], where amount is what was detached from the banker for the bid
+   of a submitted auction.
+*/
+
+bool
+PostAuctionService::
+forwardToOwner(const Id & auctionId, const std::vector<std::string> & message)
+{
+    if (!ring || !ring->has(serviceName())) return false;
+
+    const std::string & owner = ring->find(auctionId.hash());
+    if (owner == serviceName()) return false;
+
+    recordHit("ring.forwarded");
+    if (!peers->sendToNode(owner, "FORWARDED", { message.at(1), message.at(2) }))
+        recordHit("ring.forwardDropped");
+
+    return true;
+}
+
+void
+PostAuctionService::
+doForwardedMessage(const std::vector<std::string> & message)
+{
+    const std::string & topic = message.at(2);
+    recordHit("ring.received.%s", topic);
+
+    if (topic == "AUCTION") {
+        doAuction(std::make_shared<SubmittedAuctionEvent>(
+                        ML::DB::reconstituteFromString<SubmittedAuctionEvent>(
+                                message.at(3))));
+    }
+    else {
+        doEvent(std::make_shared<PostAuctionEvent>(
+                        ML::DB::reconstituteFromString<PostAuctionEvent>(
+                                message.at(3))));
+    }
+}
+
+void
+PostAuctionService::
+doHandOffMessage(const std::vector<std::string> & message)
+{
+    EventMatcher::HandOff entry;
+    entry.kind = static_cast<EventMatcher::HandOff::Kind>(std::stoi(message.at(2)));
+    entry.auctionId = Id(message.at(3));
+    entry.key = message.at(4);
+    entry.value = message.at(5);
+    entry.amount = Amount::fromJson(Json::parse(message.at(6)));
+
+    try {
+        matcher->takeOver(std::move(entry));
+    } catch (const std::exception & exc) {
+        LOG(error) << "error taking over auction " << message.at(3)
+            << ": " << exc.what() << endl;
+        recordHit("ring.takeOverError");
+    }
+}
+
+void
+PostAuctionService::
+doRingChange(std::shared_ptr<const ConsistentHashRing> newRing)
+{
+    ring = std::move(newRing);
+
+    LOG(print) << "post auction ring has " << ring->size() << " services, "
+        << (ring->share(serviceName()) * 100.0) << "% of it is ours" << endl;
+    recordLevel(ring->size(), "ring.size");
+
+    // Until we're on the ring nothing is ours to give away.
+    handOffPending = ring->has(serviceName());
+    checkHandOff();
+}
+
+void
+PostAuctionService::
+checkHandOff()
+{
+    if (!handOffPending) return;
+
+    // Whatever we'd send to a service we're not connected to yet would be
+    // dropped so we hold on to it until then.
+    if (!peers->isConnected()) {
+        recordHit("ring.handOffWaiting");
+        return;
+    }
+
+    handOffPending = false;
+
+    auto current = ring;
+    auto self = serviceName();
+    PostAuctionProxy * peers = this->peers.get();
+
+    auto isOwned = [=] (const Id & auctionId) {
+        return current->find(auctionId.hash()) == self;
+    };
+
+    auto onHandOff = [=] (EventMatcher::HandOff && entry) {
+        const std::string & owner = current->find(entry.auctionId.hash());
+
+        std::vector<std::string> parts = {
+            std::to_string(entry.kind),
+            entry.auctionId.toString(),
+            std::move(entry.key),
+            std::move(entry.value),
+            entry.amount.toJson().toStringNoNewLine()
+        };
+
+        if (!peers->sendToNode(owner, "HANDOFF", parts))
+            recordHit("ring.handOffDropped");
+    };
+
+    matcher->handOff(isOwned, onHandOff);
+}
+
+
 void
 PostAuctionService::
 injectSubmittedAuction(
@@ -12,6 +12,7 @@
 #include "rtbkit/core/monitor/monitor_provider.h"
 #include "rtbkit/core/agent_configuration/agent_configuration_listener.h"
 #include "rtbkit/common/bidder_interface.h"
+#include "rtbkit/common/post_auction_proxy.h"
 #include "soa/service/logs.h"
 #include "soa/service/service_base.h"
 #include "soa/service/loop_monitor.h"
@@ -45,7 +46,11 @@ struct PostAuctionService : public ServiceBase, public MonitorProvider
 
 
     void initBidderInterface(Json::Value const & json);
-    void init(size_t externalShard = 0, size_t internalShards = 1);
+    /** More than one internal shard splits the matching over that many
+        threads, each pinned to one of shardCpus if it's not empty.
+    */
+    void init(size_t externalShard = 0, size_t internalShards = 1,
+              const std::vector<int> & shardCpus = std::vector<int>());
     void start(std::function<void ()> onStop = std::function<void ()>());
     void shutdown();
 
@@ -198,10 +203,24 @@ struct PostAuctionService : public ServiceBase, public MonitorProvider
     /* PERSISTENCE                                                          */
     /************************************************************************/
 
+    /** Keeps the pending auctions of the matcher on disk under path so
+        that they survive a restart.  Must be called after init() and
+        before start().
+    */
     void initStatePersistence(const std::string & path)
     {
-        throw ML::Exception(
-                "post auction service persistence is not yet implemented.");
+        ExcCheck(matcher, "initStatePersistence called before init");
+        matcher->initStatePersistence(path);
+    }
+
+    /** Keeps only the recent finished auctions in memory; see
+        SimpleEventMatcher::initFinishedSpill().  Must be called after
+        init() and initStatePersistence().
+    */
+    void initFinishedSpill(double spillAge, const std::string & path)
+    {
+        ExcCheck(matcher, "initFinishedSpill called before init");
+        matcher->initFinishedSpill(spillAge, path);
     }
 
 
@@ -244,7 +263,12 @@ private:
         event loop.
     */
     void initConnections(size_t shard);
-    void initMatcher(size_t shards);
+    void initMatcher(size_t shards, const std::vector<int> & cpus);
+
+    /** With the postAuctionRing parameter, joins the consistent hash ring of
+        post auction services instead of serving a fixed shard.
+    */
+    void initRing();
 
     void doAuction(std::shared_ptr< SubmittedAuctionEvent> event);
     void doEvent(std::shared_ptr<PostAuctionEvent> event);
@@ -263,6 +287,27 @@ private:
      * in. */
     void doCampaignEventMessage(const std::vector<std::string> & message);
 
+    /** Decode and handle a message that another service on the ring got
+        for one of our auctions.
+    */
+    void doForwardedMessage(const std::vector<std::string> & message);
+
+    /** Decode and take over an entry handed off by another service. */
+    void doHandOffMessage(const std::vector<std::string> & message);
+
+    /** Sends the message on to the owner of the auction if it's not us.
+        Returns true if it was forwarded.
+    */
+    bool forwardToOwner(const Id & auctionId,
+                        const std::vector<std::string> & message);
+
+    void doRingChange(std::shared_ptr<const ConsistentHashRing> newRing);
+
+    /** Hands off the auctions we lost in the last ring change once we're
+        connected to everyone on the ring.
+    */
+    void checkHandOff();
+
     void doConfigChange(
             const std::string & agent,
             std::shared_ptr<const AgentConfig> config);
@@ -302,6 +347,12 @@ private:
 
     ZmqMessageRouter router;
 
+    /** Connections to the other services on the ring and our view of it. */
+    std::unique_ptr<PostAuctionProxy> peers;
+    std::shared_ptr<const ConsistentHashRing> ring;
+    TypedMessageSink<std::shared_ptr<const ConsistentHashRing> > ringChanges;
+    bool handOffPending;
+
 };
 
 } // namespace RTBKIT
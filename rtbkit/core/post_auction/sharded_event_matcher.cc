@@ -10,6 +10,11 @@
  */
 
 #include "sharded_event_matcher.h"
+#include "jml/arch/exception.h"
+#include "jml/arch/format.h"
+
+#include <sched.h>
+#include <errno.h>
 
 using namespace std;
 using namespace ML;
@@ -26,46 +31,77 @@ Logging::Category ShardedEventMatcher::error("ShardedEventMatcher Error", Sharde
 Logging::Category ShardedEventMatcher::trace("ShardedEventMatcher Trace", ShardedEventMatcher::print);
 
 
+namespace {
+
+/** Threads inherit the affinity of the thread that creates them so we pin
+    ourselves while the thread is created and then go back to what we had.
+*/
+template<typename Fn>
+void startPinned(int cpu, const Fn & startThread)
+{
+    if (cpu < 0) {
+        startThread();
+        return;
+    }
+
+    cpu_set_t old;
+    if (sched_getaffinity(0, sizeof(old), &old) == -1)
+        throw ML::Exception(errno, "sched_getaffinity");
+
+    cpu_set_t pinned;
+    CPU_ZERO(&pinned);
+    CPU_SET(cpu, &pinned);
+    if (sched_setaffinity(0, sizeof(pinned), &pinned) == -1)
+        throw ML::Exception(errno, ML::format("sched_setaffinity to cpu %d", cpu));
+
+    try {
+        startThread();
+    } catch (...) {
+        sched_setaffinity(0, sizeof(old), &old);
+        throw;
+    }
+
+    sched_setaffinity(0, sizeof(old), &old);
+}
+
+} // file scope
+
+
 ShardedEventMatcher::
 ShardedEventMatcher(std::string prefix, std::shared_ptr<EventService> events) :
     EventMatcher(std::move(prefix), std::move(events)),
-    matchedWinLossEvents(1 << 10),
-    matchedCampaignEvents(1 << 8),
-    unmatchedEvents(1 << 4),
-    errorEvents(1 << 4)
+    results(1 << 10)
 {}
 
 
 ShardedEventMatcher::
 ShardedEventMatcher(std::string prefix, std::shared_ptr<ServiceProxies> proxies) :
     EventMatcher(std::move(prefix), std::move(proxies)),
-    matchedWinLossEvents(1 << 10),
-    matchedCampaignEvents(1 << 8),
-    unmatchedEvents(1 << 4),
-    errorEvents(1 << 4)
+    results(1 << 10)
 {}
 
 ShardedEventMatcher::Shard::
 Shard(std::string prefix, std::shared_ptr<EventService> events) :
+    index(0), parent(nullptr),
     matcher(std::move(prefix), std::move(events)),
-    auctions(1 << 8),
-    events(1 << 6)
+    inbox(1 << 10)
 {}
 
 ShardedEventMatcher::Shard::
 Shard(std::string prefix, std::shared_ptr<ServiceProxies> proxies) :
+    index(0), parent(nullptr),
     matcher(std::move(prefix), std::move(proxies)),
-    auctions(1 << 8),
-    events(1 << 6)
+    inbox(1 << 10)
 {}
 
 void
 ShardedEventMatcher::
-init(size_t numShards)
+init(size_t numShards, const std::vector<int> & cpus)
 {
     if (numShards <= 1)
         THROW(error) << "Invalid number of shards: " << numShards;
 
+    this->cpus = cpus;
     shards.reserve(numShards);
 
     for (size_t i = 0; i < numShards; ++i) {
@@ -77,74 +113,128 @@ init(size_t numShards)
         shard->init(i, this);
     }
 
-    using std::placeholders::_1;
+    results.onEvent = [=] (ShardResult && result) {
+        doResult(std::move(result));
+    };
+    addSource("ShardedEventMatcher::results", results);
+}
 
-    matchedWinLossEvents.onEvent =
-        std::bind(&ShardedEventMatcher::doMatchedWinLoss, this, _1);
-    addSource("SahrdedEventMatcher::matchedWinLossEvents", matchedWinLossEvents);
+void
+ShardedEventMatcher::
+doResult(ShardResult && result)
+{
+    if (result.matchedWinLoss)
+        doMatchedWinLoss(std::move(result.matchedWinLoss));
 
-    matchedCampaignEvents.onEvent =
-        std::bind(&ShardedEventMatcher::doMatchedCampaignEvent, this, _1);
-    addSource("SahrdedEventMatcher::matchedCampaignEvents", matchedCampaignEvents);
+    else if (result.matchedCampaignEvent)
+        doMatchedCampaignEvent(std::move(result.matchedCampaignEvent));
 
-    unmatchedEvents.onEvent =
-        std::bind(&ShardedEventMatcher::doUnmatchedEvent, this, _1);
-    addSource("SahrdedEventMatcher::unmatchedEvents", unmatchedEvents);
+    else if (result.unmatchedEvent)
+        doUnmatchedEvent(std::move(result.unmatchedEvent));
 
-    errorEvents.onEvent = [=] (std::shared_ptr<PostAuctionErrorEvent> event) {
-        doError(std::move(event));
-    };
-    addSource("SahrdedEventMatcher::errorEvents", errorEvents);
+    else if (result.errorEvent)
+        doError(std::move(result.errorEvent));
 }
 
 void
 ShardedEventMatcher::Shard::
 init(size_t shard, ShardedEventMatcher* parent)
 {
-    using std::placeholders::_1;
+    this->index = shard;
+    this->parent = parent;
 
-    auctions.onEvent = [=] (std::shared_ptr<SubmittedAuctionEvent> event) {
-        parent->recordHit("shards.%d.messages.%s", shard, "AUCTION");
-
-        this->matcher.doAuction(std::move(event));
+    inbox.onEvent = [=] (ShardMessage && message) {
+        doMessage(std::move(message));
     };
-    addSource("ShardedEventMatcher::Shard::auctions", auctions);
-
-    events.onEvent = [=] (std::shared_ptr<PostAuctionEvent> event) {
-        parent->recordHit("shards.%d.messages.%s", shard, RTBKIT::print(event->type));
-        if (event->type == PAE_CAMPAIGN_EVENT)
-            parent->recordHit("shards.%d.messages.events.%s", shard, event->label);
-
-        this->matcher.doEvent(std::move(event));
-    };
-    addSource("ShardedEventMatcher::Shard::events", events);
+    inbox.onDrained = [=] { flushStats(); };
+    addSource("ShardedEventMatcher::Shard::inbox", inbox);
 
     addPeriodic("ShardedEventMatcher::checkExpiredAuctions", 0.1,
-            std::bind(&SimpleEventMatcher::checkExpiredAuctions, &matcher));
-
+            [=] (uint64_t) {
+                matcher.checkExpiredAuctions();
+                flushStats();
+            });
 
 
     matcher.onMatchedWinLoss = [=] (std::shared_ptr<MatchedWinLoss> event) {
-        parent->recordHit("shards.%d.results.MATCHED%s", shard, event->typeString());
-        parent->matchedWinLossEvents.push(std::move(event));
+        ++resultCounts[std::string("MATCHED") + event->typeString()];
+        ShardResult result;
+        result.matchedWinLoss = std::move(event);
+        parent->results.push(std::move(result));
     };
 
     matcher.onMatchedCampaignEvent = [=] (std::shared_ptr<MatchedCampaignEvent> event) {
-        parent->recordHit("shards.%d.results.MATCHED%s", shard, event->label);
-        parent->matchedCampaignEvents.push(std::move(event));
+        ++resultCounts["MATCHED" + event->label];
+        ShardResult result;
+        result.matchedCampaignEvent = std::move(event);
+        parent->results.push(std::move(result));
     };
 
     matcher.onUnmatchedEvent = [=] (std::shared_ptr<UnmatchedEvent> event) {
-        parent->recordHit("shards.%d.results.%s", shard, "UNMATCHED");
-        parent->unmatchedEvents.push(std::move(event));
+        ++resultCounts["UNMATCHED"];
+        ShardResult result;
+        result.unmatchedEvent = std::move(event);
+        parent->results.push(std::move(result));
     };
 
     matcher.onError = [=] (std::shared_ptr<PostAuctionErrorEvent> event) {
-        parent->recordHit("shards.%d.results.%s", shard, "ERROR");
-        parent->errorEvents.push(std::move(event));
+        ++resultCounts["ERROR"];
+        ShardResult result;
+        result.errorEvent = std::move(event);
+        parent->results.push(std::move(result));
     };
 }
 
+void
+ShardedEventMatcher::Shard::
+start(int cpu)
+{
+    startPinned(cpu, [&] { MessageLoop::start(); });
+}
+
+void
+ShardedEventMatcher::Shard::
+doMessage(ShardMessage && message)
+{
+    if (message.task) {
+        message.task(matcher);
+        return;
+    }
+
+    if (message.auction) {
+        ++messageCounts["AUCTION"];
+        matcher.doAuction(std::move(message.auction));
+        return;
+    }
+
+    auto& event = message.event;
+
+    ++messageCounts[RTBKIT::print(event->type)];
+    if (event->type == PAE_CAMPAIGN_EVENT)
+        ++messageCounts["events." + event->label];
+
+    matcher.doEvent(std::move(event));
+}
+
+void
+ShardedEventMatcher::Shard::
+flushStats()
+{
+    for (auto& entry : messageCounts) {
+        if (!entry.second) continue;
+        parent->recordCount(entry.second, "shards.%d.messages.%s",
+                int(index), entry.first);
+        entry.second = 0;
+    }
+
+    for (auto& entry : resultCounts) {
+        if (!entry.second) continue;
+        parent->recordCount(entry.second, "shards.%d.results.%s",
+                int(index), entry.first);
+        entry.second = 0;
+    }
+}
+
 
 void
 ShardedEventMatcher::
@@ -173,7 +263,7 @@ ShardedEventMatcher::
 start()
 {
     for (size_t i = 0; i < shards.size(); ++i)
-        shards[i]->start();
+        shards[i]->start(cpus.empty() ? -1 : cpus[i % cpus.size()]);
 }
 
 void
@@ -185,6 +275,65 @@ shutdown()
 }
 
 
+void
+ShardedEventMatcher::
+initStatePersistence(const std::string & path)
+{
+    // Each shard already spreads its decoding over all the cpus.
+    for (size_t i = 0; i < shards.size(); ++i) {
+        shards[i]->matcher.initStatePersistence(
+                path + "/shard-" + std::to_string(i));
+    }
+}
+
+
+void
+ShardedEventMatcher::
+initFinishedSpill(double spillAge, const std::string & path)
+{
+    for (size_t i = 0; i < shards.size(); ++i) {
+        std::string shardPath;
+        if (!path.empty()) shardPath = path + "/shard-" + std::to_string(i);
+        shards[i]->matcher.initFinishedSpill(spillAge, shardPath);
+    }
+}
+
+
+void
+ShardedEventMatcher::
+handOff(const IsOwned & isOwned, const OnHandOff & onHandOff)
+{
+    for (auto& shard : shards) {
+        ShardMessage message;
+        message.task = [=] (SimpleEventMatcher & matcher) {
+            matcher.handOff(isOwned, onHandOff);
+        };
+        shard->inbox.push(std::move(message));
+    }
+}
+
+void
+ShardedEventMatcher::
+takeOver(HandOff && entry)
+{
+    auto& s = shard(entry.auctionId);
+
+    // Moved into a shared_ptr since std::function needs to be copyable.
+    auto shared = std::make_shared<HandOff>(std::move(entry));
+
+    ShardMessage message;
+    message.task = [=] (SimpleEventMatcher & matcher) {
+        try {
+            matcher.takeOver(std::move(*shared));
+        } catch (const std::exception & exc) {
+            LOG(error) << "error taking over auction "
+                << shared->auctionId << ": " << exc.what() << std::endl;
+        }
+    };
+    s.inbox.push(std::move(message));
+}
+
+
 ShardedEventMatcher::Shard&
 ShardedEventMatcher::
 shard(const Id& auctionId)
@@ -196,16 +345,18 @@ void
 ShardedEventMatcher::
 doAuction(std::shared_ptr<SubmittedAuctionEvent> event)
 {
-    auto& s = shard(event->auctionId);
-    s.auctions.push(std::move(event));
+    ShardMessage message;
+    message.auction = std::move(event);
+    shard(message.auction->auctionId).inbox.push(std::move(message));
 }
 
 void
 ShardedEventMatcher::
 doEvent(std::shared_ptr<PostAuctionEvent> event)
 {
-    auto& s = shard(event->auctionId);
-    s.events.push(std::move(event));
+    ShardMessage message;
+    message.event = std::move(event);
+    shard(message.event->auctionId).inbox.push(std::move(message));
 }
 
 } // namepsace RTBKIT
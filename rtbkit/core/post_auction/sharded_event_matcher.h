@@ -16,6 +16,8 @@
 #include "soa/service/logs.h"
 #include "soa/service/typed_message_channel.h"
 
+#include <unordered_map>
+
 namespace RTBKIT {
 
 /******************************************************************************/
@@ -28,7 +30,10 @@ struct ShardedEventMatcher : public EventMatcher, public MessageLoop
     ShardedEventMatcher(std::string prefix, std::shared_ptr<EventService> events);
     ShardedEventMatcher(std::string prefix, std::shared_ptr<ServiceProxies> proxies);
 
-    void init(size_t shards);
+    /** Creates the given number of shards.  If cpus isn't empty then the
+        thread of shard i is pinned to cpus[i % cpus.size()].
+    */
+    void init(size_t shards, const std::vector<int> & cpus = std::vector<int>());
     void start();
     void shutdown();
 
@@ -50,26 +55,80 @@ struct ShardedEventMatcher : public EventMatcher, public MessageLoop
     /** Periodic auction expiry. */
     virtual void checkExpiredAuctions() {}
 
+
+    /************************************************************************/
+    /* PERSISTENCE                                                          */
+    /************************************************************************/
+
+    /** Each shard keeps its state under path/shard-<n>. */
+    virtual void initStatePersistence(const std::string & path);
+    virtual void initFinishedSpill(double spillAge, const std::string & path);
+
+
+    /************************************************************************/
+    /* HAND OFF                                                             */
+    /************************************************************************/
+
+    /** Every shard hands off its own entries from its thread so onHandOff is
+        called from all the shard threads.  Returns before they're done.
+    */
+    virtual void handOff(const IsOwned & isOwned, const OnHandOff & onHandOff);
+
+    virtual void takeOver(HandOff && entry);
+
 private:
 
+    /** What gets queued for a shard; only one of the three is set. */
+    struct ShardMessage
+    {
+        std::shared_ptr<SubmittedAuctionEvent> auction;
+        std::shared_ptr<PostAuctionEvent> event;
+        std::function<void (SimpleEventMatcher &)> task;
+    };
+
+    /** What a shard hands back; only one of the four is set. */
+    struct ShardResult
+    {
+        std::shared_ptr<MatchedWinLoss> matchedWinLoss;
+        std::shared_ptr<MatchedCampaignEvent> matchedCampaignEvent;
+        std::shared_ptr<UnmatchedEvent> unmatchedEvent;
+        std::shared_ptr<PostAuctionErrorEvent> errorEvent;
+    };
+
     struct Shard : public MessageLoop
     {
         Shard(std::string prefix, std::shared_ptr<EventService> events);
         Shard(std::string prefix, std::shared_ptr<ServiceProxies> proxies);
         void init(size_t shard, ShardedEventMatcher* parent);
 
+        /** Starts the shard thread, pinned to the given cpu unless it's -1. */
+        void start(int cpu);
+
+        void doMessage(ShardMessage && message);
+
+        /** Stats are counted locally and recorded once per batch of messages
+            instead of once per message.
+        */
+        void flushStats();
+
+        size_t index;
+        ShardedEventMatcher* parent;
+
         SimpleEventMatcher matcher;
-        TypedMessageSink<std::shared_ptr<SubmittedAuctionEvent> > auctions;
-        TypedMessageSink<std::shared_ptr<PostAuctionEvent> > events;
+        TypedMessageLaneSink<ShardMessage> inbox;
+
+        std::unordered_map<std::string, uint64_t> messageCounts;
+        std::unordered_map<std::string, uint64_t> resultCounts;
     };
 
     std::vector< std::unique_ptr<Shard> > shards;
+    std::vector<int> cpus;
     Shard& shard(const Id& auctionId);
 
-    TypedMessageSink<std::shared_ptr<MatchedWinLoss> > matchedWinLossEvents;
-    TypedMessageSink<std::shared_ptr<MatchedCampaignEvent> > matchedCampaignEvents;
-    TypedMessageSink<std::shared_ptr<UnmatchedEvent> > unmatchedEvents;
-    TypedMessageSink<std::shared_ptr<PostAuctionErrorEvent> > errorEvents;
+    void doResult(ShardResult && result);
+
+    /** Every shard thread gets its own lane so they never contend. */
+    TypedMessageLaneSink<ShardResult> results;
 
     static Logging::Category print;
     static Logging::Category error;
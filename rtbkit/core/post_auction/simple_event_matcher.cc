@@ -7,9 +7,13 @@
 
 #include "events.h"
 #include "simple_event_matcher.h"
+#include "rtbkit/common/auction_tracer.h"
 #include "jml/utils/guard.h"
+#include "soa/service/fs_utils.h"
 
+#include <algorithm>
 #include <iostream>
+#include <thread>
 
 using namespace std;
 using namespace Datacratic;
@@ -79,14 +83,26 @@ Logging::Category SimpleEventMatcher::trace("SimpleEventMatcher Trace", SimpleEv
 
 SimpleEventMatcher::
 SimpleEventMatcher(std::string prefix, std::shared_ptr<EventService> events) :
-    EventMatcher(std::move(prefix), std::move(events))
+    EventMatcher(std::move(prefix), std::move(events)),
+    spillAge(0.0)
 {}
 
 SimpleEventMatcher::
 SimpleEventMatcher(std::string prefix, std::shared_ptr<ServiceProxies> proxies) :
-    EventMatcher(std::move(prefix), std::move(proxies))
+    EventMatcher(std::move(prefix), std::move(proxies)),
+    spillAge(0.0)
 {}
 
+SimpleEventMatcher::
+~SimpleEventMatcher()
+{
+    try {
+        flushState();
+    } catch (const std::exception & exc) {
+        LOG(error) << "error flushing matcher state: " << exc.what() << endl;
+    }
+}
+
 
 Date
 SimpleEventMatcher::
@@ -97,6 +113,7 @@ expireSubmitted(Date start, const pair<Id, Id> & key, const SubmissionInfo & inf
 
     // Just making sure it doesn't leak if doBidResult throws.
     spotIdMap.erase(key.first);
+    submittedChanged(key);
 
     recordHit("submittedAuctionExpiry");
 
@@ -131,6 +148,7 @@ SimpleEventMatcher::
 expireFinished(const pair<Id, Id> & key, const FinishedInfo & info)
 {
     spotIdMap.erase(key.first);
+    finishedChanged(key);
 
     recordHit("finishedAuctionExpiry");
     return Date();
@@ -140,8 +158,13 @@ void
 SimpleEventMatcher::
 checkExpiredAuctions()
 {
-    Date now = Date::now();
+    checkExpiredAuctions(Date::now());
+}
 
+void
+SimpleEventMatcher::
+checkExpiredAuctions(Date now)
+{
     using std::placeholders::_1;
     using std::placeholders::_2;
 
@@ -155,6 +178,16 @@ checkExpiredAuctions()
             std::bind(&SimpleEventMatcher::expireFinished, this, _1, _2),
             now);
 
+    if (spillDb) {
+        recordLevel(spilled.size(), "finishedSpilledSize");
+        spilled.expire(
+                std::bind(&SimpleEventMatcher::expireSpilled, this, _1),
+                now);
+    }
+
+    flushState();
+    spillFinished(now);
+
     banker->logBidEvents(*this);
 }
 
@@ -166,6 +199,10 @@ doEvent(std::shared_ptr<PostAuctionEvent> event)
 {
     auto type = event->type;
 
+    // The id is copied by the span since the event is moved below.
+    AuctionTracer::Span span("postAuction.match", event->auctionId,
+                             RTBKIT::print(type));
+
     try {
         switch (type) {
         case PAE_WIN:
@@ -190,6 +227,8 @@ void
 SimpleEventMatcher::
 doAuction(std::shared_ptr<SubmittedAuctionEvent> event)
 {
+    AuctionTracer::Span span("postAuction.submitted", event->auctionId);
+
     try {
         recordHit("processedAuction");
 
@@ -218,6 +257,7 @@ doAuction(std::shared_ptr<SubmittedAuctionEvent> event)
 
         submitted.emplace(key, submission, lossTimeout);
         spotIdMap[key.first] = key.second;
+        submittedChanged(key);
 
         string transId =
             makeBidId(auctionId, event->adSpotId, submission.bid.agent);
@@ -284,6 +324,8 @@ doWinLoss(std::shared_ptr<PostAuctionEvent> event, bool isReplay)
        timed out, and so an auction may be both inFlight and submitted or
        finished.
     */
+    reloadFinished(auctionId, adSpotId);
+
     if (finished.count(key)) {
 
         FinishedInfo info = finished.get(key);
@@ -312,6 +354,7 @@ doWinLoss(std::shared_ptr<PostAuctionEvent> event, bool isReplay)
             info.forceWin(timestamp, winPrice, winPrice, meta.toString());
 
             finished.get(key) = info;
+            finishedChanged(key);
 
             doMatchedWinLoss(std::make_shared<MatchedWinLoss>(
                             MatchedWinLoss::LateWin,
@@ -350,6 +393,7 @@ doWinLoss(std::shared_ptr<PostAuctionEvent> event, bool isReplay)
             info.earlyWinEvents.push_back(event);
             submitted.emplace(key, info, Date::now().plusSeconds(lossTimeout));
             spotIdMap[key.first] = key.second;
+            submittedChanged(key);
 
             return;
         }
@@ -378,6 +422,7 @@ doWinLoss(std::shared_ptr<PostAuctionEvent> event, bool isReplay)
 
     SubmissionInfo info = submitted.pop(key);
     spotIdMap.erase(key.first);
+    submittedChanged(key);
 
     if (!info.bidRequest) {
         // We doubled up on a WIN without having got the auction yet
@@ -434,6 +479,8 @@ doCampaignEvent(std::shared_ptr<PostAuctionEvent> event)
         doUnmatchedEvent(std::make_shared<UnmatchedEvent>(why, *event));
     };
 
+    reloadFinished(auctionId, adSpotId);
+
     if (findAuction(submitted, spotIdMap, auctionId, adSpotId, submissionInfo)) {
         // Record the impression or click in the submission info.  This will
         // then be passed on once the win comes in.
@@ -449,6 +496,7 @@ doCampaignEvent(std::shared_ptr<PostAuctionEvent> event)
         submissionInfo.earlyCampaignEvents.push_back(event);
         submitted.get(make_pair(auctionId, adSpotId)) = submissionInfo;
         spotIdMap[auctionId] = adSpotId;
+        submittedChanged(make_pair(auctionId, adSpotId));
         return;
     }
 
@@ -477,6 +525,7 @@ doCampaignEvent(std::shared_ptr<PostAuctionEvent> event)
         finishedInfo.addUids(uids);
 
         finished.get(key) = finishedInfo;
+        finishedChanged(key);
 
         doMatchedCampaignEvent(
                 std::make_shared<MatchedCampaignEvent>(label, finishedInfo));
@@ -591,7 +640,6 @@ doBidResult(
     i.auctionId = auctionId;
     i.adSpotId = adSpotId;
     i.spotIndex = adspot_num;
-    i.bidRequest = submission.bidRequest;
     i.bidRequestStr = submission.bidRequestStr;
     i.bidRequestStrFormat = submission.bidRequestStrFormat ;
     i.bid = response;
@@ -614,8 +662,11 @@ doBidResult(
         expiryInterval = auctionTimeout;
 
     Date expiryTime = Date::now().plusSeconds(expiryInterval);
-    finished.emplace(make_pair(auctionId, adSpotId), i, expiryTime);
+    auto key = make_pair(auctionId, adSpotId);
+    finished.emplace(key, i, expiryTime);
     spotIdMap[auctionId] = adSpotId;
+    finishedChanged(key);
+    if (spillDb) spillQueue.emplace_back(Date::now(), key);
 }
 
 
@@ -623,10 +674,20 @@ doBidResult(
 /******************************************************************************/
 /* PERSISTENCE                                                                */
 /******************************************************************************/
-// Needs to be properly tested before enabling.
 
 namespace {
 
+/** Entries are flushed in batches of at most this many keys. */
+enum { MaxPendingWrites = 1 << 16 };
+
+/** Entries are decoded in chunks of this many, split over the threads. */
+enum { RestoreChunkSize = 1 << 14 };
+
+bool isPersistable(const std::pair<Id, Id> & key)
+{
+    return key.second && key.second.type != Id::NULLID;
+}
+
 std::pair<Id, Id>
 unstringifyPair(const std::string & str)
 {
@@ -639,7 +700,7 @@ unstringifyPair(const std::string & str)
 
 std::string stringifyPair(const std::pair<Id, Id> & vals)
 {
-    if (!vals.second || vals.second.type == Id::NULLID)
+    if (!isPersistable(vals))
         throw ML::Exception("attempt to store null ID");
 
     ostringstream stream;
@@ -651,146 +712,543 @@ std::string stringifyPair(const std::pair<Id, Id> & vals)
     return stream.str();
 }
 
-} // file scope
+/** The stored value is the timeout followed by the serialized info. */
+template<typename Info>
+std::string stringifyEntry(const Info & info, Date timeout)
+{
+    ostringstream stream;
+    {
+        DB::Store_Writer store(stream);
+        store << timeout.secondsSinceEpoch() << info.serializeToString();
+    }
+    return stream.str();
+}
+
+template<typename Info>
+void unstringifyEntry(const std::string & str, Info & info, Date & timeout)
+{
+    istringstream stream(str);
+    DB::Store_Reader store(stream);
 
+    double seconds;
+    string serialized;
+    store >> seconds >> serialized;
 
-#if 0 // Persistence layer that needs to be reworked.
+    timeout = Date::fromSecondsSinceEpoch(seconds);
+    info.reconstituteFromString(serialized);
+}
 
-void
-SimpleEventMatcher::
-initStatePersistence(const std::string & path)
+/** Writes the current state of the dirty keys: their value if they're
+    still in the map, or an erase if they're gone.
+*/
+template<typename Info>
+size_t flushDirty(
+        const TimeoutMap<pair<Id, Id>, Info> & pending,
+        std::unordered_set< pair<Id, Id> > & dirty,
+        LeveldbPendingPersistence & db)
 {
-    typedef PendingPersistenceT<pair<Id, Id>, SubmissionInfo>
-        SubmittedPending;
+    size_t result = 0;
 
-    auto submittedDb = std::make_shared<LeveldbPendingPersistence>();
-    submittedDb->open(path + "/submitted");
+    for (const auto & key : dirty) {
+        if (!isPersistable(key)) continue;
 
-    auto submittedPersistence
-        = std::make_shared<SubmittedPending>();
-    submittedPersistence->store = submittedDb;
+        if (pending.count(key))
+            db.put(stringifyPair(key),
+                   stringifyEntry(pending.get(key), pending.getTimeout(key)));
+        else db.erase(stringifyPair(key));
 
-    auto stringifySubmissionInfo = [] (const SubmissionInfo & info)
-        {
-            return info.serializeToString();
-        };
+        ++result;
+    }
+
+    dirty.clear();
+    db.flush();
+    return result;
+}
+
+/** Reads back all the entries of the database.  Decoding a stored entry
+    means parsing its bid request, so the entries are read in chunks whose
+    decoding is spread over a thread per cpu; they're then handed to
+    onEntry in order from the calling thread, which returns whether it kept
+    the entry.  Entries that can't be decoded are erased.  Returns the number
+    of entries kept.
+*/
+template<typename Info>
+size_t restoreEntries(
+        LeveldbPendingPersistence & db,
+        const std::function<bool (pair<Id, Id> &, Info &, Date)> & onEntry)
+{
+    struct Entry
+    {
+        std::string key;
+        std::string value;
+
+        pair<Id, Id> decodedKey;
+        Info info;
+        Date timeout;
+        bool ok;
+    };
+
+    size_t numThreads = std::max(1u, std::thread::hardware_concurrency());
+
+    std::vector<Entry> chunk;
+    chunk.reserve(RestoreChunkSize);
 
-    auto unstringifySubmissionInfo = [] (const std::string & str)
+    std::vector<std::string> toErase;
+    size_t restored = 0;
+
+    auto decode = [&] (size_t thread)
         {
-            SubmissionInfo info;
-            info.reconstituteFromString(str);
-            return info;
+            for (size_t i = thread;  i < chunk.size();  i += numThreads) {
+                Entry & entry = chunk[i];
+                try {
+                    entry.decodedKey = unstringifyPair(entry.key);
+                    unstringifyEntry(entry.value, entry.info, entry.timeout);
+                    entry.ok = true;
+                } catch (const std::exception & exc) {
+                    entry.ok = false;
+                }
+                std::string().swap(entry.value);
+            }
         };
 
-    submittedPersistence->stringifyKey = stringifyPair;
-    submittedPersistence->unstringifyKey = unstringifyPair;
-    submittedPersistence->stringifyValue = stringifySubmissionInfo;
-    submittedPersistence->unstringifyValue = unstringifySubmissionInfo;
+    auto processChunk = [&] ()
+        {
+            std::vector<std::thread> threads;
+            for (size_t i = 1;  i < numThreads && i < chunk.size();  ++i)
+                threads.emplace_back(decode, i);
+            decode(0);
+            for (auto & thread : threads) thread.join();
+
+            for (auto & entry : chunk) {
+                if (!entry.ok) {
+                    toErase.push_back(entry.key);
+                    continue;
+                }
+                if (onEntry(entry.decodedKey, entry.info, entry.timeout))
+                    ++restored;
+            }
 
-    Date newTimeout = Date::now().plusSeconds(15);
+            chunk.clear();
+        };
 
-    auto acceptSubmitted = [&] (pair<Id, Id> & key,
-                                SubmissionInfo & info,
-                                Date & timeout) -> bool
+    auto onRaw = [&] (const std::string & key, const std::string & value)
         {
-            info.fromOldRouter = true;
-            newTimeout.addSeconds(0.001);
-            timeout = newTimeout;
-            // this->debugSpot(key.first, key.second, "RECONST SUBMITTED");
-            return true;
+            chunk.emplace_back();
+            chunk.back().key = key;
+            chunk.back().value = value;
+            if (chunk.size() == RestoreChunkSize) processChunk();
         };
 
-    submitted.initFromStore(submittedPersistence,
-                            acceptSubmitted,
-                            Date::now().plusSeconds(15));
+    db.scan(onRaw, PendingPersistence::OnError());
+    processChunk();
+
+    for (const auto & key : toErase)
+        db.erase(key);
+    db.flush();
+
+    return restored;
+}
 
-    typedef PendingPersistenceT<pair<Id, Id>, FinishedInfo>
-        FinishedPending;
+} // file scope
 
-    auto finishedDb = std::make_shared<LeveldbPendingPersistence>();
-    finishedDb->open(path + "/finished");
+void
+SimpleEventMatcher::
+initStatePersistence(const std::string & path)
+{
+    if (spillDb)
+        THROW(error) << "initStatePersistence must be called before "
+            << "initFinishedSpill";
 
-    auto finishedPersistence
-        = std::make_shared<FinishedPending>();
-    finishedPersistence->store = finishedDb;
+    makeUriDirectory(path + "/");
 
-    auto stringifyFinishedInfo = [] (const FinishedInfo & info)
+    auto openDb = [&] (const std::string & name)
         {
-            return info.serializeToString();
+            auto db = std::make_shared<LeveldbPendingPersistence>();
+            db->open(path + "/" + name, 64 * 1024 * 1024);
+            db->setWriteBehind(MaxPendingWrites);
+            return db;
         };
 
-    auto unstringifyFinishedInfo = [] (const std::string & str)
+    Date start = Date::now();
+    Date now = start;
+
+    auto acceptSubmitted = [&] (pair<Id, Id> & key,
+                                SubmissionInfo & info,
+                                Date timeout)
         {
-            FinishedInfo info;
-            info.reconstituteFromString(str);
-            return info;
+            // Auctions whose loss timeout passed while we were down are
+            // expired as inferred losses on the next check.
+            info.fromOldRouter = true;
+            if (!submitted.emplace(key, std::move(info), std::max(timeout, now)))
+                return false;
+            spotIdMap[key.first] = key.second;
+            return true;
         };
 
-    finishedPersistence->stringifyKey = stringifyPair;
-    finishedPersistence->unstringifyKey = unstringifyPair;
-    finishedPersistence->stringifyValue = stringifyFinishedInfo;
-    finishedPersistence->unstringifyValue = unstringifyFinishedInfo;
-
-    newTimeout = Date::now().plusSeconds(auctionTimeout);
-
     auto acceptFinished = [&] (pair<Id, Id> & key,
                                FinishedInfo & info,
-                               Date & timeout) -> bool
+                               Date timeout)
         {
             info.fromOldRouter = true;
-            newTimeout.addSeconds(0.001);
-            timeout = newTimeout;
-            // this->debugSpot(key.first, key.second, "RECONST FINISHED");
-
+            if (timeout <= now) {
+                dirtyFinished.insert(key);
+                return false;
+            }
+            if (!finished.emplace(key, std::move(info), timeout))
+                return false;
+            spotIdMap[key.first] = key.second;
             return true;
         };
 
-    finished.initFromStore(finishedPersistence,
-                           acceptFinished,
-                           Date::now().plusSeconds(auctionTimeout));
+    auto submittedDb = openDb("submitted");
+    size_t numSubmitted =
+        restoreEntries<SubmissionInfo>(*submittedDb, acceptSubmitted);
 
-    auto backgroundWork = [=] (volatile int & shutdown, int64_t threadId)
-        {
-            while (!shutdown) {
-                futex_wait(const_cast<int &>(shutdown), 0, 600.0);
-                if (shutdown) break;
-                //continue;
+    auto finishedDb = openDb("finished");
+    size_t numFinished =
+        restoreEntries<FinishedInfo>(*finishedDb, acceptFinished);
+
+    this->submittedDb = submittedDb;
+    this->finishedDb = finishedDb;
+
+    // Erases the finished entries that were already expired.
+    flushState();
+
+    double elapsed = Date::now().secondsSince(start);
+    LOG(print) << "restored " << numSubmitted << " submitted and "
+        << numFinished << " finished auctions from " << path
+        << " in " << elapsed << "s" << endl;
+
+    recordLevel(numSubmitted, "persistence.restoredSubmitted");
+    recordLevel(numFinished, "persistence.restoredFinished");
+    recordOutcome(elapsed * 1000.0, "persistence.restoreTimeMs");
+}
+
+void
+SimpleEventMatcher::
+flushState()
+{
+    if (!submittedDb || !finishedDb) return;
+    if (dirtySubmitted.empty() && dirtyFinished.empty()) return;
+
+    Date start = Date::now();
 
+    size_t written =
+        flushDirty(submitted, dirtySubmitted, *submittedDb)
+        + flushDirty(finished, dirtyFinished, *finishedDb);
+
+    recordCount(written, "persistence.keysWritten");
+    recordOutcome(Date::now().secondsSince(start) * 1000.0,
+                  "persistence.flushTimeMs");
+}
+
+void
+SimpleEventMatcher::
+initFinishedSpill(double spillAge, const std::string & path)
+{
+    if (spillAge <= 0.0)
+        THROW(error) << "invalid spill age: " << spillAge;
+
+    this->spillAge = spillAge;
+
+    if (finishedDb) {
+        spillDb = finishedDb;
+
+        // What was restored is queued by the time it was finished so that
+        // the auctions which already sat on disk long enough spill on the
+        // next check instead of staying in memory until they expire.
+        Date now = Date::now();
+        finished.forEach([&] (const pair<Id, Id> & key,
+                              const FinishedInfo & info,
+                              Date)
                 {
-                    Date start = Date::now();
-                    submittedDb->compact();
-                    Date end = Date::now();
-                    this->recordEvent("persistentData.submitted.compactTimeMs",
-                                  ET_OUTCOME,
-                                  1000.0 * (end.secondsSince(start)));
-                    uint64_t size = submittedDb->getDbSize();
-                    //cerr << "submitted db is " << size / 1024.0 / 1024.0
-                    //     << "MB" << endl;
-                    this->recordEvent("persistentData.submitted.dbSizeMb",
-                                  ET_LEVEL, size / 1024.0 / 1024.0);
-                }
+                    Date age = info.hasWin() ? std::min(info.winTime, now) : now;
+                    spillQueue.emplace_back(age, key);
+                });
 
+        std::stable_sort(spillQueue.begin(), spillQueue.end(),
+                [] (const pair<Date, pair<Id, Id> > & lhs,
+                    const pair<Date, pair<Id, Id> > & rhs)
                 {
-                    Date start = Date::now();
-                    finishedDb->compact();
-                    Date end = Date::now();
-                    this->recordEvent("persistentData.finished.compactTimeMs",
-                                  ET_OUTCOME,
-                                  1000.0 * (end.secondsSince(start)));
-                    uint64_t size = finishedDb->getDbSize();
-                    //cerr << "finished db is " << size / 1024.0 / 1024.0
-                    //     << "MB" << endl;
-                    this->recordEvent("persistentData.finished.dbSizeMb",
-                                  ET_LEVEL, size / 1024.0 / 1024.0);
-                }
-            }
+                    return lhs.first < rhs.first;
+                });
+        return;
+    }
+
+    if (path.empty())
+        THROW(error) << "spilling needs a path without state persistence";
+
+    makeUriDirectory(path + "/");
+    leveldb::DestroyDB(path + "/spilled", leveldb::Options());
+
+    spillDb = std::make_shared<LeveldbPendingPersistence>();
+    spillDb->open(path + "/spilled", 64 * 1024 * 1024);
+    spillDb->setWriteBehind(MaxPendingWrites);
+}
+
+void
+SimpleEventMatcher::
+spillFinished(Date now)
+{
+    if (!spillDb) return;
+
+    // Auctions are spilled from the persistent store once it has their
+    // latest state, which flushState() just wrote.
+    bool persistent = spillDb == finishedDb;
+    size_t numSpilled = 0;
+
+    while (!spillQueue.empty()
+            && spillQueue.front().first.plusSeconds(spillAge) <= now)
+    {
+        auto key = spillQueue.front().second;
+        spillQueue.pop_front();
+
+        if (!finished.count(key) || !isPersistable(key)) continue;
+
+        Date timeout = finished.getTimeout(key);
+        if (!persistent) {
+            spillDb->put(stringifyPair(key),
+                         stringifyEntry(finished.get(key), timeout));
+        }
+
+        finished.erase(key);
+        spilled.emplace(key, true, timeout);
+        ++numSpilled;
+    }
+
+    if (!persistent) spillDb->flush();
+
+    if (numSpilled) recordCount(numSpilled, "finishedSpilled");
+}
+
+bool
+SimpleEventMatcher::
+reloadFinished(const Id & auctionId, Id adSpotId)
+{
+    if (!spilled.size()) return false;
 
-            cerr << "exiting background work thread" << endl;
+    if (!adSpotId) {
+        auto it = spotIdMap.find(auctionId);
+        if (it == spotIdMap.end()) return false;
+        adSpotId = it->second;
+    }
+
+    auto key = make_pair(auctionId, adSpotId);
+    if (!spilled.count(key)) return false;
+    spilled.erase(key);
+
+    FinishedInfo info;
+    Date timeout;
+
+    try {
+        string skey = stringifyPair(key);
+        unstringifyEntry(spillDb->get(skey), info, timeout);
+        if (spillDb != finishedDb) spillDb->erase(skey);
+    } catch (const std::exception & exc) {
+        doError("reloadFinished", exc.what());
+        return false;
+    }
+
+    finished.emplace(key, std::move(info), timeout);
+    spillQueue.emplace_back(Date::now(), key);
+
+    recordHit("finishedReloaded");
+    return true;
+}
+
+Date
+SimpleEventMatcher::
+expireSpilled(const pair<Id, Id> & key)
+{
+    spotIdMap.erase(key.first);
+
+    if (spillDb == finishedDb)
+        finishedChanged(key);
+    else spillDb->erase(stringifyPair(key));
+
+    recordHit("finishedAuctionExpiry");
+    return Date();
+}
+
+/******************************************************************************/
+/* HAND OFF                                                                   */
+/******************************************************************************/
+
+void
+SimpleEventMatcher::
+handOff(const IsOwned & isOwned, const OnHandOff & onHandOff)
+{
+    Date start = Date::now();
+    size_t numSubmitted = 0, numFinished = 0, numEvents = 0;
+
+    std::vector< pair<Id, Id> > keys;
+    auto notOwned = [&] (const pair<Id, Id> & key)
+        {
+            if (!isOwned(key.first)) keys.push_back(key);
         };
 
-    // loop.startSubordinateThread(backgroundWork);
+    submitted.forEach([&] (const pair<Id, Id> & key, const SubmissionInfo &, Date)
+            {
+                notOwned(key);
+            });
+
+    for (const auto & key : keys) {
+        Date timeout = submitted.getTimeout(key);
+        SubmissionInfo info = submitted.pop(key);
+        spotIdMap.erase(key.first);
+        submittedChanged(key);
+
+        // Wins that came in before their auction go where the auction will.
+        for (const auto & event : info.earlyWinEvents) {
+            HandOff entry;
+            entry.kind = HandOff::EVENT;
+            entry.auctionId = key.first;
+            entry.value = ML::DB::serializeToString(*event);
+            onHandOff(std::move(entry));
+            ++numEvents;
+        }
+
+        if (!info.bidRequest || !isPersistable(key)) continue;
+
+        // Whatever is still authorized for the bid moves with it so that
+        // the new owner doesn't attach more than was left here.
+        HandOff entry;
+        entry.amount = info.bid.price.maxPrice;
+
+        try {
+            entry.amount = banker->detachBid(info.bid.account,
+                    makeBidId(key.first, key.second, info.bid.agent));
+        } catch (const std::exception & exc) {
+            doError("handOff.detachBid", exc.what());
+        }
+
+        entry.kind = HandOff::SUBMITTED;
+        entry.auctionId = key.first;
+        entry.key = stringifyPair(key);
+        entry.value = stringifyEntry(info, timeout);
+        onHandOff(std::move(entry));
+        ++numSubmitted;
+    }
+
+    keys.clear();
+    finished.forEach([&] (const pair<Id, Id> & key, const FinishedInfo &, Date)
+            {
+                if (isPersistable(key)) notOwned(key);
+            });
+
+    for (const auto & key : keys) {
+        HandOff entry;
+        entry.kind = HandOff::FINISHED;
+        entry.auctionId = key.first;
+        entry.key = stringifyPair(key);
+        entry.value = stringifyEntry(finished.get(key), finished.getTimeout(key));
+
+        finished.erase(key);
+        spotIdMap.erase(key.first);
+        finishedChanged(key);
+
+        onHandOff(std::move(entry));
+        ++numFinished;
+    }
+
+    if (spillDb) {
+        keys.clear();
+        spilled.forEach([&] (const pair<Id, Id> & key, bool, Date)
+                {
+                    notOwned(key);
+                });
+
+        for (const auto & key : keys) {
+            spilled.erase(key);
+            spotIdMap.erase(key.first);
+
+            HandOff entry;
+            entry.kind = HandOff::FINISHED;
+            entry.auctionId = key.first;
+            entry.key = stringifyPair(key);
+
+            try {
+                entry.value = spillDb->get(entry.key);
+            } catch (const std::exception & exc) {
+                doError("handOff.spilled", exc.what());
+                continue;
+            }
+
+            if (spillDb == finishedDb)
+                finishedChanged(key);
+            else spillDb->erase(entry.key);
+
+            onHandOff(std::move(entry));
+            ++numFinished;
+        }
+
+        if (spillDb != finishedDb) spillDb->flush();
+    }
+
+    flushState();
+
+    double elapsed = Date::now().secondsSince(start);
+    LOG(print) << "handed off " << numSubmitted << " submitted, "
+        << numFinished << " finished auctions and "
+        << numEvents << " early events in " << elapsed << "s" << endl;
+
+    recordCount(numSubmitted, "handOff.submitted");
+    recordCount(numFinished, "handOff.finished");
+    recordCount(numEvents, "handOff.events");
+    recordOutcome(elapsed * 1000.0, "handOff.timeMs");
 }
 
-#endif
+void
+SimpleEventMatcher::
+takeOver(HandOff && entry)
+{
+    if (entry.kind == HandOff::EVENT) {
+        recordHit("takeOver.events");
+        doEvent(std::make_shared<PostAuctionEvent>(
+                        ML::DB::reconstituteFromString<PostAuctionEvent>(entry.value)));
+        return;
+    }
+
+    auto key = unstringifyPair(entry.key);
+    Date timeout;
+
+    if (entry.kind == HandOff::FINISHED) {
+        FinishedInfo info;
+        unstringifyEntry(entry.value, info, timeout);
+
+        if (!finished.emplace(key, std::move(info), timeout)) return;
+        spotIdMap[key.first] = key.second;
+        finishedChanged(key);
+        if (spillDb) spillQueue.emplace_back(Date::now(), key);
+
+        recordHit("takeOver.finished");
+        return;
+    }
+
+    SubmissionInfo info;
+    unstringifyEntry(entry.value, info, timeout);
+
+    // Wins that beat the auction here are waiting in a placeholder entry.
+    vector<std::shared_ptr<PostAuctionEvent> > earlyWinEvents;
+    if (submitted.count(key)) {
+        SubmissionInfo early = submitted.pop(key);
+        earlyWinEvents.swap(early.earlyWinEvents);
+    }
+
+    banker->attachBid(info.bid.account,
+            makeBidId(key.first, key.second, info.bid.agent),
+            entry.amount);
+
+    submitted.emplace(key, std::move(info), timeout);
+    spotIdMap[key.first] = key.second;
+    submittedChanged(key);
+
+    recordHit("takeOver.submitted");
+
+    for (const auto & event : earlyWinEvents) {
+        recordHit("replayedEarlyWinEvent");
+        doWinLoss(event, true /* is_replay */);
+    }
+}
 
 } // RTBKIT
@@ -12,9 +12,11 @@
 #include "finished_info.h"
 #include "submission_info.h"
 #include "rtbkit/common/auction.h"
-// #include "soa/service/pending_list.h"
+#include "soa/service/pending_list.h"
 #include "soa/service/logs.h"
 
+#include <deque>
+#include <unordered_set>
 #include <utility>
 
 
@@ -44,6 +46,8 @@ struct SimpleEventMatcher : public EventMatcher
     SimpleEventMatcher(std::string prefix, std::shared_ptr<EventService> events);
     SimpleEventMatcher(std::string prefix, std::shared_ptr<ServiceProxies> proxies);
 
+    ~SimpleEventMatcher();
+
 
     /************************************************************************/
     /* EVENT MATCHING                                                       */
@@ -58,12 +62,55 @@ struct SimpleEventMatcher : public EventMatcher
     /** Periodic auction expiry. */
     virtual void checkExpiredAuctions();
 
+    /** Expires and spills the auctions as of now. */
+    void checkExpiredAuctions(Date now);
+
 
     /************************************************************************/
     /* PERSISTENCE                                                          */
     /************************************************************************/
 
-    // virtual void initStatePersistence(const std::string & path);
+    /** Keeps the submitted and finished auctions in leveldb databases under
+        path, and loads back what a previous instance left there, so that
+        the wins and events of auctions from before a restart still match.
+
+        Changed entries are written behind: they're only marked dirty as
+        events come in and written in one batch per checkExpiredAuctions(),
+        so a crash loses at most one period of changes.  Entries are
+        decoded in parallel on load.
+    */
+    virtual void initStatePersistence(const std::string & path);
+
+    /** Writes the entries that changed since the last flush. */
+    void flushState();
+
+    /** Finished auctions are kept for an hour after a win, but late events
+        mostly come in within minutes.  Those that have been finished for
+        more than spillAge seconds are dropped from memory, leaving only
+        their key, and reloaded from disk if an event comes in for them.
+
+        With state persistence they're reloaded from the persistent store
+        and path isn't used, so this must be called after
+        initStatePersistence().  Otherwise path is a scratch database that
+        is cleared first.
+    */
+    virtual void initFinishedSpill(double spillAge, const std::string & path);
+
+
+    /************************************************************************/
+    /* HAND OFF                                                             */
+    /************************************************************************/
+
+    /** Hands off the submitted, finished and spilled auctions that aren't
+        owned anymore along with the early wins still waiting for their
+        auction.  The bids of the submitted auctions are detached from our
+        banker and attached to the banker of whoever takes them over.
+        Auctions without a spot id can't be handed off and stay here until
+        they expire.  Calls onHandOff from the calling thread.
+    */
+    virtual void handOff(const IsOwned & isOwned, const OnHandOff & onHandOff);
+
+    virtual void takeOver(HandOff && entry);
 
     static Logging::Category print;
     static Logging::Category error;
@@ -104,6 +151,26 @@ private:
 
     Date expireFinished(const std::pair<Id, Id> & key, const FinishedInfo & info);
 
+    void submittedChanged(const std::pair<Id, Id> & key)
+    {
+        if (submittedDb) dirtySubmitted.insert(key);
+    }
+
+    void finishedChanged(const std::pair<Id, Id> & key)
+    {
+        if (finishedDb) dirtyFinished.insert(key);
+    }
+
+    /** Moves the finished auctions that are old enough to disk. */
+    void spillFinished(Date now);
+
+    /** If the auction was spilled, loads it back into finished.  A null
+        spot id is looked up in spotIdMap.
+    */
+    bool reloadFinished(const Id & auctionId, Id adSpotId);
+
+    Date expireSpilled(const std::pair<Id, Id> & key);
+
 
     /** List of auctions we're currently tracking as submitted.  Note that an
         auction may be both submitted and in flight (if we had submitted a bid
@@ -136,6 +203,23 @@ private:
         entry.
      */
     std::unordered_map<Id, Id> spotIdMap;
+
+    /** Persistent copies of submitted and finished, along with the keys
+        that changed since they were last flushed.
+    */
+    std::shared_ptr<LeveldbPendingPersistence> submittedDb;
+    std::shared_ptr<LeveldbPendingPersistence> finishedDb;
+    std::unordered_set<std::pair<Id, Id> > dirtySubmitted;
+    std::unordered_set<std::pair<Id, Id> > dirtyFinished;
+
+    /** Finished auctions that were spilled to spillDb, with their timeout,
+        and the keys of finished in the order they were finished or
+        reloaded.
+    */
+    double spillAge;
+    std::shared_ptr<LeveldbPendingPersistence> spillDb;
+    TimeoutMap<std::pair<Id, Id>, bool> spilled;
+    std::deque<std::pair<Date, std::pair<Id, Id> > > spillQueue;
 };
 
 } // RTBKIT
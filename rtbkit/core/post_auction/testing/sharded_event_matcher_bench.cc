@@ -0,0 +1,202 @@
+/** sharded_event_matcher_bench.cc                                 -*- C++ -*-
+    Copyright (c) 2014 Datacratic.  All rights reserved.
+
+    Throughput of the sharded event matcher on its own, without any of the
+    networking of the post auction service in the way.
+
+*/
+
+#include "rtbkit/core/post_auction/sharded_event_matcher.h"
+#include "rtbkit/core/banker/null_banker.h"
+#include "soa/utils/print_utils.h"
+
+#include <boost/program_options/options_description.hpp>
+#include <boost/program_options/parsers.hpp>
+#include <boost/program_options/variables_map.hpp>
+#include <thread>
+#include <atomic>
+
+using namespace std;
+using namespace ML;
+using namespace Datacratic;
+using namespace RTBKIT;
+
+
+/******************************************************************************/
+/* CONFIG                                                                     */
+/******************************************************************************/
+
+struct Config
+{
+    Config() : shards(4), feeders(2), auctions(1000000) {}
+
+    size_t shards;
+    size_t feeders;
+    size_t auctions;
+    std::vector<int> cpus;
+};
+
+Config getConfig(int argc, char** argv)
+{
+    using namespace boost::program_options;
+
+    Config config;
+
+    options_description opt;
+    opt.add_options()
+        ("shards,s", value<size_t>(&config.shards))
+        ("feeders,f", value<size_t>(&config.feeders))
+        ("auctions,n", value<size_t>(&config.auctions))
+        ("cpus,c", value< std::vector<int> >(&config.cpus)->multitoken())
+        ("help,h","print this message");
+
+    variables_map vm;
+    store(command_line_parser(argc, argv).options(opt).run(), vm);
+    notify(vm);
+
+    if (vm.count("help")) {
+        cerr << opt << endl;
+        exit(1);
+    }
+
+    return config;
+}
+
+
+/******************************************************************************/
+/* EVENTS                                                                     */
+/******************************************************************************/
+
+std::string makeBidRequest(Id auctionId)
+{
+    BidRequest bidRequest;
+
+    AdSpot spot;
+    spot.id = Id(1);
+    spot.formats.push_back(Format(300,250));
+    bidRequest.imp.push_back(spot);
+
+    bidRequest.auctionId = auctionId;
+    bidRequest.exchange = "mock";
+    bidRequest.timestamp = Date::now();
+
+    return bidRequest.toJsonStr();
+}
+
+std::shared_ptr<SubmittedAuctionEvent> makeAuction(Id auctionId)
+{
+    auto event = std::make_shared<SubmittedAuctionEvent>();
+
+    event->auctionId = auctionId;
+    event->adSpotId = Id(1);
+    event->lossTimeout = Date::now().plusSeconds(3600);
+    event->bidRequestStr = makeBidRequest(auctionId);
+    event->bidRequestStrFormat = "datacratic";
+    event->bidResponse = Auction::Response(USD_CPM(2), 1, AccountKey("a.b.c"));
+    event->bidResponse.bidData = "{\"bids\":[{\"spotIndex\":0}]}";
+
+    return event;
+}
+
+std::shared_ptr<PostAuctionEvent> makeWin(const SubmittedAuctionEvent& auction)
+{
+    auto event = std::make_shared<PostAuctionEvent>();
+
+    event->type = PAE_WIN;
+    event->auctionId = auction.auctionId;
+    event->adSpotId = auction.adSpotId;
+    event->winPrice = USD_CPM(1);
+    event->timestamp = Date::now();
+    event->account = auction.bidResponse.account;
+    event->bidTimestamp = Date::now();
+
+    return event;
+}
+
+
+/******************************************************************************/
+/* MAIN                                                                       */
+/******************************************************************************/
+
+int main(int argc, char* argv[])
+{
+    SimpleEventMatcher::print.deactivate();
+    MessageLoopLogs::print.deactivate();
+
+    auto config = getConfig(argc, argv);
+
+    auto events = std::make_shared<NullEventService>();
+    ShardedEventMatcher matcher("bench", events);
+    matcher.init(config.shards, config.cpus);
+    matcher.setBanker(std::make_shared<NullBanker>());
+    matcher.setWinTimeout(3600);
+    matcher.setAuctionTimeout(3600);
+
+    std::atomic<size_t> matched(0), failed(0);
+    matcher.onMatchedWinLoss = [&] (std::shared_ptr<MatchedWinLoss>) { ++matched; };
+    matcher.onUnmatchedEvent = [&] (std::shared_ptr<UnmatchedEvent>) { ++failed; };
+    matcher.onError = [&] (std::shared_ptr<PostAuctionErrorEvent>) { ++failed; };
+
+    MessageLoop loop;
+    loop.addSource("matcher", matcher);
+    loop.start();
+    matcher.start();
+
+    // Build everything up front so that we only time the matcher.
+    size_t perFeeder = config.auctions / config.feeders;
+    size_t total = perFeeder * config.feeders;
+
+    std::vector< std::vector<std::shared_ptr<SubmittedAuctionEvent> > >
+        auctions(config.feeders);
+    std::vector< std::vector<std::shared_ptr<PostAuctionEvent> > >
+        wins(config.feeders);
+    std::vector<size_t> perShard(config.shards, 0);
+
+    for (size_t i = 0; i < config.feeders; ++i) {
+        for (size_t j = 0; j < perFeeder; ++j) {
+            Id auctionId((i << 40) + j + 1);
+            auctions[i].push_back(makeAuction(auctionId));
+            wins[i].push_back(makeWin(*auctions[i].back()));
+            perShard[auctionId.hash() % config.shards] += 2;
+        }
+    }
+
+    std::cerr << "feeding " << printValue(total) << " auctions and wins"
+        << std::endl;
+
+    Date start = Date::now();
+
+    std::vector<std::thread> feeders;
+    for (size_t i = 0; i < config.feeders; ++i) {
+        feeders.emplace_back([&, i] {
+                    for (size_t j = 0; j < perFeeder; ++j) {
+                        matcher.doAuction(std::move(auctions[i][j]));
+                        matcher.doEvent(std::move(wins[i][j]));
+                    }
+                });
+    }
+
+    for (auto& feeder : feeders) feeder.join();
+    double fed = Date::now().secondsSince(start);
+
+    while (matched + failed < total)
+        std::this_thread::sleep_for(std::chrono::milliseconds(1));
+    double elapsed = Date::now().secondsSince(start);
+
+    matcher.shutdown();
+    loop.shutdown();
+
+    size_t busiest = *std::max_element(perShard.begin(), perShard.end());
+
+    std::cerr << "\n"
+        << printValue(config.shards) << " Shards\n"
+        << printValue(config.feeders) << " Feeders\n"
+        << printValue(fed) << " Feed seconds\n"
+        << printValue(elapsed) << " Total seconds\n"
+        << printValue(size_t(matched)) << " Matched\n"
+        << printValue(size_t(failed)) << " Failed\n"
+        << printValue(2 * total / elapsed) << " Events/sec\n"
+        << printValue(2 * total / elapsed / config.shards) << " Events/sec/shard\n"
+        << printValue(busiest / elapsed) << " Events/sec on busiest shard\n"
+        << std::endl;
+}
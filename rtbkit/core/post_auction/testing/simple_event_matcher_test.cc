@@ -0,0 +1,377 @@
+/** simple_event_matcher_test.cc                                 -*- C++ -*-
+    Copyright (c) 2014 Datacratic.  All rights reserved.
+
+    Tests for the state the event matcher keeps across restarts.
+
+*/
+
+#define BOOST_TEST_MAIN
+#define BOOST_TEST_DYN_LINK
+
+#include "rtbkit/core/post_auction/simple_event_matcher.h"
+#include "rtbkit/core/banker/null_banker.h"
+#include "jml/utils/guard.h"
+
+#include <boost/test/unit_test.hpp>
+#include <boost/filesystem.hpp>
+#include <map>
+#include <mutex>
+#include <thread>
+
+using namespace std;
+using namespace ML;
+using namespace Datacratic;
+using namespace RTBKIT;
+
+
+namespace {
+
+/** Keeps the last value of every level and the total of every count. */
+struct TestEvents : public EventService
+{
+    virtual void onEvent(const std::string & name,
+                         const char * event,
+                         EventType type,
+                         float value)
+    {
+        std::lock_guard<std::mutex> guard(lock);
+        if (type == ET_LEVEL) values[event] = value;
+        else values[event] += value;
+    }
+
+    double operator [] (const std::string & event)
+    {
+        std::lock_guard<std::mutex> guard(lock);
+        auto it = values.find(event);
+        return it == values.end() ? 0.0 : it->second;
+    }
+
+    void clear()
+    {
+        std::lock_guard<std::mutex> guard(lock);
+        values.clear();
+    }
+
+    std::mutex lock;
+    std::map<std::string, double> values;
+};
+
+std::shared_ptr<SubmittedAuctionEvent>
+makeAuction(Id auctionId, double lossTimeout = 3600)
+{
+    BidRequest bidRequest;
+
+    AdSpot spot;
+    spot.id = Id(1);
+    spot.formats.push_back(Format(300,250));
+    bidRequest.imp.push_back(spot);
+
+    bidRequest.auctionId = auctionId;
+    bidRequest.exchange = "mock";
+    bidRequest.timestamp = Date::now();
+
+    auto event = std::make_shared<SubmittedAuctionEvent>();
+
+    event->auctionId = auctionId;
+    event->adSpotId = Id(1);
+    event->lossTimeout = Date::now().plusSeconds(lossTimeout);
+    event->bidRequestStr = bidRequest.toJsonStr();
+    event->bidRequestStrFormat = "datacratic";
+    event->bidResponse = Auction::Response(USD_CPM(2), 1, AccountKey("a.b.c"));
+    event->bidResponse.agent = "agent";
+    event->bidResponse.bidData = "{\"bids\":[{\"spotIndex\":0}]}";
+
+    return event;
+}
+
+std::shared_ptr<PostAuctionEvent> makeWin(Id auctionId)
+{
+    auto event = std::make_shared<PostAuctionEvent>();
+
+    event->type = PAE_WIN;
+    event->auctionId = auctionId;
+    event->adSpotId = Id(1);
+    event->winPrice = USD_CPM(1);
+    event->timestamp = Date::now();
+    event->account = AccountKey("a.b.c");
+    event->bidTimestamp = Date::now();
+
+    return event;
+}
+
+/** Keeps track of the amounts attached to bids and hands out a fixed
+    amount for the bids that are detached.
+*/
+struct TestBanker : public NullBanker
+{
+    TestBanker(Amount detached = Amount()) : detached(detached) {}
+
+    virtual void attachBid(const AccountKey & account,
+                           const std::string & item,
+                           Amount amountAuthorized)
+    {
+        attached[item] = amountAuthorized;
+    }
+
+    virtual Amount detachBid(const AccountKey & account,
+                             const std::string & item)
+    {
+        detachedItems.push_back(item);
+        return detached;
+    }
+
+    Amount detached;
+    std::map<std::string, Amount> attached;
+    std::vector<std::string> detachedItems;
+};
+
+/** Matcher along with everything it sends out. */
+struct TestMatcher
+{
+    TestMatcher(std::shared_ptr<Banker> banker = std::make_shared<NullBanker>()) :
+        events(std::make_shared<TestEvents>()),
+        matcher("test", events),
+        errors(0)
+    {
+        matcher.setBanker(banker);
+        matcher.onMatchedWinLoss = [&] (std::shared_ptr<MatchedWinLoss> event)
+            {
+                matched.push_back(event);
+            };
+        matcher.onError = [&] (std::shared_ptr<PostAuctionErrorEvent> event)
+            {
+                cerr << "error: " << event->key << ": " << event->message
+                     << endl;
+                ++errors;
+            };
+    }
+
+    std::shared_ptr<TestEvents> events;
+    SimpleEventMatcher matcher;
+    std::vector< std::shared_ptr<MatchedWinLoss> > matched;
+    int errors;
+};
+
+} // file scope
+
+
+BOOST_AUTO_TEST_CASE( test_persistence_round_trip )
+{
+    SimpleEventMatcher::print.deactivate();
+
+    string path = "./tmp/simple_event_matcher_test_persistence";
+    boost::filesystem::remove_all(path);
+    ML::Call_Guard guard([&] () { boost::filesystem::remove_all(path); });
+
+    {
+        TestMatcher test;
+        test.matcher.initStatePersistence(path);
+        test.matcher.setWinTimeout(3600);
+
+        // 1 stays submitted, 2 is won and 3 times out while we're down.
+        test.matcher.doAuction(makeAuction(Id(1)));
+        test.matcher.doAuction(makeAuction(Id(2)));
+        test.matcher.doAuction(makeAuction(Id(3), 0.5));
+        test.matcher.doEvent(makeWin(Id(2)));
+
+        // 4 is finished but has expired by the time we're back.
+        test.matcher.setWinTimeout(0.5);
+        test.matcher.doAuction(makeAuction(Id(4)));
+        test.matcher.doEvent(makeWin(Id(4)));
+
+        BOOST_CHECK_EQUAL(test.matched.size(), 2);
+
+        // Written behind: nothing is in the databases before the flush,
+        // which writes the four submitted keys (two of them as erases) and
+        // the two finished ones.
+        test.matcher.flushState();
+        BOOST_CHECK_EQUAL((*test.events)["persistence.keysWritten"], 6);
+    }
+
+    std::this_thread::sleep_for(std::chrono::seconds(1));
+
+    {
+        TestMatcher test;
+        test.matcher.initStatePersistence(path);
+
+        // 4 had expired so it's dropped on restore and not counted.
+        auto & events = *test.events;
+        BOOST_CHECK_EQUAL(events["persistence.restoredSubmitted"], 2);
+        BOOST_CHECK_EQUAL(events["persistence.restoredFinished"], 1);
+
+        // 3 expires as an inferred loss and joins
+        // 2 in the finished auctions.
+        test.matcher.checkExpiredAuctions();
+        BOOST_CHECK_EQUAL(events["submittedSize"], 2);
+        BOOST_CHECK_EQUAL(events["finishedSize"], 2);
+
+        BOOST_REQUIRE_EQUAL(test.matched.size(), 1);
+        BOOST_CHECK_EQUAL(test.matched[0]->auctionId, Id(3));
+        BOOST_CHECK_EQUAL(test.matched[0]->type, MatchedWinLoss::Loss);
+        BOOST_CHECK_EQUAL(test.matched[0]->confidence,
+                          MatchedWinLoss::Inferred);
+
+        // The win for 1 still matches its auction and the one for 2 is
+        // recognized as a duplicate.
+        test.matcher.doEvent(makeWin(Id(1)));
+        BOOST_REQUIRE_EQUAL(test.matched.size(), 2);
+        BOOST_CHECK_EQUAL(test.matched[1]->auctionId, Id(1));
+        BOOST_CHECK_EQUAL(test.matched[1]->type, MatchedWinLoss::Win);
+
+        test.matcher.doEvent(makeWin(Id(2)));
+        BOOST_CHECK_EQUAL(test.matched.size(), 2);
+        BOOST_CHECK_EQUAL(events["bidResult.WIN.duplicate"], 1);
+
+        // 4 is gone so its win is taken for one that beat its auction.
+        test.matcher.doEvent(makeWin(Id(4)));
+        BOOST_CHECK_EQUAL(events["bidResult.WIN.noBidSubmitted"], 1);
+
+        BOOST_CHECK_EQUAL(test.errors, 0);
+    }
+
+    {
+        TestMatcher test;
+        test.matcher.initStatePersistence(path);
+
+        // What happened since the last restart was persisted as well:
+        // only the early win for 4 is left submitted.
+        auto & events = *test.events;
+        BOOST_CHECK_EQUAL(events["persistence.restoredSubmitted"], 1);
+        BOOST_CHECK_EQUAL(events["persistence.restoredFinished"], 3);
+    }
+}
+
+BOOST_AUTO_TEST_CASE( test_spill_reload_expiry )
+{
+    SimpleEventMatcher::print.deactivate();
+
+    string path = "./tmp/simple_event_matcher_test_spill";
+    boost::filesystem::remove_all(path);
+    ML::Call_Guard guard([&] () { boost::filesystem::remove_all(path); });
+
+    // The checks are made as of explicit times rather than waiting.
+    Date start = Date::now();
+
+    TestMatcher test;
+    test.matcher.initFinishedSpill(60, path);
+    test.matcher.setWinTimeout(3600);
+    auto & events = *test.events;
+
+    test.matcher.doAuction(makeAuction(Id(1)));
+    test.matcher.doEvent(makeWin(Id(1)));
+
+    // Too young to be spilled.
+    test.matcher.checkExpiredAuctions(start);
+    BOOST_CHECK_EQUAL(events["finishedSpilled"], 0);
+
+    test.matcher.checkExpiredAuctions(start.plusSeconds(61));
+    BOOST_CHECK_EQUAL(events["finishedSpilled"], 1);
+
+    test.matcher.checkExpiredAuctions(start.plusSeconds(61));
+    BOOST_CHECK_EQUAL(events["finishedSize"], 0);
+    BOOST_CHECK_EQUAL(events["finishedSpilledSize"], 1);
+
+    // A late event reloads it and it spills again once it's idle.
+    test.matcher.doEvent(makeWin(Id(1)));
+    BOOST_CHECK_EQUAL(events["finishedReloaded"], 1);
+    BOOST_CHECK_EQUAL(events["bidResult.WIN.duplicate"], 1);
+
+    test.matcher.checkExpiredAuctions(start.plusSeconds(62));
+    BOOST_CHECK_EQUAL(events["finishedSpilled"], 2);
+
+    // Spilled auctions still expire with their win timeout.
+    test.matcher.checkExpiredAuctions(start.plusSeconds(3700));
+    BOOST_CHECK_EQUAL(events["finishedAuctionExpiry"], 1);
+
+    test.matcher.checkExpiredAuctions(start.plusSeconds(3700));
+    BOOST_CHECK_EQUAL(events["finishedSpilledSize"], 0);
+
+    test.matcher.doEvent(makeWin(Id(1)));
+    BOOST_CHECK_EQUAL(events["finishedReloaded"], 1);
+    BOOST_CHECK_EQUAL(events["bidResult.WIN.noBidSubmitted"], 1);
+
+    BOOST_CHECK_EQUAL(test.matched.size(), 1);
+    BOOST_CHECK_EQUAL(test.errors, 0);
+}
+
+BOOST_AUTO_TEST_CASE( test_spill_restored )
+{
+    SimpleEventMatcher::print.deactivate();
+
+    string path = "./tmp/simple_event_matcher_test_spill_restored";
+    boost::filesystem::remove_all(path);
+    ML::Call_Guard guard([&] () { boost::filesystem::remove_all(path); });
+
+    {
+        TestMatcher test;
+        test.matcher.initStatePersistence(path);
+        test.matcher.setWinTimeout(3600);
+
+        // Won two minutes before the restart.
+        auto win = makeWin(Id(1));
+        win->timestamp = Date::now().plusSeconds(-120);
+
+        test.matcher.doAuction(makeAuction(Id(1)));
+        test.matcher.doEvent(win);
+        test.matcher.flushState();
+    }
+
+    TestMatcher test;
+    test.matcher.initStatePersistence(path);
+    test.matcher.initFinishedSpill(60, "");
+    auto & events = *test.events;
+
+    // The restored auction was won long enough ago to spill right away.
+    test.matcher.checkExpiredAuctions();
+    BOOST_CHECK_EQUAL(events["finishedSize"], 1);
+    BOOST_CHECK_EQUAL(events["finishedSpilled"], 1);
+
+    // It's reloaded from the persistent store.
+    test.matcher.doEvent(makeWin(Id(1)));
+    BOOST_CHECK_EQUAL(events["finishedReloaded"], 1);
+    BOOST_CHECK_EQUAL(events["bidResult.WIN.duplicate"], 1);
+
+    BOOST_CHECK_EQUAL(test.errors, 0);
+}
+
+BOOST_AUTO_TEST_CASE( test_hand_off_amount )
+{
+    SimpleEventMatcher::print.deactivate();
+
+    // Part of the 2 CPM bid was already spent where it was first attached.
+    auto fromBanker = std::make_shared<TestBanker>(USD_CPM(0.5));
+    auto toBanker = std::make_shared<TestBanker>();
+
+    TestMatcher from(fromBanker);
+    TestMatcher to(toBanker);
+
+    from.matcher.doAuction(makeAuction(Id(1)));
+
+    std::vector<EventMatcher::HandOff> entries;
+    from.matcher.handOff(
+            [] (const Id &) { return false; },
+            [&] (EventMatcher::HandOff && entry)
+            {
+                entries.push_back(std::move(entry));
+            });
+
+    BOOST_REQUIRE_EQUAL(entries.size(), 1);
+    BOOST_CHECK_EQUAL(entries[0].kind, EventMatcher::HandOff::SUBMITTED);
+    BOOST_REQUIRE_EQUAL(fromBanker->detachedItems.size(), 1);
+
+    for (auto & entry : entries)
+        to.matcher.takeOver(std::move(entry));
+
+    // What's attached on the other side is what was detached, not the
+    // bid's maximum price.
+    const std::string & item = fromBanker->detachedItems[0];
+    BOOST_REQUIRE_EQUAL(toBanker->attached.count(item), 1);
+    BOOST_CHECK_EQUAL(toBanker->attached[item], USD_CPM(0.5));
+
+    to.matcher.doEvent(makeWin(Id(1)));
+    BOOST_REQUIRE_EQUAL(to.matched.size(), 1);
+    BOOST_CHECK_EQUAL(to.matched[0]->type, MatchedWinLoss::Win);
+
+    BOOST_CHECK_EQUAL(from.errors, 0);
+    BOOST_CHECK_EQUAL(to.errors, 0);
+}
@@ -1,2 +1,4 @@
 $(eval $(call program,post_auction_redis_bench,post_auction redis))
 $(eval $(call program,post_auction_sharding_bench,post_auction boost_program_options))
+$(eval $(call program,sharded_event_matcher_bench,post_auction boost_program_options))
+$(eval $(call test,simple_event_matcher_test,post_auction boost_filesystem,boost))
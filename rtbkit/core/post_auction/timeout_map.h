@@ -13,8 +13,10 @@
 
 #include "soa/types/date.h"
 
+#include <map>
 #include <set>
 #include <queue>
+#include <unordered_map>
 
 namespace RTBKIT {
 
@@ -50,6 +52,13 @@ struct TimeoutMap
         return it->second.value;
     }
 
+    Datacratic::Date getTimeout(const Key& key) const
+    {
+        auto it = map.find(key);
+        ExcCheck(it != map.end(), "key not present in the timeout map.");
+        return it->second.timeout;
+    }
+
     bool emplace(Key key, Value value, Datacratic::Date timeout)
     {
         auto ret = map.insert(std::make_pair(
@@ -84,6 +93,16 @@ struct TimeoutMap
         return map.erase(key);
     }
 
+    /** Calls fn(key, value, timeout) for every entry; fn must not modify the
+        map.
+    */
+    template<typename Fn>
+    void forEach(const Fn& fn) const
+    {
+        for (const auto& entry : map)
+            fn(entry.first, entry.second.value, entry.second.timeout);
+    }
+
     template<typename Fn>
     size_t expire(const Fn& fn, Datacratic::Date now = Datacratic::Date::now())
     {
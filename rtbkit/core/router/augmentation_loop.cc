@@ -15,6 +15,7 @@
 #include <iostream>
 #include <boost/make_shared.hpp>
 #include "rtbkit/core/agent_configuration/agent_config.h"
+#include "rtbkit/common/auction_tracer.h"
 
 
 using namespace std;
@@ -167,6 +168,9 @@ handleAugmentorMessage(const std::vector<std::string> & message)
     else if (type == "RESPONSE") {
         doResponse(message);
     }
+    else if (type == "RESPONSES") {
+        doResponses(message);
+    }
     else throw ML::Exception("error handling unknown "
                              "augmentor message of type "
                              + type);
@@ -412,7 +416,9 @@ doAugmentation(const std::shared_ptr<Entry> & entry)
         ML::DB::Store_Writer writer(availableAgentsStr);
         writer.save(agents);
 
-        // Send the message to the augmentor
+        // Send the message to the augmentor along with how long it has to
+        // respond so that it can drop requests we'll have given up on.
+        Date sent = Date::now();
         toAugmentors.sendMessage(
                 instance->addr,
                 "AUGMENT", "1.0", *it,
@@ -420,7 +426,8 @@ doAugmentation(const std::shared_ptr<Entry> & entry)
                 entry->info->auction->requestStrFormat,
                 entry->info->auction->requestStr,
                 availableAgentsStr.str(),
-                Date::now());
+                sent,
+                sent.secondsUntil(entry->timeout) * 1000.0);
 
         sentToAugmentor = true;
     }
@@ -470,7 +477,8 @@ doConfig(const std::vector<std::string> & message)
 
     updateAllAugmentors();
 
-    toAugmentors.sendMessage(addr, "CONFIGOK");
+    // Let the augmentor know that we accept batched responses.
+    toAugmentors.sendMessage(addr, "CONFIGOK", "RESPONSES");
 }
 
 
@@ -529,11 +537,42 @@ doResponse(const std::vector<std::string> & message)
     const string & version = message[2];
     ExcCheckEqual(version, "1.0", "unknown response version");
 
-    const std::string & addr = message[0];
-    Date startTime = Date::parseSecondsSinceEpoch(message[3]);
-    Id id(message[4]);
-    const std::string & augmentor = message[5];
-    const std::string & augmentation = message[6];
+    handleResponse(message[0], message[3], message[4], message[5], message[6]);
+}
+
+/** Same as doResponse except that the four fields of each response follow
+    each other after the version.
+*/
+void
+AugmentationLoop::
+doResponses(const std::vector<std::string> & message)
+{
+    ExcCheckGreaterEqual(message.size(), 7, "responses message is too short");
+    ExcCheckEqual((message.size() - 3) % 4, 0,
+                  "responses message has wrong size");
+
+    const string & version = message[2];
+    ExcCheckEqual(version, "1.0", "unknown responses version");
+
+    recordLevel((message.size() - 3) / 4, "augmentation.responseBatchSize");
+
+    for (size_t i = 3; i < message.size(); i += 4) {
+        recordEvent("augmentation.response");
+        handleResponse(message[0], message[i], message[i + 1],
+                       message[i + 2], message[i + 3]);
+    }
+}
+
+void
+AugmentationLoop::
+handleResponse(const std::string & addr,
+               const std::string & startTimeStr,
+               const std::string & idStr,
+               const std::string & augmentor,
+               const std::string & augmentation)
+{
+    Date startTime = Date::parseSecondsSinceEpoch(startTimeStr);
+    Id id(idStr);
 
     ML::Timer timer;
 
@@ -555,9 +594,13 @@ doResponse(const std::vector<std::string> & message)
     recordLevel(timer.elapsed_wall(), "responseParseTimeMs");
 
     {
-        double timeTakenMs = startTime.secondsUntil(Date::now()) * 1000.0;
+        Date now = Date::now();
+        double timeTakenMs = startTime.secondsUntil(now) * 1000.0;
         string eventName = "augmentor." + augmentor + ".timeTakenMs";
         recordEvent(eventName.c_str(), ET_OUTCOME, timeTakenMs);
+
+        AuctionTracer::instance().record(
+                "router.augmentation", id, startTime, now, augmentor.c_str());
     }
 
     {
@@ -602,6 +645,7 @@ void
 AugmentationLoop::
 augmentationExpired(const Id & id, const Entry & entry)
 {
+    AuctionTracer::instance().trigger(id, "augmentationTimeout");
     entry.onFinished(entry.info);
 }                     
 
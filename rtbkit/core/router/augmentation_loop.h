@@ -174,6 +174,15 @@ private:
     /** Handle a response from an augmentation. */
     void doResponse(const std::vector<std::string> & message);
 
+    /** Handle a batch of responses sent in a single RESPONSES frame. */
+    void doResponses(const std::vector<std::string> & message);
+
+    void handleResponse(const std::string & addr,
+                        const std::string & startTimeStr,
+                        const std::string & idStr,
+                        const std::string & augmentor,
+                        const std::string & augmentation);
+
     /** Handle a message asking for augmentation. */
     void doAugment(const std::vector<std::string> & message);
 
@@ -27,7 +27,7 @@ namespace RTBKIT {
 /******************************************************************************/
 
 FilterPool::
-FilterPool() : data(new Data()), events(nullptr) {}
+FilterPool() : data(&copies[0]), events(nullptr) {}
 
 
 void
@@ -38,32 +38,46 @@ init(EventRecorder* events)
 }
 
 
-bool
 FilterPool::
-setData(Data*& oldData, unique_ptr<Data>& newData)
+~FilterPool()
 {
-    if (!data.compare_exchange_strong(oldData, newData.get()))
-        return false;
-
-    newData.release();
-    gc.defer([=] { delete oldData; });
-
-    return true;
+    // Wait for any stragglers in filter() before the copies go away.
+    gc.visibleBarrier();
 }
 
 
+template<typename Fn>
+void
 FilterPool::
-~FilterPool()
+update(const Fn& fn)
 {
-    {
-        GcLockBase::SharedGuard guard(gc);
-
-        unique_ptr<Data> nil;
-        Data* current = data.load();
-        while (!setData(current, nil));
+    std::lock_guard<std::mutex> guard(writeLock);
+
+    Data* active = data.load();
+    Data* inactive = active == &copies[0] ? &copies[1] : &copies[0];
+
+    // A filter can reject a config part way through the update so the copy
+    // is rebuilt from the untouched one rather than left half updated.
+    try {
+        fn(*inactive);
+    } catch (...) {
+        inactive->copyFrom(*active);
+        throw;
     }
 
-    gc.deferBarrier();
+    data.store(inactive);
+
+    // Must not be called while holding a guard on gc which is why the writers
+    // don't take one.
+    gc.visibleBarrier();
+
+    // The update went through on the other copy which is now live so we only
+    // need to bring this one back in sync if it fails here.
+    try {
+        fn(*active);
+    } catch (...) {
+        active->copyFrom(*inactive);
+    }
 }
 
 
@@ -145,15 +159,9 @@ void
 FilterPool::
 addFilter(const string& name)
 {
-    GcLockBase::SharedGuard guard(gc);
-
-    Data* oldData = data.load();
-    unique_ptr<Data> newData;
-
-    do {
-        newData.reset(new Data(*oldData));
-        newData->addFilter(FilterRegistry::makeFilter(name));
-    } while (!setData(oldData, newData));
+    update([&] (Data& copy) {
+                copy.addFilter(FilterRegistry::makeFilter(name));
+            });
 
     if (events) events->recordHit("filters.addFilter.%s", name);
 }
@@ -163,15 +171,7 @@ void
 FilterPool::
 removeFilter(const string& name)
 {
-    GcLockBase::SharedGuard guard(gc);
-
-    unique_ptr<Data> newData;
-    Data* oldData = data.load();
-
-    do {
-        newData.reset(new Data(*oldData));
-        newData->removeFilter(name);
-    } while (!setData(oldData, newData));
+    update([&] (Data& copy) { copy.removeFilter(name); });
 
     if (events) events->recordHit("filters.removeFilter.%s", name);
 }
@@ -180,21 +180,19 @@ void
 FilterPool::
 initWithDefaultFilters()
 {
-    GcLockBase::SharedGuard guard(gc);
-
-    Data* oldData = data.load();
-    unique_ptr<Data> newData;
+    auto names = FilterRegistry::listFilters();
 
-    do {
-        newData.reset(new Data);
+    update([&] (Data& copy) {
+                while (!copy.filters.empty())
+                    copy.removeFilter(copy.filters.back()->name());
 
-        for (const auto& name: FilterRegistry::listFilters()) {
-            newData->addFilter(FilterRegistry::makeFilter(name));
-            if (events) events->recordHit("filters.addFilter.%s", name);
-        }
-
-    } while (!setData(oldData, newData));
+                for (const auto& name : names)
+                    copy.addFilter(FilterRegistry::makeFilter(name));
+            });
 
+    if (!events) return;
+    for (const auto& name : names)
+        events->recordHit("filters.addFilter.%s", name);
 }
 
 
@@ -203,38 +201,72 @@ unsigned
 FilterPool::
 addConfig(const string& name, const AgentInfo& info)
 {
-    GcLockBase::SharedGuard guard(gc);
+    return applyConfigChanges({ ConfigChange(name, &info) }).front();
+}
 
-    unique_ptr<Data> newData;
-    Data* oldData = data.load();
-    unsigned index;
 
-    do {
-        newData.reset(new Data(*oldData));
-        index = newData->addConfig(name, info);
-    } while (!setData(oldData, newData));
+void
+FilterPool::
+removeConfig(const string& name)
+{
+    applyConfigChanges({ ConfigChange(name) });
+}
 
-    if (events) events->recordHit("filters.addConfig");
 
-    return index;
-}
+vector<int>
+FilterPool::
+applyConfigChanges(const vector<ConfigChange>& changes)
+{
+    vector<int> indexes(changes.size(), -1);
+    if (changes.empty()) return indexes;
+
+    // Both copies go through the same sequence of operations so the indexes
+    // handed out are identical.
+    update([&] (Data& copy) {
+                for (size_t i = 0; i < changes.size(); ++i) {
+                    const ConfigChange& change = changes[i];
+                    if (change.info)
+                        indexes[i] = copy.addConfig(change.name, *change.info);
+                    else copy.removeConfig(change.name);
+                }
+            });
 
+    if (!events) return indexes;
 
-void
+    for (const ConfigChange& change : changes) {
+        if (change.info) events->recordHit("filters.addConfig");
+        else events->recordHit("filters.removeConfig");
+    }
+    events->recordLevel(changes.size(), "filters.configBatchSize");
+
+    return indexes;
+}
+
+vector<int>
 FilterPool::
-removeConfig(const string& name)
+applyConfigChanges(
+        const vector<ConfigChange>& changes, const OnRejected& onRejected)
 {
-    GcLockBase::SharedGuard guard(gc);
+    try {
+        return applyConfigChanges(changes);
+    }
+    catch (const std::exception&) {
+        // The pool was left as it was so the changes can be retried.
+    }
 
-    unique_ptr<Data> newData;
-    Data* oldData = data.load();
+    vector<int> indexes(changes.size(), -1);
 
-    do {
-        newData.reset(new Data(*oldData));
-        newData->removeConfig(name);
-    } while (!setData(oldData, newData));
+    for (size_t i = 0; i < changes.size(); ++i) {
+        try {
+            indexes[i] = applyConfigChanges({ changes[i] }).front();
+        }
+        catch (const std::exception& exc) {
+            if (events) events->recordHit("filters.rejectedConfig");
+            onRejected(changes[i], exc);
+        }
+    }
 
-    if (events) events->recordHit("filters.removeConfig");
+    return indexes;
 }
 
 
@@ -243,20 +275,31 @@ removeConfig(const string& name)
 /******************************************************************************/
 
 FilterPool::Data::
-Data(const Data& other) :
-    configs(other.configs),
-    activeConfigs(other.activeConfigs)
+~Data()
 {
-    filters.reserve(other.filters.size());
-    for (FilterBase* filter : other.filters)
-        filters.push_back(filter->clone());
+    for (FilterBase* filter : filters) delete filter;
 }
 
-
+void
 FilterPool::Data::
-~Data()
+copyFrom(const Data& other)
 {
+    vector<FilterBase*> cloned;
+    cloned.reserve(other.filters.size());
+
+    try {
+        for (FilterBase* filter : other.filters)
+            cloned.push_back(filter->clone());
+    } catch (...) {
+        for (FilterBase* filter : cloned) delete filter;
+        throw;
+    }
+
     for (FilterBase* filter : filters) delete filter;
+    filters.swap(cloned);
+
+    configs = other.configs;
+    activeConfigs = other.activeConfigs;
 }
 
 ssize_t
@@ -326,7 +369,7 @@ addFilter(FilterBase* filter)
     ConfigSet active = activeConfigs.aggregate();
     for (size_t cfgId = active.next();
          cfgId < active.size();
-         cfgId += active.next(cfgId + 1))
+         cfgId = active.next(cfgId + 1))
     {
         filter->addConfig(cfgId, configs[cfgId].config);
     }
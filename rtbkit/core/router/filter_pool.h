@@ -12,6 +12,8 @@
 #include "soa/gc/gc_lock.h"
 
 #include <atomic>
+#include <functional>
+#include <mutex>
 #include <vector>
 #include <memory>
 #include <string>
@@ -76,24 +78,62 @@ struct FilterPool
             const ConfigSet& mask = ConfigSet(true));
 
 
-    // \todo Need batch interfaces of these to alleviate overhead.
     void addFilter(const std::string& name);
     void removeFilter(const std::string& name);
     void initWithDefaultFilters();
 
 
-    // \todo Need batch interfaces to alleviate overhead.
     unsigned addConfig(const std::string& name, const AgentInfo& info);
     void removeConfig(const std::string& name);
 
+    /** Change to the config of an agent; a null info removes the agent. */
+    struct ConfigChange
+    {
+        ConfigChange(std::string name, const AgentInfo* info = nullptr) :
+            name(std::move(name)), info(info)
+        {}
+
+        std::string name;
+        const AgentInfo* info;
+    };
+
+    /** Applies all the changes, in order, as a single update. Returns the
+        index of each added config or -1 for the removals.
+     */
+    std::vector<int> applyConfigChanges(const std::vector<ConfigChange>& changes);
+
+    typedef std::function<void(const ConfigChange&, const std::exception&)>
+        OnRejected;
+
+    /** Same as above except that a change that throws doesn't hold back the
+        others: the changes are then applied again one at a time, skipping
+        the ones that throw which are passed to onRejected and get an index
+        of -1.
+     */
+    std::vector<int> applyConfigChanges(
+            const std::vector<ConfigChange>& changes,
+            const OnRejected& onRejected);
+
 private:
 
+    /** Filters are never copied. Instead there are two copies of the data:
+        filter() reads the active one while updates are made to the other
+        which then becomes active. Once the readers of the previously active
+        copy are gone, the same updates are made to it. An update then only
+        costs twice the size of the configs it touches and a batch of
+        updates only waits for the readers once.
+     */
     struct Data
     {
         Data() {}
-        Data(const Data& other);
         ~Data();
 
+        Data(const Data&) = delete;
+        Data& operator=(const Data&) = delete;
+
+        /** Replaces the content with a copy of other, cloning its filters. */
+        void copyFrom(const Data& other);
+
         ssize_t findConfig(const std::string& name) const;
         unsigned addConfig(const std::string& name, const AgentInfo& info);
         void removeConfig(const std::string& name);
@@ -109,13 +149,20 @@ private:
         CreativeMatrix activeConfigs;
     };
 
-    bool setData(Data*&, std::unique_ptr<Data>&);
+    /** Calls fn on both copies of the data, see Data. If fn throws on the
+        first copy, that copy is restored from the other one and the
+        exception is rethrown, leaving the pool as it was.
+     */
+    template<typename Fn>
+    void update(const Fn& fn);
+
     void recordDiff(const Data* data, const FilterBase* f, const ConfigSet& diff);
     uint64_t recordTime(uint64_t ticks, const FilterBase* filter);
 
+    Data copies[2];
     std::atomic<Data*> data;
-    std::vector< std::shared_ptr<AgentConfig> > configs;
     Datacratic::GcLock gc;
+    std::mutex writeLock;
 
     EventRecorder* events;
 };
@@ -11,6 +11,7 @@
 
 LIB_FILTERS_SOURCES := \
 	static_filters.cc \
+	segment_index.cc \
         creative_filters.cc
 
 LIB_FILTERS_LINK := \
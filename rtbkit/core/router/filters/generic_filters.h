@@ -10,6 +10,7 @@
 
 #include "rtbkit/core/agent_configuration/agent_config.h"
 #include "rtbkit/core/agent_configuration/include_exclude.h"
+#include "rtbkit/core/router/filters/segment_index.h"
 #include "rtbkit/common/filter.h"
 
 
@@ -262,13 +263,17 @@ struct DomainFilter
     ConfigSet filter(const Url& host) const
     {
         ConfigSet matches;
-
-        for (const auto& key : getKeys(host)) {
-            auto it = domainMap.find(key);
-            if (it == domainMap.end()) continue;
-
-            matches |= it->second;
-        }
+        if (domainMap.empty()) return matches;
+
+        // Walks the domains of the host straight out of the url; only the
+        // lookup key needs a copy.
+        std::string key;
+        host.forEachDomain([&] (const char* domain, size_t length) {
+                    key.assign(domain, length);
+                    auto it = domainMap.find(key);
+                    if (it != domainMap.end())
+                        matches |= it->second;
+                });
 
         return matches;
     }
@@ -297,22 +302,6 @@ private:
         domainMap[host].reset(cfgIndex);
     }
 
-    std::vector<std::string> getKeys(const Url& host) const
-    {
-        std::vector<std::string> keys;
-
-        std::string domain = host.host();
-        while (true) {
-            keys.push_back(domain);
-
-            size_t pos = domain.find('.');
-            if (pos == std::string::npos) break;
-            domain = domain.substr(pos+1);
-        }
-
-        return keys;
-    }
-
     std::unordered_map<std::string, ConfigSet> domainMap;
 };
 
@@ -471,6 +460,10 @@ private:
 
 /** Segments have quirks and are best handled seperatly from the list filter.
 
+    Integer segments are kept in a SegmentIndex which intersects them with the
+    sorted ints of a SegmentList in one pass. String segments are looked up by
+    their hash (see SegmentList::hashString) and only compared as strings when
+    the hash matches.
  */
 struct SegmentListFilter
 {
@@ -491,39 +484,61 @@ struct SegmentListFilter
 
     ConfigSet filter(int i, const std::string& str) const
     {
-        return i >= 0 ? get(intSet, i) : get(strSet, str);
+        return i >= 0 ?
+            ints.get(i) : get(SegmentList::hashString(str), str);
     }
 
     ConfigSet filter(const SegmentList& segments) const
     {
         ConfigSet configs;
 
-        segments.forEach([&](int i, std::string str, float) {
-                    configs |= filter(i, str);
-                });
+        if (!segments.ints.empty()) {
+            const int* first = &segments.ints[0];
+            configs = ints.filter(first, first + segments.ints.size());
+        }
+
+        for (size_t i = 0; i < segments.strings.size(); ++i)
+            configs |= get(segments.stringHashes[i], segments.strings[i]);
 
         return configs;
     }
 
 private:
 
+    struct StringEntry
+    {
+        std::string str;
+        ConfigSet configs;
+    };
+
     void setConfig(unsigned cfgIndex, const SegmentList& segments, bool value)
     {
-        segments.forEach([&](int i, std::string str, float) {
-                    if (i >= 0) intSet[i].set(cfgIndex, value);
-                    else strSet[str].set(cfgIndex, value);
-                });
+        for (int i : segments.ints)
+            ints.set(i, cfgIndex, value);
+
+        for (size_t i = 0; i < segments.strings.size(); ++i) {
+            const std::string& str = segments.strings[i];
+            auto& entry = strSet[segments.stringHashes[i]];
+
+            if (entry.str.empty()) entry.str = str;
+            else if (entry.str != str) {
+                throw ML::Exception("segments '%s' and '%s' have the same hash",
+                        entry.str.c_str(), str.c_str());
+            }
+
+            entry.configs.set(cfgIndex, value);
+        }
     }
 
-    template<typename K>
-    ConfigSet get(const std::unordered_map<K, ConfigSet>& m, K k) const
+    ConfigSet get(uint64_t hash, const std::string& str) const
     {
-        auto it = m.find(k);
-        return it != m.end() ? it->second : ConfigSet();
+        auto it = strSet.find(hash);
+        if (it == strSet.end() || it->second.str != str) return ConfigSet();
+        return it->second.configs;
     }
 
-    std::unordered_map<int, ConfigSet> intSet;
-    std::unordered_map<std::string, ConfigSet> strSet;
+    SegmentIndex ints;
+    std::unordered_map<uint64_t, StringEntry> strSet;
 };
 
 
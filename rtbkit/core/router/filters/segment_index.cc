@@ -0,0 +1,337 @@
+/** segment_index.cc                                 -*- C++ -*-
+    Copyright (c) 2013 Datacratic.  All rights reserved.
+
+    Compressed bitmap index of the configs that refer to integer segments.
+
+*/
+
+#include "segment_index.h"
+#include "jml/arch/bitops.h"
+
+#include <algorithm>
+
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
+
+using namespace std;
+using namespace ML;
+
+namespace RTBKIT {
+
+
+/******************************************************************************/
+/* MERGE KERNEL                                                               */
+/******************************************************************************/
+
+namespace {
+
+/** Index of the first value of the sorted array [values + i, values + n) that
+    isn't smaller than low.
+ */
+JML_ALWAYS_INLINE size_t
+skipSmaller(const uint16_t* values, size_t i, size_t n, uint16_t low)
+{
+#ifdef __SSE2__
+    // SSE2 only has signed 16 bit compares so both sides are flipped into
+    // the signed range first. Since the values are sorted, the compare yields
+    // a prefix of set lanes which tells how many of them can be skipped.
+    const __m128i flip = _mm_set1_epi16(0x8000);
+    const __m128i key = _mm_xor_si128(_mm_set1_epi16(low), flip);
+
+    for (; i + 8 <= n; i += 8) {
+        __m128i block = _mm_loadu_si128((const __m128i*) (values + i));
+        block = _mm_xor_si128(block, flip);
+
+        unsigned mask = _mm_movemask_epi8(_mm_cmplt_epi16(block, key));
+        if (mask != 0xFFFF)
+            return i + num_bits_set(mask) / 2;
+    }
+#endif
+
+    while (i < n && values[i] < low) ++i;
+    return i;
+}
+
+/** Same as skipSmaller() but through a binary search whose branches compile
+    to conditional moves; the merge jumps around too much for the branches of
+    std::lower_bound to be predicted.
+ */
+JML_ALWAYS_INLINE size_t
+searchSmaller(const uint16_t* values, size_t i, size_t n, uint16_t low)
+{
+    if (i == n) return n;
+
+    const uint16_t* base = values + i;
+    for (size_t size = n - i; size > 1; size -= size / 2)
+        base = base[size / 2] < low ? base + size / 2 : base;
+
+    return (base - values) + (*base < low);
+}
+
+} // namespace anonymous
+
+
+/******************************************************************************/
+/* CONTAINER                                                                  */
+/******************************************************************************/
+
+bool
+SegmentIndex::Container::
+find(uint16_t low, size_t& rank) const
+{
+    if (isBitmap()) {
+        size_t word = low / 64;
+        uint64_t bit = 1ULL << (low % 64);
+        if (!(bits[word] & bit)) return false;
+
+        rank = ranks[word] + num_bits_set(bits[word] & (bit - 1));
+        return true;
+    }
+
+    auto it = lower_bound(values.begin(), values.end(), low);
+    if (it == values.end() || *it != low) return false;
+
+    rank = it - values.begin();
+    return true;
+}
+
+void
+SegmentIndex::Container::
+insert(uint16_t low, uint32_t slot)
+{
+    size_t rank;
+
+    if (isBitmap()) {
+        bits[low / 64] |= 1ULL << (low % 64);
+        updateRanks();
+        find(low, rank);
+    }
+    else {
+        auto it = lower_bound(values.begin(), values.end(), low);
+        rank = it - values.begin();
+        values.insert(it, low);
+    }
+
+    slots.insert(slots.begin() + rank, slot);
+    if (!isBitmap() && values.size() > ArrayMax) toBitmap();
+}
+
+uint32_t
+SegmentIndex::Container::
+erase(uint16_t low)
+{
+    size_t rank = 0;
+    find(low, rank);
+
+    uint32_t slot = slots[rank];
+    slots.erase(slots.begin() + rank);
+
+    if (isBitmap()) {
+        bits[low / 64] &= ~(1ULL << (low % 64));
+        updateRanks();
+
+        // Wait until we're well under the limit before converting back so
+        // that a segment flapping around the limit doesn't convert each time.
+        if (count() <= ArrayMax / 2) toArray();
+    }
+    else values.erase(values.begin() + rank);
+
+    return slot;
+}
+
+template<typename OnMatch>
+void
+SegmentIndex::Container::
+intersect(const int* first, const int* last, OnMatch onMatch) const
+{
+    if (isBitmap()) {
+        for (; first != last; ++first) {
+            size_t rank;
+            if (find(toKey(*first), rank)) onMatch(rank);
+        }
+        return;
+    }
+
+    const uint16_t* data = &values[0];
+    size_t n = values.size();
+    size_t runSize = last - first;
+
+    // A handful of segments against a large container is better served by
+    // binary searches than by walking the container.
+    bool gallop = n / 32 > runSize;
+
+    size_t i = 0;
+    for (; first != last && i < n; ++first) {
+        uint16_t low = toKey(*first);
+
+        if (gallop) i = searchSmaller(data, i, n, low);
+        else i = skipSmaller(data, i, n, low);
+
+        if (i < n && data[i] == low) onMatch(i);
+    }
+}
+
+void
+SegmentIndex::Container::
+toBitmap()
+{
+    bits.assign(65536 / 64, 0);
+    for (uint16_t low : values)
+        bits[low / 64] |= 1ULL << (low % 64);
+
+    vector<uint16_t>().swap(values);
+    updateRanks();
+}
+
+void
+SegmentIndex::Container::
+toArray()
+{
+    values.clear();
+    values.reserve(count());
+
+    for (size_t word = 0; word < bits.size(); ++word) {
+        for (uint64_t w = bits[word]; w; w &= w - 1)
+            values.push_back(word * 64 + lowest_bit(w));
+    }
+
+    vector<uint64_t>().swap(bits);
+    vector<uint32_t>().swap(ranks);
+}
+
+void
+SegmentIndex::Container::
+updateRanks()
+{
+    ranks.resize(bits.size());
+
+    uint32_t total = 0;
+    for (size_t word = 0; word < bits.size(); ++word) {
+        ranks[word] = total;
+        total += num_bits_set(bits[word]);
+    }
+}
+
+
+/******************************************************************************/
+/* SEGMENT INDEX                                                              */
+/******************************************************************************/
+
+vector<SegmentIndex::Container>::iterator
+SegmentIndex::
+findContainer(uint16_t high)
+{
+    return lower_bound(containers.begin(), containers.end(), high,
+            [] (const Container& c, uint16_t high) { return c.high < high; });
+}
+
+vector<SegmentIndex::Container>::const_iterator
+SegmentIndex::
+findContainer(uint16_t high) const
+{
+    return lower_bound(containers.begin(), containers.end(), high,
+            [] (const Container& c, uint16_t high) { return c.high < high; });
+}
+
+void
+SegmentIndex::
+set(int segment, unsigned cfgIndex, bool value)
+{
+    uint32_t key = toKey(segment);
+    uint16_t high = key >> 16;
+    uint16_t low = key;
+
+    auto it = findContainer(high);
+    bool found = it != containers.end() && it->high == high;
+
+    size_t rank;
+    if (found && it->find(low, rank)) {
+        ConfigSet& entry = configs[it->slots[rank]];
+        entry.set(cfgIndex, value);
+        if (value || !entry.empty()) return;
+
+        // Nothing refers to the segment anymore so drop it from the index.
+        uint32_t slot = it->erase(low);
+        configs[slot] = ConfigSet();
+        freeSlots.push_back(slot);
+
+        if (!it->count()) containers.erase(it);
+        return;
+    }
+
+    if (!value) return;
+
+    uint32_t slot;
+    if (!freeSlots.empty()) {
+        slot = freeSlots.back();
+        freeSlots.pop_back();
+    }
+    else {
+        slot = configs.size();
+        configs.emplace_back();
+    }
+    configs[slot].set(cfgIndex);
+
+    if (!found) it = containers.insert(it, Container(high));
+    it->insert(low, slot);
+}
+
+ConfigSet
+SegmentIndex::
+get(int segment) const
+{
+    uint32_t key = toKey(segment);
+
+    auto it = findContainer(key >> 16);
+    if (it == containers.end() || it->high != (key >> 16)) return ConfigSet();
+
+    size_t rank;
+    if (!it->find(key, rank)) return ConfigSet();
+    return configs[it->slots[rank]];
+}
+
+ConfigSet
+SegmentIndex::
+filter(const int* first, const int* last) const
+{
+    ConfigSet result;
+
+    if (!is_sorted(first, last)) {
+        for (; first != last; ++first)
+            result |= get(*first);
+        return result;
+    }
+
+    auto it = containers.begin(), end = containers.end();
+
+    while (first != last && it != end) {
+        uint16_t high = toKey(*first) >> 16;
+
+        if (high < it->high) {
+            ++first;
+            continue;
+        }
+
+        if (high > it->high) {
+            it = lower_bound(it, end, high,
+                    [] (const Container& c, uint16_t high) { return c.high < high; });
+            continue;
+        }
+
+        // Segments are sorted so the ones sharing a container are contiguous.
+        const int* run = first;
+        while (first != last && (toKey(*first) >> 16) == high) ++first;
+
+        const Container& container = *it;
+        container.intersect(run, first, [&] (size_t rank) {
+                    result |= configs[container.slots[rank]];
+                });
+        ++it;
+    }
+
+    return result;
+}
+
+} // namespace RTBKIT
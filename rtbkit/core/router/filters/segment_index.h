@@ -0,0 +1,103 @@
+/** segment_index.h                                 -*- C++ -*-
+    Copyright (c) 2013 Datacratic.  All rights reserved.
+
+    Compressed bitmap index of the configs that refer to integer segments.
+
+*/
+
+#pragma once
+
+#include "rtbkit/common/filter.h"
+
+#include <vector>
+#include <cstdint>
+
+
+namespace RTBKIT {
+
+
+/******************************************************************************/
+/* SEGMENT INDEX                                                              */
+/******************************************************************************/
+
+/** Index of the configs that refer to each integer segment, used to match
+    the hundreds of segments of a bid request against the segment lists of
+    every config in a single pass.
+
+    Segments are kept in a compressed bitmap split the same way as a Roaring
+    bitmap: the high 16 bits of a segment select a container which holds the
+    low 16 bits either as a sorted array, while it has at most ArrayMax of
+    them, or as a 65536 bit bitmap. The rank of a segment in its container
+    gives the slot of its config set.
+
+    A sorted list of segments is intersected with the array containers by a
+    merge that skips over 8 values at a time with SSE2 and with the bitmap
+    containers by testing bits.
+
+    The index is updated in place when configs are added or removed; this is
+    linear in the size of the segment's container which is fine for config
+    changes.
+ */
+struct SegmentIndex
+{
+    enum { ArrayMax = 4096 };
+
+    bool empty() const { return containers.empty(); }
+
+    /** Number of segments in the index. */
+    size_t size() const { return configs.size() - freeSlots.size(); }
+
+    void set(int segment, unsigned cfgIndex, bool value);
+
+    /** Configs that refer to the given segment. */
+    ConfigSet get(int segment) const;
+
+    /** Union of the configs of every segment in [first, last) which must be
+        sorted. Unsorted lists are handled one segment at a time.
+     */
+    ConfigSet filter(const int* first, const int* last) const;
+
+private:
+
+    static uint32_t toKey(int segment)
+    {
+        // Keeps the order of negative segments.
+        return uint32_t(segment) ^ 0x80000000;
+    }
+
+    struct Container
+    {
+        explicit Container(uint16_t high) : high(high) {}
+
+        uint16_t high;
+
+        std::vector<uint16_t> values; // sorted low bits while sparse...
+        std::vector<uint64_t> bits;   // ... or a bitmap once dense.
+        std::vector<uint32_t> ranks;  // bits set before each word of bits.
+        std::vector<uint32_t> slots;  // config set of each value, by rank.
+
+        size_t count() const { return slots.size(); }
+        bool isBitmap() const { return !bits.empty(); }
+
+        bool find(uint16_t low, size_t& rank) const;
+        void insert(uint16_t low, uint32_t slot);
+        uint32_t erase(uint16_t low);
+
+        template<typename OnMatch>
+        void intersect(const int* first, const int* last, OnMatch onMatch) const;
+
+    private:
+        void toBitmap();
+        void toArray();
+        void updateRanks();
+    };
+
+    std::vector<Container>::iterator findContainer(uint16_t high);
+    std::vector<Container>::const_iterator findContainer(uint16_t high) const;
+
+    std::vector<Container> containers; // sorted on high
+    std::vector<ConfigSet> configs;
+    std::vector<uint32_t> freeSlots;   // unused entries of configs
+};
+
+} // namespace RTBKIT
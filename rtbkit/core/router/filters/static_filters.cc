@@ -27,7 +27,8 @@ SegmentsFilter::
 setConfig(unsigned cfgIndex, const AgentConfig& config, bool value)
 {
     for (const auto& entry : config.segments) {
-        auto& segment = data[entry.first];
+        InternedString source = InternedString::intern(entry.first);
+        auto& segment = data[source];
 
         segment.ie.setInclude(cfgIndex, value, entry.second.include);
         segment.ie.setExclude(cfgIndex, value, entry.second.exclude);
@@ -37,12 +38,16 @@ setConfig(unsigned cfgIndex, const AgentConfig& config, bool value)
 
         if (entry.second.excludeIfNotPresent) {
             if (value && segment.excludeIfNotPresent.empty())
-                excludeIfNotPresent.insert(entry.first);
+                excludeIfNotPresent.push_back(source);
 
             segment.excludeIfNotPresent.set(cfgIndex, value);
 
-            if (!value && segment.excludeIfNotPresent.empty())
-                excludeIfNotPresent.erase(entry.first);
+            if (!value && segment.excludeIfNotPresent.empty()) {
+                excludeIfNotPresent.erase(find(
+                                excludeIfNotPresent.begin(),
+                                excludeIfNotPresent.end(),
+                                source));
+            }
         }
     }
 }
@@ -84,11 +89,7 @@ void
 SegmentsFilter::
 filter(FilterState& state) const
 {
-    unordered_set<string> toCheck = excludeIfNotPresent;
-
     for (const auto& segment : state.request.segments) {
-        toCheck.erase(segment.first);
-
         auto it = data.find(segment.first);
         if (it == data.end()) continue;
 
@@ -97,8 +98,10 @@ filter(FilterState& state) const
         if (state.configs().empty()) return;
     }
 
-    for (const auto& segment : toCheck) {
-        auto it = data.find(segment);
+    for (const auto& source : excludeIfNotPresent) {
+        if (state.request.segments.count(source)) continue;
+
+        auto it = data.find(source);
         if (it == data.end()) continue;
 
         ConfigSet result = it->second.excludeIfNotPresent.negate();
@@ -48,8 +48,8 @@ private:
                 FilterState& state, const ConfigSet& result) const;
     };
 
-    std::unordered_map<std::string, SegmentData> data;
-    std::unordered_set<std::string> excludeIfNotPresent;
+    std::unordered_map<InternedString, SegmentData> data;
+    std::vector<InternedString> excludeIfNotPresent;
 };
 
 
@@ -13,6 +13,7 @@
 #include "rtbkit/core/router/filters/generic_filters.h"
 
 #include <boost/test/unit_test.hpp>
+#include <random>
 
 using namespace std;
 using namespace RTBKIT;
@@ -257,6 +258,73 @@ BOOST_AUTO_TEST_CASE(segmentListTest)
     check(filter.filter(seg2),     { 0, 1 });
 }
 
+BOOST_AUTO_TEST_CASE(segmentIndexTest)
+{
+    // Segments are drawn from a few dense ranges to get containers on both
+    // sides of SegmentIndex::ArrayMax and from the whole int range to get a
+    // lot of sparse containers, negative segments included.
+    mt19937 rng(1234);
+    auto randomSegment = [&] {
+        switch (rng() % 3) {
+        case 0: return int(rng() % 20000);
+        case 1: return int(70000 + rng() % 3000);
+        default: return int(rng());
+        }
+    };
+
+    auto randomList = [&] (size_t size) {
+        vector<int> ints;
+        for (size_t i = 0; i < size; ++i) ints.push_back(randomSegment());
+        return SegmentList(ints);
+    };
+
+    enum { Configs = 16 };
+    vector<SegmentList> configs;
+    for (size_t i = 0; i < Configs; ++i)
+        configs.push_back(randomList(rng() % 2 ? 10 : 2000));
+
+    SegmentListFilter filter;
+    for (size_t i = 0; i < configs.size(); ++i)
+        filter.addConfig(i, configs[i]);
+
+    auto checkRequests = [&] (const vector<bool>& active) {
+        for (size_t round = 0; round < 200; ++round) {
+            SegmentList request = randomList(rng() % 2 ? 5 : 1000);
+
+            // Every other request reuses segments of a config to get hits.
+            if (round % 2) {
+                const SegmentList& cfg = configs[rng() % Configs];
+                for (size_t i = 0; i < 20; ++i)
+                    request.add(cfg.ints[rng() % cfg.ints.size()]);
+                request.sort();
+            }
+
+            ConfigSet result = filter.filter(request);
+            for (size_t i = 0; i < configs.size(); ++i) {
+                bool expected = active[i] && configs[i].match(request);
+                BOOST_CHECK_EQUAL(result.test(i), expected);
+            }
+        }
+    };
+
+    title("segment-index-1");
+    checkRequests(vector<bool>(Configs, true));
+
+    title("segment-index-2");
+    vector<bool> active(Configs, true);
+    for (size_t i = 0; i < configs.size(); i += 2) {
+        filter.removeConfig(i, configs[i]);
+        active[i] = false;
+    }
+    checkRequests(active);
+
+    title("segment-index-3");
+    for (size_t i = 0; i < configs.size(); ++i) {
+        if (active[i]) filter.removeConfig(i, configs[i]);
+    }
+    BOOST_CHECK(filter.filter(configs[1]).empty());
+}
+
 BOOST_AUTO_TEST_CASE(includeExcludeFilterTest)
 {
     typedef ListFilter<size_t> BaseFilterT;
@@ -33,6 +33,7 @@
 #include "rtbkit/common/messages.h"
 #include "rtbkit/common/win_cost_model.h"
 #include "rtbkit/common/bidder_interface.h"
+#include "rtbkit/common/auction_tracer.h"
 
 using namespace std;
 using namespace ML;
@@ -124,6 +125,7 @@ Router(ServiceBase & parent,
       submittedBuffer(65536),
       auctionGraveyard(65536),
       doBidBuffer(65536),
+      agentMessageBuffer(65536),
       augmentationLoop(*this),
       loopMonitor(*this),
       loadStabilizer(loopMonitor),
@@ -170,6 +172,7 @@ Router(std::shared_ptr<ServiceProxies> services,
       submittedBuffer(65536),
       auctionGraveyard(65536),
       doBidBuffer(65536),
+      agentMessageBuffer(65536),
       augmentationLoop(*this),
       loopMonitor(*this),
       loadStabilizer(loopMonitor),
@@ -571,6 +574,12 @@ run()
             }
         }
 
+        {
+            vector<string> message;
+            while (agentMessageBuffer.tryPop(message))
+                handleAgentMessage(message);
+        }
+
         {
             std::shared_ptr<ExchangeConnector> exchange;
             while (exchangeBuffer.tryPop(exchange)) {
@@ -585,7 +594,10 @@ run()
         {
             double atStart = getTime();
 
-            std::pair<std::string, std::shared_ptr<const AgentConfig> > config;
+            // Configs are applied in batches so that a burst of them only
+            // costs a single filter pool update.
+            std::vector<AgentConfigEntry> configs;
+            AgentConfigEntry config;
             while (configBuffer.tryPop(config)) {
                 if (!config.second) {
                     // deconfiguration
@@ -594,7 +606,15 @@ run()
                          << endl;
                 }
                 else {
-                    doConfig(config.first, config.second);
+                    configs.push_back(std::move(config));
+                }
+            }
+            if (!configs.empty()) {
+                try {
+                    doConfigs(configs);
+                } catch (const std::exception & exc) {
+                    cerr << "error applying configs: " << exc.what() << endl;
+                    logRouterError("doConfigs", exc.what());
                 }
             }
 
@@ -659,6 +679,11 @@ run()
         if (now - last_check > 10.0) {
             logUsageMetrics(10.0);
 
+            // Spans lost because the rings were too small for the export
+            // period; see --trace-ring-size.
+            if (AuctionTracer::instance().enabled())
+                recordLevel(AuctionTracer::instance().dropped, "tracer.dropped");
+
             logMessage("MARK",
                        Date::fromSecondsSinceEpoch(last_check).print(),
                        format("active: %zd augmenting, %zd inFlight, "
@@ -1045,14 +1070,16 @@ checkDeadAgents()
         }
     }
 
+    std::vector<FilterPool::ConfigChange> removed;
     for (auto it = deadAgents.begin(), end = deadAgents.end();
          it != end;  ++it) {
         cerr << "WARNING: dead agent doesn't clean up its state properly"
              << endl;
         // TODO: undo all bids in progress
-        filters.removeConfig((*it)->first);
+        removed.emplace_back((*it)->first);
         agents.erase(*it);
     }
+    filters.applyConfigChanges(removed);
 
     if (!deadAgents.empty())
         // Broadcast that we have different agents
@@ -1078,6 +1105,7 @@ checkExpiredAuctions()
                                       const AuctionInfo & auctionInfo)
             {
                 this->debugAuction(auctionId, "EXPIRED", {});
+                AuctionTracer::instance().trigger(auctionId, "timeout");
 
                 // Tell any remaining bidders that it's too late...
                 for (auto it = auctionInfo.bidders.begin(),
@@ -1328,7 +1356,11 @@ preprocessAuction(const std::shared_ptr<Auction> & auction)
     }
 
     // Do the actual filtering.
-    auto biddableConfigs = filters.filter(*auction->request, exchangeConnector);
+    FilterPool::ConfigList biddableConfigs;
+    {
+        AuctionTracer::Span span("router.filters", auction->id);
+        biddableConfigs = filters.filter(*auction->request, exchangeConnector);
+    }
 
     auto checkAgent = [&] (
             const AgentConfig & config,
@@ -1696,8 +1728,10 @@ doStartBidding(const std::shared_ptr<AugmentationInfo> & augInfo)
         debugAuction(auctionId, "AUCTION");
     } catch (const std::exception & exc) {
         cerr << "warning: auction threw exception: " << exc.what() << endl;
-        if (augInfo)
+        if (augInfo) {
             augInfo->auction->setError("auction processing error", exc.what());
+            AuctionTracer::instance().trigger(augInfo->auction->id, "error");
+        }
     }
 }
 
@@ -1937,8 +1971,14 @@ doBidImpl(const BidMessage &message, const std::vector<std::string> &originalMes
         // authorize an amount of money computed from the win cost model.
         Amount price = message.wcm.evaluate(bid, bid.price);
 
-        if (!banker->authorizeBid(config.account, auctionKey, price)
-                || failBid(budgetErrorRate))
+        bool authorized;
+        {
+            AuctionTracer::Span span(
+                    "router.bankerAuthorize", auctionId, agent.c_str());
+            authorized = banker->authorizeBid(config.account, auctionKey, price);
+        }
+
+        if (!authorized || failBid(budgetErrorRate))
         {
             ++info.stats->noBudget;
 
@@ -2007,8 +2047,10 @@ doBidImpl(const BidMessage &message, const std::vector<std::string> &originalMes
             // fall through
         case Auction::WinLoss::TOOLATE:
         case Auction::WinLoss::INVALID: {
-            if (localResult.val == Auction::WinLoss::TOOLATE)
+            if (localResult.val == Auction::WinLoss::TOOLATE) {
                 ++info.stats->tooLate;
+                AuctionTracer::instance().trigger(auctionId, "tooLate");
+            }
             else if (localResult.val == Auction::WinLoss::INVALID)
                 ++info.stats->invalid;
 
@@ -2066,6 +2108,10 @@ doBidImpl(const BidMessage &message, const std::vector<std::string> &originalMes
 
     double bidTime = dateGotBid.secondsSince(bidInfo.bidTime);
 
+    AuctionTracer::instance().record(
+            "router.agent", auctionId, bidInfo.bidTime, dateGotBid,
+            agent.c_str());
+
     //cerr << "now " << auctionInfo.bidders.size() << " bidders" << endl;
 
     //cerr << "campaign " << info.config->campaign << " bidTime "
@@ -2374,37 +2420,105 @@ void
 Router::
 doConfig(const std::string & agent,
          std::shared_ptr<const AgentConfig> config)
+{
+    doConfigs({ AgentConfigEntry(agent, std::move(config)) });
+}
+
+void
+Router::
+doConfigs(const std::vector<AgentConfigEntry> & configs)
 {
     RouterProfiler profiler(dutyCycleCurrent.nsConfig);
     //const string fName = "Router::doConfig:";
-    logMessage("CONFIG", agent, boost::trim_copy(config->toJson().toString()));
 
-    // TODO: no need for this...
-    auto newConfig = std::make_shared<AgentConfig>(*config);
-    if (newConfig->roundRobinGroup == "")
-        newConfig->roundRobinGroup = agent;
+    // The filters get the new configs before the agents do so that a config
+    // they reject leaves its agent as it was.  The infos handed to them share
+    // the status and stats of the agents they'll end up in.
+    std::vector<AgentInfo> pending;
+    pending.reserve(configs.size());
 
-    AgentInfo & info = agents[agent];
+    std::vector<FilterPool::ConfigChange> changes;
+    changes.reserve(configs.size());
+
+    for (const auto & entry : configs) {
+        const std::string & agent = entry.first;
+        const AgentConfig & config = *entry.second;
+
+        logMessage("CONFIG", agent, boost::trim_copy(config.toJson().toString()));
+
+        // TODO: no need for this...
+        auto newConfig = std::make_shared<AgentConfig>(config);
+        if (newConfig->roundRobinGroup == "")
+            newConfig->roundRobinGroup = agent;
+
+        try {
+            configure(agent, *newConfig);
+        } catch (const std::exception & exc) {
+            cerr << "rejected config for " << agent << ": " << exc.what()
+                 << endl;
+            logRouterError("doConfigs.configure", exc.what(), agent);
+            continue;
+        }
+
+        // An agent that shows up more than once in the batch builds on its
+        // previous change.
+        size_t previous = changes.size();
+        while (previous > 0 && changes[previous - 1].name != agent)
+            --previous;
+
+        AgentInfo info;
+        if (previous > 0)
+            info = pending[previous - 1];
+        else {
+            auto it = agents.find(agent);
+            if (it != agents.end()) info = it->second;
+        }
+
+        info.config = newConfig;
+        //cerr << "configured " << agent << " strategy : " << info.config->strategy << " campaign "
+        //     <<  info.config->campaign << endl;
+
+        string bidRequestFormat = "jsonRaw";
+        info.setBidRequestFormat(bidRequestFormat);
 
-    if (info.configured) {
-        unconfigure(agent, *info.config);
-        info.configured = false;
+        pending.push_back(std::move(info));
+        changes.emplace_back(agent, &pending.back());
     }
 
-    info.config = newConfig;
-    //cerr << "configured " << agent << " strategy : " << info.config->strategy << " campaign "
-    //     <<  info.config->campaign << endl;
+    auto onRejected = [&] (const FilterPool::ConfigChange & change,
+                           const std::exception & exc)
+        {
+            cerr << "rejected config for " << change.name << ": "
+                 << exc.what() << endl;
+            logRouterError("doConfigs.filters", exc.what(), change.name);
+        };
+
+    auto indexes = filters.applyConfigChanges(changes, onRejected);
+
+    // An agent that shows up more than once in the batch ends up with its
+    // last accepted change.  Agents only hear that their config was taken
+    // once the filters have it.
+    for (size_t i = 0; i < changes.size(); ++i) {
+        if (indexes[i] == -1) continue;
 
-    string bidRequestFormat = "jsonRaw";
-    info.setBidRequestFormat(bidRequestFormat);
+        const std::string & agent = changes[i].name;
 
-    configure(agent, *newConfig);
-    info.configured = true;
-    bidder->sendMessage(agent, "GOTCONFIG");
+        auto it = agents.find(agent);
+        if (it == agents.end())
+            it = agents.insert(make_pair(agent, pending[i])).first;
+        else if (it->second.configured)
+            unconfigure(agent, *it->second.config);
 
-    info.filterIndex = filters.addConfig(agent, info);
+        AgentInfo & info = it->second;
+        info.config = pending[i].config;
+        info.bidRequestFormat = pending[i].bidRequestFormat;
+        info.configured = true;
+        info.filterIndex = indexes[i];
+
+        bidder->sendMessage(agent, "GOTCONFIG");
+    }
 
-    // Broadcast that we have a new agent or it has a new configuration
+    // Broadcast that we have new agents or new configurations
     updateAllAgents();
 }
 
@@ -402,6 +402,11 @@ public:
     ML::RingBufferSWMR<std::shared_ptr<Auction> > auctionGraveyard;
     ML::RingBufferSRMW<BidMessage> doBidBuffer;
 
+    /** Messages from agents that didn't come in through the bridge; handled
+        in the main loop as if they had.  The first part is the address.
+    */
+    ML::RingBufferSRMW<std::vector<std::string> > agentMessageBuffer;
+
     ML::Wakeup_Fd wakeupMainLoop;
 
     FilterPool filters;
@@ -491,10 +496,18 @@ public:
     /** An auction finished. */
     void onAuctionDone(std::shared_ptr<Auction> auction);
 
+    typedef std::pair<std::string, std::shared_ptr<const AgentConfig> >
+        AgentConfigEntry;
+
     /** Got a configuration message; update our internal data structures */
     void doConfig(const std::string & agent,
                   std::shared_ptr<const AgentConfig> config);
 
+    /** Same as doConfig but for a batch of configurations which only updates
+        the filters and the agent list once.
+    */
+    void doConfigs(const std::vector<AgentConfigEntry> & configs);
+
     /* Add a given agent (with the given configuration) to the exchange */
     void configureAgentOnExchange(std::shared_ptr<ExchangeConnector> const & exchange,
                                   std::string const & agent,
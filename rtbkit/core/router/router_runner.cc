@@ -16,6 +16,7 @@
 #include <boost/thread/thread.hpp>
 
 #include "rtbkit/common/bidder_interface.h"
+#include "rtbkit/common/auction_tracer.h"
 #include "rtbkit/core/router/router.h"
 #include "rtbkit/core/banker/slave_banker.h"
 #include "soa/service/process_stats.h"
@@ -49,7 +50,9 @@ RouterRunner() :
     logBids(false),
     maxBidPrice(200),
     slowModeTimeout(MonitorClient::DefaultCheckTimeout),
-    useHttpBanker(false)
+    useHttpBanker(false),
+    traceRate(0.001),
+    traceRingSize(1 << 14)
 {
 }
 
@@ -83,7 +86,16 @@ doOptions(int argc, char ** argv,
         ("max-bid-price", value(&maxBidPrice),
          "maximum bid price accepted by router")
         ("spend-rate", value<string>(&spendRate)->default_value("100000USD/1M"),
-         "Amount of budget in USD to be periodically re-authorized (default 100000USD/1M)");
+         "Amount of budget in USD to be periodically re-authorized (default 100000USD/1M)")
+        ("trace-file", value<string>(&traceFile),
+         "file to export per-auction traces to (chrome trace format)")
+        ("trace-rate", value<double>(&traceRate),
+         "ratio of the auctions that are traced (default 0.001)")
+        ("trace-on", value<vector<string> >(&traceTriggers)->multitoken(),
+         "also trace the auctions that hit one of: timeout, tooLate, "
+         "augmentationTimeout, error")
+        ("trace-ring-size", value<size_t>(&traceRingSize),
+         "spans kept per thread until they're exported (default 16384)");
 
     options_description all_opt = opts;
     all_opt
@@ -113,6 +125,10 @@ init()
     auto proxies = serviceArgs.makeServiceProxies();
     auto serviceName = serviceArgs.serviceName("router");
 
+    if (!traceFile.empty())
+        AuctionTracer::instance().init(
+                traceFile, traceRate, traceTriggers, traceRingSize);
+
     exchangeConfig = loadJsonFromFile(exchangeConfigurationFile);
     bidderConfig = loadJsonFromFile(bidderConfigurationFile);
 
@@ -164,6 +180,7 @@ shutdown()
 {
     router->shutdown();
     banker->shutdown();
+    AuctionTracer::instance().shutdown();
 }
 
 int main(int argc, char ** argv)
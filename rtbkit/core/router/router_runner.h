@@ -43,6 +43,11 @@ struct RouterRunner {
 
     bool useHttpBanker;
 
+    std::string traceFile;
+    double traceRate;
+    std::vector<std::string> traceTriggers;
+    size_t traceRingSize;
+
     void doOptions(int argc, char ** argv,
                    const boost::program_options::options_description & opts
                    = boost::program_options::options_description());
@@ -6,6 +6,7 @@
 
 LIB_FILTERS_SOURCES := \
 	filters/static_filters.cc \
+	filters/segment_index.cc \
         filters/creative_filters.cc
 
 LIB_FILTERS_LINK := \
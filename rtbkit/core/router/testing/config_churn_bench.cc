@@ -0,0 +1,246 @@
+/** config_churn_bench.cc                                 -*- C++ -*-
+    Copyright (c) 2014 Datacratic.  All rights reserved.
+
+    Cost of agent config churn on a router with thousands of agents: full
+    configs parsed from scratch and added one at a time versus patches
+    applied to the previous version, parsed through the config cache and
+    added to the filter pool in batches.
+
+*/
+
+#include "rtbkit/core/router/filter_pool.h"
+#include "rtbkit/core/router/router_types.h"
+#include "rtbkit/core/agent_configuration/agent_config.h"
+#include "soa/utils/print_utils.h"
+
+#include <boost/program_options/options_description.hpp>
+#include <boost/program_options/parsers.hpp>
+#include <boost/program_options/variables_map.hpp>
+#include <random>
+
+using namespace std;
+using namespace ML;
+using namespace Datacratic;
+using namespace RTBKIT;
+
+
+/******************************************************************************/
+/* CONFIG                                                                     */
+/******************************************************************************/
+
+struct Config
+{
+    Config() : agents(2000), updates(20000), batch(64), filterChanges(0.1) {}
+
+    size_t agents;
+    size_t updates;
+    size_t batch;
+    double filterChanges;
+};
+
+Config getConfig(int argc, char** argv)
+{
+    using namespace boost::program_options;
+
+    Config config;
+
+    options_description opt;
+    opt.add_options()
+        ("agents,a", value<size_t>(&config.agents))
+        ("updates,n", value<size_t>(&config.updates))
+        ("batch,b", value<size_t>(&config.batch))
+        ("filter-changes,f", value<double>(&config.filterChanges),
+                "ratio of the updates that change a url filter")
+        ("help,h","print this message");
+
+    variables_map vm;
+    store(command_line_parser(argc, argv).options(opt).run(), vm);
+    notify(vm);
+
+    if (vm.count("help")) {
+        cerr << opt << endl;
+        exit(1);
+    }
+
+    return config;
+}
+
+
+/******************************************************************************/
+/* AGENTS                                                                     */
+/******************************************************************************/
+
+Json::Value makeConfig(size_t agent)
+{
+    Json::Value json;
+
+    json["account"][0] = "campaign" + to_string(agent % 100);
+    json["account"][1] = "strategy" + to_string(agent);
+    json["bidProbability"] = 1.0;
+
+    // A handful of filters that are shared between agents as they would be
+    // in the field.
+    for (size_t i = 0; i < 20; ++i) {
+        json["urlFilter"]["include"][unsigned(i)] = ML::format(
+                "^http://www\\.site%d\\.com/section%d/.*", int(i), int(agent % 10));
+    }
+    json["languageFilter"]["include"][0] = "en";
+    json["languageFilter"]["include"][1] = "fr";
+
+    const int sizes[][2] = { { 300, 250 }, { 728, 90 }, { 160, 600 } };
+    for (unsigned i = 0; i < 3; ++i) {
+        Json::Value & creative = json["creatives"][i];
+        creative["id"] = i;
+        creative["width"] = sizes[i][0];
+        creative["height"] = sizes[i][1];
+        creative["name"] = ML::format("creative%d", i);
+    }
+
+    return json;
+}
+
+/** Changes the config the way agents usually do: mostly the bid probability
+    with the occasional change to a filter.
+ */
+void churn(Json::Value & json, double filterChanges, std::mt19937 & rng)
+{
+    std::uniform_real_distribution<double> dist(0.0, 1.0);
+
+    json["bidProbability"] = dist(rng);
+    if (dist(rng) < filterChanges) {
+        json["urlFilter"]["include"][0] = ML::format(
+                "^http://www\\.site%d\\.com/.*", int(rng() % 1000));
+    }
+}
+
+
+/******************************************************************************/
+/* BENCH                                                                      */
+/******************************************************************************/
+
+struct Result
+{
+    Result() : elapsed(0), bytes(0) {}
+
+    double elapsed;
+    size_t bytes;
+};
+
+Result runFull(const Config& config, std::vector<Json::Value> jsons)
+{
+    FilterPool pool;
+    pool.initWithDefaultFilters();
+
+    std::vector<AgentInfo> infos(config.agents);
+    for (size_t i = 0; i < config.agents; ++i) {
+        infos[i].config = make_shared<AgentConfig>(
+                AgentConfig::createFromJson(jsons[i]));
+        pool.addConfig(ML::format("agent%d", int(i)), infos[i]);
+    }
+
+    std::mt19937 rng;
+    Result result;
+    Date start = Date::now();
+
+    for (size_t i = 0; i < config.updates; ++i) {
+        size_t agent = rng() % config.agents;
+        churn(jsons[agent], config.filterChanges, rng);
+
+        // What the configuration service sends and every listener parses.
+        string str = jsons[agent].toString();
+        result.bytes += str.size();
+
+        Json::Value json = Json::parse(str);
+        infos[agent].config = make_shared<AgentConfig>(
+                AgentConfig::createFromJson(json));
+        pool.addConfig(ML::format("agent%d", int(agent)), infos[agent]);
+    }
+
+    result.elapsed = Date::now().secondsSince(start);
+    return result;
+}
+
+Result runPatch(const Config& config, std::vector<Json::Value> jsons)
+{
+    FilterPool pool;
+    pool.initWithDefaultFilters();
+    AgentConfigCache cache;
+
+    // What the listener keeps to apply the patches to.
+    std::vector<Json::Value> received = jsons;
+
+    std::vector<AgentInfo> infos(config.agents);
+    std::vector<FilterPool::ConfigChange> changes;
+    for (size_t i = 0; i < config.agents; ++i) {
+        infos[i].config = make_shared<AgentConfig>(
+                AgentConfig::createFromJson(jsons[i], &cache));
+        changes.emplace_back(ML::format("agent%d", int(i)), &infos[i]);
+    }
+    pool.applyConfigChanges(changes);
+    changes.clear();
+
+    std::mt19937 rng;
+    Result result;
+    Date start = Date::now();
+
+    for (size_t i = 0; i < config.updates; ++i) {
+        size_t agent = rng() % config.agents;
+
+        Json::Value previous = jsons[agent];
+        churn(jsons[agent], config.filterChanges, rng);
+
+        string str = diffAgentConfig(previous, jsons[agent]).toString();
+        result.bytes += str.size();
+
+        received[agent] = patchAgentConfig(
+                std::move(received[agent]), Json::parse(str));
+        infos[agent].config = make_shared<AgentConfig>(
+                AgentConfig::createFromJson(received[agent], &cache));
+        changes.emplace_back(ML::format("agent%d", int(agent)), &infos[agent]);
+
+        if (changes.size() < config.batch) continue;
+        pool.applyConfigChanges(changes);
+        changes.clear();
+    }
+    pool.applyConfigChanges(changes);
+
+    result.elapsed = Date::now().secondsSince(start);
+
+    cerr << printValue(cache.hits) << " cache hits, "
+        << printValue(cache.misses) << " cache misses" << endl;
+
+    return result;
+}
+
+
+/******************************************************************************/
+/* MAIN                                                                       */
+/******************************************************************************/
+
+int main(int argc, char* argv[])
+{
+    auto config = getConfig(argc, argv);
+
+    std::vector<Json::Value> jsons;
+    for (size_t i = 0; i < config.agents; ++i)
+        jsons.push_back(makeConfig(i));
+
+    cerr << "churning " << printValue(config.updates) << " updates over "
+        << printValue(config.agents) << " agents" << endl;
+
+    Result full = runFull(config, jsons);
+    Result patch = runPatch(config, jsons);
+
+    auto print = [&] (const char* name, const Result& result) {
+        cerr << "\n" << name << ":\n"
+            << printValue(result.elapsed) << " Seconds\n"
+            << printValue(config.updates / result.elapsed) << " Updates/sec\n"
+            << printValue(result.bytes / config.updates) << " Bytes/update\n";
+    };
+
+    print("full configs", full);
+    print("patches", patch);
+
+    cerr << "\n" << printValue(full.elapsed / patch.elapsed) << " Speedup\n"
+        << endl;
+}
@@ -0,0 +1,238 @@
+/** filter_pool_test.cc                                 -*- C++ -*-
+    Copyright (c) 2014 Datacratic.  All rights reserved.
+
+    Tests for the updates of the filter pool.
+
+*/
+
+#define BOOST_TEST_MAIN
+#define BOOST_TEST_DYN_LINK
+
+#include "rtbkit/core/router/filter_pool.h"
+#include "rtbkit/core/router/router_types.h"
+#include "rtbkit/core/router/filters/generic_filters.h"
+#include "rtbkit/core/agent_configuration/agent_config.h"
+#include "rtbkit/common/bid_request.h"
+#include "jml/arch/exception.h"
+
+#include <boost/test/unit_test.hpp>
+#include <algorithm>
+
+using namespace std;
+using namespace ML;
+using namespace Datacratic;
+using namespace RTBKIT;
+
+
+/******************************************************************************/
+/* UTILS                                                                      */
+/******************************************************************************/
+
+namespace {
+
+/** Lets everything through but rejects the configs of the "throw" account
+    the way a filter would reject a config it can't make sense of.
+ */
+struct TestFilter : public IterativeFilter<TestFilter>
+{
+    static constexpr const char* name = "FilterPoolTest";
+
+    void addConfig(unsigned cfgIndex, const std::shared_ptr<AgentConfig>& config)
+    {
+        if (config->account[0] == "throw")
+            throw ML::Exception("rejected config");
+        IterativeFilter<TestFilter>::addConfig(cfgIndex, config);
+    }
+
+    bool filterConfig(FilterState&, const AgentConfig&) const { return true; }
+};
+
+struct AtInit {
+    AtInit()
+    {
+        FilterRegistry::registerFilter<TestFilter>();
+    }
+} atInit;
+
+AgentInfo makeInfo(const std::string& account)
+{
+    AgentInfo info;
+    info.config = std::make_shared<AgentConfig>();
+    info.config->account = AccountKey({ account });
+    info.config->creatives.push_back(Creative(300, 250));
+    return info;
+}
+
+BidRequest makeRequest()
+{
+    BidRequest request;
+
+    AdSpot spot;
+    spot.formats.push_back(Format(300, 250));
+    request.imp.push_back(spot);
+
+    return request;
+}
+
+/** Names of the configs that make it through the filters. */
+vector<string> filterNames(FilterPool& pool)
+{
+    vector<string> result;
+    for (const auto& entry : pool.filter(makeRequest(), nullptr))
+        result.push_back(entry.name);
+
+    sort(result.begin(), result.end());
+    return result;
+}
+
+void check(FilterPool& pool, const vector<string>& expected)
+{
+    auto names = filterNames(pool);
+    BOOST_CHECK_EQUAL_COLLECTIONS(
+            names.begin(), names.end(), expected.begin(), expected.end());
+}
+
+} // namespace anonymous
+
+
+/******************************************************************************/
+/* TESTS                                                                      */
+/******************************************************************************/
+
+BOOST_AUTO_TEST_CASE( test_add_remove )
+{
+    FilterPool pool;
+    pool.addFilter(TestFilter::name);
+
+    AgentInfo a = makeInfo("a"), b = makeInfo("b"), c = makeInfo("c");
+
+    // Every update swaps the copy that's read so checking after each one
+    // covers both copies.
+    BOOST_CHECK_EQUAL(pool.addConfig("a", a), 0);
+    check(pool, { "a" });
+
+    BOOST_CHECK_EQUAL(pool.addConfig("b", b), 1);
+    check(pool, { "a", "b" });
+
+    pool.removeConfig("a");
+    check(pool, { "b" });
+
+    // The freed index is reused.
+    BOOST_CHECK_EQUAL(pool.addConfig("c", c), 0);
+    check(pool, { "b", "c" });
+
+    // Adding an existing config replaces it.
+    BOOST_CHECK_EQUAL(pool.addConfig("b", b), 1);
+    check(pool, { "b", "c" });
+
+    pool.removeConfig("unknown");
+    check(pool, { "b", "c" });
+}
+
+BOOST_AUTO_TEST_CASE( test_batch )
+{
+    FilterPool pool;
+    pool.addFilter(TestFilter::name);
+
+    AgentInfo a = makeInfo("a"), b = makeInfo("b"), c = makeInfo("c");
+
+    auto indexes = pool.applyConfigChanges({
+                FilterPool::ConfigChange("a", &a),
+                FilterPool::ConfigChange("b", &b) });
+    BOOST_CHECK_EQUAL(indexes[0], 0);
+    BOOST_CHECK_EQUAL(indexes[1], 1);
+    check(pool, { "a", "b" });
+
+    // Changes are applied in order within the batch.
+    indexes = pool.applyConfigChanges({
+                FilterPool::ConfigChange("a"),
+                FilterPool::ConfigChange("c", &c),
+                FilterPool::ConfigChange("b"),
+                FilterPool::ConfigChange("a", &a) });
+    BOOST_CHECK_EQUAL(indexes[0], -1);
+    BOOST_CHECK_EQUAL(indexes[1], 0);
+    BOOST_CHECK_EQUAL(indexes[2], -1);
+    BOOST_CHECK_EQUAL(indexes[3], 1);
+    check(pool, { "a", "c" });
+
+    BOOST_CHECK(pool.applyConfigChanges({}).empty());
+    check(pool, { "a", "c" });
+}
+
+BOOST_AUTO_TEST_CASE( test_throw_and_recover )
+{
+    FilterPool pool;
+    pool.addFilter(TestFilter::name);
+
+    AgentInfo a = makeInfo("a"), b = makeInfo("b"), c = makeInfo("c");
+    AgentInfo d = makeInfo("d"), bad = makeInfo("throw");
+
+    pool.applyConfigChanges({
+                FilterPool::ConfigChange("a", &a),
+                FilterPool::ConfigChange("b", &b) });
+
+    // The filter rejects the last change after the others were made: none
+    // of them stick.
+    BOOST_CHECK_THROW(
+            pool.applyConfigChanges({
+                        FilterPool::ConfigChange("c", &c),
+                        FilterPool::ConfigChange("a"),
+                        FilterPool::ConfigChange("bad", &bad) }),
+            ML::Exception);
+    check(pool, { "a", "b" });
+
+    BOOST_CHECK_THROW(pool.addConfig("bad", bad), ML::Exception);
+    check(pool, { "a", "b" });
+
+    // Both copies are still in sync and hand out the same indexes.
+    BOOST_CHECK_EQUAL(pool.addConfig("c", c), 2);
+    check(pool, { "a", "b", "c" });
+
+    BOOST_CHECK_EQUAL(pool.addConfig("d", d), 3);
+    check(pool, { "a", "b", "c", "d" });
+
+    pool.removeConfig("a");
+    check(pool, { "b", "c", "d" });
+
+    pool.removeConfig("c");
+    check(pool, { "b", "d" });
+}
+
+BOOST_AUTO_TEST_CASE( test_skip_rejected )
+{
+    FilterPool pool;
+    pool.addFilter(TestFilter::name);
+
+    AgentInfo a = makeInfo("a"), b = makeInfo("b"), c = makeInfo("c");
+    AgentInfo bad = makeInfo("throw");
+
+    pool.addConfig("a", a);
+
+    // Only the rejected change is left out of the batch.
+    vector<string> rejected;
+    auto onRejected = [&] (const FilterPool::ConfigChange& change,
+                           const std::exception&)
+        {
+            rejected.push_back(change.name);
+        };
+
+    auto indexes = pool.applyConfigChanges({
+                FilterPool::ConfigChange("b", &b),
+                FilterPool::ConfigChange("a", &bad),
+                FilterPool::ConfigChange("c", &c) },
+            onRejected);
+
+    BOOST_CHECK_EQUAL(indexes[0], 1);
+    BOOST_CHECK_EQUAL(indexes[1], -1);
+    BOOST_CHECK_EQUAL(indexes[2], 2);
+    BOOST_CHECK(rejected == vector<string>{ "a" });
+    check(pool, { "a", "b", "c" });
+
+    // Nothing is retried when the whole batch goes through.
+    rejected.clear();
+    indexes = pool.applyConfigChanges({ FilterPool::ConfigChange("a") },
+                                      onRejected);
+    BOOST_CHECK_EQUAL(indexes[0], -1);
+    BOOST_CHECK(rejected.empty());
+    check(pool, { "b", "c" });
+}
@@ -0,0 +1,403 @@
+/** router_bench.cc                                 -*- C++ -*-
+    Copyright (c) 2014 Datacratic.  All rights reserved.
+
+    End-to-end benchmark of the router pipeline.
+
+    Stands up a router with a null banker and a set of in-process test agents
+    and feeds it bid requests through an in-memory exchange connector so that
+    nothing but the router itself sits on the path. The time spent in each of
+    the stages timestamped on the Auction object is reported along with the
+    overall throughput so that a regression in any one of them stands out.
+
+*/
+
+#include "rtbkit/core/router/router.h"
+#include "rtbkit/core/agent_configuration/agent_configuration_service.h"
+#include "rtbkit/core/banker/null_banker.h"
+#include "rtbkit/common/exchange_connector.h"
+#include "rtbkit/testing/test_agent.h"
+#include "rtbkit/testing/latency_histogram.h"
+#include "soa/utils/print_utils.h"
+#include "jml/utils/filter_streams.h"
+#include "jml/arch/spinlock.h"
+#include "jml/arch/timers.h"
+
+#include <boost/program_options/options_description.hpp>
+#include <boost/program_options/parsers.hpp>
+#include <boost/program_options/variables_map.hpp>
+#include <atomic>
+#include <thread>
+
+using namespace std;
+using namespace ML;
+using namespace Datacratic;
+using namespace RTBKIT;
+
+
+/******************************************************************************/
+/* CONFIG                                                                     */
+/******************************************************************************/
+
+struct Config
+{
+    Config() :
+        agents(4),
+        auctions(100000),
+        qps(0),
+        window(1000),
+        threads(1),
+        timeoutMs(50),
+        bidProbability(1.0),
+        requests("rtbkit/core/router/testing/20000-datacratic-auctions.xz"),
+        format("datacratic"),
+        settle(2.0)
+    {}
+
+    size_t agents;
+    size_t auctions;
+    double qps;
+    size_t window;
+    size_t threads;
+    double timeoutMs;
+    double bidProbability;
+    string requests;
+    string format;
+    double settle;
+    string output;
+};
+
+Config getConfig(int argc, char** argv)
+{
+    using namespace boost::program_options;
+
+    Config config;
+
+    options_description opt;
+    opt.add_options()
+        ("agents,a", value<size_t>(&config.agents))
+        ("auctions,n", value<size_t>(&config.auctions))
+        ("qps,q", value<double>(&config.qps),
+                "auctions per second; 0 keeps window auctions in flight instead")
+        ("window,w", value<size_t>(&config.window),
+                "auctions kept in flight when no qps is given")
+        ("threads,t", value<size_t>(&config.threads),
+                "exchange threads injecting auctions")
+        ("timeout-ms", value<double>(&config.timeoutMs),
+                "time available to each auction")
+        ("bid-probability,p", value<double>(&config.bidProbability),
+                "probability that an agent is sent a given auction")
+        ("requests,r", value<string>(&config.requests),
+                "file with one bid request per line")
+        ("format,f", value<string>(&config.format),
+                "format of the bid requests")
+        ("settle", value<double>(&config.settle),
+                "seconds to wait for the agent configs to reach the router")
+        ("output,o", value<string>(&config.output),
+                "file to write the json report to")
+        ("help,h","print this message");
+
+    variables_map vm;
+    store(command_line_parser(argc, argv).options(opt).run(), vm);
+    notify(vm);
+
+    if (vm.count("help")) {
+        cerr << opt << endl;
+        exit(1);
+    }
+
+    return config;
+}
+
+
+/******************************************************************************/
+/* STAGES                                                                     */
+/******************************************************************************/
+
+/** Latencies of the stages of every finished auction in microseconds. */
+struct Stages
+{
+    void record(const Auction& auction, Date finished, Date rendered)
+    {
+        std::lock_guard<ML::Spinlock> guard(lock);
+
+        auto span = [&] (const char* name, Date from, Date to) {
+            if (from == Date() || to == Date()) return;
+            histograms[name].recordSeconds(to.secondsSince(from));
+        };
+
+        span("parse", auction.start, auction.doneParsing);
+        span("preproQueue", auction.doneParsing, auction.inPrepro);
+        span("prepro", auction.inPrepro, auction.outOfPrepro);
+        span("augmentation", auction.outOfPrepro, auction.doneAugmenting);
+        span("biddingQueue", auction.doneAugmenting, auction.inStartBidding);
+        span("bidding", auction.inStartBidding, finished);
+        span("submission", finished, rendered);
+        span("total", auction.start, rendered);
+
+        outcomes[outcome(auction)]++;
+    }
+
+    static const char* outcome(const Auction& auction)
+    {
+        const Auction::Data* data = auction.getCurrentData();
+        if (data->hasError()) return "error";
+        if (auction.outOfPrepro == Date()) return "noPotentialBidders";
+
+        for (size_t spot = 0; spot < data->responses.size(); ++spot)
+            if (data->hasValidResponse(spot)) return "bid";
+
+        return "noBid";
+    }
+
+    ML::Spinlock lock;
+    std::map<std::string, LatencyHistogram> histograms;
+    std::map<std::string, uint64_t> outcomes;
+};
+
+
+/******************************************************************************/
+/* IN MEMORY EXCHANGE CONNECTOR                                               */
+/******************************************************************************/
+
+/** Exchange connector that is handed its bid requests directly instead of
+    reading them off a socket. Responses are rendered to JSON and dropped.
+ */
+struct InMemoryExchangeConnector : public ExchangeConnector
+{
+    InMemoryExchangeConnector(
+            std::shared_ptr<ServiceProxies> proxies,
+            const string& format, double timeout) :
+        ExchangeConnector("inMemory", proxies),
+        format(format), timeout(timeout), inFlight(0)
+    {}
+
+    std::string exchangeName() const { return "inMemory"; }
+    void configure(const Json::Value& parameters) {}
+    void enableUntil(Date date) {}
+
+    /** Parses the request and starts the auction as the HTTP exchange
+        connectors would. The auction is assumed to have started at the given
+        time which may be in the past if the injector is running late.
+     */
+    void inject(const string& requestStr, uint64_t auctionId, Date start)
+    {
+        std::shared_ptr<BidRequest> request(
+                BidRequest::parse(format, requestStr));
+
+        // Requests are replayed so the ids have to be made unique.
+        request->auctionId = Id(auctionId);
+
+        auto auction = std::make_shared<Auction>(
+                this,
+                [=] (std::shared_ptr<Auction> auction) { onFinished(auction); },
+                request, requestStr, format,
+                start, start.plusSeconds(timeout));
+        auction->doneParsing = Date::now();
+
+        ++inFlight;
+        onNewAuction(auction);
+    }
+
+    void onFinished(const std::shared_ptr<Auction>& auction)
+    {
+        Date finished = Date::now();
+        Json::Value response = auction->getResponsesJson();
+        Date rendered = Date::now();
+
+        onAuctionDone(auction);
+        stages.record(*auction, finished, rendered);
+
+        --inFlight;
+    }
+
+    string format;
+    double timeout;
+
+    std::atomic<size_t> inFlight;
+    Stages stages;
+};
+
+
+/******************************************************************************/
+/* BENCH                                                                      */
+/******************************************************************************/
+
+/** Injects this thread's share of the auctions either on a fixed schedule or
+    as fast as the window of auctions in flight allows.
+ */
+void inject(
+        const Config& config,
+        InMemoryExchangeConnector& exchange,
+        const std::vector<string>& requests,
+        std::atomic<size_t>& next,
+        Date start)
+{
+    double rate = config.qps / config.threads;
+    size_t window = std::max<size_t>(1, config.window);
+
+    for (size_t sent = 0;; ++sent) {
+        size_t i = next++;
+        if (i >= config.auctions) break;
+
+        Date scheduled = Date::now();
+
+        if (rate > 0.0) {
+            // Late auctions keep their scheduled start so that the delay
+            // shows up in their latency instead of being absorbed.
+            scheduled = start.plusSeconds(sent / rate);
+            double wait = scheduled.secondsSince(Date::now());
+            if (wait > 0) ML::sleep(wait);
+        }
+        else {
+            while (exchange.inFlight >= window)
+                std::this_thread::yield();
+            scheduled = Date::now();
+        }
+
+        exchange.inject(requests[i % requests.size()], i + 1, scheduled);
+    }
+}
+
+Json::Value report(const Config& config, const Stages& stages, double elapsed)
+{
+    Json::Value result;
+
+    result["agents"] = Json::UInt(config.agents);
+    result["auctions"] = Json::UInt(config.auctions);
+    result["qps"] = config.qps;
+    result["window"] = Json::UInt(config.window);
+    result["threads"] = Json::UInt(config.threads);
+    result["elapsed"] = elapsed;
+    result["throughput"] = config.auctions / elapsed;
+
+    for (const auto& entry : stages.outcomes)
+        result["outcomes"][entry.first] = Json::UInt(entry.second);
+
+    for (const auto& entry : stages.histograms)
+        result["stages"][entry.first] = entry.second.toJson();
+
+    return result;
+}
+
+void print(const Stages& stages, double elapsed, size_t auctions)
+{
+    cerr << endl
+        << printValue(auctions / elapsed) << " auctions/sec over "
+        << printValue(elapsed) << " seconds" << endl;
+
+    for (const auto& entry : stages.outcomes)
+        cerr << ML::format("    %-20s %10lld\n",
+                entry.first.c_str(), (long long) entry.second);
+
+    cerr << endl << ML::format("%-15s %10s %10s %10s %10s %10s\n",
+            "stage (us)", "count", "p50", "p99", "p999", "max");
+
+    const char* order[] = {
+        "parse", "preproQueue", "prepro", "augmentation",
+        "biddingQueue", "bidding", "submission", "total"
+    };
+
+    for (const char* name : order) {
+        auto it = stages.histograms.find(name);
+        if (it == stages.histograms.end()) continue;
+
+        const LatencyHistogram& histogram = it->second;
+        cerr << ML::format("%-15s %10lld %10lld %10lld %10lld %10lld\n",
+                name,
+                (long long) histogram.count(),
+                (long long) histogram.percentile(50),
+                (long long) histogram.percentile(99),
+                (long long) histogram.percentile(99.9),
+                (long long) histogram.max());
+    }
+}
+
+
+/******************************************************************************/
+/* MAIN                                                                       */
+/******************************************************************************/
+
+int main(int argc, char* argv[])
+{
+    auto config = getConfig(argc, argv);
+
+    std::vector<string> requests;
+    {
+        filter_istream stream(config.requests);
+        string line;
+        while (getline(stream, line))
+            if (!line.empty()) requests.push_back(line);
+    }
+    ExcCheck(!requests.empty(), "no bid requests in " + config.requests);
+
+    auto proxies = std::make_shared<ServiceProxies>();
+
+    AgentConfigurationService acs(proxies, "AgentConfigurationService");
+    acs.unsafeDisableMonitor();
+    acs.init();
+    acs.bindTcp();
+    acs.start();
+
+    Router router(proxies, "router");
+    router.unsafeDisableMonitor();
+    router.init();
+    router.setBanker(std::make_shared<NullBanker>(true));
+    router.bindTcp();
+    router.start();
+
+    auto exchange = std::make_shared<InMemoryExchangeConnector>(
+            proxies, config.format, config.timeoutMs / 1000.0);
+    router.addExchange(exchange);
+
+    std::vector< std::shared_ptr<TestAgent> > agents;
+    for (size_t i = 0; i < config.agents; ++i) {
+        string name = ML::format("agent%d", int(i));
+
+        auto agent = std::make_shared<TestAgent>(
+                proxies, name, AccountKey({ "benchCampaign", name }));
+        agent->config.bidProbability = config.bidProbability;
+        agent->bidWithFixedAmount(USD_CPM(1));
+        agent->init();
+        agent->start();
+        agent->strictMode(false);
+        agents.push_back(agent);
+    }
+
+    // Give the agent configurations time to make it to the router.
+    ML::sleep(config.settle);
+
+    cerr << "running " << printValue(config.auctions) << " auctions through "
+        << printValue(config.agents) << " agents" << endl;
+
+    std::atomic<size_t> next(0);
+    Date start = Date::now();
+
+    std::vector<std::thread> threads;
+    for (size_t i = 0; i < config.threads; ++i) {
+        threads.emplace_back([&] {
+                    inject(config, *exchange, requests, next, start);
+                });
+    }
+    for (auto& thread : threads) thread.join();
+
+    // Every auction finishes on its own once it expires.
+    while (exchange->inFlight) ML::sleep(0.001);
+
+    double elapsed = Date::now().secondsSince(start);
+
+    {
+        std::lock_guard<ML::Spinlock> guard(exchange->stages.lock);
+
+        print(exchange->stages, elapsed, config.auctions);
+
+        if (!config.output.empty()) {
+            filter_ostream stream(config.output);
+            stream << report(config, exchange->stages, elapsed)
+                .toStyledString();
+        }
+    }
+
+    for (auto& agent : agents) agent->shutdown();
+    router.shutdown();
+    acs.shutdown();
+}
@@ -7,5 +7,8 @@ $(eval $(call nodejs_test,rtb_router_unit_test,rtb sync))
 $(eval $(call nodejs_test,rtb_new_format_test,bid_request sync_utils))
 #$(eval $(call test,rtb_router_leak_test,rtb_router rtbsim,boost valgrind))
 $(eval $(call test,pending_list_test,types,boost))
+$(eval $(call test,filter_pool_test,rtb_router,boost))
 #$(eval $(call test,router_banker_test,rtb_router dataflow bidding_agent,boost))
 #$(eval $(call test,augmentation_test,rtb_router bid_request augmentor_base,boost))
+$(eval $(call program,config_churn_bench,rtb_router boost_program_options))
+$(eval $(call program,router_bench,rtb_router bidding_agent integration_test_utils boost_program_options))
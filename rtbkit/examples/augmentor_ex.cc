@@ -94,9 +94,9 @@ FrequencyCapAugmentor(
 */
 void
 FrequencyCapAugmentor::
-init()
+init(int numThreads, size_t maxBacklog)
 {
-    SyncAugmentor::init(2 /* numThreads */);
+    SyncAugmentor::init(numThreads, maxBacklog);
 
     /* Manages all the communications with the AgentConfigurationService. */
     agentConfig.init(getServices()->config);
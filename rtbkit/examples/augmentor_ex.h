@@ -50,7 +50,8 @@ struct FrequencyCapAugmentor :
             const std::string& serviceName,
             const std::string& augmentorName = "frequency-cap-ex");
 
-    void init();
+    void init(int numThreads = 2,
+              size_t maxBacklog = RTBKIT::Augmentor::DefaultMaxBacklog);
 
 private:
 
@@ -0,0 +1,240 @@
+/** augmentor_ex_load_test.cc                                 -*- C++ -*-
+    Copyright (c) 2013 Datacratic.  All rights reserved.
+
+    Load test harness for the augmentor base built on top of our example
+    frequency cap augmentor.
+
+    Stands up the augmentor along with a fake router that feeds it AUGMENT
+    messages at a fixed rate and measures how long it takes for the responses
+    to come back, how many were shed or dropped because they expired and how
+    well the responses were batched.
+
+*/
+
+#include "augmentor_ex.h"
+#include "soa/service/service_base.h"
+#include "soa/service/zmq_endpoint.h"
+#include "jml/db/persistent.h"
+#include "jml/utils/exc_assert.h"
+
+#include <boost/program_options/cmdline.hpp>
+#include <boost/program_options/options_description.hpp>
+#include <boost/program_options/parsers.hpp>
+#include <boost/program_options/variables_map.hpp>
+
+#include <algorithm>
+#include <iostream>
+#include <thread>
+#include <chrono>
+#include <atomic>
+#include <set>
+
+
+using namespace std;
+using namespace Datacratic;
+using namespace RTBKIT;
+
+static const string sampleBr =
+    "{\"id\":\"85885bb0-b91b-11e2-c4cf-7fba90171555\",\"timestamp\":1368153863.008756,\"isTest\":false,\"url\":\"http://myonlinearcade.com/\",\"ipAddress\":\"166.13.20.21\",\"userAgent\":\"Mozilla/5.0 (Windows NT 6.1; WOW64; rv:19.0) Gecko/20100101 Firefox/20.0\",\"language\":\"fr\",\"protocolVersion\":\"0.3\",\"exchange\":\"appnexus\",\"provider\":\"appnexus\",\"location\":{\"countryCode\":\"CA\",\"regionCode\":\"QC\",\"cityName\":\"Laval\",\"postalCode\":\"0\",\"dma\":0,\"timezoneOffsetMinutes\":-1},\"segments\":{\"appnexus\":[\"memberId1357\"],\"browser\":[\"Mozilla Firefox\"]},\"userIds\":{\"an\":\"5273283952213481305\",\"xchg\":\"5273283952213481305\"},\"imp\":[{\"id\":\"156331815539876686\",\"banner\":{\"w\":728,\"h\":90},\"formats\":[\"728x90\"]}],\"spots\":[{\"id\":\"156331815539876686\",\"banner\":{\"w\":728,\"h\":90},\"formats\":[\"728x90\"]}]}";
+
+
+/******************************************************************************/
+/* LOAD TEST ROUTER                                                           */
+/******************************************************************************/
+
+/** Plays the part of the router's augmentation loop. */
+struct LoadTestRouter : public ServiceBase, public MessageLoop
+{
+    LoadTestRouter(const std::shared_ptr<ServiceProxies>& proxies,
+                   const string& augmentor,
+                   double rate,
+                   double timeoutMs,
+                   bool batching) :
+        ServiceBase("augmentor-load-test-router", proxies),
+        toAug(proxies->zmqContext),
+        augmentor(augmentor),
+        rate(rate), timeoutMs(timeoutMs), batching(batching),
+        sending(false), credit(0),
+        sent(0), recv(0), nullResponses(0), frames(0)
+    {}
+
+    void start()
+    {
+        registerServiceProvider(serviceName(), { "rtbRouterAugmentation" });
+
+        toAug.init(getServices()->config, serviceName() + "/augmentors");
+        toAug.bindTcp(getServices()->ports->getRange("augmentors"));
+
+        toAug.clientMessageHandler = [=] (const vector<string> & message) {
+            handleMessage(message);
+        };
+
+        addSource("LoadTestRouter::toAug", toAug);
+
+        {
+            set<string> agents { "load-test-agent" };
+            std::ostringstream agentStr;
+            ML::DB::Store_Writer writer(agentStr);
+            writer.save(agents);
+            this->agents = agentStr.str();
+        }
+
+        addPeriodic("LoadTestRouter::send", 0.001, [=] (uint64_t) {
+                    if (!sending) return;
+
+                    credit += rate / 1000.0;
+                    for (; credit >= 1.0; credit -= 1.0) {
+                        toAug.sendMessage(
+                                augmentor, "AUGMENT", "1.0", augmentor,
+                                to_string(random()), "datacratic", sampleBr,
+                                agents, Date::now(), timeoutMs);
+                        sent++;
+                    }
+                });
+
+        MessageLoop::start();
+    }
+
+    void handleMessage(const vector<string> & message)
+    {
+        const string& type = message.at(1);
+
+        if (type == "CONFIG") {
+            if (batching)
+                toAug.sendMessage(message[0], "CONFIGOK", "RESPONSES");
+            else toAug.sendMessage(message[0], "CONFIGOK");
+        }
+
+        else if (type == "RESPONSE") {
+            frames++;
+            record(message[3], message[6]);
+        }
+
+        else if (type == "RESPONSES") {
+            frames++;
+            ExcAssertEqual((message.size() - 3) % 4, 0);
+            for (size_t i = 3; i < message.size(); i += 4)
+                record(message[i], message[i + 3]);
+        }
+    }
+
+    void record(const string& startTime, const string& augmentation)
+    {
+        Date start = Date::parseSecondsSinceEpoch(startTime);
+        latenciesMs.push_back(start.secondsUntil(Date::now()) * 1000.0);
+        if (augmentation == "null") nullResponses++;
+        recv++;
+    }
+
+    ZmqNamedClientBus toAug;
+    string augmentor;
+    string agents;
+
+    double rate;
+    double timeoutMs;
+    bool batching;
+
+    std::atomic<bool> sending;
+    double credit;
+
+    size_t sent, recv, nullResponses, frames;
+    vector<double> latenciesMs;
+};
+
+
+/******************************************************************************/
+/* MAIN                                                                       */
+/******************************************************************************/
+
+int main(int argc, char** argv)
+{
+    using namespace boost::program_options;
+
+    double rate = 10000;
+    double duration = 10;
+    double timeoutMs = 5;
+    int threads = 2;
+    size_t backlog = Augmentor::DefaultMaxBacklog;
+    bool noBatching = false;
+
+    options_description options("Augmentor load test");
+    options.add_options()
+        ("rate,r", value<double>(&rate),
+         "Requests per second sent to the augmentor")
+        ("duration,d", value<double>(&duration),
+         "Length of the test in seconds")
+        ("timeout,t", value<double>(&timeoutMs),
+         "Time available for each request in milliseconds")
+        ("threads,n", value<int>(&threads),
+         "Number of augmentor worker threads")
+        ("backlog,b", value<size_t>(&backlog),
+         "Maximum number of requests waiting for a worker")
+        ("no-batching", bool_switch(&noBatching),
+         "Ask for one message per response")
+        ("help,h", "Print this message");
+
+    variables_map vm;
+    store(command_line_parser(argc, argv).options(options).run(), vm);
+    notify(vm);
+
+    if (vm.count("help")) {
+        cerr << options << endl;
+        return 1;
+    }
+
+    auto proxies = std::make_shared<ServiceProxies>();
+
+    const string augmentorName = "frequency-cap-ex";
+
+    LoadTestRouter router(proxies, augmentorName, rate, timeoutMs, !noBatching);
+    router.start();
+
+    FrequencyCapAugmentor augmentor(proxies, "frequency-cap-ex", augmentorName);
+    augmentor.init(threads, backlog);
+    augmentor.start();
+
+    // Give the augmentor time to find and configure itself with the router.
+    this_thread::sleep_for(chrono::milliseconds(500));
+
+    router.sending = true;
+    for (int i = 0; i < duration; ++i) {
+        this_thread::sleep_for(chrono::seconds(1));
+        cerr << "[ " << i << " / " << duration << " ]: "
+             << "load=" << augmentor.sampleLoad()
+             << ", prob=" << augmentor.shedProbability()
+             << endl;
+    }
+    router.sending = false;
+
+    // Wait for the stragglers.
+    this_thread::sleep_for(chrono::milliseconds(100));
+    router.shutdown();
+    augmentor.shutdown();
+
+    auto& latencies = router.latenciesMs;
+    std::sort(latencies.begin(), latencies.end());
+    auto percentile = [&] (double p) {
+        if (latencies.empty()) return 0.0;
+        return latencies[std::min<size_t>(latencies.size() - 1,
+                                          p * latencies.size())];
+    };
+
+    size_t late = std::count_if(latencies.begin(), latencies.end(),
+                                [&] (double ms) { return ms > timeoutMs; });
+
+    cout << "sent:       " << router.sent << endl
+         << "received:   " << router.recv << endl
+         << "null:       " << router.nullResponses << endl
+         << "late:       " << late << endl
+         << "frames:     " << router.frames << endl
+         << "batch:      "
+         << (router.frames ? double(router.recv) / router.frames : 0.0) << endl
+         << "p50 ms:     " << percentile(0.50) << endl
+         << "p90 ms:     " << percentile(0.90) << endl
+         << "p99 ms:     " << percentile(0.99) << endl
+         << "p999 ms:    " << percentile(0.999) << endl;
+
+    proxies->events->dump(cerr);
+
+    return 0;
+}
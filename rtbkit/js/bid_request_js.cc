@@ -303,15 +303,19 @@ from_js(const JSValue & value, SegmentList *)
 
 void to_js(JS::JSValue & value, const UserIds & uids)
 {
-    to_js(value, static_cast<const std::map<std::string, Id> &>(uids));
+    std::map<std::string, Id> ids;
+    for (auto & entry: uids)
+        ids[entry.first] = entry.second;
+    to_js(value, ids);
 }
 
 UserIds 
 from_js(const JSValue & value, UserIds *)
 {
     UserIds result;
-    static_cast<std::map<std::string, Id> &>(result)
-        = from_js(value, (std::map<std::string, Id> *)0);
+    auto ids = from_js(value, (std::map<std::string, Id> *)0);
+    for (auto & entry: ids)
+        result.set(entry.second, entry.first);
     return result;
 }
 
@@ -519,7 +523,7 @@ struct SegmentsBySourceJS
             for (auto it = segs->begin(), end = segs->end();
                  it != end;  ++it,++i) {
                 v8::Local<Integer> key = v8::Integer::New(i);
-                v8::Handle<Value>  val = JS::toJS(it->first);
+                v8::Handle<Value>  val = JS::toJS(it->first.str());
                 result->Set(key, val);
             }
             
@@ -677,7 +681,7 @@ struct UserIdsJS
             for (auto it = ids->begin(), end = ids->end();
                  it != end;  ++it,++i) {
                 v8::Local<Integer> key = v8::Integer::New(i);
-                v8::Handle<Value>  val = JS::toJS(it->first);
+                v8::Handle<Value>  val = JS::toJS(it->first.str());
                 result->Set(key, val);
             }
             
@@ -11,6 +11,8 @@
 #include "jml/arch/timers.h"
 #include "jml/utils/vector_utils.h"
 #include "jml/arch/futex.h"
+#include "jml/arch/atomic_ops.h"
+#include <algorithm>
 #include <memory>
 
 
@@ -26,10 +28,12 @@ namespace RTBKIT {
 /*****************************************************************************/
 
 // Determined via a very scientific method: 2^16 should be enough... right?
-// \todo Need to make this queue way smaller so that we don't build up a backlog
-// of requests.
+// Only used for responses now; the request backlog is bounded by maxBacklog.
 enum { QueueSize = 65536 };
 
+// Smallest backlog we'll give to a single worker.
+enum { MinWorkerQueueSize = 16 };
+
 Augmentor::
 Augmentor(const std::string & augmentorName,
           const std::string & serviceName,
@@ -38,7 +42,7 @@ Augmentor(const std::string & augmentorName,
       augmentorName(augmentorName),
       toRouters(getZmqContext()),
       responseQueue(QueueSize),
-      requestQueue(QueueSize),
+      nextWorker(0),
       loopMonitor(*this),
       loadStabilizer(loopMonitor)
 {
@@ -52,7 +56,7 @@ Augmentor(const std::string & augmentorName,
       augmentorName(augmentorName),
       toRouters(getZmqContext()),
       responseQueue(QueueSize),
-      requestQueue(QueueSize),
+      nextWorker(0),
       loopMonitor(*this),
       loadStabilizer(loopMonitor)
 {
@@ -66,23 +70,16 @@ Augmentor::
 
 void
 Augmentor::
-init(int numThreads)
+init(int numThreads, size_t maxBacklog)
 {
     responseQueue.onEvent = [=] (const Response& resp)
         {
-            const AugmentationRequest& request = resp.first;
-            const AugmentationList& response = resp.second;
-
-            toRouters.sendMessage(
-                    request.router,
-                    "RESPONSE",
-                    "1.0",
-                    request.startTime,
-                    request.id.toString(),
-                    request.augmentor,
-                    chomp(response.toJson().toString()));
+            queueResponse(resp);
+        };
 
-            recordHit("messages.RESPONSE");
+    responseQueue.onDrained = [=] ()
+        {
+            flushAllResponses();
         };
 
     addSource("Augmentor::responseQueue", responseQueue);
@@ -98,6 +95,8 @@ init(int numThreads)
     toRouters.disconnectHandler = [=] (const std::string & oldRouter)
         {
             cerr << "disconnected from router " << oldRouter << endl;
+            batchingRouters.erase(oldRouter);
+            pendingResponses.erase(oldRouter);
         };
 
     toRouters.messageHandler = [=] (const std::string & router,
@@ -112,9 +111,14 @@ init(int numThreads)
     addSource("Augmentor::toRouters", toRouters);
 
 
+    size_t workerQueueSize = std::max<size_t>(
+            maxBacklog / numThreads, MinWorkerQueueSize);
+    for (size_t i = 0; i < numThreads; ++i)
+        workerQueues.emplace_back(new WorkerQueue(workerQueueSize));
+
     stopWorkers = false;
     for (size_t i = 0; i < numThreads; ++i)
-        workers.create_thread([=] { this->runWorker(); });
+        workers.create_thread([=] { this->runWorker(i); });
 
     loopMonitor.init();
     loopMonitor.addMessageLoop("augmentor", this);
@@ -151,28 +155,119 @@ respond(const AugmentationRequest & request, const AugmentationList & response)
     cerr << "Dropping augmentation response: response queue is full" << endl;
 }
 
+/** Routers that told us they understand RESPONSES frames get their responses
+    batched until the response queue runs dry (or the batch is full) which
+    saves a zmq send and a router wakeup per request under load.  Everyone
+    else gets one RESPONSE message per request as before.
+*/
+void
+Augmentor::
+queueResponse(const Response & resp)
+{
+    const AugmentationRequest& request = resp.first;
+    const AugmentationList& response = resp.second;
+
+    if (!batchingRouters.count(request.router)) {
+        toRouters.sendMessage(
+                request.router,
+                "RESPONSE",
+                "1.0",
+                request.startTime,
+                request.id.toString(),
+                request.augmentor,
+                chomp(response.toJson().toString()));
+
+        recordHit("messages.RESPONSE");
+        return;
+    }
+
+    auto& parts = pendingResponses[request.router];
+    parts.emplace_back(ML::format("%.5f", request.startTime.secondsSinceEpoch()));
+    parts.emplace_back(request.id.toString());
+    parts.emplace_back(request.augmentor);
+    parts.emplace_back(chomp(response.toJson().toString()));
+
+    if (parts.size() >= MaxResponseBatch * 4)
+        flushResponses(request.router, parts);
+}
+
+void
+Augmentor::
+flushResponses(const std::string & router, std::vector<std::string> & parts)
+{
+    if (parts.empty()) return;
+
+    recordLevel(parts.size() / 4, "responseBatchSize");
+    recordHit("messages.RESPONSES");
+
+    try {
+        toRouters.sendMessage(router, "RESPONSES", "1.0", parts);
+    } catch (const std::exception & exc) {
+        cerr << "error sending responses to " << router << ": "
+             << exc.what() << endl;
+    }
+
+    parts.clear();
+}
+
+void
+Augmentor::
+flushAllResponses()
+{
+    for (auto& pending : pendingResponses)
+        flushResponses(pending.first, pending.second);
+}
+
 void
 Augmentor::
 parseMessage(AugmentationRequest& request, Message& message)
 {
-    const string & version = message.second.at(1);
+    const string & version = message.parts.at(1);
     ExcCheckEqual(version, "1.0", "unexpected version in augment");
 
-    request.router = message.first;
-    request.timeAvailableMs = 0.05;
-    request.augmentor = std::move(message.second.at(2));
-    request.id = Id(std::move(message.second.at(3)));
+    request.router = message.router;
+    request.augmentor = std::move(message.parts.at(2));
+    request.id = Id(std::move(message.parts.at(3)));
 
-    const string & brSource = std::move(message.second.at(4));
-    const string & brStr = std::move(message.second.at(5));
+    const string & brSource = std::move(message.parts.at(4));
+    const string & brStr = std::move(message.parts.at(5));
     request.bidRequest.reset(BidRequest::parse(brSource, brStr));
 
-    istringstream agentsStr(message.second.at(6));
+    istringstream agentsStr(message.parts.at(6));
     ML::DB::Store_Reader reader(agentsStr);
     reader.load(request.agents);
 
-    const string & startTimeStr = message.second.at(7);
+    const string & startTimeStr = message.parts.at(7);
     request.startTime = Date::fromSecondsSinceEpoch(strtod(startTimeStr.c_str(), 0));
+
+    request.deadline = message.deadline;
+    request.timeAvailableMs = message.deadline == Date::positiveInfinity()
+        ? 0.05 : Date::now().secondsUntil(message.deadline) * 1000.0;
+}
+
+/** Spreads the requests round-robin over the worker queues, moving on to the
+    next one when a queue is full.  Only fails once every queue is full which
+    means the backlog is as big as we allow it to get.
+*/
+bool
+Augmentor::
+pushRequest(Message && message)
+{
+    for (size_t i = 0; i < workerQueues.size(); ++i) {
+        WorkerQueue& worker = *workerQueues[nextWorker];
+        nextWorker = (nextWorker + 1) % workerQueues.size();
+
+        if (!worker.queue.tryPush(std::move(message))) continue;
+
+        ML::memory_barrier();
+        if (worker.sleeping) {
+            worker.sleeping = 0;
+            ML::futex_wake(worker.sleeping);
+        }
+        return true;
+    }
+
+    return false;
 }
 
 void
@@ -184,26 +279,41 @@ handleRouterMessage(const std::string & router, std::vector<std::string> & messa
     const std::string & type = message.at(0);
     recordHit("messages." + type);
 
-    if (type == "CONFIGOK") {}
+    if (type == "CONFIGOK") {
+        // Newer routers list the optional features they support.
+        for (size_t i = 1; i < message.size(); ++i)
+            if (message[i] == "RESPONSES")
+                batchingRouters.insert(router);
+    }
 
     else if (type == "AUGMENT") {
 
-        bool shedMessage = loadStabilizer.shedMessage();
+        Message value;
+        value.router = router;
 
-        if (!shedMessage) {
-            Message value = make_pair(router, std::move(message));
-            shedMessage = !requestQueue.tryPush(std::move(value));
+        // Older routers don't send the time available for the request.
+        if (message.size() > 8) {
+            double timeAvailableMs = strtod(message[8].c_str(), 0);
+            value.deadline = Date::now().plusSeconds(timeAvailableMs / 1000.0);
         }
+        else value.deadline = Date::positiveInfinity();
+
+        value.parts = std::move(message);
+
+        // Only moved from if it was actually queued.
+        bool shedMessage = loadStabilizer.shedMessage();
+        if (!shedMessage)
+            shedMessage = !pushRequest(std::move(value));
 
         if (shedMessage) {
             toRouters.sendMessage(
                     router,
                     "RESPONSE",
-                    message.at(1), // version
-                    message.at(7), // startTime
-                    message.at(3), // auctionId
-                    message.at(2), // augmentor
-                    "null");       // response
+                    value.parts.at(1), // version
+                    value.parts.at(7), // startTime
+                    value.parts.at(3), // auctionId
+                    value.parts.at(2), // augmentor
+                    "null");           // response
             recordHit("shedMessages");
         }
     }
@@ -211,20 +321,78 @@ handleRouterMessage(const std::string & router, std::vector<std::string> & messa
     else cerr << "unknown router message type: " << type << endl;
 }
 
+bool
+Augmentor::
+stealRequest(size_t index, Message & message)
+{
+    for (size_t i = 1; i < workerQueues.size(); ++i) {
+        WorkerQueue& victim = *workerQueues[(index + i) % workerQueues.size()];
+        if (victim.queue.tryPop(message))
+            return true;
+    }
+    return false;
+}
+
+void
+Augmentor::
+waitForRequest(WorkerQueue & worker)
+{
+    worker.sleeping = 1;
+    ML::memory_barrier();
+
+    // Re-check after announcing we're asleep so that a push that raced with
+    // us can't be missed. The timeout is there for work that lands in other
+    // queues which we'd want to steal.
+    if (!worker.queue.couldPop())
+        ML::futex_wait(worker.sleeping, 1, 0.01);
+
+    worker.sleeping = 0;
+}
+
+/** The router has already given up on the request so there's no point in
+    working on it but we still owe it a response to keep its in-flight count
+    for us accurate.
+*/
 void
 Augmentor::
-runWorker()
+expireRequest(const Message & message)
 {
+    recordHit("expiredMessages");
+
+    AugmentationRequest request;
+    request.router = message.router;
+    request.augmentor = message.parts.at(2);
+    request.id = Id(message.parts.at(3));
+    request.startTime = Date::fromSecondsSinceEpoch(
+            strtod(message.parts.at(7).c_str(), 0));
+
+    respond(request, AugmentationList());
+}
+
+void
+Augmentor::
+runWorker(size_t index)
+{
+    WorkerQueue& worker = *workerQueues[index];
+
     AugmentationRequest request;
     Message message;
 
     while(!stopWorkers) {
-        if (!requestQueue.tryPop(message, 1.0)) continue;
+        if (!worker.queue.tryPop(message) && !stealRequest(index, message)) {
+            waitForRequest(worker);
+            continue;
+        }
+
+        if (message.deadline < Date::now()) {
+            expireRequest(message);
+            continue;
+        }
 
         try { parseMessage(request, message); }
         catch (const std::exception& ex) {
             cerr << "error while parsing message: "
-                << message << " -> " << ex.what()
+                << message.parts << " -> " << ex.what()
                 << endl;
             continue;
         }
@@ -234,4 +402,3 @@ runWorker()
 }
 
 } // namespace RTBKIT
-
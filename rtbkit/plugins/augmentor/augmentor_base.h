@@ -26,6 +26,8 @@
 
 #include <boost/function.hpp>
 #include <boost/thread.hpp>
+#include <map>
+#include <set>
 
 
 namespace RTBKIT {
@@ -49,6 +51,7 @@ struct AugmentationRequest
     std::vector<std::string> agents;          // Agents availble to bid
     double timeAvailableMs;                   // Time to respond
     Date startTime;                           // Start of the latency timer
+    Date deadline;                            // Router gives up after this
 };
 
 
@@ -72,7 +75,18 @@ struct Augmentor : public ServiceBase, public MessageLoop {
 
     ~Augmentor();
 
-    void init(int numThreads = 1);
+    enum {
+        /** Default number of requests that can be waiting for a worker
+            across all the worker threads.  Anything more than that would
+            time out in the router before we get to it anyway.
+        */
+        DefaultMaxBacklog = 1024,
+
+        /** Maximum number of responses sent to a router in one frame. */
+        MaxResponseBatch = 64
+    };
+
+    void init(int numThreads = 1, size_t maxBacklog = DefaultMaxBacklog);
     void start();
     void shutdown();
 
@@ -97,8 +111,37 @@ private:
     typedef std::pair<AugmentationRequest, AugmentationList> Response;
     TypedMessageSink<Response> responseQueue;
 
-    typedef std::pair<std::string, std::vector<std::string> > Message;
-    ML::RingBufferSWMR<Message> requestQueue;
+    /** Routers which accept batched RESPONSES frames along with the pending
+        responses for each of them.  Only touched from the message loop.
+    */
+    std::set<std::string> batchingRouters;
+    std::map<std::string, std::vector<std::string> > pendingResponses;
+
+    void queueResponse(const Response & response);
+    void flushResponses(const std::string & router,
+                        std::vector<std::string> & parts);
+    void flushAllResponses();
+
+    /** Request as it sits in the backlog until a worker gets to it. */
+    struct Message {
+        std::string router;
+        std::vector<std::string> parts;
+        Date deadline;
+    };
+
+    /** Backlog of a single worker thread.  Requests are only pushed from the
+        message loop but idle workers steal from the others so pops can come
+        from any worker.
+    */
+    struct WorkerQueue {
+        WorkerQueue(size_t size) : queue(size), sleeping(0) {}
+
+        ML::RingBufferMWMR<Message> queue;
+        int sleeping;   // futex the worker waits on when out of work
+    };
+
+    std::vector<std::unique_ptr<WorkerQueue> > workerQueues;
+    size_t nextWorker;
 
     boost::thread_group workers;
     std::atomic<bool> stopWorkers;
@@ -106,7 +149,12 @@ private:
     LoopMonitor loopMonitor;
     LoadStabilizer loadStabilizer;
 
-    void runWorker();
+    void runWorker(size_t index);
+    bool pushRequest(Message && message);
+    bool stealRequest(size_t index, Message & message);
+    void waitForRequest(WorkerQueue & worker);
+    void expireRequest(const Message & message);
+
     void handleRouterMessage(const std::string & router,
                              std::vector<std::string> & message);
 
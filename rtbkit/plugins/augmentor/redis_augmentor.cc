@@ -10,15 +10,233 @@
 #include <algorithm>// std::copy_if
 #include <boost/range/irange.hpp>
 #include "redis_augmentor.h"
+#include "rtbkit/core/agent_configuration/agent_config.h"
 #include "jml/utils/exc_assert.h"
 using namespace std;
 
 namespace RTBKIT {
 
 
+/******************************************************************************/
+/* REDIS AUGMENTATION KEYS                                                    */
+/******************************************************************************/
+
+namespace {
+
+const string redisKeyPrefix = "RTBkit:aug";
+
+bool needsJsonEscape(const std::string & value)
+{
+    for (unsigned char c: value)
+        if (c < 0x20 || c == '\\' || c >= 0x80)
+            return true;
+    return false;
+}
+
+template<typename Fn>
+RedisAugmentationKeys::Extractor
+stringField(Fn getter)
+{
+    return [=] (const BidRequest & br, std::string & out) -> bool {
+        const std::string & value = getter(br);
+        if (value.empty()) return false;
+        RedisAugmentationKeys::appendFragment(out, value);
+        return true;
+    };
+}
+
+template<typename Fn>
+RedisAugmentationKeys::Extractor
+unicodeField(Fn getter)
+{
+    return [=] (const BidRequest & br, std::string & out) -> bool {
+        const Datacratic::UnicodeString & value = getter(br);
+        if (value.rawLength() == 0) return false;
+        RedisAugmentationKeys::appendFragment(out, value.utf8String());
+        return true;
+    };
+}
+
+template<typename Fn>
+RedisAugmentationKeys::Extractor
+intField(Fn getter)
+{
+    return [=] (const BidRequest & br, std::string & out) -> bool {
+        int value = getter(br);
+        if (value == -1) return false;
+        out += to_string(value);
+        return true;
+    };
+}
+
+} // file scope
+
+RedisAugmentationKeys::Key::
+Key(const std::string & name)
+    : name(name),
+      prefix(redisKeyPrefix + ":" + name + ":"),
+      extract(getExtractor(name)),
+      path(name[0] == '.' ? name : "." + name) // prefix root path if absent
+{
+}
+
+RedisAugmentationKeys::Extractor
+RedisAugmentationKeys::
+getExtractor(const std::string & path)
+{
+    // Mirrors the layout of BidRequest::toJson() for every field that has a
+    // direct representation; empty fields are omitted there so they are
+    // reported as absent here.
+    static const std::unordered_map<std::string, Extractor> extractors = {
+        { "id", [] (const BidRequest & br, std::string & out) -> bool {
+                out += br.auctionId.toString();
+                return true;
+            } },
+        { "url", [] (const BidRequest & br, std::string & out) -> bool {
+                if (br.url.empty()) return false;
+                appendFragment(out, br.url.toString());
+                return true;
+            } },
+        { "ipAddress",
+          stringField([] (const BidRequest & br) -> const std::string &
+                      { return br.ipAddress; }) },
+        { "protocolVersion",
+          stringField([] (const BidRequest & br) -> const std::string &
+                      { return br.protocolVersion; }) },
+        { "exchange",
+          stringField([] (const BidRequest & br) -> const std::string &
+                      { return br.exchange; }) },
+        { "provider",
+          stringField([] (const BidRequest & br) -> const std::string &
+                      { return br.provider; }) },
+        { "userAgent",
+          unicodeField([] (const BidRequest & br)
+                       -> const Datacratic::UnicodeString &
+                       { return br.userAgent; }) },
+        { "language",
+          unicodeField([] (const BidRequest & br)
+                       -> const Datacratic::UnicodeString &
+                       { return br.language; }) },
+        { "location.countryCode",
+          stringField([] (const BidRequest & br) -> const std::string &
+                      { return br.location.countryCode; }) },
+        { "location.regionCode",
+          stringField([] (const BidRequest & br) -> const std::string &
+                      { return br.location.regionCode; }) },
+        { "location.cityName",
+          unicodeField([] (const BidRequest & br)
+                       -> const Datacratic::UnicodeString &
+                       { return br.location.cityName; }) },
+        { "location.postalCode",
+          unicodeField([] (const BidRequest & br)
+                       -> const Datacratic::UnicodeString &
+                       { return br.location.postalCode; }) },
+        { "location.dma",
+          intField([] (const BidRequest & br) { return br.location.dma; }) },
+        { "location.metro",
+          intField([] (const BidRequest & br) { return br.location.metro; }) },
+        { "location.timezoneOffsetMinutes",
+          intField([] (const BidRequest & br)
+                   { return br.location.timezoneOffsetMinutes; }) }
+    };
+
+    std::string key = !path.empty() && path[0] == '.' ? path.substr(1) : path;
+
+    auto it = extractors.find(key);
+    if (it != extractors.end())
+        return it->second;
+
+    static const string userIdsPrefix = "userIds.";
+    if (key.compare(0, userIdsPrefix.size(), userIdsPrefix) == 0) {
+        std::string domain = key.substr(userIdsPrefix.size());
+        if (domain.empty() || domain.find_first_of(".[") != string::npos)
+            return Extractor();
+
+        return [=] (const BidRequest & br, std::string & out) -> bool {
+            auto it = br.userIds.find(domain);
+            if (it == br.userIds.end()) return false;
+            appendFragment(out, it->second.toString());
+            return true;
+        };
+    }
+
+    return Extractor();
+}
+
+void
+RedisAugmentationKeys::
+appendFragment(std::string & out, const std::string & value)
+{
+    // The key format predates the typed accessors: it is the JSON rendering
+    // of the value with all quotes and newlines stripped. Plain strings
+    // render as themselves so we only go through JSON for the odd ones.
+    if (needsJsonEscape(value)) {
+        appendFragment(out, Json::Value(value));
+        return;
+    }
+
+    for (char c: value)
+        if (c != '"') out += c;
+}
+
+void
+RedisAugmentationKeys::
+appendFragment(std::string & out, const Json::Value & value)
+{
+    const string str = value.toString();
+    copy_if(str.begin(), str.end(), back_inserter(out), [](const char& c) {
+        return c!='\n'&&c!='"';
+    });
+}
+
+std::shared_ptr<const RedisAugmentationKeys>
+RedisAugmentationKeys::
+compile(std::shared_ptr<const AgentConfig> config)
+{
+    if (!config) return nullptr;
+
+    auto it = find_if(config->augmentations.begin(),
+                      config->augmentations.end(),
+                      [] (const AugmentationConfig & aug)
+                      { return aug.name == "redis"; });
+    if (it == config->augmentations.end())
+        return nullptr;
+
+    const Json::Value & augList = it->config.atStr("aug-list");
+    if (!augList || augList.type() != Json::arrayValue || !augList.size())
+        return nullptr;
+
+    auto result = std::make_shared<RedisAugmentationKeys>();
+    result->config = config;
+    result->needsJson = false;
+
+    int n = augList.size();
+    for (auto i: boost::irange(0, n)) {
+        auto name = augList.atIndex(i).asString();
+        if (name.empty()) continue;
+
+        result->keys.emplace_back(name);
+        if (!result->keys.back().extract)
+            result->needsJson = true;
+    }
+
+    if (result->keys.empty())
+        return nullptr;
+    return result;
+}
+
+
+/******************************************************************************/
+/* REDIS AUGMENTOR                                                            */
+/******************************************************************************/
+
 RedisAugmentor::
 ~RedisAugmentor()
 {
+    // Worker threads read the compiled keys so they must be gone before the
+    // keys can be released without deferring on the gc lock.
+    shutdown();
+    compiled_.replace(nullptr, false);
 }
 
 /** Sets up the internal components of the augmentor.
@@ -29,14 +247,86 @@ RedisAugmentor::
 */
 void
 RedisAugmentor::
-init(int nthreads)
+init(int nthreads, size_t cacheSize, double cacheTtl)
 {
     AsyncAugmentor::init(nthreads);
+    cache_.configure(cacheSize, cacheTtl);
+
     /* Manages all the communications with the AgentConfigurationService. */
+    agent_config_.onConfigChange = [=] (
+            std::string agent, std::shared_ptr<const AgentConfig> config)
+        {
+            this->onConfigChange(agent, config);
+        };
     agent_config_.init(getServices()->config);
     addSource("RedisAugmentor::agentConfig", agent_config_);
 }
 
+/** Compiles the aug-list of an agent whenever its configuration changes.
+
+    Always called from the message loop thread so there's only ever one
+    writer; the worker threads read the map under RCU.
+*/
+void
+RedisAugmentor::
+onConfigChange(const std::string & agent,
+               std::shared_ptr<const AgentConfig> config)
+{
+    std::unique_ptr<CompiledKeys> newCompiled(new CompiledKeys(*compiled_()));
+
+    auto keys = RedisAugmentationKeys::compile(config);
+    if (keys)
+        (*newCompiled)[agent] = keys;
+    else newCompiled->erase(agent);
+
+    compiled_.replace(newCompiled.release());
+    recordHit("augListCompiled");
+}
+
+std::shared_ptr<const RedisAugmentationKeys>
+RedisAugmentor::
+getKeys(const AgentConfigEntry & entry)
+{
+    {
+        auto compiled = compiled_();
+        auto it = compiled->find(entry.name);
+        if (it != compiled->end() && it->second->config == entry.config)
+            return it->second;
+    }
+
+    /* The listener publishes a new configuration before it notifies us so
+       there's a small window where the compiled keys lag behind. Compile
+       on the spot rather than use keys of a stale configuration. */
+    recordHit("augListCompiledInline");
+    return RedisAugmentationKeys::compile(entry.config);
+}
+
+namespace {
+
+/** State of an augmentation request that is waiting on Redis values, either
+    from its own MGET or from fetches of the same keys by other requests.
+*/
+struct PendingAugmentation
+{
+    PendingAugmentation(size_t numKeys)
+        : values(numKeys), outstanding(numKeys)
+    {
+    }
+
+    // we build an *ordered* map indexed by Redis keys, pointing at set of
+    // account keys.
+    map<string,set<RTBKIT::AccountKey>> jobs;
+    vector<string> values;
+    std::atomic<size_t> outstanding;
+
+    /** Returns true when the last value has been filled in. */
+    bool done(size_t count = 1)
+    {
+        return outstanding.fetch_sub(count) == count;
+    }
+};
+
+} // file scope
 
 void
 RedisAugmentor::
@@ -46,12 +336,13 @@ onRequest(const AugmentationRequest & request, SendResponseCB sendResponse)
 
     recordHit("requests");
 
-    // we build an *ordered* map indexed by Redis keys, pointing
-    // at set of account keys. It will be captured by copy by the
-    // Redis lambda call back, and used in order to build the
-    // augmentation list.
     map<string,set<RTBKIT::AccountKey>> jobs;
-    auto br = request.bidRequest->toJson();
+
+    // Only built if one of the agents has a path without a typed accessor.
+    Json::Value br;
+    bool brBuilt = false;
+
+    string redisKey;
     for (const string& agent : request.agents)
     {
         RTBKIT::AgentConfigEntry c  = agent_config_.getAgentEntry(agent);
@@ -65,30 +356,30 @@ onRequest(const AugmentationRequest & request, SendResponseCB sendResponse)
             continue;
         }
 
-        // FIXME avoid converting the thing in Json::Value
-        const auto& aug_c = c.config->toJson(false);
-        const auto& aug_l = aug_c.atStr("augmentations").atStr("redis").atStr("config").atStr("aug-list");
-        if (!aug_l || aug_l.type() != Json::arrayValue || !aug_l.size())
+        auto keys = getKeys(c);
+        if (!keys)
         {
             recordHit ("noRedisAugAgentConfig");
             continue ;
         }
-        int n = aug_l.size();
-        static const string prefix = "RTBkit:aug" ;
-        for (auto i: boost::irange (0,n))
+
+        if (keys->needsJson && !brBuilt) {
+            br = request.bidRequest->toJson();
+            brBuilt = true;
+        }
+
+        for (const auto& key: keys->keys)
         {
-            auto key = aug_l.atIndex(i).asString();
-            if (key.empty()) continue;
-            // prefix root path (.) if absent.
-            auto root_key = key[0] == '.' ? key : "."+key;
-            Json::Value v = Json::Path(root_key).make(br);
-            if (!v) continue;
-            auto v_str = v.toString();
-            string vv_str ;
-            copy_if(v_str.begin(), v_str.end(),  back_inserter(vv_str), [](const char& c) {
-                return c!='\n'&&c!='"';
-            });
-            jobs[prefix+":"+key+":"+vv_str].insert (c.config->account);
+            redisKey = key.prefix;
+            if (key.extract) {
+                if (!key.extract(*request.bidRequest, redisKey)) continue;
+            }
+            else {
+                const Json::Value & v = key.path.resolve(br);
+                if (!v) continue;
+                RedisAugmentationKeys::appendFragment(redisKey, v);
+            }
+            jobs[redisKey].insert (c.config->account);
         }
     }
 
@@ -99,37 +390,81 @@ onRequest(const AugmentationRequest & request, SendResponseCB sendResponse)
         return;
     }
 
-    auto doResponse = [=](const Redis::Results& results) {
-        ExcAssertEqual (results.size(), jobs.size());
+    auto pending = std::make_shared<PendingAugmentation>(jobs.size());
+    pending->jobs = std::move(jobs);
+
+    auto doResponse = [=] () {
         AugmentationList auglret;
-        if (results)
-        {
-            auto i=0;
-            for (const auto& ii: jobs)
-            {
-                const auto& res = results.at(i).reply().asString();
-                if (!res.empty())
-                    for (const auto& jj: ii.second)
-                        auglret[jj].data.atStr(ii.first) = res;
-                ++i;
-            }
-        }
-        else
+        auto i=0;
+        for (const auto& ii: pending->jobs)
         {
-            cerr << "RedisAugmentor::onRequest::lambda(doResponse) error: " << results.error() << endl ;
-            recordHit("redisError."+results.error());
+            const auto& res = pending->values[i++];
+            if (!res.empty())
+                for (const auto& jj: ii.second)
+                    auglret[jj].data.atStr(ii.first) = res;
         }
         recordOutcome(tm.elapsed_wall() * 1000.0, "redisResponseMs");
         sendResponse(auglret);
     };
 
-    // build a vector of commands
-    vector<Redis::Command> cmds;
-    for (auto& ii: jobs)
-        cmds.emplace_back (Redis::GET(ii.first));
+    // Resolve what we can locally and build a single MGET with the rest.
+    vector<pair<string, size_t> > misses;
+    size_t resolved = 0;
+    size_t i = 0;
+    for (const auto& ii: pending->jobs)
+    {
+        const size_t index = i++;
+        auto onValue = [=] (const string& value) {
+            pending->values[index] = value;
+            if (pending->done()) doResponse();
+        };
+
+        switch (cache_.lookup(ii.first, pending->values[index], onValue)) {
+        case RedisAugmentorCache::HIT:
+            recordHit("cache.hit");
+            ++resolved;
+            break;
+        case RedisAugmentorCache::PENDING:
+            recordHit("cache.coalesced");
+            break;
+        case RedisAugmentorCache::MISS:
+            recordHit("cache.miss");
+            misses.emplace_back(ii.first, index);
+            break;
+        }
+    }
+
+    if (!misses.empty()) {
+        Redis::Command mget(Redis::MGET);
+        for (const auto& miss: misses)
+            mget.addArg(miss.first);
 
-    // and post it
-    redis_->queueMulti(cmds, doResponse, 0.004);
+        auto onResult = [=] (const Redis::Result& result) {
+            if (result) {
+                const Redis::Reply& reply = result.reply();
+                ExcAssertEqual (reply.length(), misses.size());
+                for (unsigned j = 0;  j < misses.size();  ++j) {
+                    pending->values[misses[j].second] = reply[j].asString();
+                    cache_.complete(misses[j].first,
+                                    pending->values[misses[j].second]);
+                }
+            }
+            else
+            {
+                cerr << "RedisAugmentor::onRequest::lambda(onResult) error: " << result.error() << endl ;
+                recordHit("redisError."+result.error());
+                for (const auto& miss: misses)
+                    cache_.fail(miss.first);
+            }
+
+            if (pending->done(misses.size())) doResponse();
+        };
+
+        redis_->queue(mget, onResult, 0.004);
+    }
 
+    // Everything that was served straight from the cache counts as done; if
+    // that was the last of it, we respond from this thread.
+    if (resolved && pending->done(resolved)) doResponse();
 }
 } /* namespace RTBKIT */
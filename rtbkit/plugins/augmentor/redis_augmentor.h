@@ -9,12 +9,66 @@
 #define REDIS_AUGMENTOR_H_
 
 #include <string>
+#include <unordered_map>
 #include "augmentor_base.h"
+#include "redis_augmentor_cache.h"
 #include "soa/service/redis.h"
+#include "soa/gc/rcu_protected.h"
 #include "rtbkit/core/agent_configuration/agent_configuration_listener.h"
 
 namespace RTBKIT {
 
+/******************************************************************************/
+/* REDIS AUGMENTATION KEYS                                                    */
+/******************************************************************************/
+
+/** The `aug-list` of an agent's redis augmentation config, compiled once per
+    configuration change instead of on every bid request.
+
+    Paths that map onto a plain field of the BidRequest (id, url, exchange,
+    location.countryCode, userIds.xchg, ...) are resolved through a typed
+    accessor. Anything else falls back to a pre-parsed Json::Path evaluated
+    against the JSON form of the bid request, which is then only built for
+    the requests that actually need it.
+ */
+struct RedisAugmentationKeys
+{
+    /** Typed accessor: writes the key fragment for the bid request into the
+        string and returns false if the field is absent.
+     */
+    typedef std::function<bool (const BidRequest &, std::string &)> Extractor;
+
+    struct Key {
+        std::string name;        ///< Entry of the aug-list
+        std::string prefix;      ///< Redis key up to the extracted value
+        Extractor extract;       ///< Null if the JSON path must be used
+        Json::Path path;
+
+        Key(const std::string & name);
+    };
+
+    std::shared_ptr<const AgentConfig> config;
+    std::vector<Key> keys;
+    bool needsJson;
+
+    /** Compiles the redis aug-list of the given configuration. Returns null
+        if the configuration has no (or an empty) redis aug-list.
+     */
+    static std::shared_ptr<const RedisAugmentationKeys>
+    compile(std::shared_ptr<const AgentConfig> config);
+
+    /** Returns the typed accessor for the path or null if there is none. */
+    static Extractor getExtractor(const std::string & path);
+
+    /** Formats a key fragment the way the value would appear in the JSON
+        form of the bid request, minus the quotes and newlines.
+     */
+    static void appendFragment(std::string & out, const std::string & value);
+
+    /** Same as appendFragment but for a value that went through JSON. */
+    static void appendFragment(std::string & out, const Json::Value & value);
+};
+
 /**
  *     Redis Augmentor.
  */
@@ -27,6 +81,7 @@ public:
         : RTBKIT::AsyncAugmentor(augmentorName,serviceName,proxies)
         , agent_config_ (proxies->zmqContext)
         , redis_(std::make_shared<Redis::AsyncConnection>(redis))
+        , compiled_ (compiledGc_)
     {
     }
 
@@ -37,6 +92,7 @@ public:
         : RTBKIT::AsyncAugmentor(augmentorName,serviceName,proxies)
         , agent_config_ (proxies->zmqContext)
         , redis_(redis)
+        , compiled_ (compiledGc_)
     {
     }
 
@@ -47,6 +103,7 @@ public:
         : RTBKIT::AsyncAugmentor(augmentorName,serviceName,parent)
         , agent_config_ (parent.getZmqContext())
         , redis_(std::make_shared<Redis::AsyncConnection>(redis))
+        , compiled_ (compiledGc_)
     {
     }
 
@@ -57,15 +114,34 @@ public:
         : RTBKIT::AsyncAugmentor(augmentorName,serviceName,parent)
         , agent_config_ (parent.getZmqContext())
         , redis_ (redis)
+        , compiled_ (compiledGc_)
     {
     }
 
-    void init(int nthreads);
+    /** cacheSize and cacheTtl (in seconds) control the local cache of Redis
+        replies; a ttl of 0 disables it but keeps identical in-flight keys
+        coalesced into a single fetch.
+     */
+    void init(int nthreads,
+              size_t cacheSize = RedisAugmentorCache::DefaultCapacity,
+              double cacheTtl = RedisAugmentorCache::DefaultTtl);
     virtual ~RedisAugmentor() ;
 private:
     void onRequest(const AugmentationRequest & request, SendResponseCB sendResponse);
+    void onConfigChange(const std::string & agent,
+                        std::shared_ptr<const AgentConfig> config);
+
+    std::shared_ptr<const RedisAugmentationKeys>
+    getKeys(const AgentConfigEntry & entry);
+
     RTBKIT::AgentConfigurationListener agent_config_;
     std::shared_ptr<Redis::AsyncConnection> redis_ ;
+    RedisAugmentorCache cache_;
+
+    typedef std::unordered_map<
+        std::string, std::shared_ptr<const RedisAugmentationKeys> > CompiledKeys;
+    GcLock compiledGc_;
+    RcuProtected<CompiledKeys> compiled_;
 };
 
 } /* namespace RTBKIT */
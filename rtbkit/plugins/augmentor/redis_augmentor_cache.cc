@@ -0,0 +1,156 @@
+/* redis_augmentor_cache.cc
+   Copyright (c) 2013 Datacratic.  All rights reserved.
+
+   In-process cache of Redis replies used by the RedisAugmentor.
+*/
+
+#include "redis_augmentor_cache.h"
+
+using namespace std;
+using namespace Datacratic;
+
+
+namespace RTBKIT {
+
+
+/******************************************************************************/
+/* REDIS AUGMENTOR CACHE                                                      */
+/******************************************************************************/
+
+RedisAugmentorCache::
+RedisAugmentorCache(size_t capacity, double ttl)
+{
+    configure(capacity, ttl);
+}
+
+void
+RedisAugmentorCache::
+configure(size_t capacity, double ttl)
+{
+    this->shardCapacity = (capacity + NumShards - 1) / NumShards;
+    this->ttl = ttl;
+    clear();
+}
+
+RedisAugmentorCache::Shard &
+RedisAugmentorCache::
+shardFor(const std::string & key)
+{
+    return shards[std::hash<std::string>()(key) % NumShards];
+}
+
+RedisAugmentorCache::Status
+RedisAugmentorCache::
+lookup(const std::string & key,
+       std::string & value,
+       const OnValue & onValue,
+       Date now)
+{
+    Shard & shard = shardFor(key);
+    lock_guard<mutex> guard(shard.lock);
+
+    auto it = shard.index.find(key);
+    if (it != shard.index.end()) {
+        LruList::iterator entry = it->second;
+        if (now < entry->expiry) {
+            shard.lru.splice(shard.lru.begin(), shard.lru, entry);
+            value = entry->value;
+            return HIT;
+        }
+
+        shard.lru.erase(entry);
+        shard.index.erase(it);
+    }
+
+    auto jt = shard.inFlight.find(key);
+    if (jt != shard.inFlight.end()) {
+        jt->second.push_back(onValue);
+        return PENDING;
+    }
+
+    shard.inFlight[key];
+    return MISS;
+}
+
+void
+RedisAugmentorCache::
+complete(const std::string & key, const std::string & value, Date now)
+{
+    for (const OnValue & onValue : finish(key, &value, now))
+        onValue(value);
+}
+
+void
+RedisAugmentorCache::
+fail(const std::string & key)
+{
+    static const string empty;
+    for (const OnValue & onValue : finish(key, nullptr, Date()))
+        onValue(empty);
+}
+
+std::vector<RedisAugmentorCache::OnValue>
+RedisAugmentorCache::
+finish(const std::string & key, const std::string * value, Date now)
+{
+    Shard & shard = shardFor(key);
+    vector<OnValue> waiters;
+
+    // Waiters are returned rather than called here so that they never run
+    // with the shard lock held; they may well look up more keys.
+    lock_guard<mutex> guard(shard.lock);
+
+    auto it = shard.inFlight.find(key);
+    if (it != shard.inFlight.end()) {
+        waiters.swap(it->second);
+        shard.inFlight.erase(it);
+    }
+
+    if (!value || ttl <= 0.0 || !shardCapacity)
+        return waiters;
+
+    auto jt = shard.index.find(key);
+    if (jt != shard.index.end()) {
+        shard.lru.erase(jt->second);
+        shard.index.erase(jt);
+    }
+
+    shard.lru.push_front(Entry());
+    Entry & entry = shard.lru.front();
+    entry.key = key;
+    entry.value = *value;
+    entry.expiry = now.plusSeconds(ttl);
+    shard.index[key] = shard.lru.begin();
+
+    while (shard.index.size() > shardCapacity) {
+        shard.index.erase(shard.lru.back().key);
+        shard.lru.pop_back();
+    }
+
+    return waiters;
+}
+
+size_t
+RedisAugmentorCache::
+size() const
+{
+    size_t result = 0;
+    for (const Shard & shard : shards) {
+        lock_guard<mutex> guard(shard.lock);
+        result += shard.index.size();
+    }
+    return result;
+}
+
+void
+RedisAugmentorCache::
+clear()
+{
+    for (Shard & shard : shards) {
+        lock_guard<mutex> guard(shard.lock);
+        shard.lru.clear();
+        shard.index.clear();
+    }
+}
+
+} // namespace RTBKIT
@@ -0,0 +1,119 @@
+/* redis_augmentor_cache.h                                         -*- C++ -*-
+   Copyright (c) 2013 Datacratic.  All rights reserved.
+
+   In-process cache of Redis replies used by the RedisAugmentor.
+*/
+
+#pragma once
+
+#include "soa/types/date.h"
+
+#include <functional>
+#include <list>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+
+namespace RTBKIT {
+
+
+/******************************************************************************/
+/* REDIS AUGMENTOR CACHE                                                      */
+/******************************************************************************/
+
+/** Bounded LRU cache of Redis replies with a time-to-live on every entry.
+
+    Also coalesces concurrent lookups of the same key: the first caller to
+    miss on a key becomes responsible for fetching it, and every subsequent
+    caller is parked until that fetch completes or fails. This means that a
+    burst of bid requests for the same url or user only ever costs a single
+    Redis round trip.
+
+    Empty replies (missing keys) are cached like any other value so that
+    keys that are not in Redis don't get hammered either.
+
+    The cache is split into independently locked shards to keep the worker
+    threads of the augmentor from contending on a single mutex.
+ */
+struct RedisAugmentorCache
+{
+    enum {
+        DefaultCapacity = 1 << 16,
+        NumShards = 16
+    };
+
+    static constexpr double DefaultTtl = 1.0;
+
+    RedisAugmentorCache(size_t capacity = DefaultCapacity,
+                        double ttl = DefaultTtl);
+
+    /** Changes the total capacity and the time-to-live of the entries. A ttl
+        of 0 disables caching but keeps the coalescing of in-flight requests.
+        Must not be called while the cache is being used.
+     */
+    void configure(size_t capacity, double ttl);
+
+    /** Callback used to hand the value of a coalesced key to its waiter. An
+        empty string means that the key has no value or that the fetch failed.
+     */
+    typedef std::function<void (const std::string & value)> OnValue;
+
+    enum Status {
+        HIT,      ///< value was filled in from the cache
+        PENDING,  ///< key is already being fetched; onValue will be called
+        MISS      ///< caller must fetch the key then call complete() or fail()
+    };
+
+    Status lookup(const std::string & key,
+                  std::string & value,
+                  const OnValue & onValue,
+                  Datacratic::Date now = Datacratic::Date::now());
+
+    /** Records the value fetched for a key which was reported as a MISS and
+        wakes up everyone that was waiting on it.
+     */
+    void complete(const std::string & key,
+                  const std::string & value,
+                  Datacratic::Date now = Datacratic::Date::now());
+
+    /** Signals that the fetch of a key which was reported as a MISS failed.
+        Waiters are woken up with an empty value and nothing is cached.
+     */
+    void fail(const std::string & key);
+
+    /** Number of entries currently cached. */
+    size_t size() const;
+
+    /** Drops every cached entry. In-flight fetches are left untouched. */
+    void clear();
+
+private:
+    struct Entry {
+        std::string key;
+        std::string value;
+        Datacratic::Date expiry;
+    };
+
+    typedef std::list<Entry> LruList;
+
+    struct Shard {
+        mutable std::mutex lock;
+        LruList lru;  // most recently used at the front
+        std::unordered_map<std::string, LruList::iterator> index;
+        std::unordered_map<std::string, std::vector<OnValue> > inFlight;
+    };
+
+    Shard & shardFor(const std::string & key);
+
+    std::vector<OnValue> finish(const std::string & key,
+                                const std::string * value,
+                                Datacratic::Date now);
+
+    size_t shardCapacity;
+    double ttl;
+    Shard shards[NumShards];
+};
+
+} // namespace RTBKIT
@@ -0,0 +1,144 @@
+/** redis_augmentor_cache_test.cc                                 -*- C++ -*-
+    Copyright (c) 2013 Datacratic.  All rights reserved.
+
+    Tests for the reply cache and the key compilation of the redis augmentor.
+
+*/
+
+#define BOOST_TEST_MAIN
+#define BOOST_TEST_DYN_LINK
+
+#include "rtbkit/plugins/augmentor/redis_augmentor.h"
+#include "rtbkit/core/agent_configuration/agent_config.h"
+
+#include <boost/test/unit_test.hpp>
+#include <memory>
+
+using namespace std;
+using namespace ML;
+using namespace RTBKIT;
+
+
+BOOST_AUTO_TEST_CASE( test_cache_hit_miss_and_expiry )
+{
+    RedisAugmentorCache cache(16, 1.0);
+    Date now = Date::fromSecondsSinceEpoch(1000);
+
+    auto noWait = [] (const string &) { BOOST_FAIL("unexpected waiter"); };
+
+    string value;
+    BOOST_CHECK_EQUAL(cache.lookup("a", value, noWait, now),
+                      RedisAugmentorCache::MISS);
+    cache.complete("a", "1", now);
+
+    BOOST_CHECK_EQUAL(cache.lookup("a", value, noWait, now.plusSeconds(0.5)),
+                      RedisAugmentorCache::HIT);
+    BOOST_CHECK_EQUAL(value, "1");
+
+    // Expired entries are fetched again.
+    BOOST_CHECK_EQUAL(cache.lookup("a", value, noWait, now.plusSeconds(2.0)),
+                      RedisAugmentorCache::MISS);
+    cache.fail("a");
+    BOOST_CHECK_EQUAL(cache.size(), 0);
+
+    // Missing keys are cached as empty values.
+    BOOST_CHECK_EQUAL(cache.lookup("b", value, noWait, now),
+                      RedisAugmentorCache::MISS);
+    cache.complete("b", "", now);
+    value = "x";
+    BOOST_CHECK_EQUAL(cache.lookup("b", value, noWait, now),
+                      RedisAugmentorCache::HIT);
+    BOOST_CHECK_EQUAL(value, "");
+}
+
+BOOST_AUTO_TEST_CASE( test_cache_coalescing )
+{
+    RedisAugmentorCache cache(16, 1.0);
+
+    string value;
+    vector<string> seen;
+    auto onValue = [&] (const string & v) { seen.push_back(v); };
+
+    BOOST_CHECK_EQUAL(cache.lookup("k", value, onValue),
+                      RedisAugmentorCache::MISS);
+    BOOST_CHECK_EQUAL(cache.lookup("k", value, onValue),
+                      RedisAugmentorCache::PENDING);
+    BOOST_CHECK_EQUAL(cache.lookup("k", value, onValue),
+                      RedisAugmentorCache::PENDING);
+    BOOST_CHECK(seen.empty());
+
+    cache.complete("k", "v");
+    BOOST_CHECK_EQUAL(seen.size(), 2);
+    BOOST_CHECK_EQUAL(seen[0], "v");
+    BOOST_CHECK_EQUAL(seen[1], "v");
+
+    // Failures wake the waiters up with nothing and are not cached.
+    seen.clear();
+    BOOST_CHECK_EQUAL(cache.lookup("f", value, onValue),
+                      RedisAugmentorCache::MISS);
+    BOOST_CHECK_EQUAL(cache.lookup("f", value, onValue),
+                      RedisAugmentorCache::PENDING);
+    cache.fail("f");
+    BOOST_CHECK_EQUAL(seen.size(), 1);
+    BOOST_CHECK_EQUAL(seen[0], "");
+    BOOST_CHECK_EQUAL(cache.lookup("f", value, onValue),
+                      RedisAugmentorCache::MISS);
+}
+
+BOOST_AUTO_TEST_CASE( test_cache_eviction )
+{
+    RedisAugmentorCache cache(RedisAugmentorCache::NumShards, 10.0);
+    auto noWait = [] (const string &) {};
+
+    string value;
+    for (unsigned i = 0;  i < 1000;  ++i) {
+        string key = "key" + to_string(i);
+        cache.lookup(key, value, noWait);
+        cache.complete(key, key);
+    }
+
+    BOOST_CHECK_LE(cache.size(), RedisAugmentorCache::NumShards);
+}
+
+BOOST_AUTO_TEST_CASE( test_compiled_keys )
+{
+    auto config = std::make_shared<AgentConfig>();
+    AugmentationConfig augConfig("redis");
+    augConfig.config["aug-list"].append("id");
+    augConfig.config["aug-list"].append("url");
+    augConfig.config["aug-list"].append("userIds.xchg");
+    augConfig.config["aug-list"].append("winSurcharges.surcharge.USD/1M");
+    config->addAugmentation(augConfig);
+
+    auto keys = RedisAugmentationKeys::compile(config);
+    BOOST_REQUIRE(keys);
+    BOOST_CHECK_EQUAL(keys->keys.size(), 4);
+    BOOST_CHECK(keys->keys[0].extract);
+    BOOST_CHECK(keys->keys[1].extract);
+    BOOST_CHECK(keys->keys[2].extract);
+    BOOST_CHECK(!keys->keys[3].extract);
+    BOOST_CHECK(keys->needsJson);
+
+    BidRequest br;
+    br.auctionId = Id("85885bb0-b91b-11e2-c4cf-7fba90171555");
+    br.url = Url("http://myonlinearcade.com/");
+    br.userIds.add(Id("5273283952213481305"), ID_EXCHANGE);
+
+    // The typed accessors must build the same keys as the JSON path.
+    Json::Value json = br.toJson();
+    for (unsigned i = 0;  i < 3;  ++i) {
+        const auto & key = keys->keys[i];
+        string typed = key.prefix;
+        BOOST_CHECK(key.extract(br, typed));
+
+        string viaJson = key.prefix;
+        RedisAugmentationKeys::appendFragment(viaJson, key.path.resolve(json));
+        BOOST_CHECK_EQUAL(typed, viaJson);
+    }
+
+    BOOST_CHECK_EQUAL(keys->keys[0].prefix + "85885bb0-b91b-11e2-c4cf-7fba90171555",
+                      "RTBkit:aug:id:85885bb0-b91b-11e2-c4cf-7fba90171555");
+
+    // No redis augmentation means nothing to compile.
+    BOOST_CHECK(!RedisAugmentationKeys::compile(std::make_shared<AgentConfig>()));
+}
@@ -6,6 +6,8 @@
 #pragma once
 
 #include "rtbkit/common/bidder_interface.h"
+#include "rtbkit/common/messages.h"
+#include "rtbkit/core/agent_configuration/agent_configuration_listener.h"
 #include "soa/jsoncpp/json.h"
 #include <iostream>
 
@@ -57,6 +59,32 @@ struct AgentsBidderInterface : public BidderInterface
     void sendPingMessage(std::string const & agent,
                          int ping);
 
+protected:
+    /** Hooks for subclasses that can reach some of the agents without going
+        through the bridge.  For those agents, isLocalAgent() returns true and
+        sendLocalMessage() gets the message encoded as it would have been sent
+        on the bridge, minus the address.
+    */
+    virtual bool isLocalAgent(std::string const & agent) const
+    {
+        return false;
+    }
+
+    virtual void sendLocalMessage(std::string const & agent,
+                                  std::vector<std::string> && message)
+    {
+    }
+
+    template<typename... Args>
+    void sendAgentMessage(std::string const & agent, Args const &... args)
+    {
+        if (isLocalAgent(agent)) {
+            std::vector<std::string> message;
+            encodeMessageParts(message, args...);
+            sendLocalMessage(agent, std::move(message));
+        }
+        else bridge->sendAgentMessage(agent, args...);
+    }
 };
 
 }
@@ -12,6 +12,8 @@
 #include "rtbkit/openrtb/openrtb_parsing.h"
 #include "rtbkit/core/router/router.h"
 
+#include <sys/timerfd.h>
+
 using namespace Datacratic;
 using namespace RTBKIT;
 
@@ -46,11 +48,26 @@ Logging::Category HttpBidderInterface::trace("HttpBidderInterface Trace", HttpBi
 HttpBidderInterface::HttpBidderInterface(std::string serviceName,
                                          std::shared_ptr<ServiceProxies> proxies,
                                          Json::Value const & json)
-        : BidderInterface(proxies, serviceName) {
+        : BidderInterface(proxies, serviceName),
+          hedgePercentile(0.95),
+          minHedgeDelayMs(5.0),
+          hedgeDelayUs(-1) {
+
+    int connections = 4;
+    bool pipelining = false;
 
     try {
-        routerHost = json["router"]["host"].asString();
-        routerPath = json["router"]["path"].asString();
+        const Json::Value & routerConfig = json["router"];
+        routerHost = routerConfig["host"].asString();
+        routerPath = routerConfig["path"].asString();
+        connections = routerConfig.get("connections", connections).asInt();
+        pipelining = routerConfig.get("pipelining", pipelining).asBool();
+        if (routerConfig.isMember("hedge")) {
+            const Json::Value & hedge = routerConfig["hedge"];
+            hedgeHost = hedge.get("host", routerHost).asString();
+            hedgePercentile = hedge.get("percentile", hedgePercentile).asDouble();
+            minHedgeDelayMs = hedge.get("minDelayMs", minHedgeDelayMs).asDouble();
+        }
         adserverHost = json["adserver"]["host"].asString();
         adserverWinPort = json["adserver"]["winPort"].asInt();
         adserverEventPort = json["adserver"]["eventPort"].asInt();
@@ -60,6 +77,13 @@ HttpBidderInterface::HttpBidderInterface(std::string serviceName,
                    << "{" << std::endl << "\t\"router\" : {" << std::endl
                    << "\t\t\"host\" : <string : hostname with port>" << std::endl  
                    << "\t\t\"path\" : <string : resource name>" << std::endl
+                   << "\t\t\"connections\" : <int : size of the connection pool>" << std::endl
+                   << "\t\t\"pipelining\" : <bool : use HTTP pipelining>" << std::endl
+                   << "\t\t\"hedge\" : {" << std::endl
+                   << "\t\t\t\"host\" : <string : hostname with port>" << std::endl
+                   << "\t\t\t\"percentile\" : <double : percentile of the response time>" << std::endl
+                   << "\t\t\t\"minDelayMs\" : <double : minimum hedging delay>" << std::endl
+                   << "\t\t}" << std::endl
                    << "\t}" << std::endl << "\t{" << std::endl 
                    << "\t{" << std::endl << "\t\"adserver\" : {" << std::endl
                    << "\t\t\"host\" : <string : hostname>" << std::endl  
@@ -68,9 +92,29 @@ HttpBidderInterface::HttpBidderInterface(std::string serviceName,
                    << "\t}" << std::endl << "}";
     }
 
-    httpClientRouter.reset(new HttpClient(routerHost));
+    ExcCheck(connections > 0, "invalid number of connections");
+    ExcCheck(hedgePercentile > 0 && hedgePercentile < 1, "invalid hedge percentile");
+
+    httpClientRouter.reset(new HttpClient(routerHost, connections));
+    if (pipelining)
+        httpClientRouter->enablePipelining();
     loop.addSource("HttpBidderInterface::httpClientRouter", httpClientRouter);
 
+    if (!hedgeHost.empty()) {
+        httpClientHedge.reset(new HttpClient(hedgeHost, connections));
+        if (pipelining)
+            httpClientHedge->enablePipelining();
+        loop.addSource("HttpBidderInterface::httpClientHedge", httpClientHedge);
+
+        hedgeTimer.reset(new HedgeTimer());
+        hedgeTimer->onHedge = [=] (const std::shared_ptr<PendingAuction> & pending) {
+            sendHedge(pending);
+        };
+        loop.addSource("HttpBidderInterface::hedgeTimer", hedgeTimer);
+        loop.addPeriodic("HttpBidderInterface::updateHedgeDelay", 1.0,
+                         [=] (uint64_t) { updateHedgeDelay(); });
+    }
+
     std::string winHost = adserverHost + ':' + std::to_string(adserverWinPort);
     httpClientAdserverWins.reset(new HttpClient(winHost));
     loop.addSource("HttpBidderInterface::httpClientAdserverWins", httpClientAdserverWins);
@@ -98,9 +142,131 @@ void HttpBidderInterface::shutdown() {
 void HttpBidderInterface::sendAuctionMessage(std::shared_ptr<Auction> const & auction,
                                              double timeLeftMs,
                                              std::map<std::string, BidInfo> const & bidders) {
+    BidRequest originalRequest = *auction->request;
+    OpenRTB::BidRequest openRtbRequest = toOpenRtb(originalRequest);
+    bool ok = prepareRequest(openRtbRequest, originalRequest, auction, bidders);
+    /* If we took too much time processing the request, then we don't send it.  */
+    if (!ok) {
+        return;
+    }
+    StructuredJsonPrintingContext context;
+    desc.printJson(&openRtbRequest, context);
+
+    /* The pending auction is shared by the callbacks of the request and of
+       its hedge, which might outlive this scope.
+    */
+    auto pending = std::make_shared<PendingAuction>();
+    pending->auction = auction;
+    pending->bidders = bidders;
+    pending->request = std::move(openRtbRequest);
+    pending->content = context.output.toString();
+    pending->sent = Date::now();
+    pending->deadline = auction->expiry;
+
+    if (!sendRequest(pending, *httpClientRouter, false))
+        return;
+
+    int64_t delayUs = hedgeDelayUs;
+    if (hedgeTimer && delayUs >= 0) {
+        Date hedgeAt = pending->sent.plusSeconds(delayUs / 1000000.0);
+        if (hedgeAt < pending->deadline)
+            hedgeTimer->schedule(hedgeAt, pending);
+    }
+}
+
+bool HttpBidderInterface::sendRequest(const std::shared_ptr<PendingAuction> & pending,
+                                      HttpClient & client, bool hedge) {
+    Date start = Date::now();
+    double timeLeft = pending->deadline.secondsSince(start);
+    if (timeLeft <= 0) {
+        return false;
+    }
+
+    auto callbacks = std::make_shared<HttpClientSimpleCallbacks>(
+            [=](const HttpRequest &, HttpClientError errorCode,
+                int statusCode, const std::string &, std::string &&body)
+            {
+                onResponse(pending, hedge, start, errorCode, statusCode, body);
+            });
+
+    HttpRequest::Content reqContent { pending->content, "application/json" };
+    RestParams headers { { "x-openrtb-version", "2.1" } };
+   // std::cerr << "Sending HTTP POST to: " << routerHost << " " << routerPath << std::endl;
+   // std::cerr << "Content " << reqContent.str << std::endl;
+
+    ++pending->outstanding;
+    client.post(routerPath, callbacks, reqContent,
+                { } /* queryParams */, headers, timeLeft);
+    return true;
+}
+
+void HttpBidderInterface::sendHedge(const std::shared_ptr<PendingAuction> & pending) {
+    if (pending->answered) {
+        return;
+    }
+
+    if (sendRequest(pending, *httpClientHedge, true)) {
+        recordHit("http.hedge.sent");
+    }
+}
+
+void HttpBidderInterface::onResponse(const std::shared_ptr<PendingAuction> & pending,
+                                     bool hedge, Date start,
+                                     HttpClientError errorCode,
+                                     int statusCode, const std::string & body) {
+    --pending->outstanding;
+
+    /* Late responses of the first request are still recorded; leaving them
+       out would make the hedging delay shrink every time a hedge wins.
+    */
+    if (!hedge && (errorCode == HttpClientError::None
+                   || errorCode == HttpClientError::Timeout)) {
+        double latencyMs = Date::now().secondsSince(start) * 1000;
+        latency.record(latencyMs);
+        recordOutcome(latencyMs, "http.latencyMs");
+    }
+
+    if (pending->answered) {
+        return;
+    }
+
+    if (errorCode != HttpClientError::None) {
+        // The other request might still make it.
+        if (pending->outstanding > 0) {
+            return;
+        }
+        pending->answered = true;
+
+        /* The router expires the auction by itself once its deadline has
+           passed, which is when our requests time out.
+        */
+        if (errorCode == HttpClientError::Timeout) {
+            recordHit("http.timeout");
+            return;
+        }
+
+        router->throwException("http", "Error requesting %s: %s",
+                               (hedge ? hedgeHost : routerHost).c_str(),
+                               httpErrorString(errorCode).c_str());
+    }
+
+    pending->answered = true;
+    if (hedge) {
+        recordHit("http.hedge.won");
+    }
+
+    handleResponse(*pending, statusCode, body);
+}
+
+void HttpBidderInterface::handleResponse(const PendingAuction & pending,
+                                         int statusCode, const std::string & body) {
     using namespace std;
 
-    auto findAgent = [=](uint64_t externalId)
+    const auto & bidders = pending.bidders;
+    const auto & auction = pending.auction;
+    const auto & openRtbRequest = pending.request;
+
+    auto findAgent = [&](uint64_t externalId)
         -> pair<string, shared_ptr<const AgentConfig>> {
 
         auto it =
@@ -120,139 +286,116 @@ void HttpBidderInterface::sendAuctionMessage(std::shared_ptr<Auction> const & au
 
     };
 
-    BidRequest originalRequest = *auction->request;
-    OpenRTB::BidRequest openRtbRequest = toOpenRtb(originalRequest);
-    bool ok = prepareRequest(openRtbRequest, originalRequest, auction, bidders);
-    /* If we took too much time processing the request, then we don't send it.  */
-    if (!ok) {
-        return;
+    //cerr << "Response: " << "HTTP " << statusCode << std::endl << body << endl;
+
+    /* We need to make sure that we re-inject bids into the router for each
+     * agent. When receiving a BidResponse, if the SeatBid array contains
+     * less bids than impressions, we still need to tell "no-bid" to the
+     * router for the agent that did not bid, otherwise the router will
+     * be artificially waiting for that particular bidder to bid, and will
+     * expire the auction.
+     */
+    AgentBids bidsToSubmit;
+    Bids bids;
+    bids.reserve(openRtbRequest.imp.size());
+    for (const auto &bidder: bidders) {
+        AgentBidsInfo info;
+        info.agentName = bidder.first;
+        info.agentConfig = bidder.second.agentConfig;
+        info.auctionId = auction->id;
+        info.bids = bids;
+        info.wcm = auction->exchangeConnector->getWinCostModel(
+                          *auction, *info.agentConfig);
+        bidsToSubmit[bidder.first] = info;
     }
-    StructuredJsonPrintingContext context;
-    desc.printJson(&openRtbRequest, context);
-    auto requestStr = context.output.toString();
 
-    /* We need to capture by copy inside the lambda otherwise we might get
-       a dangling reference if we go out of scope before receiving the http response
-    */
-    auto callbacks = std::make_shared<HttpClientSimpleCallbacks>(
-            [=](const HttpRequest &, HttpClientError errorCode,
-                int statusCode, const std::string &, std::string &&body)
-            {
-                 //cerr << "Response: " << "HTTP " << statusCode << std::endl << body << endl;
-
-                 /* We need to make sure that we re-inject bids into the router for each
-                  * agent. When receiving a BidResponse, if the SeatBid array contains
-                  * less bids than impressions, we still need to tell "no-bid" to the
-                  * router for the agent that did not bid, otherwise the router will
-                  * be artificially waiting for that particular bidder to bid, and will
-                  * expire the auction.
-                  */
-                 AgentBids bidsToSubmit;
-                 Bids bids;
-                 bids.reserve(openRtbRequest.imp.size());
-                 for (const auto &bidder: bidders) {
-                     AgentBidsInfo info;
-                     info.agentName = bidder.first;
-                     info.agentConfig = bidder.second.agentConfig;
-                     info.auctionId = auction->id;
-                     info.bids = bids;
-                     info.wcm = auction->exchangeConnector->getWinCostModel(
-                                       *auction, *info.agentConfig);
-                     bidsToSubmit[bidder.first] = info;
-                 }
-
-                 if (errorCode != HttpClientError::None) {
-                    router->throwException("http", "Error requesting %s: %s",
-                                           routerHost.c_str(),
-                                           httpErrorString(errorCode).c_str());
-                 }
-
-                 // If we receive a 204 No-bid, we still need to "re-inject" it to the
-                 // router otherwise we won't expire the inFlights
-                 else if (statusCode == 204) {
-                     for (auto &bidsInfo: bidsToSubmit) {
-                         auto &info = bidsInfo.second;
-                         fill_n(back_inserter(info.bids), openRtbRequest.imp.size(), Bid());
-                     }
-
-                  }
-
-                 else if (statusCode == 200) {
-                     OpenRTB::BidResponse response;
-                     ML::Parse_Context context("payload",
-                           body.c_str(), body.size());
-                     StreamingJsonParsingContext jsonContext(context);
-                     static DefaultDescription<OpenRTB::BidResponse> respDesc;
-                     respDesc.parseJson(&response, jsonContext);
-
-                     for (const auto &seatbid: response.seatbid) {
-
-                         for (const auto &bid: seatbid.bid) {
-                             if (!bid.ext.isMember("external-id")) {
-                                 router->throwException("http.response",
-                                    "Missing external-id ext field in BidResponse");
-                             }
-
-                             if (!bid.ext.isMember("priority")) {
-                                 router->throwException("http.response",
-                                    "Missing priority ext field in BidResponse");
-                             }
-
-                             uint64_t externalId = bid.ext["external-id"].asUInt();
-
-                             string agent;
-                             shared_ptr<const AgentConfig> config;
-                             tie(agent, config) = findAgent(externalId);
-                             if (config == nullptr) {
-                                 router->throwException("http.response",
-                                    "Couldn't find config for externalId: %lu",
-                                    externalId);
-                             }
-                             ExcCheck(!agent.empty(), "Invalid agent");
-
-                             Bid theBid;
-
-                             int crid = bid.crid.toInt();
-                             int creativeIndex = indexOf(config->creatives,
-                                 &Creative::id, crid);
-
-                             if (creativeIndex == -1) {
-                                 router->throwException("http.response",
-                                    "Unknown creative id: %d", crid);
-                             }
-
-                             theBid.creativeIndex = creativeIndex;
-                             theBid.price = USD_CPM(bid.price.val);
-                             theBid.priority = bid.ext["priority"].asDouble();
-
-                             int spotIndex = indexOf(openRtbRequest.imp,
-                                                    &OpenRTB::Impression::id, bid.impid);
-                             if (spotIndex == -1) {
-                                  router->throwException("http.response",
-                                     "Unknown impression id: %s",
-                                     bid.impid.toString().c_str());
-                             }
-
-                             theBid.spotIndex = spotIndex;
-
-                             auto &bidInfo = bidsToSubmit[agent];
-                             bidInfo.bids.push_back(std::move(theBid));
-
-                         }
-                     }
-
-                 }
-                 submitBids(bidsToSubmit, openRtbRequest.imp.size());
+    // If we receive a 204 No-bid, we still need to "re-inject" it to the
+    // router otherwise we won't expire the inFlights
+    if (statusCode == 204) {
+        for (auto &bidsInfo: bidsToSubmit) {
+            auto &info = bidsInfo.second;
+            fill_n(back_inserter(info.bids), openRtbRequest.imp.size(), Bid());
+        }
+
+     }
+
+    else if (statusCode == 200) {
+        OpenRTB::BidResponse response;
+        ML::Parse_Context context("payload",
+              body.c_str(), body.size());
+        StreamingJsonParsingContext jsonContext(context);
+        static DefaultDescription<OpenRTB::BidResponse> respDesc;
+        respDesc.parseJson(&response, jsonContext);
+
+        for (const auto &seatbid: response.seatbid) {
+
+            for (const auto &bid: seatbid.bid) {
+                if (!bid.ext.isMember("external-id")) {
+                    router->throwException("http.response",
+                       "Missing external-id ext field in BidResponse");
+                }
+
+                if (!bid.ext.isMember("priority")) {
+                    router->throwException("http.response",
+                       "Missing priority ext field in BidResponse");
+                }
+
+                uint64_t externalId = bid.ext["external-id"].asUInt();
+
+                string agent;
+                shared_ptr<const AgentConfig> config;
+                tie(agent, config) = findAgent(externalId);
+                if (config == nullptr) {
+                    router->throwException("http.response",
+                       "Couldn't find config for externalId: %lu",
+                       externalId);
+                }
+                ExcCheck(!agent.empty(), "Invalid agent");
+
+                Bid theBid;
+
+                int crid = bid.crid.toInt();
+                int creativeIndex = indexOf(config->creatives,
+                    &Creative::id, crid);
+
+                if (creativeIndex == -1) {
+                    router->throwException("http.response",
+                       "Unknown creative id: %d", crid);
+                }
+
+                theBid.creativeIndex = creativeIndex;
+                theBid.price = USD_CPM(bid.price.val);
+                theBid.priority = bid.ext["priority"].asDouble();
+
+                int spotIndex = indexOf(openRtbRequest.imp,
+                                       &OpenRTB::Impression::id, bid.impid);
+                if (spotIndex == -1) {
+                     router->throwException("http.response",
+                        "Unknown impression id: %s",
+                        bid.impid.toString().c_str());
+                }
+
+                theBid.spotIndex = spotIndex;
+
+                auto &bidInfo = bidsToSubmit[agent];
+                bidInfo.bids.push_back(std::move(theBid));
+
             }
-    );
+        }
 
-    HttpRequest::Content reqContent { requestStr, "application/json" };
-    RestParams headers { { "x-openrtb-version", "2.1" } };
-   // std::cerr << "Sending HTTP POST to: " << routerHost << " " << routerPath << std::endl;
-   // std::cerr << "Content " << reqContent.str << std::endl;
+    }
+    submitBids(bidsToSubmit, openRtbRequest.imp.size());
+}
 
-    httpClientRouter->post(routerPath, callbacks, reqContent,
-                     { } /* queryParams */, headers);
+void HttpBidderInterface::updateHedgeDelay() {
+    double delayMs = latency.percentile(hedgePercentile);
+    if (delayMs < 0) {
+        return;
+    }
+
+    delayMs = std::max(delayMs, minHedgeDelayMs);
+    hedgeDelayUs = delayMs * 1000;
+    recordLevel(delayMs, "http.hedge.delayMs");
 }
 
 void HttpBidderInterface::sendLossMessage(std::string const & agent,
@@ -446,6 +589,115 @@ void HttpBidderInterface::submitBids(AgentBids &info, size_t impressionsCount) {
     }
 }
 
+
+/******************************************************************************/
+/* LATENCY TRACKER                                                            */
+/******************************************************************************/
+
+HttpBidderInterface::LatencyTracker::
+LatencyTracker(size_t window)
+    : samples(window), next(0), count(0)
+{
+}
+
+void
+HttpBidderInterface::LatencyTracker::
+record(double latencyMs)
+{
+    samples[next] = latencyMs;
+    next = (next + 1) % samples.size();
+    count = std::min(count + 1, samples.size());
+}
+
+double
+HttpBidderInterface::LatencyTracker::
+percentile(double p) const
+{
+    // Too few samples and the tail is nothing but noise.
+    if (count < samples.size() / 8)
+        return -1;
+
+    std::vector<double> sorted(samples.begin(), samples.begin() + count);
+    auto it = sorted.begin() + std::min<size_t>(p * count, count - 1);
+    std::nth_element(sorted.begin(), it, sorted.end());
+    return *it;
+}
+
+
+/******************************************************************************/
+/* HEDGE TIMER                                                                */
+/******************************************************************************/
+
+HttpBidderInterface::HedgeTimer::
+HedgeTimer()
+{
+    timerFd = timerfd_create(CLOCK_REALTIME, TFD_NONBLOCK | TFD_CLOEXEC);
+    if (timerFd == -1)
+        throw ML::Exception(errno, "timerfd_create");
+}
+
+HttpBidderInterface::HedgeTimer::
+~HedgeTimer()
+{
+    ::close(timerFd);
+}
+
+void
+HttpBidderInterface::HedgeTimer::
+schedule(Date when, std::shared_ptr<PendingAuction> pending)
+{
+    std::lock_guard<ML::Spinlock> guard(lock);
+    bool wasEmpty = queue.empty();
+    queue.emplace_back(when, std::move(pending));
+    if (wasEmpty)
+        arm(when);
+}
+
+void
+HttpBidderInterface::HedgeTimer::
+arm(Date when)
+{
+    double seconds = when.secondsSinceEpoch();
+
+    itimerspec spec;
+    spec.it_interval.tv_sec = spec.it_interval.tv_nsec = 0;
+    spec.it_value.tv_sec = seconds;
+    spec.it_value.tv_nsec = (seconds - spec.it_value.tv_sec) * 1000000000;
+    if (spec.it_value.tv_sec == 0 && spec.it_value.tv_nsec == 0)
+        spec.it_value.tv_nsec = 1;  // zero would disarm the timer
+
+    int res = timerfd_settime(timerFd, TFD_TIMER_ABSTIME, &spec, 0);
+    if (res == -1)
+        throw ML::Exception(errno, "timerfd_settime");
+}
+
+bool
+HttpBidderInterface::HedgeTimer::
+processOne()
+{
+    uint64_t numWakeups;
+    int res = read(timerFd, &numWakeups, sizeof(numWakeups));
+    if (res == -1 && errno != EAGAIN && errno != EINTR)
+        throw ML::Exception(errno, "timerfd read");
+
+    Date now = Date::now();
+    std::vector<std::shared_ptr<PendingAuction> > due;
+    {
+        std::lock_guard<ML::Spinlock> guard(lock);
+        while (!queue.empty() && queue.front().first <= now) {
+            due.push_back(std::move(queue.front().second));
+            queue.pop_front();
+        }
+        if (!queue.empty())
+            arm(queue.front().first);
+    }
+
+    for (auto & pending: due)
+        onHedge(pending);
+
+    return false;
+}
+
 //
 // factory
 //
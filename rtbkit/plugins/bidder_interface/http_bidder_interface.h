@@ -8,11 +8,44 @@
 #include "rtbkit/common/bidder_interface.h"
 #include "soa/service/http_client.h"
 #include "soa/service/logs.h"
+#include "jml/arch/spinlock.h"
+
+#include <atomic>
+#include <deque>
 
 namespace RTBKIT {
 
 struct Bids;
 
+/** Bidder interface that sends every auction as an OpenRTB request to an
+    external bidder over HTTP.
+
+    Configuration:
+
+        {
+            "type": "http",
+            "router": {
+                "host": <string: scheme://host:port of the bidder>,
+                "path": <string: resource to POST the requests to>,
+                "connections": <int: size of the connection pool, default 4>,
+                "pipelining": <bool: pipeline requests, default false>,
+                "hedge": {
+                    "host": <string: second endpoint, default router host>,
+                    "percentile": <double: default 0.95>,
+                    "minDelayMs": <double: default 5>
+                }
+            },
+            "adserver": { ... }
+        }
+
+    Every request is given the time left in the auction as its timeout.
+
+    When "hedge" is given, a request that didn't get a response after the
+    configured percentile of the bidder's recent response times is sent a
+    second time to the hedge endpoint, and the first response to come back
+    is the one that is used.  Nothing is hedged until enough responses were
+    seen to estimate the percentile.
+*/
 struct HttpBidderInterface : public BidderInterface
 {
     HttpBidderInterface(std::string serviceName = "bidderService",
@@ -79,12 +112,84 @@ private:
 
     typedef std::map<std::string, AgentBidsInfo> AgentBids;
 
+    /** Auction that was sent to the bidder.  Once the request is sent, it
+        is only touched from the loop thread.
+    */
+    struct PendingAuction {
+        PendingAuction()
+            : outstanding(0), answered(false)
+        {
+        }
+
+        std::shared_ptr<Auction> auction;
+        std::map<std::string, BidInfo> bidders;
+        OpenRTB::BidRequest request;
+        std::string content;
+        Date sent;
+        Date deadline;
+        int outstanding;  ///< number of requests in flight
+        bool answered;
+    };
+
+    /** Keeps the latest response times of the bidder. */
+    struct LatencyTracker {
+        LatencyTracker(size_t window = 1024);
+
+        void record(double latencyMs);
+
+        /** Returns the given percentile of the latest response times, or -1
+            if not enough responses were seen yet.
+        */
+        double percentile(double p) const;
+
+    private:
+        std::vector<double> samples;
+        size_t next;
+        size_t count;
+    };
+
+    /** Holds the auctions that may need to be hedged until their hedging
+        time comes.  Auctions are queued in the order in which they were
+        sent and, since they all get the same delay which only changes
+        slowly, that is also the order in which they need to be hedged.
+    */
+    struct HedgeTimer : public AsyncEventSource {
+        HedgeTimer();
+        ~HedgeTimer();
+
+        /** Can be called from any thread. */
+        void schedule(Date when, std::shared_ptr<PendingAuction> pending);
+
+        std::function<void (const std::shared_ptr<PendingAuction> &)> onHedge;
+
+        virtual int selectFd() const
+        {
+            return timerFd;
+        }
+
+        virtual bool processOne();
+
+    private:
+        void arm(Date when);
+
+        int timerFd;
+        ML::Spinlock lock;
+        std::deque<std::pair<Date, std::shared_ptr<PendingAuction> > > queue;
+    };
+
     MessageLoop loop;
     std::shared_ptr<HttpClient> httpClientRouter;
+    std::shared_ptr<HttpClient> httpClientHedge;
+    std::shared_ptr<HedgeTimer> hedgeTimer;
+    LatencyTracker latency;
+    double hedgePercentile;
+    double minHedgeDelayMs;
+    std::atomic<int64_t> hedgeDelayUs;  ///< -1 when not hedging yet
     std::shared_ptr<HttpClient> httpClientAdserverWins;
     std::shared_ptr<HttpClient> httpClientAdserverEvents;
     std::string routerHost;
     std::string routerPath;
+    std::string hedgeHost;
     std::string adserverHost;
     uint16_t adserverWinPort;
     uint16_t adserverEventPort;
@@ -97,6 +202,16 @@ private:
     void injectBids(const std::string &agent, Id auctionId,
                     const Bids &bids, WinCostModel wcm);
 
+    bool sendRequest(const std::shared_ptr<PendingAuction> &pending,
+                     HttpClient &client, bool hedge);
+    void onResponse(const std::shared_ptr<PendingAuction> &pending,
+                    bool hedge, Date start, HttpClientError errorCode,
+                    int statusCode, const std::string &body);
+    void handleResponse(const PendingAuction &pending,
+                        int statusCode, const std::string &body);
+    void sendHedge(const std::shared_ptr<PendingAuction> &pending);
+    void updateHedgeDelay();
+
 };
 
 }
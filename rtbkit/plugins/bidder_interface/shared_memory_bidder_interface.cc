@@ -0,0 +1,158 @@
+/* shared_memory_bidder_interface.cc
+   Copyright (c) 2013 Datacratic.  All rights reserved.
+
+   Bidder interface that talks to co-located agents over shared memory.
+*/
+
+#include "shared_memory_bidder_interface.h"
+#include "rtbkit/core/router/router.h"
+
+using namespace Datacratic;
+using namespace RTBKIT;
+
+const std::string
+SharedMemoryBidderInterface::DefaultSocket = "/tmp/rtbkit-router.sock";
+
+SharedMemoryBidderInterface::SharedMemoryBidderInterface(std::string const & serviceName,
+                                                         std::shared_ptr<ServiceProxies> proxies,
+                                                         Json::Value const & config)
+    : AgentsBidderInterface(serviceName, proxies, config) {
+
+    std::string socket = config.get("socket", DefaultSocket).asString();
+    size_t ringSize = config.get("ringSize", (int) SharedMemoryChannel::DefaultRingSize).asInt();
+
+    listener.reset(new SharedMemoryListener(socket, ringSize));
+    listener->onConnection = [=] (std::string const & agent, Channel channel) {
+        onConnection(agent, channel);
+    };
+
+    loop.addSource("SharedMemoryBidderInterface::listener", listener);
+    loop.addPeriodic("SharedMemoryBidderInterface::checkChannels", 1.0,
+                     [=] (uint64_t) { checkChannels(); });
+}
+
+SharedMemoryBidderInterface::~SharedMemoryBidderInterface() {
+    shutdown();
+}
+
+void SharedMemoryBidderInterface::start() {
+    loop.start();
+}
+
+void SharedMemoryBidderInterface::shutdown() {
+    loop.shutdown();
+}
+
+bool SharedMemoryBidderInterface::isLocalAgent(std::string const & agent) const {
+    std::lock_guard<ML::Spinlock> guard(channelsLock);
+    return channels.count(agent);
+}
+
+SharedMemoryBidderInterface::Channel
+SharedMemoryBidderInterface::findChannel(std::string const & agent) const {
+    std::lock_guard<ML::Spinlock> guard(channelsLock);
+    auto it = channels.find(agent);
+    return it == channels.end() ? Channel() : it->second;
+}
+
+void SharedMemoryBidderInterface::sendLocalMessage(std::string const & agent,
+                                                   std::vector<std::string> && message) {
+    auto channel = findChannel(agent);
+    if (!channel) {
+        // It went away between the lookups; it wouldn't have received the
+        // message over the bridge either.
+        recordHit("shm.unknownAgent");
+        return;
+    }
+
+    if (channel->trySend(message))
+        return;
+
+    recordHit("shm.ringFull");
+    if (!channel->peerAlive())
+        dropChannel(agent, channel);
+}
+
+void SharedMemoryBidderInterface::onConnection(std::string const & agent, Channel channel) {
+    std::cerr << "agent " << agent << " connected over shared memory" << std::endl;
+    recordHit("shm.connections");
+
+    channel->onMessage = [=] (std::vector<std::string> && message) {
+        onAgentMessage(agent, std::move(message));
+    };
+
+    Channel previous;
+    {
+        std::lock_guard<ML::Spinlock> guard(channelsLock);
+        Channel & entry = channels[agent];
+        previous = entry;
+        entry = channel;
+    }
+
+    if (previous)
+        loop.removeSource(previous.get());
+    loop.addSource("SharedMemoryBidderInterface::" + agent, channel);
+}
+
+void SharedMemoryBidderInterface::onAgentMessage(std::string const & agent,
+                                                 std::vector<std::string> && message) {
+    // The router isn't thread safe; hand the message over to its main loop
+    // with the agent's address in front, as it would come off the bridge.
+    message.insert(message.begin(), agent);
+
+    if (!router->agentMessageBuffer.tryPush(std::move(message))) {
+        recordHit("shm.routerBacklog");
+        return;
+    }
+    router->wakeupMainLoop.signal();
+}
+
+void SharedMemoryBidderInterface::dropChannel(std::string const & agent,
+                                              Channel const & channel) {
+    {
+        std::lock_guard<ML::Spinlock> guard(channelsLock);
+        auto it = channels.find(agent);
+        if (it == channels.end() || it->second != channel)
+            return;
+        channels.erase(it);
+    }
+
+    std::cerr << "agent " << agent << " shared memory channel dropped" << std::endl;
+    recordHit("shm.disconnections");
+    loop.removeSource(channel.get());
+}
+
+void SharedMemoryBidderInterface::checkChannels() {
+    std::vector<std::pair<std::string, Channel> > dead;
+    {
+        std::lock_guard<ML::Spinlock> guard(channelsLock);
+        for (auto & entry : channels) {
+            if (!entry.second->peerAlive())
+                dead.push_back(entry);
+        }
+    }
+
+    for (auto & entry : dead)
+        dropChannel(entry.first, entry.second);
+}
+
+//
+// factory
+//
+
+namespace {
+
+struct AtInit {
+    AtInit()
+    {
+        BidderInterface::registerFactory("shm",
+        [](std::string const &serviceName,
+           std::shared_ptr<ServiceProxies> const &proxies,
+           Json::Value const &json)
+        {
+            return new SharedMemoryBidderInterface(serviceName, proxies, json);
+        });
+    }
+} atInit;
+
+}
@@ -0,0 +1,73 @@
+/* shared_memory_bidder_interface.h                                -*- C++ -*-
+   Copyright (c) 2013 Datacratic.  All rights reserved.
+
+   Bidder interface that talks to co-located agents over shared memory.
+*/
+
+#pragma once
+
+#include "agents_bidder_interface.h"
+#include "soa/service/shared_memory_channel.h"
+#include "soa/service/message_loop.h"
+#include "jml/arch/spinlock.h"
+
+#include <unordered_map>
+
+namespace RTBKIT {
+
+/** Same as the AgentsBidderInterface, except that agents running on the same
+    host as the router can ask for a shared memory channel on a unix socket.
+    Every message for those agents goes over their channel instead of the
+    bridge and their bids, pongs and such come back the same way.  Agents
+    that didn't ask for a channel keep going through the bridge.
+
+    Configuration:
+
+        {
+            "type": "shm",
+            "socket": <string: path of the unix socket to listen on>,
+            "ringSize": <int: size of each ring in bytes, power of two>
+        }
+
+    An agent whose ring is full (it's not keeping up or died) has its
+    messages dropped; agents that go away are forgotten about.
+*/
+struct SharedMemoryBidderInterface : public AgentsBidderInterface
+{
+    SharedMemoryBidderInterface(std::string const & serviceName = "bidderService",
+                                std::shared_ptr<ServiceProxies> proxies = std::make_shared<ServiceProxies>(),
+                                Json::Value const & config = Json::Value());
+
+    ~SharedMemoryBidderInterface();
+
+    void start();
+    void shutdown();
+
+    /** Default path of the unix socket. */
+    static const std::string DefaultSocket;
+
+protected:
+    bool isLocalAgent(std::string const & agent) const;
+
+    void sendLocalMessage(std::string const & agent,
+                          std::vector<std::string> && message);
+
+private:
+    typedef std::shared_ptr<SharedMemoryChannel> Channel;
+
+    Channel findChannel(std::string const & agent) const;
+
+    void onConnection(std::string const & agent, Channel channel);
+    void onAgentMessage(std::string const & agent,
+                        std::vector<std::string> && message);
+    void dropChannel(std::string const & agent, Channel const & channel);
+    void checkChannels();
+
+    MessageLoop loop;
+    std::shared_ptr<SharedMemoryListener> listener;
+
+    mutable ML::Spinlock channelsLock;
+    std::unordered_map<std::string, Channel> channels;
+};
+
+}
@@ -0,0 +1,144 @@
+/* agent_request_table.cc
+   Copyright (c) 2013 Datacratic.  All rights reserved.
+
+   Table of the bid requests that a bidding agent has yet to answer.
+*/
+
+#include "agent_request_table.h"
+#include "jml/utils/exc_check.h"
+
+#include <algorithm>
+
+using namespace std;
+using namespace Datacratic;
+
+
+namespace RTBKIT {
+
+
+/******************************************************************************/
+/* AGENT REQUEST TABLE                                                        */
+/******************************************************************************/
+
+AgentRequestTable::
+AgentRequestTable(double timeout)
+{
+    setTimeout(timeout);
+}
+
+void
+AgentRequestTable::
+setTimeout(double timeout)
+{
+    ExcCheckGreater(timeout, 0.0, "invalid request timeout");
+
+    timeout_ = timeout;
+    tickLength = timeout / TicksPerTimeout;
+}
+
+bool
+AgentRequestTable::
+insert(const Id & id, const std::string & fromRouter, Date now)
+{
+    Shard & shard = shardFor(id);
+    int64_t tick = toTick(now);
+
+    Guard guard(shard.lock);
+
+    auto res = shard.entries.insert(make_pair(id, Entry()));
+    if (!res.second) return false;
+
+    Entry & entry = res.first->second;
+    entry.timestamp = now;
+    entry.fromRouter = fromRouter;
+    entry.tick = tick;
+
+    shard.wheel[tick % WheelSlots].push_back(id);
+    return true;
+}
+
+bool
+AgentRequestTable::
+take(const Id & id, Request & request)
+{
+    Shard & shard = shardFor(id);
+    Guard guard(shard.lock);
+
+    auto it = shard.entries.find(id);
+    if (it == shard.entries.end()) return false;
+
+    request.timestamp = it->second.timestamp;
+    request.fromRouter = std::move(it->second.fromRouter);
+    shard.entries.erase(it);
+    return true;
+}
+
+bool
+AgentRequestTable::
+erase(const Id & id)
+{
+    Shard & shard = shardFor(id);
+    Guard guard(shard.lock);
+
+    return shard.entries.erase(id);
+}
+
+size_t
+AgentRequestTable::
+expire(Date now)
+{
+    int64_t cutoff = toTick(now) - TicksPerTimeout;
+    size_t expired = 0;
+
+    for (Shard & shard : shards) {
+        Guard guard(shard.lock);
+
+        // Anything older than a full turn of the wheel is in one of the slots
+        // that we're about to sweep anyway.
+        int64_t tick = std::max(shard.nextTick, cutoff - WheelSlots + 1);
+
+        for (; tick <= cutoff;  ++tick) {
+            unsigned slot = tick % WheelSlots;
+            auto & ids = shard.wheel[slot];
+
+            // If the sweep fell behind, a slot can also hold ids from later
+            // turns of the wheel which must be kept around.
+            size_t kept = 0;
+            for (size_t i = 0;  i < ids.size();  ++i) {
+                auto it = shard.entries.find(ids[i]);
+                if (it == shard.entries.end()) continue;
+
+                const Entry & entry = it->second;
+                if (entry.tick % WheelSlots != slot) continue;
+
+                if (entry.tick > cutoff) {
+                    ids[kept++] = ids[i];
+                    continue;
+                }
+
+                shard.entries.erase(it);
+                ++expired;
+            }
+
+            ids.resize(kept);
+        }
+
+        shard.nextTick = std::max(shard.nextTick, cutoff + 1);
+    }
+
+    return expired;
+}
+
+size_t
+AgentRequestTable::
+size() const
+{
+    size_t result = 0;
+    for (const Shard & shard : shards) {
+        Guard guard(shard.lock);
+        result += shard.entries.size();
+    }
+    return result;
+}
+
+} // namespace RTBKIT
@@ -0,0 +1,122 @@
+/* agent_request_table.h                                           -*- C++ -*-
+   Copyright (c) 2013 Datacratic.  All rights reserved.
+
+   Table of the bid requests that a bidding agent has yet to answer.
+*/
+
+#pragma once
+
+#include "soa/types/id.h"
+#include "soa/types/date.h"
+#include "jml/arch/spinlock.h"
+
+#include <mutex>
+#include <string>
+#include <vector>
+#include <unordered_map>
+
+
+namespace RTBKIT {
+
+
+/******************************************************************************/
+/* AGENT REQUEST TABLE                                                        */
+/******************************************************************************/
+
+/** Keeps track of the bid requests that were handed to the agent and that it
+    hasn't bid on yet so that we know which router to send the bid to.
+
+    Every bidding thread of the agent hits this table once per bid request
+    and once per bid so it's split into shards, each with its own spinlock
+    which is only held for the duration of a hash table operation.
+
+    Requests that are never answered (the agent chose to ignore them and the
+    router never told us it dropped them) are expired through a timing wheel
+    kept in each shard. Each slot of the wheel holds the ids that were
+    inserted during one tick; ids that were removed in the meantime are only
+    dropped from their slot when it's swept.
+ */
+struct AgentRequestTable
+{
+    enum {
+        NumShards = 32,
+        WheelSlots = 256,
+        TicksPerTimeout = WheelSlots / 2
+    };
+
+    static constexpr double DefaultTimeout = 5.0;
+
+    AgentRequestTable(double timeout = DefaultTimeout);
+
+    AgentRequestTable(const AgentRequestTable & other) = delete;
+    AgentRequestTable & operator = (const AgentRequestTable & other) = delete;
+
+    struct Request {
+        Datacratic::Date timestamp;
+        std::string fromRouter;
+    };
+
+    /** Number of seconds after which an unanswered request is forgotten.
+        Must not be changed while the table is being used.
+     */
+    void setTimeout(double timeout);
+    double timeout() const { return timeout_; }
+
+    /** Records a new request. Returns false if a request with the same id is
+        already in the table, in which case nothing is changed.
+     */
+    bool insert(const Datacratic::Id & id,
+                const std::string & fromRouter,
+                Datacratic::Date now = Datacratic::Date::now());
+
+    /** Removes the request from the table and returns it. Returns false if the
+        request wasn't found, either because it was dropped or it expired.
+     */
+    bool take(const Datacratic::Id & id, Request & request);
+
+    /** Removes the request from the table without looking at it. */
+    bool erase(const Datacratic::Id & id);
+
+    /** Forgets every request that is older than the timeout and returns how
+        many were dropped. Meant to be called periodically from a single
+        thread; the shards are only locked one at a time.
+     */
+    size_t expire(Datacratic::Date now = Datacratic::Date::now());
+
+    /** Number of requests in the table. */
+    size_t size() const;
+
+private:
+    struct Entry {
+        Datacratic::Date timestamp;
+        std::string fromRouter;
+        int64_t tick;
+    };
+
+    struct Shard {
+        Shard() : nextTick(0) {}
+
+        mutable ML::Spinlock lock;
+        std::unordered_map<Datacratic::Id, Entry> entries;
+        std::vector<Datacratic::Id> wheel[WheelSlots];
+        int64_t nextTick;  // first tick that wasn't swept yet
+    } __attribute__((__aligned__(64)));
+
+    typedef std::lock_guard<ML::Spinlock> Guard;
+
+    Shard & shardFor(const Datacratic::Id & id)
+    {
+        return shards[id.hash() % NumShards];
+    }
+
+    int64_t toTick(Datacratic::Date date) const
+    {
+        return date.secondsSinceEpoch() / tickLength;
+    }
+
+    double timeout_;
+    double tickLength;
+    Shard shards[NumShards];
+};
+
+} // namespace RTBKIT
@@ -20,6 +20,7 @@
 #include <boost/lexical_cast.hpp>
 #include <boost/algorithm/string.hpp>
 #include <iostream>
+#include <thread>
 
 using namespace std;
 using namespace Datacratic;
@@ -95,7 +96,7 @@ BiddingAgent(std::shared_ptr<ServiceProxies> proxies,
       toRouters(getZmqContext()),
       toPostAuctionServices(getZmqContext()),
       toConfigurationAgent(getZmqContext()),
-      toRouterChannel(65536),
+      toRouterChannel(8192),
       requiresAllCB(true)
 {
 }
@@ -110,7 +111,7 @@ BiddingAgent(ServiceBase& parent,
       toRouters(getZmqContext()),
       toPostAuctionServices(getZmqContext()),
       toConfigurationAgent(getZmqContext()),
-      toRouterChannel(65536),
+      toRouterChannel(8192),
       requiresAllCB(true)
 {
 }
@@ -162,9 +163,9 @@ init()
             toRouters.sendMessage(connectedTo, "CONFIG", agentName);
         };
     toRouters.connectAllServiceProviders("rtbRequestRouter", "agents");
-    toRouterChannel.onEvent = [=] (const RouterMessage & msg)
+    toRouterChannel.onEvent = [=] (RouterMessage && msg)
         {
-            toRouters.sendMessage(msg.toRouter, msg.type, msg.payload);
+            sendToRouter(msg.toRouter, msg.type, msg.payload);
         };
     toPostAuctionServices.init(getServices()->config, agentName);
     toPostAuctionServices.connectHandler = [=] (const std::string & connectedTo)
@@ -181,9 +182,69 @@ init()
     addSource("BiddingAgent::toConfigurationAgent", toConfigurationAgent);
     addSource("BiddingAgent::toRouterChannel", toRouterChannel);
 
+    if (!sharedMemorySocket.empty())
+        connectSharedMemory(messageHandler);
+
+    addPeriodic("BiddingAgent::expireRequests",
+                std::min(requests.timeout() / 4.0, 1.0),
+                [=] (uint64_t)
+                {
+                    size_t expired = requests.expire();
+                    if (expired) recordCount(expired, "requestsExpired");
+                    recordLevel(requests.size(), "requestsPending");
+                });
+
     // No need to init() message loop; it was done in the constructor
 }
 
+void
+BiddingAgent::
+useSharedMemory(const std::string & socketPath)
+{
+    sharedMemorySocket = socketPath;
+    sharedMemoryRouter = "shm://" + socketPath;
+}
+
+void
+BiddingAgent::
+connectSharedMemory(const RouterMessageHandler & messageHandler)
+{
+    try {
+        toRouterShm = connectSharedMemoryChannel(sharedMemorySocket, agentName);
+    } catch (const std::exception & exc) {
+        cerr << "BiddingAgent couldn't connect to router over shared memory at "
+             << sharedMemorySocket << ": " << exc.what()
+             << "; using zeromq only" << endl;
+        recordHit("shm.connectError");
+        return;
+    }
+
+    cerr << "BiddingAgent is connected to router over shared memory at "
+         << sharedMemorySocket << endl;
+
+    toRouterShm->onMessage = [=] (std::vector<std::string> && msg)
+        {
+            messageHandler(sharedMemoryRouter, msg);
+        };
+
+    addSource("BiddingAgent::toRouterShm", toRouterShm);
+}
+
+void
+BiddingAgent::
+sendOverSharedMemory(const std::vector<std::string> & message)
+{
+    // A full ring means that the router is way behind; give it a moment to
+    // catch up before giving up on the message.
+    for (int tries = 0;  !toRouterShm->trySend(message);  ++tries) {
+        if (tries == 100) {
+            recordHit("shm.ringFull");
+            return;
+        }
+        std::this_thread::yield();
+    }
+}
+
 void
 BiddingAgent::
 shutdown()
@@ -279,7 +340,7 @@ handleRouterMessage(const std::string & fromRouter,
             auto message_ = message;
             string received = message.at(1);
             message_.erase(message_.begin(), message_.begin() + 2);
-            toRouters.sendMessage(fromRouter, "PONG0", received, Date::now(), message_);
+            sendToRouter(fromRouter, "PONG0", received, Date::now(), message_);
             break;
         } 
         case hash_compile_time("PING1") : {
@@ -399,13 +460,8 @@ handleBidRequest(const std::string & fromRouter,
 
     recordHit("requests");
 
-    ExcCheck(!requests.count(id), "seen multiple requests with same ID");
-    {
-        lock_guard<mutex> guard (requestsLock);
-
-        requests[id].timestamp = Date::now();
-        requests[id].fromRouter = fromRouter;
-    }
+    bool inserted = requests.insert(id, fromRouter);
+    ExcCheck(inserted, "seen multiple requests with same ID");
 
     callback(timestamp, id, br, bids, timeLeftMs, augmentations, wcm);
 }
@@ -429,10 +485,8 @@ handleResult(const std::vector<std::string>& msg, ResultCbFn& callback)
 
     callback(result);
 
-    if (result.result == BS_DROPPEDBID) {
-        lock_guard<mutex> guard (requestsLock);
+    if (result.result == BS_DROPPEDBID)
         requests.erase(Id(msg[3]));
-    }
 }
 
 void
@@ -483,32 +537,24 @@ doBid(Id id, const Bids & bids, const Json::Value & jsonMeta, const WinCostModel
     boost::trim(model);
 
     Date afterSend = Date::now();
-    Date beforeSend;
-    string fromRouter;
-
-    {
-        lock_guard<mutex> guard (requestsLock);
-
-        auto it = requests.find(id);
-
-        /** If the auction id isn't in the map then we previously received a
-            DROPBID message we should simply forget this bid.
-         */
-        if (it == requests.end()) {
-            cerr << "Ignoring bid (dropped auction id): " << id << endl;
-            return;
-        }
-
-        beforeSend = it->second.timestamp;
-        fromRouter = it->second.fromRouter;
-        requests.erase(it);
+    AgentRequestTable::Request request;
+
+    /** If the auction id isn't in the table then we previously received a
+        DROPBID message or the request expired; we should simply forget this
+        bid.
+     */
+    if (!requests.take(id, request)) {
+        cerr << "Ignoring bid (dropped auction id): " << id << endl;
+        return;
     }
-    if (fromRouter.empty()) return;
+    if (request.fromRouter.empty()) return;
 
-    recordLevel((afterSend - beforeSend) * 1000.0, "timeTakenMs");
+    recordLevel((afterSend - request.timestamp) * 1000.0, "timeTakenMs");
 
     toRouterChannel.push(RouterMessage(
-                    fromRouter, "BID", { id.toString(), response, model, meta }));
+                    std::move(request.fromRouter), "BID",
+                    { id.toString(), std::move(response),
+                      std::move(model), std::move(meta) }));
 
     /** Gather some stats */
     for (const Bid& bid : bids) {
@@ -551,7 +597,7 @@ doPong(const std::string & fromRouter, Date sent, Date received,
     };
 
     message.insert(message.end(), payload.begin(), payload.end());
-    toRouterChannel.push(RouterMessage(fromRouter, "PONG1", message));
+    toRouterChannel.push(RouterMessage(fromRouter, "PONG1", std::move(message)));
 }
 
 void
@@ -21,6 +21,8 @@
 #include "soa/service/service_base.h"
 #include "soa/service/zmq_endpoint.h"
 #include "soa/service/typed_message_channel.h"
+#include "soa/service/shared_memory_channel.h"
+#include "rtbkit/plugins/bidding_agent/agent_request_table.h"
 
 #include <boost/function.hpp>
 #include <boost/noncopyable.hpp>
@@ -30,7 +32,6 @@
 #include <string>
 #include <vector>
 #include <thread>
-#include <map>
 
 
 namespace RTBKIT {
@@ -72,6 +73,24 @@ struct BiddingAgent : public ServiceBase, public MessageLoop {
     */
     void strictMode(bool strict) { requiresAllCB = strict; }
 
+    /** Number of seconds after which we forget about a bid request that the
+        agent didn't bid on. Bids placed after that are ignored. Should be set
+        before calling init().
+     */
+    void setRequestTimeout(double timeout) { requests.setTimeout(timeout); }
+
+    /** Ask the router listening on the given unix socket for a shared memory
+        channel (see SharedMemoryBidderInterface) when init() is called.
+        Only useful for agents running on the same host as the router; every
+        auction and bid then goes through shared memory instead of zeromq,
+        which is still used for everything else.  If the router can't be
+        reached we fall back on zeromq.
+
+        For the lowest latency, the agent should also be constructed with a
+        maxAddedLatency of 0.
+     */
+    void useSharedMemory(const std::string & socketPath);
+
     void init();
     void shutdown();
 
@@ -248,13 +267,13 @@ private:
 
     /** Format of a message to a router. */
     struct RouterMessage {
-        RouterMessage(const std::string & toRouter = "",
-                      const std::string & type = "",
-                      const std::vector<std::string> & payload
+        RouterMessage(std::string toRouter = "",
+                      std::string type = "",
+                      std::vector<std::string> payload
                           = std::vector<std::string>())
-            : toRouter(toRouter),
-              type(type),
-              payload(payload)
+            : toRouter(std::move(toRouter)),
+              type(std::move(type)),
+              payload(std::move(payload))
         {
         }
 
@@ -266,15 +285,41 @@ private:
     ZmqMultipleNamedClientBusProxy toRouters;
     ZmqMultipleNamedClientBusProxy toPostAuctionServices;
     ZmqNamedClientBusProxy toConfigurationAgent;
-    TypedMessageSink<RouterMessage> toRouterChannel;
 
-    struct RequestStatus {
-        Date timestamp;
-        std::string fromRouter;
-    };
+    /** Bids and pongs are sent from the agent's own threads; each of them
+        gets a lane in there and the message loop does the actual sending.
+     */
+    TypedMessageLaneSink<RouterMessage> toRouterChannel;
+
+    AgentRequestTable requests;
+
+    std::string sharedMemorySocket;
+    std::string sharedMemoryRouter;  // name of the router on the channel
+    std::shared_ptr<SharedMemoryChannel> toRouterShm;
+
+    typedef std::function<void (const std::string & router,
+                                const std::vector<std::string> & message)>
+        RouterMessageHandler;
+
+    void connectSharedMemory(const RouterMessageHandler & messageHandler);
+
+    /** Sends a message to the given router over whichever transport it came
+        in on.  Must be called from the message loop thread.
+     */
+    template<typename... Args>
+    void sendToRouter(const std::string & router,
+                      const std::string & type,
+                      const Args &... args)
+    {
+        if (toRouterShm && router == sharedMemoryRouter) {
+            std::vector<std::string> message { type };
+            encodeMessageParts(message, args...);
+            sendOverSharedMemory(message);
+        }
+        else toRouters.sendMessage(router, type, args...);
+    }
 
-    std::map<Id, RequestStatus> requests;
-    std::mutex requestsLock; // Protects concurrent writes to requests
+    void sendOverSharedMemory(const std::vector<std::string> & message);
 
     bool requiresAllCB;
 
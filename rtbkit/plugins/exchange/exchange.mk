@@ -5,7 +5,7 @@ LIBRTB_EXCHANGE_SOURCES := \
 	http_auction_handler.cc
 
 LIBRTB_EXCHANGE_LINK := \
-	zeromq boost_thread utils endpoint services rtb bid_request
+	zeromq boost_thread utils endpoint services rtb bid_request gc
 
 $(eval $(call library,exchange,$(LIBRTB_EXCHANGE_SOURCES),$(LIBRTB_EXCHANGE_LINK)))
 
@@ -7,6 +7,7 @@
 
 #include "http_auction_handler.h"
 #include "http_exchange_connector.h"
+#include "rtbkit/common/auction_tracer.h"
 
 #include "jml/arch/exception.h"
 #include "jml/arch/format.h"
@@ -206,6 +207,7 @@ handleTimeout(Date date, size_t cookie)
     }
 
     if (auction_->finish()) {
+        AuctionTracer::instance().trigger(auction_->id, "timeout");
         doEvent("auctionTimeout");
         if (this->endpoint->onTimeout)
             this->endpoint->onTimeout(auction, date);
@@ -421,6 +423,9 @@ handleHttpPayload(const HttpHeader & header,
         return;
     }
 
+    AuctionTracer::instance().record(
+            "exchange.parse", auction->id, now, Date::now());
+
     doEvent("auctionNetworkLatencyMs",
             ET_OUTCOME,
             (firstData.secondsSince(auction->request->timestamp)) * 1000.0,
@@ -510,11 +515,15 @@ sendResponse()
         return;
     }
     
+    Date beforeRender = Date::now();
     HttpResponse response = getResponse();
     
     Date startTime = auction->start;
     Date beforeSend = Date::now();
 
+    AuctionTracer::instance().record(
+            "exchange.render", auction->id, beforeRender, beforeSend);
+
     auto onSendFinished = [=] ()
         {
             //static int n = 0;
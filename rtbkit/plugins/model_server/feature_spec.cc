@@ -0,0 +1,197 @@
+/* feature_spec.cc
+   Copyright (c) 2013 Datacratic.  All rights reserved.
+
+   Extraction of classifier features from bid requests.
+*/
+
+#include "feature_spec.h"
+#include "jml/arch/exception.h"
+
+#include <limits>
+
+using namespace std;
+using namespace ML;
+
+
+namespace RTBKIT {
+
+
+/*****************************************************************************/
+/* FEATURE SPEC                                                              */
+/*****************************************************************************/
+
+namespace {
+
+const float NaN = std::numeric_limits<float>::quiet_NaN();
+
+struct ExtractName {
+    const char * name;
+    FeatureSpec::Extract extract;
+    bool isString;
+};
+
+const ExtractName extractNames[] = {
+    { "hourOfDay",       FeatureSpec::HOUR_OF_DAY,       false },
+    { "dayOfWeek",       FeatureSpec::DAY_OF_WEEK,       false },
+    { "timeAvailableMs", FeatureSpec::TIME_AVAILABLE_MS, false },
+    { "spotWidth",       FeatureSpec::SPOT_WIDTH,        false },
+    { "spotHeight",      FeatureSpec::SPOT_HEIGHT,       false },
+    { "spotPosition",    FeatureSpec::SPOT_POSITION,     false },
+    { "dma",             FeatureSpec::DMA,               false },
+    { "segment",         FeatureSpec::SEGMENT,           false },
+    { "segmentCount",    FeatureSpec::SEGMENT_COUNT,     false },
+    { "exchange",        FeatureSpec::EXCHANGE,          true },
+    { "language",        FeatureSpec::LANGUAGE,          true },
+    { "country",         FeatureSpec::COUNTRY,           true },
+    { "region",          FeatureSpec::REGION,            true },
+    { "host",            FeatureSpec::HOST,              true }
+};
+
+float match(const std::string & value, const std::string & equals)
+{
+    if (value.empty()) return NaN;
+    return value == equals;
+}
+
+} // file scope
+
+float
+FeatureSpec::Feature::
+apply(const BidRequest & request, int spot) const
+{
+    switch (extract) {
+
+    case HOUR_OF_DAY:
+        return request.timestamp.hour();
+
+    case DAY_OF_WEEK:
+        return request.timestamp.weekday();
+
+    case TIME_AVAILABLE_MS:
+        return request.timeAvailableMs;
+
+    case SPOT_WIDTH:
+    case SPOT_HEIGHT: {
+        const AdSpot & imp = request.imp.at(spot);
+        if (imp.formats.empty()) return NaN;
+        return extract == SPOT_WIDTH
+            ? imp.formats[0].width : imp.formats[0].height;
+    }
+
+    case SPOT_POSITION: {
+        int position = request.imp.at(spot).position.val;
+        return position < 0 ? NaN : position;
+    }
+
+    case DMA:
+        return request.location.dma < 0 ? NaN : request.location.dma;
+
+    case SEGMENT:
+    case SEGMENT_COUNT: {
+        auto it = request.segments.find(source);
+        if (it == request.segments.end() || !it->second)
+            return extract == SEGMENT ? 0.0 : NaN;
+
+        const SegmentList & segs = *it->second;
+        if (extract == SEGMENT_COUNT) return segs.size();
+        return isIntSegment ? segs.contains(segmentInt) : segs.contains(segmentStr);
+    }
+
+    case EXCHANGE:
+        return match(request.exchange, equals);
+
+    case LANGUAGE:
+        return match(request.language.rawString(), equals);
+
+    case COUNTRY:
+        return match(request.location.countryCode, equals);
+
+    case REGION:
+        return match(request.location.regionCode, equals);
+
+    case HOST:
+        if (request.url.empty()) return NaN;
+        return request.url.host() == equals;
+    }
+
+    throw ML::Exception("FeatureSpec: unknown extractor %d", (int)extract);
+}
+
+std::vector<std::string>
+FeatureSpec::
+names() const
+{
+    vector<string> result;
+    for (auto & feature: features)
+        result.push_back(feature.name);
+    return result;
+}
+
+void
+FeatureSpec::
+extract(const BidRequest & request, int spot, float * out) const
+{
+    for (unsigned i = 0;  i < features.size();  ++i)
+        out[i] = features[i].apply(request, spot);
+}
+
+FeatureSpec
+FeatureSpec::
+createFromJson(const Json::Value & json)
+{
+    if (!json.isArray())
+        throw ML::Exception("feature spec must be an array");
+
+    FeatureSpec result;
+
+    for (auto & entry: json) {
+        Feature feature;
+        feature.name = entry["feature"].asString();
+        if (feature.name.empty())
+            throw ML::Exception("feature spec entry needs a feature name: %s",
+                                entry.toStringNoNewLine().c_str());
+
+        string extract = entry["extract"].asString();
+
+        const ExtractName * found = 0;
+        for (auto & name: extractNames)
+            if (extract == name.name) found = &name;
+
+        if (!found)
+            throw ML::Exception("feature %s: unknown extractor '%s'",
+                                feature.name.c_str(), extract.c_str());
+
+        feature.extract = found->extract;
+
+        if (found->isString) {
+            if (!entry.isMember("equals"))
+                throw ML::Exception("feature %s: extractor '%s' needs a "
+                                    "value to compare with in 'equals'",
+                                    feature.name.c_str(), extract.c_str());
+            feature.equals = entry["equals"].asString();
+        }
+
+        if (feature.extract == SEGMENT || feature.extract == SEGMENT_COUNT) {
+            feature.source =
+                InternedString::intern(entry["source"].asString());
+
+            if (feature.extract == SEGMENT) {
+                const Json::Value & segment = entry["segment"];
+                if (segment.isIntegral()) {
+                    feature.isIntSegment = true;
+                    feature.segmentInt = segment.asInt();
+                }
+                else if (segment.isString())
+                    feature.segmentStr = segment.asString();
+                else throw ML::Exception("feature %s: needs a segment",
+                                         feature.name.c_str());
+            }
+        }
+
+        result.features.push_back(feature);
+    }
+
+    return result;
+}
+
+} // namespace RTBKIT
@@ -0,0 +1,99 @@
+/* feature_spec.h                                                  -*- C++ -*-
+   Copyright (c) 2013 Datacratic.  All rights reserved.
+
+   Declarative description of how to turn a bid request into the dense
+   feature vector of a classifier.
+*/
+
+#pragma once
+
+#include "rtbkit/common/bid_request.h"
+#include "rtbkit/common/interned_string.h"
+#include "soa/jsoncpp/value.h"
+
+#include <string>
+#include <vector>
+
+
+namespace RTBKIT {
+
+
+/*****************************************************************************/
+/* FEATURE SPEC                                                              */
+/*****************************************************************************/
+
+/** List of the features to extract from a bid request for one of its spots,
+    in the order of the feature vector.  It's described in JSON as an array
+    of objects like:
+
+        { "feature": "width",   "extract": "spotWidth" }
+        { "feature": "isUS",    "extract": "country", "equals": "US" }
+        { "feature": "seg1234", "extract": "segment",
+          "source": "provider", "segment": 1234 }
+
+    where "feature" is the name of the feature in the classifier's feature
+    space.  The numeric extractors are:
+
+        hourOfDay, dayOfWeek     time of the auction (UTC)
+        timeAvailableMs          time the exchange gives to bid
+        spotWidth, spotHeight    first format of the spot
+        spotPosition             fold position of the spot
+        dma                      location DMA code
+        segment                  1 if the segment is in the given source
+        segmentCount             number of segments in the given source
+
+    The string extractors exchange, language, country, region and host (of
+    the url) need an "equals" and give 1 if it matches.  Values that aren't
+    in the bid request are extracted as NaN, which the classifiers treat as
+    missing.
+*/
+struct FeatureSpec {
+
+    enum Extract {
+        HOUR_OF_DAY,
+        DAY_OF_WEEK,
+        TIME_AVAILABLE_MS,
+        SPOT_WIDTH,
+        SPOT_HEIGHT,
+        SPOT_POSITION,
+        DMA,
+        SEGMENT,
+        SEGMENT_COUNT,
+        EXCHANGE,
+        LANGUAGE,
+        COUNTRY,
+        REGION,
+        HOST
+    };
+
+    struct Feature {
+        Feature()
+            : extract(HOUR_OF_DAY), segmentInt(0), isIntSegment(false)
+        {
+        }
+
+        std::string name;
+        Extract extract;
+        std::string equals;        ///< For the string extractors
+        InternedString source;     ///< For the segment extractors
+        std::string segmentStr;
+        int segmentInt;
+        bool isIntSegment;
+
+        float apply(const BidRequest & request, int spot) const;
+    };
+
+    std::vector<Feature> features;
+
+    size_t size() const { return features.size(); }
+
+    /** Names of the features, in the order they are extracted. */
+    std::vector<std::string> names() const;
+
+    /** Fills in size() values for the given spot of the request. */
+    void extract(const BidRequest & request, int spot, float * out) const;
+
+    static FeatureSpec createFromJson(const Json::Value & json);
+};
+
+} // namespace RTBKIT
@@ -0,0 +1,287 @@
+/* model_server.cc
+   Copyright (c) 2013 Datacratic.  All rights reserved.
+
+   In process scoring of bid requests with jml classifiers.
+*/
+
+#include "model_server.h"
+#include "jml/arch/exception.h"
+
+#include <sys/stat.h>
+#include <errno.h>
+#include <iostream>
+
+using namespace std;
+using namespace ML;
+
+
+namespace RTBKIT {
+
+
+/*****************************************************************************/
+/* MODEL SERVER                                                              */
+/*****************************************************************************/
+
+ModelServer::FileVersion
+ModelServer::FileVersion::
+get(const std::string & file)
+{
+    struct stat st;
+    if (stat(file.c_str(), &st) == -1)
+        throw ML::Exception(errno, "stat model file " + file);
+
+    FileVersion result;
+    result.mtime = st.st_mtim.tv_sec * 1000000000LL + st.st_mtim.tv_nsec;
+    result.size = st.st_size;
+    return result;
+}
+
+void
+ModelServer::Model::
+score(const BidRequest & request, int first, int last, float * out) const
+{
+    size_t n = last - first;
+    size_t nf = spec.size();
+    size_t nl = classifier.label_count();
+
+    vector<float> rows(n * nf);
+    for (unsigned i = 0;  i < n;  ++i)
+        spec.extract(request, first + i, &rows[i * nf]);
+
+    vector<float> labels(n * nl);
+    classifier.impl->predict(&rows[0], n, &labels[0], info);
+
+    for (unsigned i = 0;  i < n;  ++i)
+        out[i] = labels[i * nl + label];
+}
+
+ModelServer::
+ModelServer(std::shared_ptr<ServiceProxies> proxies,
+            const std::string & serviceName)
+    : ServiceBase(serviceName, proxies),
+      models(gcLock)
+{
+}
+
+ModelServer::
+ModelServer(ServiceBase & parent,
+            const std::string & serviceName)
+    : ServiceBase(serviceName, parent),
+      models(gcLock)
+{
+}
+
+ModelServer::
+~ModelServer()
+{
+    shutdown();
+}
+
+void
+ModelServer::
+start(double checkPeriod)
+{
+    addPeriodic("ModelServer::checkForUpdates", checkPeriod,
+                [=] (uint64_t) { checkForUpdates(); });
+
+    MessageLoop::start();
+}
+
+void
+ModelServer::
+shutdown()
+{
+    MessageLoop::shutdown();
+}
+
+std::shared_ptr<const ModelServer::Model>
+ModelServer::
+loadModel(const std::string & name,
+          const std::string & file,
+          const FeatureSpec & spec,
+          int label)
+{
+    if (spec.size() == 0)
+        throw ML::Exception("model %s has no features", name.c_str());
+
+    std::shared_ptr<Model> model(new Model());
+    model->name = name;
+    model->file = file;
+    model->spec = spec;
+    model->label = label;
+    model->latencyEvent = "model." + name + ".latencyMs";
+
+    // Taken before the load so that a file replaced while it's being loaded
+    // is picked up by the next check.
+    model->version = FileVersion::get(file);
+    model->classifier.load(file);
+
+    if (label < 0 || label >= model->classifier.label_count())
+        throw ML::Exception("model %s: label %d out of range for %zd labels",
+                            name.c_str(), label,
+                            model->classifier.label_count());
+
+    auto fs = model->classifier.feature_space();
+
+    vector<Feature> features;
+    for (auto & featureName: spec.names()) {
+        Feature feature;
+        fs->parse(featureName, feature);
+        features.push_back(feature);
+    }
+
+    model->info = model->classifier.impl->optimize(features);
+
+    return model;
+}
+
+void
+ModelServer::
+addModel(const std::string & name, const Json::Value & config)
+{
+    if (!config.isMember("file"))
+        throw ML::Exception("model %s needs a file", name.c_str());
+
+    addModel(name,
+             config["file"].asString(),
+             FeatureSpec::createFromJson(config["features"]),
+             config.get("label", 1).asInt());
+}
+
+void
+ModelServer::
+addModel(const std::string & name,
+         const std::string & file,
+         const FeatureSpec & spec,
+         int label)
+{
+    auto model = loadModel(name, file, spec, label);
+
+    std::lock_guard<std::mutex> guard(writeLock);
+
+    std::unique_ptr<Models> newModels(new Models(*models.getImmutable()));
+    (*newModels)[name] = model;
+    models.replace(newModels.release());
+
+    failedVersions.erase(name);
+}
+
+void
+ModelServer::
+removeModel(const std::string & name)
+{
+    std::lock_guard<std::mutex> guard(writeLock);
+
+    std::unique_ptr<Models> newModels(new Models(*models.getImmutable()));
+    if (!newModels->erase(name))
+        throw ML::Exception("unknown model %s", name.c_str());
+    models.replace(newModels.release());
+
+    failedVersions.erase(name);
+}
+
+bool
+ModelServer::
+hasModel(const std::string & name) const
+{
+    auto current = models.getImmutable();
+    return current->count(name);
+}
+
+const ModelServer::Model &
+ModelServer::
+getModel(const RcuLocked<const Models> & models,
+         const std::string & name) const
+{
+    auto it = models->find(name);
+    if (it == models->end())
+        throw ML::Exception("unknown model %s", name.c_str());
+    return *it->second;
+}
+
+std::vector<float>
+ModelServer::
+score(const std::string & name, const BidRequest & request) const
+{
+    Date start = Date::now();
+
+    auto current = models.getImmutable();
+    const Model & model = getModel(current, name);
+
+    vector<float> result(request.imp.size());
+    if (!result.empty())
+        model.score(request, 0, result.size(), &result[0]);
+
+    recordOutcome(Date::now().secondsSince(start) * 1000.0,
+                  model.latencyEvent);
+    return result;
+}
+
+float
+ModelServer::
+score(const std::string & name, const BidRequest & request, int spot) const
+{
+    Date start = Date::now();
+
+    auto current = models.getImmutable();
+    const Model & model = getModel(current, name);
+
+    if (spot < 0 || spot >= request.imp.size())
+        throw ML::Exception("model %s: spot %d out of range for %zd spots",
+                            name.c_str(), spot, request.imp.size());
+
+    float result;
+    model.score(request, spot, spot + 1, &result);
+
+    recordOutcome(Date::now().secondsSince(start) * 1000.0,
+                  model.latencyEvent);
+    return result;
+}
+
+int
+ModelServer::
+checkForUpdates()
+{
+    std::lock_guard<std::mutex> guard(writeLock);
+
+    std::unique_ptr<Models> newModels(new Models(*models.getImmutable()));
+    int swapped = 0;
+
+    for (auto & entry: *newModels) {
+        const string & name = entry.first;
+        const Model & model = *entry.second;
+
+        // A file being renamed over can briefly be missing; keep serving the
+        // model we have until it comes back.
+        FileVersion version;
+        try {
+            version = FileVersion::get(model.file);
+        } catch (const std::exception & exc) {
+            continue;
+        }
+
+        if (version == model.version) continue;
+
+        auto failed = failedVersions.find(name);
+        if (failed != failedVersions.end() && failed->second == version)
+            continue;
+
+        try {
+            entry.second = loadModel(name, model.file, model.spec, model.label);
+            failedVersions.erase(name);
+            ++swapped;
+            recordHit("model.%s.reloads", name);
+        } catch (const std::exception & exc) {
+            cerr << "error reloading model " << name << " from "
+                 << model.file << ": " << exc.what() << endl;
+            failedVersions[name] = version;
+            recordHit("model.%s.reloadErrors", name);
+        }
+    }
+
+    if (swapped) models.replace(newModels.release());
+
+    return swapped;
+}
+
+} // namespace RTBKIT
@@ -0,0 +1,159 @@
+/* model_server.h                                                  -*- C++ -*-
+   Copyright (c) 2013 Datacratic.  All rights reserved.
+
+   In process scoring of bid requests with jml classifiers.
+*/
+
+#pragma once
+
+#include "feature_spec.h"
+#include "jml/boosting/classifier.h"
+#include "soa/gc/gc_lock.h"
+#include "soa/gc/rcu_protected.h"
+#include "soa/service/service_base.h"
+#include "soa/service/message_loop.h"
+
+#include <map>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+
+
+namespace RTBKIT {
+
+
+/*****************************************************************************/
+/* MODEL SERVER                                                              */
+/*****************************************************************************/
+
+/** Scores bid requests with serialized jml classifiers (boosted trees,
+    committees, perceptrons, ...) so that a bidding agent can price its bids
+    without a round trip to an external model service.
+
+    Each model is a classifier file saved with ML::Classifier::save() along
+    with the FeatureSpec that builds its feature vector from a bid request.
+    The models are scored through the optimized predict path, all the spots
+    of a request in one batch.
+
+    The set of models is RCU protected: scoring never takes a lock, and a
+    model whose file changes is reloaded and swapped in atomically while
+    the old one finishes serving the requests that were using it.  Files
+    should be replaced by renaming a complete file over the old one so that
+    a half written model is never read; a model that fails to load leaves
+    the previous one in place.
+
+    Per model events:
+        model.<name>.latencyMs       time to score a request
+        model.<name>.reloads         model reloaded from a new file
+        model.<name>.reloadErrors    new file couldn't be loaded
+*/
+
+struct ModelServer : public ServiceBase, public MessageLoop {
+
+    ModelServer(std::shared_ptr<ServiceProxies> proxies,
+                const std::string & serviceName = "modelServer");
+
+    ModelServer(ServiceBase & parent,
+                const std::string & serviceName = "modelServer");
+
+    ~ModelServer();
+
+    /** Periodically checks the model files for changes. */
+    void start(double checkPeriod = 1.0);
+    void shutdown();
+
+    /** Adds or replaces a model described by:
+
+            { "file": "model.cls", "features": [ ... ], "label": 1 }
+
+        where "features" is a FeatureSpec and "label" the column of the
+        classifier's output that is returned as the score.
+    */
+    void addModel(const std::string & name, const Json::Value & config);
+
+    void addModel(const std::string & name,
+                  const std::string & file,
+                  const FeatureSpec & spec,
+                  int label = 1);
+
+    void removeModel(const std::string & name);
+
+    bool hasModel(const std::string & name) const;
+
+    /** Score of each spot of the request. */
+    std::vector<float>
+    score(const std::string & model, const BidRequest & request) const;
+
+    float score(const std::string & model,
+                const BidRequest & request,
+                int spot) const;
+
+    /** Reloads the models whose file changed since they were loaded.
+        Returns the number of models that were swapped.
+    */
+    int checkForUpdates();
+
+private:
+
+    /** Identifies a version of a model file. */
+    struct FileVersion {
+        FileVersion() : mtime(0), size(0) {}
+
+        int64_t mtime;   // ns
+        int64_t size;
+
+        bool operator == (const FileVersion & other) const
+        {
+            return mtime == other.mtime && size == other.size;
+        }
+
+        bool operator != (const FileVersion & other) const
+        {
+            return !operator == (other);
+        }
+
+        static FileVersion get(const std::string & file);
+    };
+
+    struct Model {
+        std::string name;
+        std::string file;
+        FileVersion version;
+        FeatureSpec spec;
+        int label;
+
+        ML::Classifier classifier;
+        ML::Optimization_Info info;
+
+        std::string latencyEvent;
+
+        /** Scores the spots [first, last) of the request into out. */
+        void score(const BidRequest & request, int first, int last,
+                   float * out) const;
+    };
+
+    static std::shared_ptr<const Model>
+    loadModel(const std::string & name,
+              const std::string & file,
+              const FeatureSpec & spec,
+              int label);
+
+    typedef std::map<std::string, std::shared_ptr<const Model> > Models;
+
+    const Model & getModel(const RcuLocked<const Models> & models,
+                           const std::string & name) const;
+
+    GcLock gcLock;
+    RcuProtected<Models> models;
+
+    /** Serializes the writers, which copy the set of models and swap it. */
+    std::mutex writeLock;
+
+    /** Files that failed to load, so that they're not retried until they
+        change again.
+    */
+    std::map<std::string, FileVersion> failedVersions;
+};
+
+} // namespace RTBKIT
@@ -0,0 +1,9 @@
+#------------------------------------------------------------------------------#
+# model_server.mk
+# Copyright (c) 2013 Datacratic.  All rights reserved.
+#
+# In process scoring of bid requests with jml classifiers.
+#------------------------------------------------------------------------------#
+
+$(eval $(call library,model_server,feature_spec.cc model_server.cc,boosting neural bid_request services gc arch utils))
+$(eval $(call include_sub_make,model_server_testing,testing,model_server_testing.mk))
@@ -0,0 +1,212 @@
+/* model_server_test.cc
+   Copyright (c) 2013 Datacratic.  All rights reserved.
+
+   Tests for the model server.
+*/
+
+#define BOOST_TEST_MAIN
+#define BOOST_TEST_DYN_LINK
+
+#include <boost/test/unit_test.hpp>
+#include <sys/time.h>
+#include <atomic>
+#include <fstream>
+#include <thread>
+
+#include "rtbkit/plugins/model_server/model_server.h"
+#include "jml/boosting/decision_tree.h"
+#include "jml/boosting/dense_features.h"
+#include "jml/boosting/feature_info.h"
+#include "jml/utils/smart_ptr_utils.h"
+
+using namespace ML;
+using namespace std;
+using namespace RTBKIT;
+
+
+namespace {
+
+/** Saves a tree that predicts yes with probability small for spots narrower
+    than 500 pixels and large for the others.
+*/
+void saveModel(const std::string & file, float small, float large)
+{
+    Dense_Feature_Space fs;
+    fs.add_feature("LABEL", Feature_Info(BOOLEAN, false, true));
+    Feature width = fs.make_feature("width", REAL);
+    fs.make_feature("seg", REAL);
+
+    std::shared_ptr<Dense_Feature_Space> fsp = make_unowned_sp(fs);
+    std::shared_ptr<Decision_Tree> tree
+        (new Decision_Tree(fsp, fs.features()[0]));
+
+    auto leaf = [&] (float yes)
+        {
+            distribution<float> pred(2);
+            pred[0] = 1.0 - yes;
+            pred[1] = yes;
+            return tree->tree.new_leaf(pred, 1.0);
+        };
+
+    Tree::Node * node = tree->tree.new_node();
+    node->split = Split(width, 500, Split::LESS);
+    node->z = 0.0;
+    node->examples = 1.0;
+    node->pred = distribution<float>(2, 0.5);
+    node->child_true = leaf(small);
+    node->child_false = leaf(large);
+    node->child_missing = leaf(0.5);
+    tree->tree.root = node;
+
+    // Written next to the file and renamed over it, as the server expects.
+    string tmp = file + ".tmp";
+    Classifier(tree).save(tmp);
+
+    // Make sure the modification time changes even on coarse clocks.
+    static int generation = 0;
+    struct timeval times[2];
+    gettimeofday(&times[0], 0);
+    times[0].tv_sec += ++generation * 10;
+    times[1] = times[0];
+    utimes(tmp.c_str(), times);
+
+    BOOST_REQUIRE_EQUAL(rename(tmp.c_str(), file.c_str()), 0);
+}
+
+FeatureSpec spec()
+{
+    Json::Value json = Json::parse(
+            "[ { \"feature\": \"width\", \"extract\": \"spotWidth\" },"
+            "  { \"feature\": \"seg\", \"extract\": \"segment\","
+            "    \"source\": \"prov\", \"segment\": 12 } ]");
+    return FeatureSpec::createFromJson(json);
+}
+
+BidRequest request()
+{
+    BidRequest result;
+    result.imp.resize(2);
+    result.imp[0].formats.push_back(Format(300, 250));
+    result.imp[1].formats.push_back(Format(728, 90));
+    result.segments.addInts("prov", { 3, 12, 40 });
+    return result;
+}
+
+} // file scope
+
+BOOST_AUTO_TEST_CASE( test_feature_spec )
+{
+    FeatureSpec features = spec();
+    BOOST_REQUIRE_EQUAL(features.size(), 2);
+
+    BidRequest br = request();
+    float out[2];
+
+    features.extract(br, 1, out);
+    BOOST_CHECK_EQUAL(out[0], 728);
+    BOOST_CHECK_EQUAL(out[1], 1);
+
+    br.segments.clear();
+    br.imp[1].formats.clear();
+    features.extract(br, 1, out);
+    BOOST_CHECK(std::isnan(out[0]));
+    BOOST_CHECK_EQUAL(out[1], 0);
+
+    BOOST_CHECK_THROW(FeatureSpec::createFromJson(Json::parse(
+            "[ { \"feature\": \"us\", \"extract\": \"country\" } ]")),
+            ML::Exception);
+    BOOST_CHECK_THROW(FeatureSpec::createFromJson(Json::parse(
+            "[ { \"feature\": \"x\", \"extract\": \"unknown\" } ]")),
+            ML::Exception);
+}
+
+BOOST_AUTO_TEST_CASE( test_model_server_reload )
+{
+    string file = "build/x86_64/tmp/model_server_test.cls";
+    saveModel(file, 0.8, 0.3);
+
+    auto proxies = std::make_shared<ServiceProxies>();
+    ModelServer server(proxies);
+    server.addModel("ctr", file, spec());
+
+    BOOST_CHECK(server.hasModel("ctr"));
+    BOOST_CHECK_THROW(server.score("nope", request()), ML::Exception);
+
+    vector<float> scores = server.score("ctr", request());
+    BOOST_REQUIRE_EQUAL(scores.size(), 2);
+    BOOST_CHECK_CLOSE(scores[0], 0.8, 1e-4);
+    BOOST_CHECK_CLOSE(scores[1], 0.3, 1e-4);
+    BOOST_CHECK_CLOSE(server.score("ctr", request(), 1), 0.3, 1e-4);
+
+    BOOST_CHECK_EQUAL(server.checkForUpdates(), 0);
+
+    saveModel(file, 0.1, 0.9);
+    BOOST_CHECK_EQUAL(server.checkForUpdates(), 1);
+
+    scores = server.score("ctr", request());
+    BOOST_CHECK_CLOSE(scores[0], 0.1, 1e-4);
+    BOOST_CHECK_CLOSE(scores[1], 0.9, 1e-4);
+
+    // A broken file keeps the old model and isn't retried until it changes.
+    {
+        ofstream stream(file + ".tmp");
+        stream << "not a model";
+    }
+    BOOST_REQUIRE_EQUAL(rename((file + ".tmp").c_str(), file.c_str()), 0);
+
+    BOOST_CHECK_EQUAL(server.checkForUpdates(), 0);
+    BOOST_CHECK_EQUAL(server.checkForUpdates(), 0);
+    BOOST_CHECK_CLOSE(server.score("ctr", request(), 0), 0.1, 1e-4);
+
+    saveModel(file, 0.8, 0.3);
+    BOOST_CHECK_EQUAL(server.checkForUpdates(), 1);
+    BOOST_CHECK_CLOSE(server.score("ctr", request(), 0), 0.8, 1e-4);
+
+    server.removeModel("ctr");
+    BOOST_CHECK(!server.hasModel("ctr"));
+}
+
+BOOST_AUTO_TEST_CASE( test_model_server_concurrent_reload )
+{
+    string file = "build/x86_64/tmp/model_server_concurrent_test.cls";
+    saveModel(file, 0.8, 0.3);
+
+    auto proxies = std::make_shared<ServiceProxies>();
+    ModelServer server(proxies);
+    server.addModel("ctr", file, spec());
+
+    std::atomic<bool> finished(false);
+    std::atomic<int> errors(0), scored(0);
+
+    auto reader = [&] ()
+        {
+            BidRequest br = request();
+            while (!finished) {
+                vector<float> scores = server.score("ctr", br);
+
+                // Both spots always come from the same model.
+                bool first = fabs(scores[0] - 0.8) < 1e-4
+                    && fabs(scores[1] - 0.3) < 1e-4;
+                bool second = fabs(scores[0] - 0.1) < 1e-4
+                    && fabs(scores[1] - 0.9) < 1e-4;
+                if (!first && !second) ++errors;
+                ++scored;
+            }
+        };
+
+    std::vector<std::thread> readers;
+    for (unsigned i = 0;  i < 4;  ++i)
+        readers.emplace_back(reader);
+
+    for (unsigned i = 0;  i < 20;  ++i) {
+        if (i % 2) saveModel(file, 0.8, 0.3);
+        else saveModel(file, 0.1, 0.9);
+        BOOST_CHECK_EQUAL(server.checkForUpdates(), 1);
+    }
+
+    finished = true;
+    for (auto & thread: readers) thread.join();
+
+    BOOST_CHECK_EQUAL(errors, 0);
+    BOOST_CHECK(scored > 0);
+}
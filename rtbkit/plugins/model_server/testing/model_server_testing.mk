@@ -0,0 +1,8 @@
+#------------------------------------------------------------------------------#
+# model_server_testing.mk
+# Copyright (c) 2013 Datacratic.  All rights reserved.
+#
+# Tests for the model server.
+#------------------------------------------------------------------------------#
+
+$(eval $(call test,model_server_test,model_server boosting bid_request services,boost))
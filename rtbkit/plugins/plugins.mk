@@ -7,3 +7,4 @@ $(eval $(call include_sub_make,bid_request))
 $(eval $(call include_sub_make,bidder_interface))
 $(eval $(call include_sub_make,exchange))
 $(eval $(call include_sub_make,adserver))
+$(eval $(call include_sub_make,model_server))
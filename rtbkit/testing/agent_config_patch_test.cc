@@ -0,0 +1,101 @@
+/* agent_config_patch_test.cc
+   Copyright (c) 2014 Datacratic Inc.  All rights reserved.
+
+   Tests for the agent config patches and the agent config cache.
+*/
+
+#define BOOST_TEST_MAIN
+#define BOOST_TEST_DYN_LINK
+
+#include <boost/test/unit_test.hpp>
+
+#include "rtbkit/core/agent_configuration/agent_config.h"
+#include "jml/arch/exception.h"
+
+using namespace std;
+using namespace RTBKIT;
+
+
+namespace {
+
+Json::Value makeConfig()
+{
+    return Json::parse(R"JSON({
+        "account": [ "hello", "world" ],
+        "bidProbability": 0.5,
+        "urlFilter": { "include": [ "^http://www\\.example\\.com/.*" ] },
+        "creatives": [
+            { "id": 1, "width": 300, "height": 250, "name": "medrec" },
+            { "id": 2, "width": 728, "height": 90, "name": "leaderboard",
+              "languageFilter": { "include": [ "en", "fr" ] } }
+        ]
+    })JSON");
+}
+
+} // namespace anonymous
+
+
+BOOST_AUTO_TEST_CASE( test_diff_and_patch )
+{
+    Json::Value from = makeConfig();
+    BOOST_CHECK_EQUAL(diffAgentConfig(from, from).size(), 0);
+
+    Json::Value to = from;
+    to["bidProbability"] = 0.25;
+    to.removeMember("urlFilter");
+    to["maxInFlight"] = 10;
+
+    Json::Value patch = diffAgentConfig(from, to);
+    BOOST_CHECK_EQUAL(patch.size(), 3);
+    BOOST_CHECK_EQUAL(patchAgentConfig(from, patch), to);
+
+    // Only the changed members go over the wire.
+    to = from;
+    to["bidProbability"] = 0.75;
+    patch = diffAgentConfig(from, to);
+    BOOST_CHECK_EQUAL(patch.size(), 1);
+    BOOST_CHECK_LT(patch.toString().size(), to.toString().size() / 2);
+
+    Json::Value bad = Json::parse(
+            R"JSON([ { "op": "move", "path": "/bidProbability" } ])JSON");
+    BOOST_CHECK_THROW(patchAgentConfig(from, bad), ML::Exception);
+
+    bad = Json::parse(
+            R"JSON([ { "op": "remove", "path": "/creatives/0" } ])JSON");
+    BOOST_CHECK_THROW(patchAgentConfig(from, bad), ML::Exception);
+}
+
+BOOST_AUTO_TEST_CASE( test_cache )
+{
+    AgentConfigCache cache;
+
+    Json::Value json = makeConfig();
+    AgentConfig config = AgentConfig::createFromJson(json, &cache);
+    BOOST_CHECK_EQUAL(cache.hits, 0);
+    BOOST_CHECK_EQUAL(cache.misses, 3);
+
+    // Nothing but the bid probability changed so everything is reused.
+    json["bidProbability"] = 0.25;
+    AgentConfig cached = AgentConfig::createFromJson(json, &cache);
+    BOOST_CHECK_EQUAL(cache.hits, 3);
+    BOOST_CHECK_EQUAL(cache.misses, 3);
+
+    AgentConfig parsed = AgentConfig::createFromJson(json);
+    BOOST_CHECK_EQUAL(cached.toJson(), parsed.toJson());
+    BOOST_CHECK(cached.urlFilter.isIncluded(string("http://www.example.com/")));
+    BOOST_CHECK(!cached.urlFilter.isIncluded(string("http://www.example.org/")));
+
+    // A new creative is the only thing that gets parsed.
+    json["creatives"][2]["id"] = 3;
+    json["creatives"][2]["width"] = 160;
+    json["creatives"][2]["height"] = 600;
+    AgentConfig::createFromJson(json, &cache);
+    BOOST_CHECK_EQUAL(cache.hits, 6);
+    BOOST_CHECK_EQUAL(cache.misses, 4);
+
+    // Entries survive for one generation past the one they were used in.
+    AgentConfigCache small(1);
+    AgentConfig::createFromJson(makeConfig(), &small);
+    AgentConfig::createFromJson(makeConfig(), &small);
+    BOOST_CHECK_EQUAL(small.hits, 3);
+}
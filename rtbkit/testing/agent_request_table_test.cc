@@ -0,0 +1,109 @@
+/** agent_request_table_test.cc                                 -*- C++ -*-
+    Copyright (c) 2013 Datacratic.  All rights reserved.
+
+    Tests for the table of outstanding requests of the bidding agent.
+
+*/
+
+#define BOOST_TEST_MAIN
+#define BOOST_TEST_DYN_LINK
+
+#include "rtbkit/plugins/bidding_agent/agent_request_table.h"
+
+#include <boost/test/unit_test.hpp>
+#include <thread>
+#include <vector>
+#include <atomic>
+
+using namespace std;
+using namespace Datacratic;
+using namespace RTBKIT;
+
+
+BOOST_AUTO_TEST_CASE( test_insert_take_erase )
+{
+    AgentRequestTable table(1.0);
+    Date now = Date::fromSecondsSinceEpoch(1000);
+
+    BOOST_CHECK(table.insert(Id(1), "router1", now));
+    BOOST_CHECK(!table.insert(Id(1), "router2", now));
+    BOOST_CHECK(table.insert(Id(2), "router2", now));
+    BOOST_CHECK_EQUAL(table.size(), 2);
+
+    AgentRequestTable::Request request;
+    BOOST_CHECK(table.take(Id(1), request));
+    BOOST_CHECK_EQUAL(request.fromRouter, "router1");
+    BOOST_CHECK_EQUAL(request.timestamp, now);
+    BOOST_CHECK(!table.take(Id(1), request));
+
+    BOOST_CHECK(table.erase(Id(2)));
+    BOOST_CHECK(!table.erase(Id(2)));
+    BOOST_CHECK_EQUAL(table.size(), 0);
+}
+
+BOOST_AUTO_TEST_CASE( test_expiry )
+{
+    AgentRequestTable table(1.0);
+    Date now = Date::fromSecondsSinceEpoch(1000);
+
+    for (unsigned i = 0;  i < 100;  ++i)
+        table.insert(Id(i), "router", now.plusSeconds(i * 0.01));
+
+    // Answered requests are skipped over by the sweep.
+    table.erase(Id(10));
+
+    BOOST_CHECK_EQUAL(table.expire(now.plusSeconds(0.5)), 0);
+    BOOST_CHECK_EQUAL(table.size(), 99);
+
+    size_t expired = table.expire(now.plusSeconds(1.5));
+    BOOST_CHECK_GE(expired, 45);
+    BOOST_CHECK_LE(expired, 55);
+    BOOST_CHECK_EQUAL(table.size(), 99 - expired);
+
+    AgentRequestTable::Request request;
+    BOOST_CHECK(!table.take(Id(0), request));
+    BOOST_CHECK(table.take(Id(99), request));
+
+    // Falling behind by more than a full turn of the wheel mustn't lose the
+    // requests that were inserted in the meantime.
+    table.insert(Id(1000), "router", now.plusSeconds(100));
+    BOOST_CHECK_EQUAL(table.expire(now.plusSeconds(100)), 98 - expired);
+    BOOST_CHECK_EQUAL(table.size(), 1);
+    BOOST_CHECK_EQUAL(table.expire(now.plusSeconds(101.5)), 1);
+    BOOST_CHECK_EQUAL(table.size(), 0);
+}
+
+BOOST_AUTO_TEST_CASE( test_concurrent_access )
+{
+    AgentRequestTable table;
+    enum { NumThreads = 8, PerThread = 10000 };
+
+    std::atomic<int> taken(0);
+    std::atomic<int> failedInserts(0);
+
+    // Boost.Test assertions can't be made from the worker threads.
+    auto run = [&] (int thread)
+        {
+            for (unsigned i = 0;  i < PerThread;  ++i) {
+                Id id(thread * PerThread + i);
+                if (!table.insert(id, "router")) {
+                    ++failedInserts;
+                    continue;
+                }
+
+                AgentRequestTable::Request request;
+                if (i % 2 && table.take(id, request))
+                    ++taken;
+            }
+        };
+
+    vector<thread> threads;
+    for (unsigned i = 0;  i < NumThreads;  ++i)
+        threads.emplace_back(run, i);
+    for (auto & th : threads)
+        th.join();
+
+    BOOST_CHECK_EQUAL(failedInserts, 0);
+    BOOST_CHECK_EQUAL(taken, NumThreads * PerThread / 2);
+    BOOST_CHECK_EQUAL(table.size(), NumThreads * PerThread / 2);
+}
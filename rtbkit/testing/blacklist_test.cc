@@ -0,0 +1,120 @@
+/* blacklist_test.cc
+   Copyright (c) 2014 Datacratic Inc.  All rights reserved.
+
+   Tests for the blacklist.
+*/
+
+#define BOOST_TEST_MAIN
+#define BOOST_TEST_DYN_LINK
+
+#include <boost/test/unit_test.hpp>
+
+#include "rtbkit/core/agent_configuration/blacklist.h"
+#include "rtbkit/core/agent_configuration/agent_config.h"
+
+using namespace std;
+using namespace Datacratic;
+using namespace RTBKIT;
+
+
+namespace {
+
+AgentConfig makeConfig(const string & account, BlacklistScope scope,
+                       double time)
+{
+    AgentConfig config;
+    config.account = AccountKey(account);
+    config.blacklistType = BL_USER;
+    config.blacklistScope = scope;
+    config.blacklistTime = time;
+    return config;
+}
+
+BidRequest makeRequest(unsigned user)
+{
+    BidRequest request;
+    request.userIds.add(Id(user), ID_EXCHANGE);
+    return request;
+}
+
+} // namespace anonymous
+
+
+BOOST_AUTO_TEST_CASE( test_blacklist_scopes )
+{
+    enum { Users = 10000 };
+
+    Blacklist blacklist;
+    AgentConfig agent = makeConfig("a:b", BL_AGENT, 60);
+    AgentConfig account = makeConfig("a:b", BL_ACCOUNT, 60);
+    AgentConfig other = makeConfig("c:d", BL_ACCOUNT, 60);
+
+    for (unsigned i = 1; i <= Users; ++i)
+        blacklist.add(makeRequest(i), "agent", agent);
+    BOOST_CHECK_EQUAL(blacklist.size(), Users);
+
+    for (unsigned i = 1; i <= Users; ++i) {
+        BidRequest request = makeRequest(i);
+        BOOST_REQUIRE(blacklist.matches(request, "agent", agent));
+        BOOST_REQUIRE(!blacklist.matches(request, "agent2", agent));
+        BOOST_REQUIRE(blacklist.matches(request, "agent2", account));
+        BOOST_REQUIRE(!blacklist.matches(request, "agent3", other));
+    }
+
+    BOOST_CHECK(!blacklist.matches(makeRequest(Users + 1), "agent", agent));
+    BOOST_CHECK(!blacklist.matches(BidRequest(), "agent", agent));
+}
+
+BOOST_AUTO_TEST_CASE( test_blacklist_expiry )
+{
+    enum { Users = 1000 };
+
+    // A small wheel so that the long expiries go around it a few times.
+    Blacklist blacklist(1 << 16, 8);
+    AgentConfig shortConfig = makeConfig("a:b", BL_AGENT, 2);
+    AgentConfig longConfig = makeConfig("a:b", BL_AGENT, 30);
+
+    Date now = Date::now();
+    for (unsigned i = 1; i <= Users; ++i)
+        blacklist.add(makeRequest(i), "agent", i % 2 ? shortConfig : longConfig);
+
+    blacklist.doExpiries(now.plusSeconds(1));
+    BOOST_CHECK_EQUAL(blacklist.size(), Users);
+
+    blacklist.doExpiries(now.plusSeconds(4));
+    BOOST_CHECK_EQUAL(blacklist.size(), Users / 2);
+
+    // Whatever is left in the table after the erases is still found.
+    for (unsigned i = 1; i <= Users; ++i) {
+        BOOST_REQUIRE_EQUAL(
+                blacklist.matches(makeRequest(i), "agent", longConfig),
+                i % 2 == 0);
+    }
+
+    for (unsigned s = 5; s < 29; s += 3)
+        blacklist.doExpiries(now.plusSeconds(s));
+    BOOST_CHECK_EQUAL(blacklist.size(), Users / 2);
+
+    blacklist.doExpiries(now.plusSeconds(32));
+    BOOST_CHECK_EQUAL(blacklist.size(), 0);
+    BOOST_CHECK(!blacklist.matches(makeRequest(2), "agent", longConfig));
+
+    // Users can be blacklisted again once they expired.
+    blacklist.add(makeRequest(2), "agent", longConfig);
+    BOOST_CHECK(blacklist.matches(makeRequest(2), "agent", longConfig));
+}
+
+BOOST_AUTO_TEST_CASE( test_blacklist_sharing )
+{
+    Blacklist blacklist1, blacklist2;
+    blacklist1.onAdd = [&] (const Id & user, const BlacklistInfo::Entry & entry)
+        {
+            blacklist2.add(user, entry);
+        };
+
+    AgentConfig config = makeConfig("a:b", BL_ACCOUNT, 60);
+    blacklist1.add(makeRequest(1), "agent", config);
+
+    BOOST_CHECK_EQUAL(blacklist2.size(), 1);
+    BOOST_CHECK(blacklist2.matches(makeRequest(1), "agent2", config));
+}
@@ -180,6 +180,63 @@ BOOST_AUTO_TEST_CASE(test_snippet)
     }
 }
 
+BOOST_AUTO_TEST_CASE(test_compiled_snippet)
+{
+    const std::string snippet =
+        "<a href='%{bidrequest.site.id}'>%{bidrequest.exchange#upper}"
+        "%{bidrequest.app.id}-%{meta.test.coucou}-%{meta.missing}</a>";
+
+    TestCreativeConfiguration conf("test");
+    conf.addField("snippet",
+                  [](const Json::Value &, Dummy &) { return true; }).snippet();
+
+    Json::Value providerConfig;
+    providerConfig["test"]["snippet"] = snippet;
+    example1.providerConfig = providerConfig;
+    BOOST_CHECK(conf.handleCreativeCompatibility(example1, true).isCompatible);
+
+    RTBKIT::BidRequest bidrequest;
+    bidrequest.exchange = "adx";
+    bidrequest.site.reset(new OpenRTB::Site());
+    bidrequest.site->id = Datacratic::Id("site1");
+    RTBKIT::Auction::Response response;
+    response.meta = "{\"test\":{\"coucou\":\"Test:Meta\"}}";
+
+    TestCreativeConfiguration::Context context{example1, response, bidrequest};
+    BOOST_CHECK_EQUAL(conf.expand(snippet, context),
+                      "<a href='site1'>ADX-Test:Meta-</a>");
+
+    // Snippets that were never compiled are left alone
+    BOOST_CHECK_EQUAL(conf.expand("%{bidrequest.id}", context),
+                      "%{bidrequest.id}");
+}
+
+BOOST_AUTO_TEST_CASE(test_compiled_snippet_unset_location)
+{
+    const std::string snippet =
+        "dma=%{bidrequest.location.dma}&metro=%{bidrequest.location.metro}";
+
+    TestCreativeConfiguration conf("test");
+    conf.addField("snippet",
+                  [](const Json::Value &, Dummy &) { return true; }).snippet();
+
+    Json::Value providerConfig;
+    providerConfig["test"]["snippet"] = snippet;
+    example1.providerConfig = providerConfig;
+    BOOST_CHECK(conf.handleCreativeCompatibility(example1, true).isCompatible);
+
+    RTBKIT::BidRequest bidrequest;
+    RTBKIT::Auction::Response response;
+    TestCreativeConfiguration::Context context{example1, response, bidrequest};
+
+    // dma and metro default to -1, which means they weren't given
+    BOOST_CHECK_EQUAL(conf.expand(snippet, context), "dma=&metro=");
+
+    bidrequest.location.dma = 501;
+    bidrequest.location.metro = 0;
+    BOOST_CHECK_EQUAL(conf.expand(snippet, context), "dma=501&metro=0");
+}
+
 namespace {
 struct MyNiceStruct{};
 
@@ -0,0 +1,111 @@
+/** latency_histogram.cc                                 -*- C++ -*-
+    Copyright (c) 2014 Datacratic.  All rights reserved.
+
+    Implementation of the latency histogram.
+
+*/
+
+#include "latency_histogram.h"
+#include "jml/utils/exc_assert.h"
+
+#include <cmath>
+
+using namespace std;
+
+namespace RTBKIT {
+
+/******************************************************************************/
+/* LATENCY HISTOGRAM                                                          */
+/******************************************************************************/
+
+LatencyHistogram::
+LatencyHistogram(unsigned subBucketBits) :
+    subBucketBits(subBucketBits),
+    subBuckets(uint64_t(1) << subBucketBits),
+    total(0),
+    sum(0.0),
+    minValue(numeric_limits<uint64_t>::max()),
+    maxValue(0)
+{
+    ExcAssertGreater(subBucketBits, 0);
+    ExcAssertLess(subBucketBits, 32);
+}
+
+void
+LatencyHistogram::
+add(const LatencyHistogram& other)
+{
+    ExcAssertEqual(subBucketBits, other.subBucketBits);
+
+    if (other.counts.size() > counts.size())
+        counts.resize(other.counts.size(), 0);
+    for (size_t i = 0; i < other.counts.size(); ++i)
+        counts[i] += other.counts[i];
+
+    total += other.total;
+    sum += other.sum;
+    minValue = std::min(minValue, other.minValue);
+    maxValue = std::max(maxValue, other.maxValue);
+}
+
+void
+LatencyHistogram::
+clear()
+{
+    counts.clear();
+    total = 0;
+    sum = 0.0;
+    minValue = numeric_limits<uint64_t>::max();
+    maxValue = 0;
+}
+
+uint64_t
+LatencyHistogram::
+percentile(double percent) const
+{
+    if (!total) return 0;
+
+    percent = std::min(std::max(percent, 0.0), 100.0);
+    uint64_t target = std::max<uint64_t>(1, ceil(percent / 100.0 * total));
+
+    uint64_t seen = 0;
+    for (size_t i = 0; i < counts.size(); ++i) {
+        seen += counts[i];
+        if (seen >= target) return std::min(highest(i), maxValue);
+    }
+
+    return maxValue;
+}
+
+Json::Value
+LatencyHistogram::
+toJson(bool withBuckets) const
+{
+    Json::Value result;
+
+    result["count"] = Json::UInt(total);
+    result["min"] = Json::UInt(min());
+    result["max"] = Json::UInt(max());
+    result["mean"] = mean();
+    result["p50"] = Json::UInt(percentile(50));
+    result["p90"] = Json::UInt(percentile(90));
+    result["p99"] = Json::UInt(percentile(99));
+    result["p999"] = Json::UInt(percentile(99.9));
+    result["p9999"] = Json::UInt(percentile(99.99));
+
+    if (withBuckets) {
+        Json::Value& buckets = result["buckets"];
+        buckets = Json::Value(Json::arrayValue);
+
+        forEach([&] (uint64_t, uint64_t highest, uint64_t count) {
+                    Json::Value bucket;
+                    bucket[0] = Json::UInt(highest);
+                    bucket[1] = Json::UInt(count);
+                    buckets.append(bucket);
+                });
+    }
+
+    return result;
+}
+
+} // namespace RTBKIT
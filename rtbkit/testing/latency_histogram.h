@@ -0,0 +1,122 @@
+/** latency_histogram.h                                 -*- C++ -*-
+    Copyright (c) 2014 Datacratic.  All rights reserved.
+
+    Log-linear latency histogram in the style of HdrHistogram.
+
+    Values are bucketed by their power of two and then linearly within it so
+    that the relative error of any value read back is bounded by
+    2^-subBucketBits regardless of its magnitude. Recording is a couple of
+    shifts and an increment which makes it cheap enough to sit on the
+    response path of a load generator or a benchmark.
+
+*/
+
+#pragma once
+
+#include "soa/jsoncpp/value.h"
+
+#include <vector>
+#include <cstdint>
+#include <limits>
+
+namespace RTBKIT {
+
+/******************************************************************************/
+/* LATENCY HISTOGRAM                                                          */
+/******************************************************************************/
+
+struct LatencyHistogram
+{
+    /** The default of 7 sub-bucket bits keeps the error under 1%. */
+    LatencyHistogram(unsigned subBucketBits = 7);
+
+    void record(uint64_t value, uint64_t count = 1)
+    {
+        size_t i = index(value);
+        if (i >= counts.size()) counts.resize(i + 1, 0);
+        counts[i] += count;
+
+        total += count;
+        sum += double(value) * count;
+        if (value < minValue) minValue = value;
+        if (value > maxValue) maxValue = value;
+    }
+
+    /** Records a duration given in seconds with a microsecond resolution. */
+    void recordSeconds(double seconds)
+    {
+        record(seconds <= 0.0 ? 0 : uint64_t(seconds * 1000000.0));
+    }
+
+    /** Adds the content of other to this histogram. Both histograms must have
+        the same number of sub-bucket bits.
+    */
+    void add(const LatencyHistogram& other);
+
+    void clear();
+
+    uint64_t count() const { return total; }
+    uint64_t min() const { return total ? minValue : 0; }
+    uint64_t max() const { return maxValue; }
+    double mean() const { return total ? sum / total : 0.0; }
+
+    /** Highest value equivalent to the value at the given percentile which is
+        in the [0, 100] range. Never returns more than max().
+    */
+    uint64_t percentile(double percent) const;
+
+    /** Calls fn(lowest, highest, count) for every non-empty bucket in
+        increasing order of values.
+    */
+    template<typename Fn>
+    void forEach(const Fn& fn) const
+    {
+        for (size_t i = 0; i < counts.size(); ++i) {
+            if (!counts[i]) continue;
+            fn(lowest(i), highest(i), counts[i]);
+        }
+    }
+
+    /** Summary of the histogram with the usual percentiles. The non-empty
+        buckets are also included if withBuckets is true so that reports can be
+        merged after the fact.
+    */
+    Json::Value toJson(bool withBuckets = false) const;
+
+private:
+
+    size_t index(uint64_t value) const
+    {
+        if (value < (subBuckets << 1)) return value;
+
+        unsigned shift = 63 - __builtin_clzll(value) - subBucketBits;
+        return shift * subBuckets + (value >> shift);
+    }
+
+    uint64_t lowest(size_t i) const
+    {
+        if (i < (subBuckets << 1)) return i;
+
+        unsigned shift = i / subBuckets - 1;
+        return uint64_t(i - shift * subBuckets) << shift;
+    }
+
+    uint64_t highest(size_t i) const
+    {
+        if (i < (subBuckets << 1)) return i;
+
+        unsigned shift = i / subBuckets - 1;
+        return lowest(i) + (uint64_t(1) << shift) - 1;
+    }
+
+    unsigned subBucketBits;
+    uint64_t subBuckets;
+
+    std::vector<uint64_t> counts;
+    uint64_t total;
+    double sum;
+    uint64_t minValue;
+    uint64_t maxValue;
+};
+
+} // namespace RTBKIT
@@ -0,0 +1,88 @@
+/* latency_histogram_test.cc
+   Copyright (c) 2014 Datacratic Inc.  All rights reserved.
+
+   Tests for the latency histogram.
+*/
+
+#define BOOST_TEST_MAIN
+#define BOOST_TEST_DYN_LINK
+
+#include <boost/test/unit_test.hpp>
+
+#include "rtbkit/testing/latency_histogram.h"
+
+using namespace std;
+using namespace RTBKIT;
+
+
+BOOST_AUTO_TEST_CASE( test_empty )
+{
+    LatencyHistogram histogram;
+    BOOST_CHECK_EQUAL(histogram.count(), 0);
+    BOOST_CHECK_EQUAL(histogram.min(), 0);
+    BOOST_CHECK_EQUAL(histogram.max(), 0);
+    BOOST_CHECK_EQUAL(histogram.percentile(99), 0);
+}
+
+BOOST_AUTO_TEST_CASE( test_buckets )
+{
+    LatencyHistogram histogram(4);
+
+    // Every bucket is visited exactly once and they tile the values.
+    uint64_t next = 0;
+    for (uint64_t value = 0; value < 100000; ++value)
+        histogram.record(value);
+
+    histogram.forEach([&] (uint64_t lowest, uint64_t highest, uint64_t count) {
+                BOOST_REQUIRE_EQUAL(lowest, next);
+                uint64_t end = std::min<uint64_t>(highest + 1, 100000);
+                BOOST_REQUIRE_EQUAL(count, end - lowest);
+                BOOST_REQUIRE_LE(highest - lowest, lowest / 16);
+                next = highest + 1;
+            });
+
+    BOOST_CHECK_GE(next, 100000);
+    BOOST_CHECK_EQUAL(histogram.count(), 100000);
+    BOOST_CHECK_EQUAL(histogram.min(), 0);
+    BOOST_CHECK_EQUAL(histogram.max(), 99999);
+}
+
+BOOST_AUTO_TEST_CASE( test_percentiles )
+{
+    LatencyHistogram histogram;
+
+    // 1% of the samples stalled for a second.
+    for (unsigned i = 0; i < 9900; ++i) histogram.record(1000);
+    for (unsigned i = 0; i < 100; ++i) histogram.record(1000000);
+
+    BOOST_CHECK_CLOSE(double(histogram.percentile(50)), 1000.0, 1.0);
+    BOOST_CHECK_CLOSE(double(histogram.percentile(99)), 1000.0, 1.0);
+    BOOST_CHECK_EQUAL(histogram.percentile(99.9), 1000000);
+    BOOST_CHECK_EQUAL(histogram.percentile(100), 1000000);
+    BOOST_CHECK_CLOSE(histogram.mean(), 10990.0, 1.0);
+
+    for (uint64_t value = 1; value < (1ULL << 40); value *= 3) {
+        LatencyHistogram single;
+        single.record(value);
+        BOOST_REQUIRE_EQUAL(single.percentile(50), value);
+    }
+}
+
+BOOST_AUTO_TEST_CASE( test_add )
+{
+    LatencyHistogram a, b, both;
+    for (uint64_t value = 1; value < 1000000; value += 997) {
+        (value % 2 ? a : b).record(value);
+        both.record(value);
+    }
+
+    a.add(b);
+    BOOST_CHECK_EQUAL(a.count(), both.count());
+    BOOST_CHECK_EQUAL(a.min(), both.min());
+    BOOST_CHECK_EQUAL(a.max(), both.max());
+    BOOST_CHECK(a.toJson(true) == both.toJson(true));
+
+    Json::Value json = a.toJson(true);
+    BOOST_CHECK_EQUAL(json["count"].asUInt(), both.count());
+    BOOST_CHECK_EQUAL(json["p99"].asUInt(), both.percentile(99));
+}
@@ -0,0 +1,354 @@
+/** load_generator.cc                                 -*- C++ -*-
+    Copyright (c) 2014 Datacratic.  All rights reserved.
+
+    Implementation of the open-loop load generator.
+
+*/
+
+#include "load_generator.h"
+#include "rtbkit/plugins/exchange/http_auction_handler.h"
+#include "soa/service/http_header.h"
+#include "jml/utils/filter_streams.h"
+#include "jml/utils/exc_check.h"
+#include "jml/arch/timers.h"
+
+#include <sched.h>
+
+using namespace std;
+using namespace ML;
+using namespace Datacratic;
+
+namespace RTBKIT {
+
+namespace {
+
+/** Sleeps until the given date and spins for the last millisecond to keep the
+    send times accurate.
+ */
+void waitUntil(Date when)
+{
+    for (;;) {
+        double left = when.secondsSince(Date::now());
+        if (left <= 0.0) return;
+
+        if (left > 0.002) ML::sleep(left - 0.001);
+        else sched_yield();
+    }
+}
+
+} // namespace anonymous
+
+
+/******************************************************************************/
+/* EXCHANGE                                                                   */
+/******************************************************************************/
+
+void
+LoadGenerator::Exchange::
+loadRequests(const string& filename, const string& format)
+{
+    size_t before = requests.size();
+
+    if (format == "lines") {
+        filter_istream stream(filename);
+
+        string line;
+        while (getline(stream, line)) {
+            if (line.empty()) continue;
+
+            Request request;
+            request.body = std::move(line);
+            requests.push_back(std::move(request));
+        }
+    }
+
+    else if (format == "capture") {
+        HttpAuctionLogger::parse(filename, [&] (const string& raw) {
+                    HttpHeader header;
+                    header.parse(raw);
+
+                    Request request;
+                    request.body = header.knownData;
+                    request.contentType = header.contentType;
+
+                    // The client takes care of the connection level headers.
+                    for (const auto& entry : header.headers) {
+                        if (entry.first == "host") continue;
+                        if (entry.first == "connection") continue;
+                        if (entry.first == "expect") continue;
+                        request.headers.push_back(entry);
+                    }
+
+                    requests.push_back(std::move(request));
+                });
+    }
+
+    else throw ML::Exception("unknown request format '%s'", format.c_str());
+
+    ExcCheck(requests.size() > before, "no requests found in " + filename);
+}
+
+
+/******************************************************************************/
+/* LOAD GENERATOR                                                             */
+/******************************************************************************/
+
+LoadGenerator::
+LoadGenerator() :
+    warmup(0),
+    drain(1.0),
+    inFlight(0),
+    shutdown(false),
+    elapsed(0),
+    unanswered(0)
+{}
+
+LoadGenerator::
+~LoadGenerator()
+{
+    loop.shutdown();
+}
+
+void
+LoadGenerator::
+init(const Json::Value& config)
+{
+    const Json::Value& exchangesJson = config["exchanges"];
+    for (auto it = exchangesJson.begin(), end = exchangesJson.end();
+         it != end; ++it)
+    {
+        const Json::Value& json = *it;
+
+        Exchange exchange;
+        exchange.name = json.get("name", "exchange").asString();
+        exchange.url = json["url"].asString();
+        exchange.resource = json.get("resource", exchange.resource).asString();
+        exchange.connections =
+            json.get("connections", exchange.connections).asInt();
+        exchange.weight = json.get("weight", exchange.weight).asDouble();
+        exchange.timeout = json.get("timeout", exchange.timeout).asDouble();
+        exchange.contentType = json.get("contentType", "").asString();
+
+        const Json::Value& headers = json["headers"];
+        for (auto jt = headers.begin(), end = headers.end(); jt != end; ++jt)
+            exchange.headers.emplace_back(jt.memberName(), jt->asString());
+
+        exchange.loadRequests(
+                json["requests"].asString(),
+                json.get("format", "lines").asString());
+
+        addExchange(std::move(exchange));
+    }
+
+    const Json::Value& scheduleJson = config["schedule"];
+    for (auto it = scheduleJson.begin(), end = scheduleJson.end();
+         it != end; ++it)
+    {
+        const Json::Value& json = *it;
+        addPhase(Phase(
+                        json["qps"].asDouble(),
+                        json["duration"].asDouble(),
+                        json.get("to", -1).asDouble()));
+    }
+
+    warmup = config.get("warmup", warmup).asDouble();
+    drain = config.get("drain", drain).asDouble();
+}
+
+void
+LoadGenerator::
+addExchange(Exchange exchange)
+{
+    ExcCheck(!exchange.url.empty(), "exchange has no url");
+    ExcCheck(!exchange.requests.empty(), "exchange has no requests");
+    ExcCheckGreater(exchange.weight, 0.0, "exchange weight must be positive");
+
+    if (exchange.contentType.empty())
+        exchange.contentType = "application/json";
+
+    // Defaults for the requests that didn't come with their own.
+    for (auto& request : exchange.requests) {
+        if (request.contentType.empty())
+            request.contentType = exchange.contentType;
+        if (request.headers.empty())
+            request.headers = exchange.headers;
+    }
+
+    exchanges.push_back(std::move(exchange));
+}
+
+void
+LoadGenerator::
+run()
+{
+    ExcCheck(!exchanges.empty(), "no exchanges to send to");
+    ExcCheck(!schedule.empty(), "no schedule to follow");
+    ExcCheck(clients.empty(), "load generator can only run once");
+
+    for (const auto& exchange : exchanges) {
+        auto client = make_shared<HttpClient>(
+                exchange.url, exchange.connections);
+        loop.addSource("LoadGenerator::" + exchange.name, client);
+        clients.push_back(client);
+    }
+
+    cursors.assign(exchanges.size(), 0);
+    results.assign(schedule.size(), vector<Results>(exchanges.size()));
+
+    loop.start();
+
+    // Smooth weighted round robin which spreads the requests of every
+    // exchange evenly over time instead of sending them in bursts.
+    double totalWeight = 0.0;
+    for (const auto& exchange : exchanges) totalWeight += exchange.weight;
+    vector<double> credits(exchanges.size(), 0.0);
+
+    auto nextExchange = [&] {
+        size_t best = 0;
+        for (size_t i = 0; i < exchanges.size(); ++i) {
+            credits[i] += exchanges[i].weight;
+            if (credits[i] > credits[best]) best = i;
+        }
+        credits[best] -= totalWeight;
+        return best;
+    };
+
+    Date start = Date::now();
+    Date phaseStart = start;
+
+    for (size_t phase = 0; phase < schedule.size() && !shutdown; ++phase) {
+        const Phase& current = schedule[phase];
+        double offset = 0.0;
+
+        // The send times only depend on the schedule so a late send never
+        // pushes back the ones that follow it.
+        while (offset < current.duration && !shutdown) {
+            double rate = current.rateAt(offset);
+            if (rate <= 0.0) {
+                waitUntil(phaseStart.plusSeconds(current.duration));
+                break;
+            }
+
+            Date scheduled = phaseStart.plusSeconds(offset);
+            waitUntil(scheduled);
+            lag.recordSeconds(Date::now().secondsSince(scheduled));
+
+            bool record = scheduled.secondsSince(start) >= warmup;
+            send(phase, nextExchange(), scheduled, record);
+
+            offset += 1.0 / rate;
+        }
+
+        phaseStart = phaseStart.plusSeconds(current.duration);
+    }
+
+    elapsed = Date::now().secondsSince(start);
+
+    Date deadline = Date::now().plusSeconds(drain);
+    while (inFlight && Date::now() < deadline)
+        ML::sleep(0.01);
+
+    unanswered = inFlight;
+    loop.shutdown();
+}
+
+void
+LoadGenerator::
+send(size_t phase, size_t exchange, Date scheduled, bool record)
+{
+    const Exchange& target = exchanges[exchange];
+    const auto& request =
+        target.requests[cursors[exchange]++ % target.requests.size()];
+
+    auto onDone = [=] (const HttpRequest&, HttpClientError error, int status,
+                       string&&, string&& body)
+        {
+            onResponse(phase, exchange, scheduled, record, error, status, body);
+        };
+
+    ++inFlight;
+    results[phase][exchange].sent++;
+
+    clients[exchange]->post(
+            target.resource,
+            make_shared<HttpClientSimpleCallbacks>(onDone),
+            HttpRequest::Content(request.body, request.contentType),
+            RestParams(), request.headers, target.timeout);
+}
+
+void
+LoadGenerator::
+onResponse(size_t phase, size_t exchange, Date scheduled, bool record,
+           HttpClientError error, int status, const string& body)
+{
+    double latency = Date::now().secondsSince(scheduled);
+    --inFlight;
+
+    if (!record) return;
+
+    string type;
+    if (error == HttpClientError::Timeout) type = "timeout";
+    else if (error != HttpClientError::None) type = "error";
+    else if (status == 204 || (status == 200 && body.empty())) type = "noBid";
+    else if (status == 200) type = "bid";
+    else type = ML::format("status%d", status);
+
+    results[phase][exchange].responses[type].recordSeconds(latency);
+}
+
+Json::Value
+LoadGenerator::
+report(bool withBuckets) const
+{
+    Json::Value result;
+
+    result["elapsed"] = elapsed;
+    result["warmup"] = warmup;
+    result["unanswered"] = Json::UInt(unanswered);
+    result["lag"] = lag.toJson(withBuckets);
+
+    vector<Results> totals(exchanges.size());
+
+    for (size_t phase = 0; phase < results.size(); ++phase) {
+        const Phase& current = schedule[phase];
+
+        Json::Value& phaseJson = result["phases"][unsigned(phase)];
+        phaseJson["qps"] = current.qps;
+        phaseJson["endQps"] = current.endQps;
+        phaseJson["duration"] = current.duration;
+
+        uint64_t sent = 0;
+
+        for (size_t i = 0; i < exchanges.size(); ++i) {
+            const Results& entry = results[phase][i];
+            sent += entry.sent;
+            totals[i].sent += entry.sent;
+
+            Json::Value& json = phaseJson["exchanges"][exchanges[i].name];
+            json["sent"] = Json::UInt(entry.sent);
+
+            for (const auto& response : entry.responses) {
+                json["responses"][response.first] =
+                    response.second.toJson(withBuckets);
+                totals[i].responses[response.first].add(response.second);
+            }
+        }
+
+        phaseJson["sent"] = Json::UInt(sent);
+        phaseJson["achievedQps"] =
+            current.duration > 0 ? sent / current.duration : 0.0;
+    }
+
+    for (size_t i = 0; i < exchanges.size(); ++i) {
+        Json::Value& json = result["exchanges"][exchanges[i].name];
+        json["sent"] = Json::UInt(totals[i].sent);
+
+        for (const auto& response : totals[i].responses)
+            json["responses"][response.first] =
+                response.second.toJson(withBuckets);
+    }
+
+    return result;
+}
+
+} // namespace RTBKIT
@@ -0,0 +1,174 @@
+/** load_generator.h                                 -*- C++ -*-
+    Copyright (c) 2014 Datacratic.  All rights reserved.
+
+    Open-loop load generator for exchange connectors.
+
+    Unlike the MockExchange workers, which wait for a response before sending
+    the next request, requests are sent on a fixed schedule no matter how the
+    other side is doing. Latencies are measured from the time at which each
+    request was meant to go out rather than from when it actually did so that
+    a stall in the router shows up as the queueing it causes instead of as a
+    gap in the samples (coordinated omission).
+
+*/
+
+#pragma once
+
+#include "latency_histogram.h"
+#include "soa/service/message_loop.h"
+#include "soa/service/http_client.h"
+#include "soa/types/date.h"
+
+#include <atomic>
+#include <map>
+#include <memory>
+#include <string>
+#include <vector>
+
+namespace RTBKIT {
+
+/******************************************************************************/
+/* LOAD GENERATOR                                                             */
+/******************************************************************************/
+
+struct LoadGenerator
+{
+    /** Bid requests to replay to a single exchange endpoint.
+
+        Requests are either read one per line from "requests" (the format of
+        20000-datacratic-auctions.xz) or, with the "capture" format, parsed
+        out of HttpAuctionLogger captures in which case the captured headers
+        are replayed along with the body.
+     */
+    struct Exchange
+    {
+        Exchange() :
+            resource("/"), connections(64), weight(1.0), timeout(-1)
+        {}
+
+        void loadRequests(const std::string& filename,
+                          const std::string& format = "lines");
+
+        std::string name;
+        std::string url;          ///< scheme://host:port of the connector
+        std::string resource;
+        int connections;          ///< keep-alive connections to keep open
+        double weight;            ///< share of the total rate
+        double timeout;           ///< seconds, -1 to wait forever
+
+        /** Defaults for the requests that don't come with their own. */
+        Datacratic::RestParams headers;
+        std::string contentType;
+
+        struct Request
+        {
+            std::string body;
+            std::string contentType;
+            Datacratic::RestParams headers;
+        };
+        std::vector<Request> requests;
+    };
+
+    /** Section of the schedule during which the rate goes linearly from qps
+        to endQps.
+     */
+    struct Phase
+    {
+        Phase(double qps = 0, double duration = 0, double endQps = -1) :
+            qps(qps), endQps(endQps < 0 ? qps : endQps), duration(duration)
+        {}
+
+        double rateAt(double elapsed) const
+        {
+            return qps + (endQps - qps) * elapsed / duration;
+        }
+
+        double qps;
+        double endQps;
+        double duration;
+    };
+
+    LoadGenerator();
+    ~LoadGenerator();
+
+    /** Configuration of the form:
+
+        {
+            "exchanges": [ {
+                "name": "openrtb", "url": "http://localhost:12339",
+                "resource": "/auctions", "requests": "file.xz",
+                "format": "lines", "connections": 64, "weight": 1,
+                "timeout": 0.1, "headers": { "x-openrtb-version": "2.1" }
+            } ],
+            "schedule": [ { "qps": 1000, "to": 5000, "duration": 60 } ],
+            "warmup": 5, "drain": 2
+        }
+     */
+    void init(const Json::Value& config);
+
+    void addExchange(Exchange exchange);
+    void addPhase(Phase phase) { schedule.push_back(phase); }
+
+    /** Runs the schedule to completion and waits up to drain seconds for the
+        requests still in flight. Can only be called once.
+     */
+    void run();
+
+    /** Stops the schedule early; safe to call from any thread. */
+    void stop() { shutdown = true; }
+
+    /** Machine readable report of the run where latencies are given in
+        microseconds for every phase, exchange and response type. The non-empty
+        buckets of the histograms are included if withBuckets is true.
+     */
+    Json::Value report(bool withBuckets = false) const;
+
+    std::vector<Exchange> exchanges;
+    std::vector<Phase> schedule;
+
+    /** Responses to requests sent during the first warmup seconds are not
+        recorded.
+     */
+    double warmup;
+    double drain;
+
+private:
+
+    /** Time spent by the pacer past the scheduled send times. If this gets
+        large then the generator itself can't keep up with the schedule and
+        the results are meaningless.
+     */
+    LatencyHistogram lag;
+
+    struct Results
+    {
+        Results() : sent(0) {}
+
+        uint64_t sent;
+        std::map<std::string, LatencyHistogram> responses;
+    };
+
+    /** Indexed by phase then by exchange. The sent counts are only touched
+        by the pacer and the histograms by the message loop thread.
+     */
+    std::vector< std::vector<Results> > results;
+
+    void send(size_t phase, size_t exchange, Datacratic::Date scheduled,
+              bool record);
+
+    void onResponse(size_t phase, size_t exchange,
+                    Datacratic::Date scheduled, bool record,
+                    Datacratic::HttpClientError error, int status,
+                    const std::string& body);
+
+    Datacratic::MessageLoop loop;
+    std::vector< std::shared_ptr<Datacratic::HttpClient> > clients;
+    std::vector<size_t> cursors;
+
+    std::atomic<uint64_t> inFlight;
+    std::atomic<bool> shutdown;
+    double elapsed;
+    uint64_t unanswered;
+};
+
+} // namespace RTBKIT
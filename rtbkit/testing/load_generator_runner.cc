@@ -0,0 +1,89 @@
+/* load_generator_runner.cc
+   Copyright (c) 2014 Datacratic.  All rights reserved.
+
+   Open-loop load generator runner
+*/
+
+#include "load_generator.h"
+#include "jml/utils/file_functions.h"
+#include "jml/utils/filter_streams.h"
+#include "soa/utils/print_utils.h"
+#include "soa/jsoncpp/json.h"
+
+#include <boost/program_options/options_description.hpp>
+#include <boost/program_options/parsers.hpp>
+#include <boost/program_options/variables_map.hpp>
+
+#include <csignal>
+
+using namespace std;
+using namespace Datacratic;
+
+namespace {
+
+RTBKIT::LoadGenerator * generator = nullptr;
+
+void onSignal(int)
+{
+    if (generator) generator->stop();
+}
+
+} // namespace anonymous
+
+int main(int argc, char ** argv)
+{
+    using namespace boost::program_options;
+
+    string configuration = "rtbkit/examples/load-generator-config.json";
+    string output;
+    bool buckets = false;
+
+    options_description options("Load Generator");
+    options.add_options()
+        ("configuration,f", value(&configuration), "load generator configuration file")
+        ("output,o", value(&output), "file to write the json report to (default stdout)")
+        ("buckets,b", bool_switch(&buckets), "include the histogram buckets in the report")
+        ("help,h", "Print this message");
+
+    variables_map vm;
+    store(command_line_parser(argc, argv) .options(options) .run(), vm);
+    notify(vm);
+
+    if (vm.count("help")) {
+        cerr << options << endl;
+        exit(1);
+    }
+
+    ML::File_Read_Buffer buf(configuration);
+    Json::Value config = Json::parse(std::string(buf.start(), buf.end()));
+
+    RTBKIT::LoadGenerator loadGenerator;
+    loadGenerator.init(config);
+
+    for (const auto& exchange : loadGenerator.exchanges) {
+        cerr << exchange.name << ": " << printValue(exchange.requests.size())
+            << " requests to " << exchange.url << exchange.resource << endl;
+    }
+
+    generator = &loadGenerator;
+    signal(SIGINT, onSignal);
+    signal(SIGTERM, onSignal);
+
+    loadGenerator.run();
+
+    generator = nullptr;
+
+    Json::Value report = loadGenerator.report(buckets);
+    report["configuration"] = config;
+
+    if (output.empty()) cout << report.toStyledString();
+    else {
+        ML::filter_ostream stream(output);
+        stream << report.toStyledString();
+    }
+
+    cerr << "lag p99: " << report["lag"]["p99"].asUInt() << "us, unanswered: "
+        << report["unanswered"].asUInt() << endl;
+
+    return 0;
+}
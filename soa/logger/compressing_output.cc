@@ -6,7 +6,14 @@
 */
 
 #include "compressing_output.h"
+#include "indexed_log.h"
 #include "jml/utils/parse_context.h"
+#include "jml/utils/exc_assert.h"
+
+#include <boost/thread/mutex.hpp>
+#include <boost/thread/condition_variable.hpp>
+#include <deque>
+#include <exception>
 
 
 using namespace std;
@@ -55,8 +62,8 @@ WorkerThreadOutput::
 stopWorkerThread()
 {
     if (logThread) {
-        shutdown_ = 1;
-
+        // The thread stops once it gets to the message, so that everything
+        // that was logged before makes it out.
         Message message;
         message.type = MT_SHUTDOWN;
         ringBuffer.push(message);
@@ -143,8 +150,15 @@ runLogThread()
         bool found = ringBuffer.tryPop(msg, 0.5);
         duty.notifyAfterSleep();
 
-        if (!found)
+        if (!found) {
+            try {
+                implementIdle();
+            } catch (const std::exception & exc) {
+                cerr << "warning: log idle operation threw exception: "
+                     << exc.what() << endl;
+            }
             continue;
+        }
 
         switch (msg.type) {
 
@@ -166,6 +180,7 @@ runLogThread()
             break;
 
         case MT_SHUTDOWN:
+            shutdown_ = 1;
             break;
             
         default:
@@ -175,6 +190,276 @@ runLogThread()
 }
 
 
+void
+WorkerThreadOutput::
+implementIdle()
+{
+}
+
+
+/*****************************************************************************/
+/* PARALLEL COMPRESSOR                                                       */
+/*****************************************************************************/
+
+/** Compresses blocks of the log as independent streams in a pool of
+    threads.  Blocks are handed out in order and written to the sink in the
+    same order from the log thread, which is the only one to touch the sink.
+    With no threads, the blocks are compressed in the log thread.
+
+    When indexed, the position, time range and channels of each block are
+    recorded and written as a LogBlockIndex footer when finished.
+*/
+
+struct CompressingOutput::ParallelCompressor {
+
+    typedef Compressor::OnData OnData;
+
+    ParallelCompressor(const std::string & compression,
+                       int compressionLevel,
+                       int numThreads,
+                       bool indexed,
+                       const OnData & onData)
+        : compression(compression),
+          compressionLevel(compressionLevel),
+          onData(onData),
+          maxInFlight(std::max(2 * numThreads, 1)),
+          blockStarted(0.0),
+          indexed(indexed),
+          blocksWritten(0),
+          shutdown(false)
+    {
+        // Fail now rather than in a worker thread if the scheme is unknown.
+        std::unique_ptr<Compressor> check
+            (Compressor::create(compression, compressionLevel));
+
+        index.compression = compression == "gz" ? "gzip" : compression;
+        if (indexed && index.compression != "gzip"
+            && index.compression != "lz4")
+            throw ML::Exception("log block index needs gzip or lz4 "
+                                "compression, not '%s'", compression.c_str());
+
+        for (unsigned i = 0;  i < numThreads;  ++i)
+            workers.emplace_back(new boost::thread([=] () { this->runWorker(); }));
+    }
+
+    ~ParallelCompressor()
+    {
+        {
+            boost::unique_lock<boost::mutex> guard(lock);
+            shutdown = true;
+        }
+        workAvailable.notify_all();
+
+        for (auto & worker: workers)
+            worker->join();
+    }
+
+    struct Block {
+        Block() : done(false) {}
+
+        std::string input;
+        std::string output;
+        bool done;
+        std::exception_ptr error;
+        LogBlockIndex::Block entry;
+    };
+
+    void append(const std::string & channel, const char * data, size_t len)
+    {
+        double now = ML::wall_time();
+
+        if (current.empty()) {
+            blockStarted = now;
+            currentEntry = LogBlockIndex::Block();
+            currentEntry.firstTime = now;
+        }
+
+        current.append(data, len);
+
+        currentEntry.lastTime = now;
+        currentEntry.rawSize += len;
+        currentEntry.numMessages += 1;
+        if (indexed)
+            currentEntry.channels
+                |= LogBlockIndex::channelBit(index.addChannel(channel));
+    }
+
+    size_t blockSize() const { return current.size(); }
+
+    double blockAge() const
+    {
+        return current.empty() ? 0.0 : ML::wall_time() - blockStarted;
+    }
+
+    /** Hands the current block to the workers. */
+    void submit()
+    {
+        if (current.empty()) return;
+
+        // Don't let the log run too far ahead of the sink.
+        while (inFlight.size() >= maxInFlight)
+            writeDone(true);
+
+        std::shared_ptr<Block> block(new Block());
+        block->input.swap(current);
+        block->entry = currentEntry;
+        inFlight.push_back(block);
+
+        if (workers.empty()) {
+            compress(*block);
+            block->done = true;
+            return;
+        }
+
+        {
+            boost::unique_lock<boost::mutex> guard(lock);
+            toCompress.push_back(block);
+        }
+        workAvailable.notify_one();
+    }
+
+    /** Writes the blocks at the head of the queue that have been compressed,
+        waiting for the first one if wait is set.
+    */
+    void writeDone(bool wait)
+    {
+        while (!inFlight.empty()) {
+            std::shared_ptr<Block> block = inFlight.front();
+
+            {
+                boost::unique_lock<boost::mutex> guard(lock);
+                if (!block->done && !wait) return;
+                while (!block->done)
+                    blockDone.wait(guard);
+            }
+
+            inFlight.pop_front();
+            wait = false;
+
+            if (block->error)
+                std::rethrow_exception(block->error);
+
+            write(block->output);
+            ++blocksWritten;
+
+            if (indexed) {
+                LogBlockIndex::Block & entry = block->entry;
+                entry.offset = index.size();
+                entry.compressedSize = block->output.size();
+                index.blocks.push_back(entry);
+            }
+        }
+    }
+
+    /** Submits what's left and writes everything out. */
+    void flush()
+    {
+        submit();
+        while (!inFlight.empty())
+            writeDone(true);
+    }
+
+    /** Flushes and writes the index; nothing can be written afterwards. */
+    void finish()
+    {
+        flush();
+
+        // Like the single stream compressors, leave behind a valid (empty)
+        // stream when nothing was logged rather than a file holding only
+        // the footer or nothing at all.
+        if (blocksWritten == 0) {
+            Block empty;
+            compress(empty);
+            if (empty.error)
+                std::rethrow_exception(empty.error);
+            write(empty.output);
+        }
+
+        if (indexed)
+            write(index.footer());
+    }
+
+    void write(const std::string & output)
+    {
+        Compressor::OnData write = onData;
+        for (size_t done = 0;  done < output.size();)
+            done += write(output.c_str() + done, output.size() - done);
+    }
+
+    /** Compresses the block into a self contained stream. */
+    void compress(Block & block)
+    {
+        try {
+            auto append = [&] (const char * data, size_t len) -> size_t
+                {
+                    block.output.append(data, len);
+                    return len;
+                };
+
+            std::unique_ptr<Compressor> compressor
+                (Compressor::create(compression, compressionLevel));
+            block.output.reserve(block.input.size() / 2);
+            compressor->compress(block.input.c_str(),
+                                 block.input.size(), append);
+            compressor->finish(append);
+        } catch (...) {
+            block.error = std::current_exception();
+        }
+
+        std::string().swap(block.input);
+    }
+
+    void runWorker()
+    {
+        for (;;) {
+            std::shared_ptr<Block> block;
+
+            {
+                boost::unique_lock<boost::mutex> guard(lock);
+                while (toCompress.empty() && !shutdown)
+                    workAvailable.wait(guard);
+                if (toCompress.empty()) return;
+
+                block = toCompress.front();
+                toCompress.pop_front();
+            }
+
+            compress(*block);
+
+            {
+                boost::unique_lock<boost::mutex> guard(lock);
+                block->done = true;
+            }
+            blockDone.notify_all();
+        }
+    }
+
+    std::string compression;
+    int compressionLevel;
+    OnData onData;
+    size_t maxInFlight;
+
+    std::string current;
+    double blockStarted;
+    LogBlockIndex::Block currentEntry;
+
+    bool indexed;
+    LogBlockIndex index;
+    size_t blocksWritten;
+
+    /// Blocks not yet written, in log order; only touched by the log thread
+    std::deque<std::shared_ptr<Block> > inFlight;
+
+    boost::mutex lock;
+    boost::condition_variable workAvailable;
+    boost::condition_variable blockDone;
+    std::deque<std::shared_ptr<Block> > toCompress;
+    bool shutdown;
+
+    std::vector<std::unique_ptr<boost::thread> > workers;
+};
+
+
 /*****************************************************************************/
 /* COMPRESSING OUTPUT                                                        */
 /*****************************************************************************/
@@ -187,7 +472,11 @@ CompressingOutput::
 CompressingOutput(size_t ringBufferSize,
                   Compressor::FlushLevel flushLevel)
     : WorkerThreadOutput(ringBufferSize),
-      compressorFlushLevel(flushLevel)
+      compressorFlushLevel(flushLevel),
+      compressionThreads(0),
+      compressionBlockSize(1024 * 1024),
+      maxBlockAge(1.0),
+      blockIndex(false)
 {
 }
 
@@ -202,10 +491,9 @@ open(std::shared_ptr<Sink> sink,
      const std::string & compression,
      int compressionLevel)
 {
-    if (compressor)
+    if (compressor || parallelCompressor)
         throw ML::Exception("can't open compressor without closing the "
                             "previous one");
-    compressor.reset(Compressor::create(compression, compressionLevel));
 
     this->sink = sink;
 
@@ -213,24 +501,56 @@ open(std::shared_ptr<Sink> sink,
                        sink,
                        std::placeholders::_1,
                        std::placeholders::_2);
+
+    if (compressionThreads > 0 || blockIndex)
+        parallelCompressor.reset
+            (new ParallelCompressor(compression, compressionLevel,
+                                    compressionThreads, blockIndex, onData));
+    else compressor.reset(Compressor::create(compression, compressionLevel));
 }
 
 void
 CompressingOutput::
 closeCompressor()
 {
+    if (parallelCompressor) {
+        parallelCompressor->finish();
+        parallelCompressor.reset();
+    }
+
     if (!compressor)
         return;
     compressor->finish(onData);
     compressor.reset();
 }
 
+void
+CompressingOutput::
+setCompressionThreads(int numThreads,
+                      size_t blockSize,
+                      double maxBlockAge)
+{
+    ExcAssertGreaterEqual(numThreads, 0);
+    ExcAssertGreater(blockSize, 0);
+
+    this->compressionThreads = numThreads;
+    this->compressionBlockSize = blockSize;
+    this->maxBlockAge = maxBlockAge;
+}
+
+void
+CompressingOutput::
+setBlockIndex(bool blockIndex)
+{
+    this->blockIndex = blockIndex;
+}
+
 void
 CompressingOutput::
 implementLogMessage(const std::string & channel,
                     const std::string & message)
 {
-    if (!compressor)
+    if (!compressor && !parallelCompressor)
         throw ML::Exception("implementLogMessage without compressor");
 
     if (onFileWrite) 
@@ -242,6 +562,18 @@ implementLogMessage(const std::string & channel,
     memcpy(buf + channel.size() + 1, message.c_str(), message.size());
     buf[channel.size() + message.size() + 1] = '\n';
 
+    if (parallelCompressor) {
+        ParallelCompressor & parallel = *parallelCompressor;
+
+        parallel.append(channel, buf, channel.size() + message.size() + 2);
+        if (parallel.blockSize() >= compressionBlockSize
+            || parallel.blockAge() >= maxBlockAge)
+            parallel.submit();
+
+        parallel.writeDone(false);
+        return;
+    }
+
     compressor->compress(buf, channel.size() + message.size() + 2,
                          onData);
 
@@ -249,4 +581,14 @@ implementLogMessage(const std::string & channel,
     compressor->flush(compressorFlushLevel, onData);
 }
 
+void
+CompressingOutput::
+implementIdle()
+{
+    // Nothing is coming in, so it's a good time to get what we have to the
+    // sink.
+    if (parallelCompressor)
+        parallelCompressor->flush();
+}
+
 } // namespace Datacratic
@@ -73,6 +73,9 @@ protected:
     virtual void implementLogMessage(const std::string & channel,
                                      const std::string & message) = 0;
 
+    /** Called from the worker thread when no message came in for a while. */
+    virtual void implementIdle();
+
     /// Thread to do the logging
     boost::scoped_ptr<boost::thread> logThread;
 
@@ -130,6 +133,32 @@ struct CompressingOutput : public WorkerThreadOutput {
 
     void closeCompressor();
 
+    /** Compress with the given number of threads instead of in the log
+        thread.  The log is cut into blocks of about blockSize bytes that
+        are compressed as independent streams (a gzip member or an lz4 frame
+        each) and written out in order, the same way that pigz does it, so
+        that gunzip and lz4 read the file as a single stream.
+
+        A block is also cut when it has been open for maxBlockAge seconds or
+        when the log goes idle, which bounds how long a message waits before
+        it makes it to the sink.
+
+        Takes effect on the next open(); 0 threads compresses serially.
+    */
+    void setCompressionThreads(int numThreads,
+                               size_t blockSize = 1024 * 1024,
+                               double maxBlockAge = 1.0);
+
+    /** Write gzip or lz4 files as independently compressed blocks with an
+        index of where each block is, when it was written and which
+        channels it holds, so that IndexedLogReader can replay part of the
+        file without decompressing all of it.  The blocks are cut as for
+        setCompressionThreads() and the index is written when the file is
+        closed; a file that's appended to only indexes what was written
+        since it was opened.  Must be called before open().
+    */
+    void setBlockIndex(bool blockIndex = true);
+
     boost::function<void (std::string, std::size_t)> onFileWrite;
 
 protected:
@@ -138,10 +167,20 @@ protected:
     std::shared_ptr<Compressor> compressor;
     std::function<size_t (const char *, size_t)> onData;
 
+    int compressionThreads;
+    size_t compressionBlockSize;
+    double maxBlockAge;
+    bool blockIndex;
+
+    struct ParallelCompressor;
+    std::shared_ptr<ParallelCompressor> parallelCompressor;
+
     // Overrides
 
     virtual void implementLogMessage(const std::string & channel,
                                      const std::string & message);
+
+    virtual void implementIdle();
 };
 
 
@@ -7,6 +7,7 @@
 
 #include "compressor.h"
 #include "jml/utils/exc_assert.h"
+#include "jml/utils/lz4_filter.h"
 #include <zlib.h>
 #include <iostream>
 
@@ -45,6 +46,8 @@ filenameToCompression(const std::string & filename)
         return "bzip2";
     if (ends_with(filename, ".xz") || ends_with(filename, ".xz~"))
         return "lzma";
+    if (ends_with(filename, ".lz4") || ends_with(filename, ".lz4~"))
+        return "lz4";
     return "none";
 }
 
@@ -55,6 +58,8 @@ create(const std::string & compression,
 {
     if (compression == "gzip" || compression == "gz")
         return new GzipCompressor(level);
+    else if (compression == "lz4")
+        return new Lz4Compressor(level);
     else if (compression == "" || compression == "none")
         return new NullCompressor();
     else throw ML::Exception("unknown compression %s:%d", compression.c_str(),
@@ -242,6 +247,144 @@ finish(const OnData & onData)
 }
 
 
+/*****************************************************************************/
+/* LZ4 COMPRESSOR                                                            */
+/*****************************************************************************/
+
+struct Lz4Compressor::Itl {
+
+    Itl(int level)
+        : head(BlockSizeId, true /* independent */, true /* checksum */,
+               false),
+          headerWritten(false),
+          compressFn(level < 3 ? LZ4_compress : LZ4_compressHC)
+    {
+        buffer.reserve(head.blockSize());
+    }
+
+    enum { BlockSizeId = 6 };  // 1MB blocks
+
+    ML::lz4::Header head;
+    bool headerWritten;
+    int (*compressFn) (const char *, char *, int);
+    std::vector<char> buffer;
+    std::vector<char> compressed;
+
+    static size_t write(const OnData & onData, const void * data, size_t len)
+    {
+        const char * p = (const char *)data;
+        size_t done = 0;
+        while (done < len)
+            done += onData(p + done, len - done);
+        return done;
+    }
+
+    size_t writeHeader(const OnData & onData)
+    {
+        if (headerWritten) return 0;
+        headerWritten = true;
+        return write(onData, &head, sizeof(head));
+    }
+
+    size_t writeBlock(const OnData & onData)
+    {
+        if (buffer.empty()) return 0;
+
+        size_t result = writeHeader(onData);
+
+        compressed.resize(LZ4_compressBound(buffer.size()));
+        int compressedSize = compressFn(&buffer[0], &compressed[0],
+                                        buffer.size());
+
+        const char * block = &compressed[0];
+        uint32_t blockHeader = compressedSize;
+
+        // Incompressible data is stored as is.
+        if (compressedSize <= 0 || compressedSize >= buffer.size()) {
+            block = &buffer[0];
+            compressedSize = buffer.size();
+            blockHeader = compressedSize | ML::lz4::NotCompressedMask;
+        }
+
+        uint32_t checksum = XXH32(block, compressedSize,
+                                  ML::lz4::ChecksumSeed);
+
+        result += write(onData, &blockHeader, sizeof(blockHeader));
+        result += write(onData, block, compressedSize);
+        result += write(onData, &checksum, sizeof(checksum));
+
+        buffer.clear();
+        return result;
+    }
+
+    size_t compress(const char * data, size_t len, const OnData & onData)
+    {
+        size_t result = 0;
+
+        while (len) {
+            size_t toCopy = std::min(len, head.blockSize() - buffer.size());
+            buffer.insert(buffer.end(), data, data + toCopy);
+            data += toCopy;
+            len -= toCopy;
+
+            if (buffer.size() == head.blockSize())
+                result += writeBlock(onData);
+        }
+
+        return result;
+    }
+
+    size_t finish(const OnData & onData)
+    {
+        size_t result = writeHeader(onData);
+        result += writeBlock(onData);
+
+        const uint32_t endMark = 0;
+        result += write(onData, &endMark, sizeof(endMark));
+
+        // Anything compressed from now on starts a new frame.
+        headerWritten = false;
+        return result;
+    }
+};
+
+Lz4Compressor::
+Lz4Compressor(int level)
+    : itl(new Itl(level))
+{
+}
+
+Lz4Compressor::
+~Lz4Compressor()
+{
+}
+
+size_t
+Lz4Compressor::
+compress(const char * data, size_t len, const OnData & onData)
+{
+    return itl->compress(data, len, onData);
+}
+    
+size_t
+Lz4Compressor::
+flush(FlushLevel flushLevel, const OnData & onData)
+{
+    if (flushLevel == FLUSH_NONE) return 0;
+
+    // Blocks are independent, so closing the current one makes all of the
+    // data available and is a restart point at the same time.
+    return itl->writeBlock(onData);
+}
+
+size_t
+Lz4Compressor::
+finish(const OnData & onData)
+{
+    return itl->finish(onData);
+}
+
+
 /*****************************************************************************/
 /* LZMA COMPRESSOR                                                           */
 /*****************************************************************************/
@@ -135,6 +135,39 @@ private:
     std::unique_ptr<Itl> itl;
 };
 
+
+/*****************************************************************************/
+/* LZ4 COMPRESSOR                                                            */
+/*****************************************************************************/
+
+/** Writes the lz4 frame format, readable by the lz4 command line tool and
+    by ML::filter_istream.  Data is compressed in independent blocks of up
+    to 1MB; a flush closes the current block early, so flushing after each
+    message compresses badly and it's best used with parallel compression
+    (see CompressingOutput::setCompressionThreads()).
+
+    Once finished, the compressor can be used again to start a new frame.
+*/
+
+struct Lz4Compressor : public Compressor {
+
+    /** Levels of 3 and above use the slower high compression mode. */
+    Lz4Compressor(int level = 0);
+
+    virtual ~Lz4Compressor();
+
+    virtual size_t compress(const char * data, size_t len,
+                            const OnData & onData);
+    
+    virtual size_t flush(FlushLevel flushLevel, const OnData & onData);
+
+    virtual size_t finish(const OnData & onData);
+
+private:
+    struct Itl;
+    std::unique_ptr<Itl> itl;
+};
+
 } // namespace Datacratic
 
 #endif /* __logger__compressor_h__ */
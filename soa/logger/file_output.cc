@@ -291,7 +291,9 @@ RotatingFileOutput::
 RotatingFileOutput()
     : RotatingOutputAdaptor(std::bind(&RotatingFileOutput::createFile,
                                       this,
-                                      std::placeholders::_1))
+                                      std::placeholders::_1)),
+      compressionThreads(0),
+      blockIndex(false)
 {
 }
 
@@ -314,6 +316,20 @@ open(const std::string & filenamePattern,
     RotatingOutputAdaptor::open(filenamePattern, periodPattern);
 }
 
+void
+RotatingFileOutput::
+setCompressionThreads(int numThreads)
+{
+    compressionThreads = numThreads;
+}
+
+void
+RotatingFileOutput::
+setBlockIndex(bool blockIndex)
+{
+    this->blockIndex = blockIndex;
+}
+
 FileOutput *
 RotatingFileOutput::
 createFile(const std::string & filename)
@@ -331,6 +347,8 @@ createFile(const std::string & filename)
     result->onFileWrite = [=] (const string& channel, const std::size_t bytes)
 	{ if (this->onFileWrite) this->onFileWrite(channel, bytes); };
 
+    result->setCompressionThreads(compressionThreads);
+    result->setBlockIndex(blockIndex);
     result->open(filename, compression, level);
 
     return result.release();
@@ -136,12 +136,24 @@ struct RotatingFileOutput : public RotatingOutputAdaptor {
               const std::string & periodPattern,
               const std::string & compression = "",
               int level = -1);
+
+    /** Compress each file with the given number of threads.  See
+        CompressingOutput::setCompressionThreads().
+    */
+    void setCompressionThreads(int numThreads);
+
+    /** Write each file with a block index.  See
+        CompressingOutput::setBlockIndex().
+    */
+    void setBlockIndex(bool blockIndex = true);
     
 private:
     FileOutput * createFile(const std::string & filename);
 
     std::string compression;
     int level;
+    int compressionThreads;
+    bool blockIndex;
 };
 
 } // namespace Datacratic
@@ -0,0 +1,332 @@
+/* indexed_log.cc
+   Copyright (c) 2013 Datacratic.  All rights reserved.
+
+   Block index of compressed log files.
+*/
+
+#include "indexed_log.h"
+#include "soa/jsoncpp/json.h"
+#include "jml/utils/filter_streams.h"
+#include "jml/utils/lz4_filter.h"
+#include "jml/arch/exception.h"
+#include "jml/arch/format.h"
+
+#include <boost/iostreams/filtering_stream.hpp>
+#include <boost/iostreams/filter/gzip.hpp>
+#include <boost/iostreams/device/array.hpp>
+#include <cstring>
+#include <set>
+
+
+using namespace std;
+using namespace ML;
+
+
+namespace Datacratic {
+
+
+/*****************************************************************************/
+/* LOG BLOCK INDEX                                                           */
+/*****************************************************************************/
+
+/* The footer is laid out as
+
+       header | index as JSON | length of the footer (16 hex digits) |
+       FooterMagic | trailer
+
+   where for gzip the header opens a gzip member with only a comment, and
+   the trailer ends the comment and holds the empty deflate stream, crc and
+   size of that member.  For lz4 the header is that of a skippable frame and
+   there is no trailer.
+*/
+
+namespace {
+
+const char FooterMagic[8] = { 'D', 'C', 'L', 'O', 'G', 'I', 'D', 'X' };
+const size_t FooterTail = 16 + sizeof(FooterMagic);
+
+const char GzipHeader[10] = {
+    0x1f, (char)0x8b,  // magic
+    8,                 // deflate
+    0x10,              // FCOMMENT
+    0, 0, 0, 0,        // mtime
+    0,                 // extra flags
+    (char)255          // unknown os
+};
+
+const char GzipTrailer[11] = {
+    0,                 // end of the comment
+    0x03, 0x00,        // empty deflate stream
+    0, 0, 0, 0,        // crc32
+    0, 0, 0, 0         // size
+};
+
+const uint32_t Lz4SkippableMagic = 0x184D2A5A;
+const size_t Lz4Header = 8;
+
+} // file scope
+
+LogBlockIndex::
+LogBlockIndex()
+{
+}
+
+uint64_t
+LogBlockIndex::
+size() const
+{
+    return blocks.empty() ? 0
+        : blocks.back().offset + blocks.back().compressedSize;
+}
+
+int
+LogBlockIndex::
+addChannel(const std::string & channel)
+{
+    auto it = std::lower_bound(channelIndex.begin(), channelIndex.end(),
+                               make_pair(channel, -1));
+    if (it != channelIndex.end() && it->first == channel)
+        return it->second;
+
+    int result = channels.size();
+    channels.push_back(channel);
+    channelIndex.insert(it, make_pair(channel, result));
+    return result;
+}
+
+int
+LogBlockIndex::
+findChannel(const std::string & channel) const
+{
+    auto it = std::lower_bound(channelIndex.begin(), channelIndex.end(),
+                               make_pair(channel, -1));
+    if (it != channelIndex.end() && it->first == channel)
+        return it->second;
+    return -1;
+}
+
+std::string
+LogBlockIndex::
+footer() const
+{
+    Json::Value json;
+    json["version"] = 1;
+    json["compression"] = compression;
+    json["size"] = size();
+
+    json["channels"] = Json::Value(Json::arrayValue);
+    for (auto & channel: channels)
+        json["channels"].append(channel);
+
+    json["blocks"] = Json::Value(Json::arrayValue);
+    for (auto & block: blocks) {
+        Json::Value entry(Json::arrayValue);
+        entry.append(block.offset);
+        entry.append(block.compressedSize);
+        entry.append(block.rawSize);
+        entry.append(block.numMessages);
+        entry.append(block.channels);
+        entry.append(block.firstTime);
+        entry.append(block.lastTime);
+        json["blocks"].append(entry);
+    }
+
+    string text = json.toStringNoNewLine();
+
+    string result;
+
+    if (compression == "gzip") {
+        size_t length = sizeof(GzipHeader) + text.size() + FooterTail
+            + sizeof(GzipTrailer);
+        result.append(GzipHeader, sizeof(GzipHeader));
+        result += text;
+        result += ML::format("%016llx", (unsigned long long)length);
+        result.append(FooterMagic, sizeof(FooterMagic));
+        result.append(GzipTrailer, sizeof(GzipTrailer));
+    }
+    else if (compression == "lz4") {
+        size_t length = Lz4Header + text.size() + FooterTail;
+        uint32_t header[2] = { Lz4SkippableMagic,
+                               uint32_t(length - Lz4Header) };
+        result.append((const char *)header, sizeof(header));
+        result += text;
+        result += ML::format("%016llx", (unsigned long long)length);
+        result.append(FooterMagic, sizeof(FooterMagic));
+    }
+    else throw ML::Exception("log block index needs gzip or lz4 compression, "
+                             "not '%s'", compression.c_str());
+
+    return result;
+}
+
+bool
+LogBlockIndex::
+parse(const char * data, size_t size, size_t & start)
+{
+    const char * end = data + size;
+
+    size_t headerSize = Lz4Header, trailerSize = 0;
+    if (size >= sizeof(GzipTrailer)
+        && memcmp(end - sizeof(GzipTrailer), GzipTrailer,
+                  sizeof(GzipTrailer)) == 0) {
+        headerSize = sizeof(GzipHeader);
+        trailerSize = sizeof(GzipTrailer);
+    }
+
+    if (size < headerSize + FooterTail + trailerSize)
+        return false;
+
+    const char * magic = end - trailerSize - sizeof(FooterMagic);
+    if (memcmp(magic, FooterMagic, sizeof(FooterMagic)) != 0)
+        return false;
+
+    string lengthStr(magic - 16, magic);
+    char * lengthEnd;
+    unsigned long long length = strtoull(lengthStr.c_str(), &lengthEnd, 16);
+    if (*lengthEnd != 0
+        || length > size
+        || length < headerSize + FooterTail + trailerSize)
+        throw ML::Exception("corrupted log block index footer");
+
+    const char * footer = end - length;
+    string text(footer + headerSize, magic - 16);
+
+    Json::Value json = Json::parse(text);
+    if (json["version"].asInt() != 1)
+        throw ML::Exception("unknown log block index version %d",
+                            json["version"].asInt());
+
+    compression = json["compression"].asString();
+
+    channels.clear();
+    channelIndex.clear();
+    for (auto & channel: json["channels"])
+        addChannel(channel.asString());
+
+    blocks.clear();
+    for (auto & entry: json["blocks"]) {
+        Block block;
+        block.offset = entry[0].asUInt();
+        block.compressedSize = entry[1].asUInt();
+        block.rawSize = entry[2].asUInt();
+        block.numMessages = entry[3].asUInt();
+        block.channels = entry[4].asUInt();
+        block.firstTime = entry[5].asDouble();
+        block.lastTime = entry[6].asDouble();
+        blocks.push_back(block);
+    }
+
+    uint64_t blocksSize = json["size"].asUInt();
+    if (blocksSize != this->size() || blocksSize > footer - data)
+        throw ML::Exception("corrupted log block index");
+
+    start = (footer - data) - blocksSize;
+    return true;
+}
+
+
+/*****************************************************************************/
+/* INDEXED LOG READER                                                        */
+/*****************************************************************************/
+
+IndexedLogReader::
+IndexedLogReader(const std::string & filename)
+    : filename(filename), data(0), size(0), isIndexed(false), start(0),
+      numBlocksRead(0)
+{
+    string path = filename;
+    if (path.compare(0, 7, "file://") == 0)
+        path = string(path, 7);
+
+    if (path.find("://") == string::npos) {
+        buffer.open(path);
+        data = buffer.start();
+        size = buffer.size();
+    }
+    else {
+        // Read the raw bytes; they are decompressed block by block.
+        filter_istream stream(filename, std::ios_base::in, "none");
+        contents.assign(std::istreambuf_iterator<char>(stream),
+                        std::istreambuf_iterator<char>());
+        data = contents.c_str();
+        size = contents.size();
+    }
+
+    isIndexed = blockIndex.parse(data, size, start);
+}
+
+IndexedLogReader::
+~IndexedLogReader()
+{
+}
+
+size_t
+IndexedLogReader::
+replay(const OnMessage & onMessage,
+       Date startDate,
+       Date endDate,
+       const std::vector<std::string> & channels) const
+{
+    std::set<std::string> wanted(channels.begin(), channels.end());
+    size_t result = 0;
+
+    auto replayStream = [&] (std::istream & stream)
+        {
+            string line;
+            while (getline(stream, line)) {
+                string::size_type pos = line.find('\t');
+                string channel(line, 0, pos);
+                string message;
+                if (pos != string::npos)
+                    message = string(line, pos + 1);
+
+                if (!wanted.empty() && !wanted.count(channel))
+                    continue;
+
+                ++result;
+                if (!onMessage(channel, message))
+                    return false;
+            }
+            return true;
+        };
+
+    if (!isIndexed) {
+        filter_istream stream(filename);
+        replayStream(stream);
+        return result;
+    }
+
+    uint64_t mask = 0;
+    for (auto & channel: channels) {
+        int id = blockIndex.findChannel(channel);
+        if (id != -1) mask |= LogBlockIndex::channelBit(id);
+    }
+
+    if (!channels.empty() && !mask)
+        return 0;
+
+    double startTime = startDate.secondsSinceEpoch();
+    double endTime = endDate.secondsSinceEpoch();
+
+    for (auto & block: blockIndex.blocks) {
+        if (!block.overlaps(startTime, endTime))
+            continue;
+        if (!channels.empty() && !(block.channels & mask))
+            continue;
+
+        boost::iostreams::filtering_istream stream;
+        if (blockIndex.compression == "gzip")
+            stream.push(boost::iostreams::gzip_decompressor());
+        else stream.push(ML::lz4_decompressor());
+        stream.push(boost::iostreams::array_source
+                    (data + start + block.offset, block.compressedSize));
+
+        ++numBlocksRead;
+        if (!replayStream(stream))
+            break;
+    }
+
+    return result;
+}
+
+} // namespace Datacratic
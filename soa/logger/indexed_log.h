@@ -0,0 +1,155 @@
+/* indexed_log.h                                                   -*- C++ -*-
+   Copyright (c) 2013 Datacratic.  All rights reserved.
+
+   Block index of compressed log files, for replaying part of a log without
+   decompressing all of it.
+*/
+
+#ifndef __logger__indexed_log_h__
+#define __logger__indexed_log_h__
+
+#include "soa/types/date.h"
+#include "jml/utils/file_functions.h"
+
+#include <algorithm>
+#include <functional>
+#include <string>
+#include <vector>
+
+
+namespace Datacratic {
+
+
+/*****************************************************************************/
+/* LOG BLOCK INDEX                                                           */
+/*****************************************************************************/
+
+/** Index of a log file made of independently compressed blocks, as written
+    by CompressingOutput::setBlockIndex().  For each block it records where
+    it is, when its messages were written and on which channels.
+
+    The index is written as a footer once the file is closed.  The footer is
+    something that the standard tools skip over: an empty gzip member whose
+    comment holds the index for gzip files, and a skippable frame for lz4
+    files, so zcat and lz4 -dc still read the file as before.
+*/
+
+struct LogBlockIndex {
+
+    LogBlockIndex();
+
+    struct Block {
+        Block()
+            : offset(0), compressedSize(0), rawSize(0), numMessages(0),
+              channels(0), firstTime(0.0), lastTime(0.0)
+        {
+        }
+
+        uint64_t offset;          ///< From the start of the first block
+        uint64_t compressedSize;
+        uint64_t rawSize;
+        uint64_t numMessages;
+        uint64_t channels;        ///< Mask of channelBit() of its channels
+        double firstTime;         ///< Seconds since epoch of first message
+        double lastTime;          ///< Seconds since epoch of last message
+
+        /** Could the block have messages written in [start, end)? */
+        bool overlaps(double start, double end) const
+        {
+            return lastTime >= start && firstTime < end;
+        }
+    };
+
+    std::string compression;
+    std::vector<std::string> channels;
+    std::vector<Block> blocks;
+
+    /** Total compressed size of the blocks. */
+    uint64_t size() const;
+
+    /** Number of the channel, adding it if it's not there yet. */
+    int addChannel(const std::string & channel);
+
+    /** Number of the channel, or -1 if none of the blocks have it. */
+    int findChannel(const std::string & channel) const;
+
+    /** Blocks only keep a bit for the first 63 channels; the others all
+        share the last bit.
+    */
+    static uint64_t channelBit(int channel)
+    {
+        return 1ULL << std::min(channel, 63);
+    }
+
+    /** Footer to write after the last block. */
+    std::string footer() const;
+
+    /** Reads the index from the footer of the file in [data, data + size).
+        Returns false if there isn't one.  On success, start is set to the
+        offset of the first block in the data.
+    */
+    bool parse(const char * data, size_t size, size_t & start);
+
+private:
+    std::vector<std::pair<std::string, int> > channelIndex; // sorted
+};
+
+
+/*****************************************************************************/
+/* INDEXED LOG READER                                                        */
+/*****************************************************************************/
+
+/** Reads back the messages of a log file, seeking straight to the blocks of
+    the time range and channels that are wanted when the file has a block
+    index.  Local files are memory mapped.
+
+    Files without an index are read sequentially; only the channel filter
+    can be applied to them since their messages have no write time.
+*/
+
+struct IndexedLogReader {
+
+    IndexedLogReader(const std::string & filename);
+
+    ~IndexedLogReader();
+
+    /** Was the file written with a block index? */
+    bool indexed() const { return isIndexed; }
+
+    const LogBlockIndex & index() const { return blockIndex; }
+
+    /** Called with each message; returning false stops the replay. */
+    typedef std::function<bool (const std::string & channel,
+                                const std::string & message)> OnMessage;
+
+    /** Replays the messages written in [start, end) on one of the given
+        channels, or all of them if empty.  The time range selects whole
+        blocks, so messages written a little before or after the range can
+        come back too.  Returns the number of messages replayed.
+    */
+    size_t replay(const OnMessage & onMessage,
+                  Date start = Date::negativeInfinity(),
+                  Date end = Date::positiveInfinity(),
+                  const std::vector<std::string> & channels
+                      = std::vector<std::string>()) const;
+
+    /** Number of blocks decompressed by the replays so far. */
+    size_t blocksRead() const { return numBlocksRead; }
+
+private:
+    std::string filename;
+    ML::File_Read_Buffer buffer;
+    std::string contents;         ///< For files that can't be mapped
+    const char * data;
+    size_t size;
+
+    bool isIndexed;
+    LogBlockIndex blockIndex;
+    size_t start;                 ///< Offset of the first block
+
+    mutable size_t numBlocksRead;
+};
+
+} // namespace Datacratic
+
+#endif /* __logger__indexed_log_h__ */
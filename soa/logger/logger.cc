@@ -14,6 +14,7 @@
 #include "file_output.h"
 #include "publish_output.h"
 #include "callback_output.h"
+#include "indexed_log.h"
 #include <boost/make_shared.hpp>
 
 
@@ -400,6 +401,55 @@ replayDirect(const std::string & filename, ssize_t maxEvents) const
          << messagesDone << endl;
 }
 
+void
+Logger::
+replay(const std::string & filename,
+       Date start, Date end,
+       const std::vector<std::string> & channels)
+{
+    if (!outputs) return;
+
+    IndexedLogReader reader(filename);
+
+    auto onMessage = [&] (const string & channel, const string & message)
+        {
+            atomic_add(messagesSent, 1);
+            messages.push(std::vector<std::string> { channel + '\t' + message });
+            return true;
+        };
+
+    reader.replay(onMessage, start, end, channels);
+
+    cerr << "replay: sent " << messagesSent << " done: "
+         << messagesDone << " blocks read: " << reader.blocksRead() << endl;
+}
+
+void
+Logger::
+replayDirect(const std::string & filename,
+             Date start, Date end,
+             const std::vector<std::string> & channels) const
+{
+    if (!outputs) return;
+
+    IndexedLogReader reader(filename);
+
+    auto onMessage = [&] (const string & channel, const string & message)
+        {
+            atomic_add(messagesSent, 1);
+
+            Outputs * current = outputs;
+            if (current)
+                current->logMessage(channel, message);
+            return true;
+        };
+
+    reader.replay(onMessage, start, end, channels);
+
+    cerr << "replay: sent " << messagesSent << " done: "
+         << messagesDone << " blocks read: " << reader.blocksRead() << endl;
+}
+
 void
 Logger::
 handleListenerMessage(std::vector<std::string> const & message)
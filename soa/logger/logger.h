@@ -20,6 +20,7 @@
 #include <boost/regex.hpp>
 #include <boost/shared_ptr.hpp>
 #include "soa/jsoncpp/json.h"
+#include "soa/types/date.h"
 
 
 namespace Datacratic {
@@ -213,6 +214,21 @@ struct Logger {
     /// been called.;
     void replayDirect(const std::string & filename,
                       ssize_t maxEvents = -1) const;
+
+    /** Replay the messages of the given channels (all if empty) written
+        in [start, end).  Files written with a block index (see
+        CompressingOutput::setBlockIndex()) are memory mapped and only the
+        blocks that can match are decompressed; others are read through.
+    */
+    void replay(const std::string & filename,
+                Date start, Date end,
+                const std::vector<std::string> & channels
+                    = std::vector<std::string>());
+
+    void replayDirect(const std::string & filename,
+                      Date start, Date end,
+                      const std::vector<std::string> & channels
+                          = std::vector<std::string>()) const;
     
     uint64_t numMessagesSent() const { return messagesSent; }
     uint64_t numMessagesDone() const { return messagesDone; }
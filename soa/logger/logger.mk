@@ -7,7 +7,7 @@ LIBLOGGER_SOURCES := \
 	file_output.cc publish_output.cc \
 	filter.cc json_filter.cc stats_output.cc callback_output.cc \
 	rotating_output.cc cloud_output.cc compressor.cc compressing_output.cc \
-	multi_output.cc 
+	multi_output.cc indexed_log.cc
 
 LIBLOGGER_LINK := \
 	ACE arch utils boost_thread boost_regex zeromq endpoint lzma boost_filesystem opstats cloud gc
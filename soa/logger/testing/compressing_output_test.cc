@@ -0,0 +1,79 @@
+/* compressing_output_test.cc
+   Copyright (c) 2013 Datacratic.  All rights reserved.
+
+   Tests for the parallel compression of log files.
+*/
+
+#define BOOST_TEST_MAIN
+#define BOOST_TEST_DYN_LINK
+
+#include <boost/test/unit_test.hpp>
+#include "soa/logger/file_output.h"
+#include "jml/utils/filter_streams.h"
+#include "jml/utils/guard.h"
+#include "jml/arch/format.h"
+
+using namespace std;
+using namespace ML;
+using namespace Datacratic;
+
+
+namespace {
+
+/** Logs numMessages messages to the file and checks that they all make it
+    back out in order.
+*/
+void testCompression(const std::string & filename, int numThreads,
+                     int numMessages)
+{
+    ML::Call_Guard guard([&] () { unlink(filename.c_str()); });
+
+    {
+        FileOutput output;
+
+        // Small blocks so that there are lots of them in flight.
+        output.setCompressionThreads(numThreads, 4096);
+        output.open(filename);
+
+        for (unsigned i = 0;  i < numMessages;  ++i)
+            output.logMessage("CHANNEL", ML::format("message %d\tpayload %d",
+                                                    i, i * 7919));
+        output.close();
+    }
+
+    filter_istream stream(filename);
+
+    int i = 0;
+    for (string line; getline(stream, line);  ++i) {
+        string expected = ML::format("CHANNEL\tmessage %d\tpayload %d",
+                                     i, i * 7919);
+        if (line != expected) {
+            BOOST_CHECK_EQUAL(line, expected);
+            break;
+        }
+    }
+
+    BOOST_CHECK_EQUAL(i, numMessages);
+}
+
+} // file scope
+
+BOOST_AUTO_TEST_CASE( test_parallel_gzip )
+{
+    testCompression("tmp/compressing_output_test.gz", 3, 20000);
+}
+
+BOOST_AUTO_TEST_CASE( test_parallel_lz4 )
+{
+    testCompression("tmp/compressing_output_test.lz4", 3, 20000);
+}
+
+BOOST_AUTO_TEST_CASE( test_parallel_none )
+{
+    testCompression("tmp/compressing_output_test.txt", 2, 20000);
+}
+
+BOOST_AUTO_TEST_CASE( test_serial_lz4 )
+{
+    testCompression("tmp/compressing_output_test_serial.lz4", 0, 1000);
+}
@@ -0,0 +1,220 @@
+/* indexed_log_test.cc
+   Copyright (c) 2013 Datacratic.  All rights reserved.
+
+   Tests for block indexed log files.
+*/
+
+#define BOOST_TEST_MAIN
+#define BOOST_TEST_DYN_LINK
+
+#include <boost/test/unit_test.hpp>
+#include "soa/logger/file_output.h"
+#include "soa/logger/indexed_log.h"
+#include "jml/utils/filter_streams.h"
+#include "jml/utils/guard.h"
+#include "jml/arch/format.h"
+#include <fstream>
+
+using namespace std;
+using namespace ML;
+using namespace Datacratic;
+
+
+namespace {
+
+/** Logs numMessages messages on channel A, then as many on channel B, and
+    checks that each half can be replayed without reading the other.
+*/
+void testIndex(const std::string & filename, int numThreads,
+               int numMessages)
+{
+    ML::Call_Guard guard([&] () { unlink(filename.c_str()); });
+
+    Date middle;
+
+    {
+        FileOutput output;
+
+        // Small blocks so that each half has lots of them.
+        output.setCompressionThreads(numThreads, 4096);
+        output.setBlockIndex();
+        output.open(filename);
+
+        for (unsigned i = 0;  i < numMessages;  ++i)
+            output.logMessage("A", ML::format("message %d", i));
+
+        ML::sleep(0.1);
+        middle = Date::now();
+
+        for (unsigned i = 0;  i < numMessages;  ++i)
+            output.logMessage("B", ML::format("message %d", i));
+
+        output.close();
+    }
+
+    // The standard readers skip over the index.
+    {
+        filter_istream stream(filename);
+        int n = 0;
+        for (string line; getline(stream, line);  ++n) {
+            string expected = ML::format("%s\tmessage %d",
+                                         n < numMessages ? "A" : "B",
+                                         n % numMessages);
+            if (line != expected) {
+                BOOST_CHECK_EQUAL(line, expected);
+                break;
+            }
+        }
+        BOOST_CHECK_EQUAL(n, 2 * numMessages);
+    }
+
+    IndexedLogReader reader(filename);
+    BOOST_REQUIRE(reader.indexed());
+
+    const LogBlockIndex & index = reader.index();
+    size_t numBlocks = index.blocks.size();
+    BOOST_CHECK_GT(numBlocks, 4);
+    BOOST_CHECK_EQUAL(index.channels.size(), 2);
+
+    // Everything
+    int n = 0;
+    auto count = [&] (const string & channel, const string & message)
+        {
+            ++n;
+            return true;
+        };
+    BOOST_CHECK_EQUAL(reader.replay(count), 2 * numMessages);
+    BOOST_CHECK_EQUAL(n, 2 * numMessages);
+    BOOST_CHECK_EQUAL(reader.blocksRead(), numBlocks);
+
+    // One channel
+    n = 0;
+    auto onB = [&] (const string & channel, const string & message)
+        {
+            BOOST_CHECK_EQUAL(channel, "B");
+            BOOST_CHECK_EQUAL(message, ML::format("message %d", n));
+            ++n;
+            return true;
+        };
+    reader.replay(onB, Date::negativeInfinity(), Date::positiveInfinity(),
+                  { "B" });
+    BOOST_CHECK_EQUAL(n, numMessages);
+    size_t blocksForB = reader.blocksRead() - numBlocks;
+    BOOST_CHECK_LT(blocksForB, numBlocks);
+
+    BOOST_CHECK_EQUAL(reader.replay(count, Date::negativeInfinity(),
+                                    Date::positiveInfinity(), { "C" }), 0);
+
+    // Time range; a block can straddle the boundary.
+    int numB = 0;
+    auto afterMiddle = [&] (const string & channel, const string & message)
+        {
+            numB += channel == "B";
+            return true;
+        };
+    size_t before = reader.blocksRead();
+    reader.replay(afterMiddle, middle);
+    BOOST_CHECK_EQUAL(numB, numMessages);
+    BOOST_CHECK_LT(reader.blocksRead() - before, numBlocks);
+
+    // Stopping early
+    n = 0;
+    auto stop = [&] (const string & channel, const string & message)
+        {
+            return ++n < 10;
+        };
+    BOOST_CHECK_EQUAL(reader.replay(stop), 10);
+}
+
+} // file scope
+
+BOOST_AUTO_TEST_CASE( test_indexed_gzip )
+{
+    testIndex("tmp/indexed_log_test.gz", 2, 5000);
+}
+
+BOOST_AUTO_TEST_CASE( test_indexed_lz4 )
+{
+    testIndex("tmp/indexed_log_test.lz4", 2, 5000);
+}
+
+BOOST_AUTO_TEST_CASE( test_indexed_serial )
+{
+    testIndex("tmp/indexed_log_test_serial.gz", 0, 5000);
+}
+
+BOOST_AUTO_TEST_CASE( test_indexed_empty )
+{
+    for (string filename: { "tmp/indexed_log_test_empty.lz4",
+                            "tmp/indexed_log_test_empty.gz" }) {
+        ML::Call_Guard guard([&] () { unlink(filename.c_str()); });
+
+        {
+            FileOutput output;
+            output.setCompressionThreads(2, 4096);
+            output.setBlockIndex();
+            output.open(filename);
+            output.close();
+        }
+
+        // There's a valid, empty stream in front of the index.
+        {
+            filter_istream stream(filename);
+            string contents((istreambuf_iterator<char>(stream)),
+                            istreambuf_iterator<char>());
+            BOOST_CHECK_EQUAL(contents, "");
+        }
+
+        {
+            std::ifstream stream(filename);
+            uint32_t magic = 0;
+            stream.read((char *)&magic, sizeof(magic));
+            if (filename.find(".lz4") != string::npos)
+                BOOST_CHECK_EQUAL(magic, 0x184D2204);
+            else BOOST_CHECK_EQUAL(magic & 0xffff, 0x8b1f);
+        }
+
+        IndexedLogReader reader(filename);
+        BOOST_REQUIRE(reader.indexed());
+        BOOST_CHECK_EQUAL(reader.index().blocks.size(), 0);
+
+        auto count = [&] (const string & channel, const string & message)
+            {
+                return true;
+            };
+        BOOST_CHECK_EQUAL(reader.replay(count), 0);
+    }
+}
+
+BOOST_AUTO_TEST_CASE( test_index_needs_compression )
+{
+    FileOutput output;
+    output.setBlockIndex();
+    BOOST_CHECK_THROW(output.open("tmp/indexed_log_test.txt"), ML::Exception);
+    unlink("tmp/indexed_log_test.txt");
+}
+
+BOOST_AUTO_TEST_CASE( test_unindexed_replay )
+{
+    string filename = "tmp/indexed_log_test_plain.gz";
+    ML::Call_Guard guard([&] () { unlink(filename.c_str()); });
+
+    {
+        filter_ostream stream(filename);
+        for (unsigned i = 0;  i < 100;  ++i)
+            stream << (i % 2 ? "A" : "B") << "\tmessage " << i << endl;
+    }
+
+    IndexedLogReader reader(filename);
+    BOOST_CHECK(!reader.indexed());
+
+    int n = 0;
+    auto count = [&] (const string & channel, const string & message)
+        {
+            ++n;
+            return true;
+        };
+    reader.replay(count, Date::negativeInfinity(), Date::positiveInfinity(),
+                  { "A" });
+    BOOST_CHECK_EQUAL(n, 50);
+}
@@ -282,7 +282,7 @@ enqueueRequest(const string & verb, const string & resource,
                const shared_ptr<HttpClientCallbacks> & callbacks,
                const HttpRequest::Content & content,
                const RestParams & queryParams, const RestParams & headers,
-               int timeout)
+               double timeout)
 {
     string url = baseUrl_ + resource + queryParams.uriEscaped();
     {
@@ -631,8 +631,9 @@ perform(bool noSSLChecks, bool debug)
     easy_.setOpt<curlopt::WriteFunction>(onWrite_);
     easy_.setOpt<curlopt::ReadFunction>(onRead_);
     easy_.setOpt<curlopt::BufferSize>(65536);
-    if (request_.timeout_ != -1) {
-        easy_.setOpt<curlopt::Timeout>(request_.timeout_);
+    if (request_.timeout_ > 0) {
+        long timeoutMs = request_.timeout_ * 1000;
+        easy_.setOpt<curlopt::TimeoutMs>(std::max(timeoutMs, 1L));
     }
     easy_.setOpt<curlopt::NoSignal>(true);
     easy_.setOpt<curlopt::NoProgress>(true);
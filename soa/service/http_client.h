@@ -85,7 +85,7 @@ struct HttpRequest {
     HttpRequest(const std::string & verb, const std::string & url,
                 const std::shared_ptr<HttpClientCallbacks> & callbacks,
                 const Content & content, const RestParams & headers,
-                int timeout = -1)
+                double timeout = -1)
         noexcept
         : verb_(verb), url_(url), callbacks_(callbacks),
           content_(content), headers_(headers),
@@ -108,7 +108,7 @@ struct HttpRequest {
     std::shared_ptr<HttpClientCallbacks> callbacks_;
     Content content_;
     RestParams headers_;
-    int timeout_;
+    double timeout_;  ///< seconds, may be fractional; -1 for no timeout
 };
 
 
@@ -136,7 +136,8 @@ struct HttpClient : public AsyncEventSource {
 
     /** Performs a POST request, with "resource" as the location of the
      *  resource on the server indicated in "baseUrl". Query parameters
-     *  should preferably be passed via "queryParams".
+     *  should preferably be passed via "queryParams". "timeout" is in
+     *  seconds and may be fractional (millisecond resolution).
      *
      *  Returns "true" when the request could successfully be enqueued.
      */
@@ -144,7 +145,7 @@ struct HttpClient : public AsyncEventSource {
              const std::shared_ptr<HttpClientCallbacks> & callbacks,
              const RestParams & queryParams = RestParams(),
              const RestParams & headers = RestParams(),
-             int timeout = -1)
+             double timeout = -1)
     {
         return enqueueRequest("GET", resource, callbacks,
                               HttpRequest::Content(),
@@ -161,7 +162,7 @@ struct HttpClient : public AsyncEventSource {
               const HttpRequest::Content & content = HttpRequest::Content(),
               const RestParams & queryParams = RestParams(),
               const RestParams & headers = RestParams(),
-              int timeout = -1)
+              double timeout = -1)
     {
         return enqueueRequest("POST", resource, callbacks, content,
                               queryParams, headers, timeout);
@@ -176,7 +177,7 @@ struct HttpClient : public AsyncEventSource {
              const HttpRequest::Content & content = HttpRequest::Content(),
              const RestParams & queryParams = RestParams(),
              const RestParams & headers = RestParams(),
-             int timeout = -1)
+             double timeout = -1)
     {
         return enqueueRequest("PUT", resource, callbacks, content,
                               queryParams, headers, timeout);
@@ -196,7 +197,7 @@ private:
                         const HttpRequest::Content & content,
                         const RestParams & queryParams,
                         const RestParams & headers,
-                        int timeout = -1);
+                        double timeout = -1);
     std::vector<HttpRequest> popRequests(size_t number);
 
     void handleEvents();
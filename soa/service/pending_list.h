@@ -10,7 +10,9 @@
 
 #include "timeout_map.h"
 #include "leveldb/db.h"
+#include "leveldb/write_batch.h"
 #include "jml/utils/guard.h"
+#include <unordered_map>
 
 namespace Datacratic {
 
@@ -35,14 +37,42 @@ struct PendingPersistence {
                       const OnError & onError = OnError()) const = 0;
 };
 
+/** Pending persistence in a leveldb database.
+
+    By default every put and erase is written through.  With
+    setWriteBehind(), they are kept in memory and written in a single
+    batch by flush(), which the owner calls periodically; only the last
+    operation on each key is written, so an entry that comes and goes
+    between two flushes never touches the disk.  A crash loses what was
+    written since the last flush.
+*/
+
 struct LeveldbPendingPersistence : public PendingPersistence {
     std::shared_ptr<leveldb::DB> db;
 
-    void open(const std::string & filename)
+    LeveldbPendingPersistence()
+        : maxPending(0)
+    {
+    }
+
+    ~LeveldbPendingPersistence()
+    {
+        if (!db) return;
+        try {
+            flush();
+        } catch (const std::exception & exc) {
+            std::cerr << "error flushing pending persistence: "
+                      << exc.what() << std::endl;
+        }
+    }
+
+    void open(const std::string & filename,
+              size_t writeBufferSize = 4 * 1024 * 1024)
     {
         leveldb::DB* db;
         leveldb::Options options;
         options.create_if_missing = true;
+        options.write_buffer_size = writeBufferSize;
         leveldb::Status status
             = leveldb::DB::Open(options, filename, &db);
         this->db.reset(db);
@@ -100,8 +130,51 @@ struct LeveldbPendingPersistence : public PendingPersistence {
         return size;
     }
 
+    /** Buffer up to maxPending keys before flushing on its own; 0 writes
+        everything through.
+    */
+    void setWriteBehind(size_t maxPending)
+    {
+        flush();
+        this->maxPending = maxPending;
+    }
+
+    /** Number of keys waiting to be written. */
+    size_t numPending() const { return pending.size(); }
+
+    /** Writes the buffered operations in one batch.  Returns the number of
+        keys written.
+    */
+    size_t flush()
+    {
+        if (pending.empty()) return 0;
+
+        leveldb::WriteBatch batch;
+        for (auto & entry: pending) {
+            if (entry.second.first)
+                batch.Put(entry.first, entry.second.second);
+            else batch.Delete(entry.first);
+        }
+
+        leveldb::WriteOptions options;
+        leveldb::Status status = db->Write(options, &batch);
+        if (!status.ok()) {
+            throw ML::Exception("Writing to leveldb: " + status.ToString());
+        }
+
+        size_t result = pending.size();
+        pending.clear();
+        return result;
+    }
+
     virtual void put(const std::string & key, const std::string & value)
     {
+        if (maxPending) {
+            pending[key] = std::make_pair(true, value);
+            if (pending.size() >= maxPending) flush();
+            return;
+        }
+
         leveldb::WriteOptions options;
         leveldb::Status status = db->Put(options, key, value);
         if (!status.ok()) {
@@ -119,6 +192,13 @@ struct LeveldbPendingPersistence : public PendingPersistence {
     virtual std::string
     get(const std::string & key) const
     {
+        auto it = pending.find(key);
+        if (it != pending.end()) {
+            if (!it->second.first)
+                throw ML::Exception("Reading from leveldb: key was erased");
+            return it->second.second;
+        }
+
         leveldb::ReadOptions options;
         std::string value;
         leveldb::Status status = db->Get(options, key, &value);
@@ -130,6 +210,12 @@ struct LeveldbPendingPersistence : public PendingPersistence {
 
     virtual void erase(const std::string & key)
     {
+        if (maxPending) {
+            pending[key] = std::make_pair(false, std::string());
+            if (pending.size() >= maxPending) flush();
+            return;
+        }
+
         leveldb::WriteOptions options;
         leveldb::Status status = db->Delete(options, key);
         if (!status.ok()) {
@@ -145,8 +231,12 @@ struct LeveldbPendingPersistence : public PendingPersistence {
         //db->CompactRange(0, 0);
         //cerr << "done compacting" << endl;
 
+        if (!pending.empty())
+            throw ML::Exception("LevelDbPersistence::scan(): flush first");
+
         leveldb::ReadOptions options;
         options.verify_checksums = true;
+        options.fill_cache = false;  // scanned once at startup
 
         // Now iterate over everything in the database
         std::auto_ptr<leveldb::Iterator> it
@@ -176,6 +266,12 @@ struct LeveldbPendingPersistence : public PendingPersistence {
         using namespace std;
         cerr << "scanned " << numScanned << " entries" << endl;
     }
+
+private:
+    size_t maxPending;
+
+    /// Last operation on each buffered key: (true, value) or (false, "")
+    std::unordered_map<std::string, std::pair<bool, std::string> > pending;
 };
 
 template<typename Key, typename Value>
@@ -49,6 +49,7 @@ LIBSERVICES_SOURCES := \
 	rest_request_binding.cc \
 	runner.cc \
 	sink.cc \
+	shared_memory_channel.cc \
 	zookeeper.cc \
 	http_client.cc \
 	http_rest_proxy.cc \
@@ -0,0 +1,530 @@
+/* shared_memory_channel.cc
+   Copyright (c) 2013 Datacratic.  All rights reserved.
+
+   Message channel between two processes on the same host, built on a pair
+   of rings living in a shared memory segment.
+*/
+
+#include "soa/service/shared_memory_channel.h"
+#include "jml/arch/exception.h"
+#include "jml/utils/exc_assert.h"
+#include "jml/utils/exc_check.h"
+#include "jml/utils/guard.h"
+
+#include <sys/eventfd.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+#include <sys/un.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <string.h>
+#include <iostream>
+#include <mutex>
+
+using namespace std;
+
+
+namespace Datacratic {
+
+
+namespace {
+
+const uint64_t RingMagic = 0x52544253484d5231ULL;  // "RTBSHMR1"
+const uint32_t WrapMarker = 0xffffffff;
+
+int createSharedMemory()
+{
+#ifdef __NR_memfd_create
+    int fd = syscall(__NR_memfd_create, "rtbkit-shm", 1 /* MFD_CLOEXEC */);
+    if (fd != -1)
+        return fd;
+    if (errno != ENOSYS)
+        throw ML::Exception(errno, "memfd_create");
+#endif
+
+    // Kernels older than 3.17 have no memfd; an unlinked file in /dev/shm
+    // is just as anonymous once both sides have it mapped.
+    char path[] = "/dev/shm/rtbkit-shm-XXXXXX";
+    int res = mkstemp(path);
+    if (res == -1)
+        throw ML::Exception(errno, "mkstemp");
+    unlink(path);
+    fcntl(res, F_SETFD, FD_CLOEXEC);
+    return res;
+}
+
+void sendFds(int socket, const int * fds, int numFds)
+{
+    char byte = 0;
+    iovec iov = { &byte, 1 };
+
+    char control[CMSG_SPACE(sizeof(int) * 4)];
+    ExcAssertLessEqual(numFds, 4);
+    memset(control, 0, sizeof(control));
+
+    msghdr msg;
+    memset(&msg, 0, sizeof(msg));
+    msg.msg_iov = &iov;
+    msg.msg_iovlen = 1;
+    msg.msg_control = control;
+    msg.msg_controllen = CMSG_SPACE(sizeof(int) * numFds);
+
+    cmsghdr * cmsg = CMSG_FIRSTHDR(&msg);
+    cmsg->cmsg_level = SOL_SOCKET;
+    cmsg->cmsg_type = SCM_RIGHTS;
+    cmsg->cmsg_len = CMSG_LEN(sizeof(int) * numFds);
+    memcpy(CMSG_DATA(cmsg), fds, sizeof(int) * numFds);
+
+    int res;
+    do {
+        res = sendmsg(socket, &msg, MSG_NOSIGNAL);
+    } while (res == -1 && errno == EINTR);
+
+    if (res == -1)
+        throw ML::Exception(errno, "sendmsg");
+}
+
+void recvFds(int socket, int * fds, int numFds)
+{
+    char byte;
+    iovec iov = { &byte, 1 };
+
+    char control[CMSG_SPACE(sizeof(int) * 4)];
+    ExcAssertLessEqual(numFds, 4);
+
+    msghdr msg;
+    memset(&msg, 0, sizeof(msg));
+    msg.msg_iov = &iov;
+    msg.msg_iovlen = 1;
+    msg.msg_control = control;
+    msg.msg_controllen = CMSG_SPACE(sizeof(int) * numFds);
+
+    int res;
+    do {
+        res = recvmsg(socket, &msg, MSG_CMSG_CLOEXEC);
+    } while (res == -1 && errno == EINTR);
+
+    if (res == -1)
+        throw ML::Exception(errno, "recvmsg");
+    if (res == 0)
+        throw ML::Exception("shared memory channel: peer closed the socket");
+
+    cmsghdr * cmsg = CMSG_FIRSTHDR(&msg);
+    if (!cmsg || cmsg->cmsg_type != SCM_RIGHTS
+        || cmsg->cmsg_len != CMSG_LEN(sizeof(int) * numFds))
+        throw ML::Exception("shared memory channel: bad file descriptors");
+
+    memcpy(fds, CMSG_DATA(cmsg), sizeof(int) * numFds);
+}
+
+} // file scope
+
+
+/*****************************************************************************/
+/* SHARED MEMORY RING                                                        */
+/*****************************************************************************/
+
+size_t
+SharedMemoryRing::
+bytesNeeded(size_t capacity)
+{
+    return sizeof(Header) + capacity;
+}
+
+void
+SharedMemoryRing::
+init(void * mem, size_t capacity)
+{
+    ExcCheck(capacity >= 64 && (capacity & (capacity - 1)) == 0,
+             "shared memory ring capacity must be a power of two");
+
+    header = new (mem) Header();
+    header->capacity = capacity;
+    header->writePosition = 0;
+    header->readPosition = 0;
+    header->magic = RingMagic;
+    data = (char *)mem + sizeof(Header);
+}
+
+void
+SharedMemoryRing::
+attach(void * mem)
+{
+    header = (Header *)mem;
+    if (header->magic != RingMagic)
+        throw ML::Exception("shared memory ring has bad magic number");
+    data = (char *)mem + sizeof(Header);
+}
+
+bool
+SharedMemoryRing::
+tryWrite(const std::vector<std::string> & message, bool & wakeReader)
+{
+    uint64_t capacity = header->capacity;
+
+    uint64_t size = 8;
+    for (const string & part : message)
+        size += 4 + part.size();
+    size = (size + 7) & ~7ULL;
+
+    if (size > capacity / 2)
+        throw ML::Exception("message of %lld bytes is too large for a shared "
+                            "memory ring of %lld bytes",
+                            (long long)size, (long long)capacity);
+
+    // We're the only writer so our position can't change under us.
+    uint64_t write = header->writePosition.load(std::memory_order_relaxed);
+    uint64_t read = header->readPosition.load(std::memory_order_acquire);
+
+    uint64_t offset = write & (capacity - 1);
+    uint64_t skip = offset + size > capacity ? capacity - offset : 0;
+
+    if (write + skip + size - read > capacity)
+        return false;
+
+    if (skip) {
+        *(uint32_t *)(data + offset) = WrapMarker;
+        offset = 0;
+    }
+
+    char * p = data + offset;
+    *(uint32_t *)p = size;
+    *(uint32_t *)(p + 4) = message.size();
+    p += 8;
+
+    for (const string & part : message) {
+        *(uint32_t *)p = part.size();
+        memcpy(p + 4, part.data(), part.size());
+        p += 4 + part.size();
+    }
+
+    uint64_t newWrite = write + skip + size;
+
+    // Publish then check where the reader is; the reader does the opposite
+    // so at least one of us sees the other's update and no wakeup is lost.
+    header->writePosition.store(newWrite, std::memory_order_seq_cst);
+    wakeReader
+        = header->readPosition.load(std::memory_order_seq_cst) == write;
+
+    return true;
+}
+
+bool
+SharedMemoryRing::
+tryRead(std::vector<std::string> & message)
+{
+    uint64_t capacity = header->capacity;
+    uint64_t read = header->readPosition.load(std::memory_order_relaxed);
+
+    for (;;) {
+        uint64_t write = header->writePosition.load(std::memory_order_seq_cst);
+        if (read == write)
+            return false;
+
+        uint64_t offset = read & (capacity - 1);
+        const char * p = data + offset;
+
+        uint32_t size = *(const uint32_t *)p;
+        if (size == WrapMarker) {
+            read += capacity - offset;
+            continue;
+        }
+
+        if (size < 8 || size > capacity - offset || read + size > write)
+            throw ML::Exception("corrupt shared memory ring");
+
+        const char * end = p + size;
+        uint32_t numParts = *(const uint32_t *)(p + 4);
+        p += 8;
+
+        message.clear();
+        message.reserve(numParts);
+        for (uint32_t i = 0;  i < numParts;  ++i) {
+            uint32_t len = *(const uint32_t *)p;
+            if (p + 4 + len > end)
+                throw ML::Exception("corrupt shared memory ring");
+            message.emplace_back(p + 4, len);
+            p += 4 + len;
+        }
+
+        header->readPosition.store(read + size, std::memory_order_seq_cst);
+        return true;
+    }
+}
+
+bool
+SharedMemoryRing::
+empty() const
+{
+    return header->readPosition.load(std::memory_order_relaxed)
+        == header->writePosition.load(std::memory_order_acquire);
+}
+
+size_t
+SharedMemoryRing::
+capacity() const
+{
+    return header->capacity;
+}
+
+
+/*****************************************************************************/
+/* SHARED MEMORY CHANNEL                                                     */
+/*****************************************************************************/
+
+SharedMemoryChannel::
+SharedMemoryChannel()
+    : socket(-1), mem(0), memSize(0), outFd(-1), inFd(-1)
+{
+}
+
+SharedMemoryChannel::
+~SharedMemoryChannel()
+{
+    if (mem)
+        munmap(mem, memSize);
+    if (outFd != -1) ::close(outFd);
+    if (inFd != -1) ::close(inFd);
+    if (socket != -1) ::close(socket);
+}
+
+std::shared_ptr<SharedMemoryChannel>
+SharedMemoryChannel::
+create(int socket, size_t ringSize)
+{
+    std::shared_ptr<SharedMemoryChannel> result(new SharedMemoryChannel());
+
+    int memFd = createSharedMemory();
+    ML::Call_Guard closeMem([=] () { ::close(memFd); });
+
+    if (ftruncate(memFd, 2 * SharedMemoryRing::bytesNeeded(ringSize)) == -1)
+        throw ML::Exception(errno, "ftruncate");
+
+    result->map(memFd, ringSize, true);
+
+    result->outFd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+    if (result->outFd == -1)
+        throw ML::Exception(errno, "eventfd");
+    result->inFd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+    if (result->inFd == -1)
+        throw ML::Exception(errno, "eventfd");
+
+    int fds[3] = { memFd, result->outFd, result->inFd };
+    sendFds(socket, fds, 3);
+
+    // Only ours once nothing can throw; until then it's the caller's.
+    result->socket = socket;
+    return result;
+}
+
+std::shared_ptr<SharedMemoryChannel>
+SharedMemoryChannel::
+attach(int socket)
+{
+    std::shared_ptr<SharedMemoryChannel> result(new SharedMemoryChannel());
+
+    int fds[3];
+    recvFds(socket, fds, 3);
+
+    ML::Call_Guard closeMem([&] () { ::close(fds[0]); });
+
+    // The creator's outgoing direction is our incoming one.
+    result->inFd = fds[1];
+    result->outFd = fds[2];
+    result->map(fds[0], 0, false);
+
+    result->socket = socket;
+    return result;
+}
+
+void
+SharedMemoryChannel::
+map(int memFd, size_t ringSize, bool creator)
+{
+    struct stat st;
+    if (fstat(memFd, &st) == -1)
+        throw ML::Exception(errno, "fstat");
+
+    memSize = st.st_size;
+    mem = mmap(0, memSize, PROT_READ | PROT_WRITE, MAP_SHARED, memFd, 0);
+    if (mem == MAP_FAILED) {
+        mem = 0;
+        throw ML::Exception(errno, "mmap");
+    }
+
+    char * base = (char *)mem;
+
+    if (creator) {
+        out.init(base, ringSize);
+        in.init(base + SharedMemoryRing::bytesNeeded(ringSize), ringSize);
+    }
+    else {
+        in.attach(base);
+        ringSize = in.capacity();
+        if (memSize < 2 * SharedMemoryRing::bytesNeeded(ringSize))
+            throw ML::Exception("shared memory segment is too small");
+        out.attach(base + SharedMemoryRing::bytesNeeded(ringSize));
+    }
+}
+
+bool
+SharedMemoryChannel::
+trySend(const std::vector<std::string> & message)
+{
+    bool wakeReader = false;
+
+    {
+        std::lock_guard<ML::Spinlock> guard(sendLock);
+        if (!out.tryWrite(message, wakeReader))
+            return false;
+    }
+
+    if (wakeReader)
+        eventfd_write(outFd, 1);
+
+    return true;
+}
+
+bool
+SharedMemoryChannel::
+peerAlive() const
+{
+    char c;
+    ssize_t res = recv(socket, &c, 1, MSG_PEEK | MSG_DONTWAIT);
+    if (res == 0)
+        return false;
+    if (res == -1 && errno != EAGAIN && errno != EWOULDBLOCK
+        && errno != EINTR)
+        return false;
+    return true;
+}
+
+bool
+SharedMemoryChannel::
+processOne()
+{
+    // Re-arm the eventfd before looking at the ring; the writer only
+    // signals when it sees that we've caught up with it.
+    eventfd_t val;
+    ::read(inFd, &val, sizeof(val));
+
+    std::vector<std::string> message;
+    for (unsigned i = 0;  i < MaxBatch;  ++i) {
+        if (!in.tryRead(message))
+            return false;
+        onMessage(std::move(message));
+    }
+
+    return !in.empty();
+}
+
+
+/*****************************************************************************/
+/* SHARED MEMORY LISTENER                                                    */
+/*****************************************************************************/
+
+SharedMemoryListener::
+SharedMemoryListener(const std::string & path, size_t ringSize)
+    : path(path), fd(-1), ringSize(ringSize)
+{
+    sockaddr_un addr;
+    memset(&addr, 0, sizeof(addr));
+    addr.sun_family = AF_UNIX;
+    if (path.size() >= sizeof(addr.sun_path))
+        throw ML::Exception("unix socket path is too long: " + path);
+    strcpy(addr.sun_path, path.c_str());
+
+    fd = ::socket(AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+    if (fd == -1)
+        throw ML::Exception(errno, "socket");
+
+    // Left behind by a previous instance that didn't shut down cleanly.
+    unlink(path.c_str());
+
+    if (bind(fd, (sockaddr *)&addr, sizeof(addr)) == -1)
+        throw ML::Exception(errno, "bind " + path);
+    if (listen(fd, 128) == -1)
+        throw ML::Exception(errno, "listen " + path);
+}
+
+SharedMemoryListener::
+~SharedMemoryListener()
+{
+    if (fd != -1) {
+        ::close(fd);
+        unlink(path.c_str());
+    }
+}
+
+bool
+SharedMemoryListener::
+processOne()
+{
+    int client = accept4(fd, 0, 0, SOCK_CLOEXEC);
+    if (client == -1) {
+        if (errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR)
+            return false;
+        throw ML::Exception(errno, "accept");
+    }
+
+    ML::Call_Guard closeClient([=] () { ::close(client); });
+
+    // The client sends its name straight after connecting; don't let one
+    // that doesn't hold us up for long.
+    timeval timeout = { 1, 0 };
+    setsockopt(client, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+
+    string name;
+    char c;
+    while (name.size() < 1024) {
+        ssize_t res = ::recv(client, &c, 1, 0);
+        if (res == -1 && errno == EINTR) continue;
+        if (res != 1) {
+            cerr << "shared memory listener: couldn't read client name"
+                 << endl;
+            return true;
+        }
+        if (c == '\n') break;
+        name += c;
+    }
+
+    auto channel = SharedMemoryChannel::create(client, ringSize);
+    closeClient.clear();
+
+    if (onConnection)
+        onConnection(name, channel);
+
+    return true;
+}
+
+std::shared_ptr<SharedMemoryChannel>
+connectSharedMemoryChannel(const std::string & path, const std::string & name)
+{
+    sockaddr_un addr;
+    memset(&addr, 0, sizeof(addr));
+    addr.sun_family = AF_UNIX;
+    if (path.size() >= sizeof(addr.sun_path))
+        throw ML::Exception("unix socket path is too long: " + path);
+    strcpy(addr.sun_path, path.c_str());
+
+    int fd = ::socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    if (fd == -1)
+        throw ML::Exception(errno, "socket");
+
+    ML::Call_Guard closeFd([=] () { ::close(fd); });
+
+    if (connect(fd, (sockaddr *)&addr, sizeof(addr)) == -1)
+        throw ML::Exception(errno, "connect " + path);
+
+    string hello = name + "\n";
+    if (::send(fd, hello.c_str(), hello.size(), MSG_NOSIGNAL) != hello.size())
+        throw ML::Exception(errno, "send");
+
+    auto channel = SharedMemoryChannel::attach(fd);
+    closeFd.clear();
+    return channel;
+}
+
+} // namespace Datacratic
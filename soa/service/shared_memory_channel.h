@@ -0,0 +1,210 @@
+/* shared_memory_channel.h                                         -*- C++ -*-
+   Copyright (c) 2013 Datacratic.  All rights reserved.
+
+   Message channel between two processes on the same host, built on a pair
+   of rings living in a shared memory segment.
+*/
+
+#pragma once
+
+#include "soa/service/async_event_source.h"
+#include "jml/arch/spinlock.h"
+
+#include <atomic>
+#include <functional>
+#include <memory>
+#include <string>
+#include <vector>
+
+
+namespace Datacratic {
+
+
+/*****************************************************************************/
+/* SHARED MEMORY RING                                                        */
+/*****************************************************************************/
+
+/** Single producer single consumer ring of multi-part messages that lives in
+    memory shared between two processes.
+
+    Messages are stored as a record header (total length and number of
+    parts) followed by the length and bytes of each part.  Records never
+    straddle the end of the ring; when one doesn't fit, a wrap marker is left
+    in its place and the record starts at the beginning of the ring.
+
+    Both positions are byte counts that only ever grow, which makes it
+    trivial to tell a full ring from an empty one.
+*/
+struct SharedMemoryRing {
+
+    SharedMemoryRing()
+        : header(0), data(0)
+    {
+    }
+
+    /** Number of bytes of shared memory needed for a ring of the given
+        capacity.
+    */
+    static size_t bytesNeeded(size_t capacity);
+
+    /** Formats the given memory as an empty ring.  The capacity must be a
+        power of two.
+    */
+    void init(void * mem, size_t capacity);
+
+    /** Attaches to a ring that was formatted by the other process. */
+    void attach(void * mem);
+
+    /** Writes a message in the ring.  Returns false if there isn't enough
+        room for it.  On success, wakeReader is set if the reader may have
+        gone to sleep on an empty ring and needs to be signalled.
+    */
+    bool tryWrite(const std::vector<std::string> & message, bool & wakeReader);
+
+    /** Reads the next message from the ring.  Returns false if the ring is
+        empty.
+    */
+    bool tryRead(std::vector<std::string> & message);
+
+    bool empty() const;
+
+    size_t capacity() const;
+
+private:
+    struct Header {
+        uint64_t magic;
+        uint64_t capacity;
+        char pad0[48];
+        std::atomic<uint64_t> writePosition;
+        char pad1[56];
+        std::atomic<uint64_t> readPosition;
+        char pad2[56];
+    };
+
+    Header * header;
+    char * data;
+};
+
+
+/*****************************************************************************/
+/* SHARED MEMORY CHANNEL                                                     */
+/*****************************************************************************/
+
+/** Bidirectional message channel between two processes on the same host.
+
+    One side creates the channel, which allocates an anonymous shared memory
+    segment (memfd) holding one ring per direction along with an eventfd per
+    direction, then hands the file descriptors over to the other side through
+    a unix socket.  From then on messages never go through the kernel: the
+    eventfds are only written to when the reader might be asleep.
+
+    The channel is an AsyncEventSource that calls onMessage for every message
+    sent by the other side.  Several threads may send at the same time but
+    only one may process messages.
+*/
+struct SharedMemoryChannel : public AsyncEventSource {
+
+    enum {
+        DefaultRingSize = 4 << 20,
+        MaxBatch = 64        ///< messages handled per processOne() call
+    };
+
+    ~SharedMemoryChannel();
+
+    /** Creates a new channel with rings of the given size in bytes.  The
+        socket is the unix socket connected to the other side, which will be
+        used to hand it the file descriptors; the channel takes ownership of
+        it and uses it to know if the other side is still around.
+    */
+    static std::shared_ptr<SharedMemoryChannel>
+    create(int socket, size_t ringSize = DefaultRingSize);
+
+    /** Attaches to the channel that the other side created by receiving its
+        file descriptors on the given unix socket.  Blocks until they arrive.
+        The channel takes ownership of the socket.
+    */
+    static std::shared_ptr<SharedMemoryChannel> attach(int socket);
+
+    /** Sends a message to the other side.  Returns false if its ring is full,
+        meaning that it isn't keeping up or has gone away.
+    */
+    bool trySend(const std::vector<std::string> & message);
+
+    /** Returns false once the other side has closed its end of the socket. */
+    bool peerAlive() const;
+
+    std::function<void (std::vector<std::string> && message)> onMessage;
+
+    virtual int selectFd() const
+    {
+        return inFd;
+    }
+
+    virtual bool poll() const
+    {
+        return !in.empty();
+    }
+
+    virtual bool processOne();
+
+private:
+    SharedMemoryChannel();
+
+    void map(int memFd, size_t ringSize, bool creator);
+
+    int socket;
+    void * mem;
+    size_t memSize;
+
+    SharedMemoryRing out;
+    SharedMemoryRing in;
+    int outFd;   ///< signals the other side that out has messages
+    int inFd;    ///< signalled by the other side when in has messages
+
+    ML::Spinlock sendLock;
+};
+
+
+/*****************************************************************************/
+/* SHARED MEMORY LISTENER                                                    */
+/*****************************************************************************/
+
+/** Listens on a unix socket for processes that want a shared memory channel.
+
+    A client connects, writes its name followed by a newline and receives the
+    channel's file descriptors in return (see connectSharedMemoryChannel()).
+*/
+struct SharedMemoryListener : public AsyncEventSource {
+
+    SharedMemoryListener(const std::string & path,
+                         size_t ringSize = SharedMemoryChannel::DefaultRingSize);
+    ~SharedMemoryListener();
+
+    /** Called with the name of the client and its new channel, which still
+        needs to be added to a message loop.
+    */
+    std::function<void (const std::string & name,
+                        std::shared_ptr<SharedMemoryChannel> channel)>
+        onConnection;
+
+    virtual int selectFd() const
+    {
+        return fd;
+    }
+
+    virtual bool processOne();
+
+    const std::string path;
+
+private:
+    int fd;
+    size_t ringSize;
+};
+
+/** Connects to the SharedMemoryListener on the given path under the given
+    name and returns the channel that it created for us.
+*/
+std::shared_ptr<SharedMemoryChannel>
+connectSharedMemoryChannel(const std::string & path, const std::string & name);
+
+} // namespace Datacratic
@@ -89,6 +89,176 @@ BOOST_AUTO_TEST_CASE( test_message_channel )
     }
 }
 
+BOOST_AUTO_TEST_CASE( test_message_lane_sink )
+{
+    TypedMessageLaneSink<std::pair<int, int> > sink(64);
+
+    enum { NumPushThreads = 8, PerThread = 20000 };
+
+    int numReceived = 0;
+    int numDrained = 0;
+    int numOutOfOrder = 0;
+    vector<int> lastSeen(NumPushThreads, -1);
+
+    // Boost.Test assertions can't be made from the processing thread so the
+    // results are checked once it's done.
+    sink.onEvent = [&] (std::pair<int, int> && msg)
+        {
+            // Messages pushed by the same thread must stay in order.
+            if (msg.second != lastSeen[msg.first] + 1)
+                ++numOutOfOrder;
+            lastSeen[msg.first] = msg.second;
+            ++numReceived;
+        };
+
+    sink.onDrained = [&] () { ++numDrained; };
+
+    ML::Watchdog watchdog(30.0);
+
+    volatile bool finished = false;
+
+    auto pushThread = [&] (int thread)
+        {
+            for (int i = 0;  i < PerThread;  ++i)
+                sink.push(make_pair(thread, i));
+        };
+
+    auto processThread = [&] ()
+        {
+            while (!finished || sink.poll()) {
+                if (sink.poll())
+                    sink.processOne();
+            }
+        };
+
+    boost::thread processor(processThread);
+
+    boost::thread_group pushThreads;
+    for (unsigned i = 0;  i < NumPushThreads;  ++i)
+        pushThreads.create_thread(std::bind<void>(pushThread, i));
+    pushThreads.join_all();
+
+    finished = true;
+    processor.join();
+
+    BOOST_CHECK_EQUAL(numOutOfOrder, 0);
+    BOOST_CHECK_EQUAL(numReceived, NumPushThreads * PerThread);
+    BOOST_CHECK_EQUAL(sink.size(), 0);
+
+    // Every pass over the lanes hands over more than one message when the
+    // producers are busy.
+    cerr << "received " << numReceived << " messages in " << numDrained
+         << " passes" << endl;
+    BOOST_CHECK_LT(numDrained, numReceived);
+}
+
+BOOST_AUTO_TEST_CASE( test_message_lane_sink_thread_churn )
+{
+    typedef TypedMessageLaneSink<int> Sink;
+    Sink sink(4);
+
+    int numReceived = 0;
+    sink.onEvent = [&] (int && msg) { ++numReceived; };
+
+    ML::Watchdog watchdog(30.0);
+
+    // Lanes of the threads that exited are handed to the next ones so this
+    // never runs out of lanes.
+    for (unsigned i = 0;  i < 4 * Sink::MaxLanes;  ++i) {
+        std::thread pusher([&] () { sink.push(i); });
+        pusher.join();
+        sink.processOne();
+    }
+
+    BOOST_CHECK_EQUAL(numReceived, 4 * Sink::MaxLanes);
+
+    // More threads pushing at once than there are lanes end up sharing.
+    enum { NumPushThreads = Sink::MaxLanes + 64 };
+
+    std::atomic<int> pushed(0);
+    std::atomic<bool> release(false);
+    std::atomic<int> numFailed(0);
+
+    vector<std::thread> pushers;
+    for (unsigned i = 0;  i < NumPushThreads;  ++i) {
+        pushers.emplace_back([&] ()
+            {
+                try {
+                    sink.push(1);
+                } catch (...) {
+                    ++numFailed;
+                }
+                ++pushed;
+                while (!release) sched_yield();
+            });
+    }
+
+    while (pushed < NumPushThreads) {
+        sink.processOne();
+        sched_yield();
+    }
+    release = true;
+    for (auto & pusher : pushers) pusher.join();
+
+    while (sink.size()) sink.processOne();
+
+    BOOST_CHECK_EQUAL(numFailed, 0);
+    BOOST_CHECK_EQUAL(numReceived, 4 * Sink::MaxLanes + NumPushThreads);
+}
+
+BOOST_AUTO_TEST_CASE( test_message_lane_sink_many_sinks )
+{
+    typedef TypedMessageLaneSink<int> Sink;
+
+    enum { NumSinks = 8, PerSink = 1000, Rounds = 20 };
+
+    vector<std::unique_ptr<Sink> > sinks;
+    vector<int> numReceived(NumSinks, 0);
+    vector<int> numOutOfOrder(NumSinks, 0);
+
+    for (unsigned i = 0;  i < NumSinks;  ++i) {
+        sinks.emplace_back(new Sink(2 * PerSink));
+        int * received = &numReceived[i];
+        int * outOfOrder = &numOutOfOrder[i];
+        sinks.back()->onEvent = [=] (int && msg)
+            {
+                if (msg != *received % PerSink) ++*outOfOrder;
+                ++*received;
+            };
+    }
+
+    ML::Watchdog watchdog(30.0);
+
+    // A single producer that alternates between the sinks, like a thread
+    // feeding the shards of a sharded matcher, keeps its lane in each one.
+    double elapsed = 0.0;
+
+    for (unsigned round = 0;  round < Rounds;  ++round) {
+        std::thread producer([&] ()
+            {
+                ML::Timer timer;
+                for (int i = 0;  i < PerSink;  ++i)
+                    for (auto & sink : sinks)
+                        sink->push(i);
+                elapsed += timer.elapsed_wall();
+            });
+        producer.join();
+
+        for (auto & sink : sinks)
+            while (sink->size()) sink->processOne();
+    }
+
+    for (unsigned i = 0;  i < NumSinks;  ++i) {
+        BOOST_CHECK_EQUAL(numReceived[i], Rounds * PerSink);
+        BOOST_CHECK_EQUAL(numOutOfOrder[i], 0);
+        BOOST_CHECK_EQUAL(sinks[i]->lanesCreated(), 1);
+    }
+
+    cerr << "pushed " << (NumSinks * PerSink * Rounds / elapsed)
+         << " messages/s into " << NumSinks << " sinks from one thread"
+         << endl;
+}
+
 namespace Datacratic {
 
 BOOST_AUTO_TEST_CASE( test_typed_message_queue )
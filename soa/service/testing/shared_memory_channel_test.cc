@@ -0,0 +1,183 @@
+/* shared_memory_channel_test.cc                                   -*- C++ -*-
+   Copyright (c) 2013 Datacratic.  All rights reserved.
+
+   Tests for the shared memory message channel.
+*/
+
+#define BOOST_TEST_MAIN
+#define BOOST_TEST_DYN_LINK
+
+#include <boost/test/unit_test.hpp>
+#include "soa/service/shared_memory_channel.h"
+#include "jml/utils/testing/watchdog.h"
+
+#include <sys/socket.h>
+#include <sys/wait.h>
+#include <unistd.h>
+#include <thread>
+
+using namespace std;
+using namespace Datacratic;
+
+
+BOOST_AUTO_TEST_CASE( test_ring_wraparound )
+{
+    const size_t capacity = 1024;
+    vector<char> mem(SharedMemoryRing::bytesNeeded(capacity));
+
+    SharedMemoryRing writer, reader;
+    writer.init(&mem[0], capacity);
+    reader.attach(&mem[0]);
+
+    BOOST_CHECK(reader.empty());
+
+    vector<string> received;
+    bool wakeReader;
+
+    // Odd sized messages so that records land all over the ring and some
+    // of them need to wrap.
+    unsigned written = 0, read = 0;
+    for (unsigned round = 0;  round < 1000;  ++round) {
+        for (;;) {
+            vector<string> message = { "msg", to_string(written),
+                                       string(written % 97, 'x') };
+            if (!writer.tryWrite(message, wakeReader))
+                break;
+            ++written;
+        }
+
+        vector<string> message;
+        for (unsigned i = 0;  i < 3 && reader.tryRead(message);  ++i) {
+            BOOST_REQUIRE_EQUAL(message.size(), 3);
+            BOOST_REQUIRE_EQUAL(message[1], to_string(read));
+            BOOST_REQUIRE_EQUAL(message[2].size(), read % 97);
+            ++read;
+        }
+    }
+
+    vector<string> message;
+    while (reader.tryRead(message))
+        ++read;
+
+    BOOST_CHECK_EQUAL(read, written);
+    BOOST_CHECK(reader.empty());
+
+    // Only a write to an empty ring needs to wake up the reader.
+    BOOST_CHECK(writer.tryWrite({ "a" }, wakeReader));
+    BOOST_CHECK(wakeReader);
+    BOOST_CHECK(writer.tryWrite({ "b" }, wakeReader));
+    BOOST_CHECK(!wakeReader);
+
+    BOOST_CHECK_THROW(writer.tryWrite({ string(capacity, 'x') }, wakeReader),
+                      ML::Exception);
+}
+
+BOOST_AUTO_TEST_CASE( test_channel_socketpair )
+{
+    ML::Watchdog watchdog(10.0);
+
+    int sv[2];
+    BOOST_REQUIRE_EQUAL(socketpair(AF_UNIX, SOCK_STREAM, 0, sv), 0);
+
+    auto a = SharedMemoryChannel::create(sv[0], 4096);
+    auto b = SharedMemoryChannel::attach(sv[1]);
+
+    vector<vector<string> > atA, atB;
+    a->onMessage = [&] (vector<string> && message) { atA.push_back(message); };
+    b->onMessage = [&] (vector<string> && message) { atB.push_back(message); };
+
+    BOOST_CHECK(a->trySend({ "AUCTION", "1", "{}" }));
+    BOOST_CHECK(a->trySend({ "AUCTION", "2", "" }));
+    BOOST_CHECK(b->poll());
+    b->processOne();
+
+    BOOST_REQUIRE_EQUAL(atB.size(), 2);
+    BOOST_CHECK_EQUAL(atB[0][1], "1");
+    BOOST_CHECK_EQUAL(atB[1][2], "");
+
+    BOOST_CHECK(b->trySend({ "BID", "1" }));
+    a->processOne();
+    BOOST_REQUIRE_EQUAL(atA.size(), 1);
+    BOOST_CHECK_EQUAL(atA[0][0], "BID");
+
+    // A reader that doesn't keep up eventually fills its ring.
+    size_t sent = 0;
+    while (a->trySend({ "PING", string(100, 'x') }))
+        ++sent;
+    BOOST_CHECK_LT(sent, 4096 / 100);
+
+    BOOST_CHECK(a->peerAlive());
+    b.reset();
+    BOOST_CHECK(!a->peerAlive());
+}
+
+BOOST_AUTO_TEST_CASE( test_listener_across_processes )
+{
+    ML::Watchdog watchdog(30.0);
+
+    string path = "/tmp/shared_memory_channel_test."
+        + to_string(getpid()) + ".sock";
+
+    SharedMemoryListener listener(path, 1 << 16);
+
+    enum { NumMessages = 100000 };
+
+    pid_t pid = fork();
+    BOOST_REQUIRE_NE(pid, -1);
+
+    if (pid == 0) {
+        // Child: echo everything back until we get a STOP.
+        auto channel = connectSharedMemoryChannel(path, "child");
+        bool done = false;
+        channel->onMessage = [&] (vector<string> && message)
+            {
+                if (message[0] == "STOP") {
+                    done = true;
+                    return;
+                }
+                message[0] = "ECHO";
+                while (!channel->trySend(message))
+                    std::this_thread::yield();
+            };
+        while (!done)
+            channel->processOne();
+        _exit(0);
+    }
+
+    string name;
+    std::shared_ptr<SharedMemoryChannel> channel;
+    listener.onConnection = [&] (const string & n,
+                                 std::shared_ptr<SharedMemoryChannel> c)
+        {
+            name = n;
+            channel = c;
+        };
+
+    while (!channel)
+        listener.processOne();
+
+    BOOST_CHECK_EQUAL(name, "child");
+
+    size_t received = 0;
+    channel->onMessage = [&] (vector<string> && message)
+        {
+            BOOST_REQUIRE_EQUAL(message.at(0), "ECHO");
+            BOOST_REQUIRE_EQUAL(message.at(1), to_string(received));
+            ++received;
+        };
+
+    for (unsigned i = 0;  i < NumMessages;  ++i) {
+        while (!channel->trySend({ "MSG", to_string(i) }))
+            channel->processOne();
+    }
+
+    while (received < NumMessages)
+        channel->processOne();
+
+    channel->trySend({ "STOP" });
+
+    int status;
+    waitpid(pid, &status, 0);
+    BOOST_CHECK_EQUAL(status, 0);
+    BOOST_CHECK(!channel->peerAlive());
+}
@@ -10,9 +10,16 @@
 
 #include <queue>
 #include <thread>
+#include <algorithm>
+#include <atomic>
+#include <memory>
+#include <mutex>
+#include <vector>
+#include <sched.h>
 
 #include "jml/utils/ring_buffer.h"
 #include "jml/arch/wakeup_fd.h"
+#include "jml/arch/thread_specific.h"
 #include "soa/service/async_event_source.h"
 
 
@@ -33,6 +40,12 @@ struct TypedMessageSink: public AsyncEventSource {
 
     std::function<void (Message && message)> onEvent;
 
+    /** Called once the buffer has been emptied, after the onEvent of the
+        last message that was waiting.  Lets consumers batch up whatever
+        they do with the messages without adding latency.
+    */
+    std::function<void ()> onDrained;
+
     template<typename MessageT>
     void push(MessageT&& message)
     {
@@ -77,7 +90,10 @@ struct TypedMessageSink: public AsyncEventSource {
         // the next instruction to be accurate
         wakeup.tryRead();
 
-        return buf.couldPop();
+        bool more = buf.couldPop();
+        if (!more && onDrained)
+            onDrained();
+        return more;
     }
     uint64_t size() const { return buf.ring.size() ; }
 private:
@@ -86,6 +102,219 @@ private:
 };
 
 
+/*****************************************************************************/
+/* TYPED MESSAGE LANE SINK                                                   */
+/*****************************************************************************/
+
+/** Variant of the TypedMessageSink meant for a lot of producer threads.
+
+    Every thread that pushes into the sink gets its own lock-free lane so
+    that producers never contend with each other, and the wakeup fd is only
+    signalled when the consumer isn't already due to wake up.  Messages that
+    are pushed while the consumer is busy accumulate in the lanes and are
+    handed over in a single pass, followed by one call to onDrained() where
+    the consumer can flush whatever it batched up.
+
+    Ordering is only preserved between messages pushed by the same thread.
+
+    A thread's lane goes back to the sink when the thread exits so that
+    thread churn doesn't use up the lanes.  If more than MaxLanes threads are
+    pushing at once then the extra ones share the least used lanes.
+*/
+template<typename Message>
+struct TypedMessageLaneSink: public AsyncEventSource {
+
+    enum { MaxLanes = 256 };
+
+    TypedMessageLaneSink(size_t laneSize)
+        : laneSize(laneSize), numLanes(0),
+          wakeup(EFD_NONBLOCK), signalled(false)
+    {
+        std::fill(users, users + MaxLanes, 0);
+    }
+
+    ~TypedMessageLaneSink()
+    {
+        for (unsigned i = 0;  i < numLanes;  ++i)
+            delete lanes[i];
+    }
+
+    std::function<void (Message && message)> onEvent;
+
+    /** Called at the end of every pass over the lanes that handed over at
+        least one message.
+    */
+    std::function<void ()> onDrained;
+
+    /** Pushes a message in the calling thread's lane.  If the lane is full
+        then we wait for the consumer to make room.
+    */
+    template<typename MessageT>
+    void push(MessageT&& message)
+    {
+        Lane & lane = threadLane();
+
+        for (int tries = 0;  !lane.tryPush(std::forward<MessageT>(message));
+             ++tries)
+        {
+            signal();
+            if (tries >= 100) sched_yield();
+        }
+
+        signal();
+    }
+
+    template<typename MessageT>
+    bool tryPush(MessageT&& message)
+    {
+        if (!threadLane().tryPush(std::forward<MessageT>(message)))
+            return false;
+
+        signal();
+        return true;
+    }
+
+    //protected:
+    virtual int selectFd() const
+    {
+        return wakeup.fd();
+    }
+
+    virtual bool poll() const
+    {
+        return signalled;
+    }
+
+    virtual bool processOne()
+    {
+        // Re-arm before looking at the lanes; anything pushed from here on
+        // will signal again and get picked up by the next call.
+        signalled = false;
+        wakeup.tryRead();
+
+        unsigned n = numLanes;
+        size_t processed = 0;
+        bool more = false;
+
+        for (unsigned i = 0;  i < n;  ++i) {
+            Lane & lane = *lanes[i];
+
+            // Don't let a single busy producer starve the other lanes.
+            Message msg;
+            for (size_t j = 0;  j < laneSize && lane.tryPop(msg);  ++j) {
+                onEvent(std::move(msg));
+                ++processed;
+            }
+
+            more = more || lane.couldPop();
+        }
+
+        if (processed && onDrained)
+            onDrained();
+
+        return more;
+    }
+
+    uint64_t size() const
+    {
+        uint64_t result = 0;
+        unsigned n = numLanes;
+        for (unsigned i = 0;  i < n;  ++i)
+            result += lanes[i]->size();
+        return result;
+    }
+
+    /** Number of lanes that were created, in use or not. */
+    unsigned lanesCreated() const
+    {
+        return numLanes;
+    }
+
+private:
+    typedef ML::RingBufferMWMR<Message> Lane;
+
+    /** Lane of a thread for this sink.  Destroyed when either the thread
+        exits or the sink is destroyed, whichever comes first.
+    */
+    struct LaneHandle {
+        LaneHandle() : sink(nullptr), lane(0) {}
+
+        ~LaneHandle()
+        {
+            if (sink) sink->releaseLane(lane);
+        }
+
+        TypedMessageLaneSink * sink;
+        unsigned lane;
+    };
+
+    Lane & threadLane()
+    {
+        LaneHandle * handle = threadLanes.get();
+        if (JML_UNLIKELY(!handle->sink)) {
+            handle->lane = acquireLane();
+            handle->sink = this;
+        }
+        return *lanes[handle->lane];
+    }
+
+    unsigned acquireLane()
+    {
+        std::lock_guard<std::mutex> guard(lanesLock);
+
+        unsigned lane;
+        unsigned n = numLanes;
+
+        if (!freeLanes.empty()) {
+            lane = freeLanes.back();
+            freeLanes.pop_back();
+        }
+        else if (n < MaxLanes) {
+            lanes[n] = new Lane(laneSize);
+            lane = n;
+            numLanes = n + 1;
+        }
+        else lane = std::min_element(users, users + n) - users;
+
+        ++users[lane];
+        return lane;
+    }
+
+    /** Doesn't touch the lane itself since it may be called while the sink
+        is being destroyed.  Messages left in the lane are still drained.
+    */
+    void releaseLane(unsigned lane)
+    {
+        std::lock_guard<std::mutex> guard(lanesLock);
+        if (--users[lane] == 0)
+            freeLanes.push_back(lane);
+    }
+
+    void signal()
+    {
+        if (!signalled.exchange(true))
+            wakeup.signal();
+    }
+
+    size_t laneSize;
+
+    std::mutex lanesLock;
+    Lane * lanes[MaxLanes];
+    unsigned users[MaxLanes];
+    std::vector<unsigned> freeLanes;
+    std::atomic<unsigned> numLanes;
+
+    ML::Wakeup_Fd wakeup;
+    std::atomic<bool> signalled;
+
+    /** Last so that the handles are released while the rest of the sink is
+        still around.
+    */
+    ML::ThreadSpecificInstanceInfo<LaneHandle, TypedMessageLaneSink>
+        threadLanes;
+};
+
+
 /*****************************************************************************
  * TYPED MESSAGE QUEUE                                                       *
  *****************************************************************************/
@@ -1191,6 +1191,29 @@ struct ZmqMultipleNamedClientBusProxy: public MessageLoop {
         it->second->sendMessage(topic, std::forward<Args>(args)...);
     }
 
+    /** Same as sendMessage() but returns false instead of throwing when the
+        recipient is unknown.
+    */
+    template<typename... Args>
+    bool trySendMessage(const std::string & recipient,
+                        const std::string & topic,
+                        Args&&... args) const
+    {
+        std::unique_lock<Lock> guard(connectionsLock);
+        auto it = connections.find(recipient);
+        if (it == connections.end()) return false;
+
+        it->second->sendMessage(topic, std::forward<Args>(args)...);
+        return true;
+    }
+
+    bool isConnectedTo(const std::string & recipient) const
+    {
+        std::unique_lock<Lock> guard(connectionsLock);
+        auto it = connections.find(recipient);
+        return it != connections.end() && it->second->isConnected();
+    }
+
 
     template<typename... Args>
     bool sendMessageToShard(size_t shard,
@@ -381,6 +381,42 @@ inline bool trySendAll(zmq::socket_t & sock,
     return trySendAll(sock, std::vector<std::string>(message), lastFlags);
 }
 
+/* Encode the arguments exactly as sendMessage() would put them on the wire,
+   but into a vector of strings.  Used to carry the same messages over
+   transports other than zeromq.
+*/
+inline void encodeMessagePart(std::vector<std::string> & parts,
+                              const std::string & part)
+{
+    parts.push_back(part);
+}
+
+inline void encodeMessagePart(std::vector<std::string> & parts,
+                              const std::vector<std::string> & vals)
+{
+    parts.insert(parts.end(), vals.begin(), vals.end());
+}
+
+template<typename T>
+void encodeMessagePart(std::vector<std::string> & parts, const T & val)
+{
+    zmq::message_t msg = encodeMessage(val);
+    parts.emplace_back((const char *)msg.data(), msg.size());
+}
+
+inline void encodeMessageParts(std::vector<std::string> & parts)
+{
+}
+
+template<typename Arg1, typename... Args>
+void encodeMessageParts(std::vector<std::string> & parts,
+                        const Arg1 & arg1,
+                        const Args &... args)
+{
+    encodeMessagePart(parts, arg1);
+    encodeMessageParts(parts, args...);
+}
+
 /* We take a copy of the shared pointer in a heap-allocated object that
    makes sure that it continues to have a reference.  The control
    connection then takes control of the pointer.  This allows us to
@@ -80,6 +80,300 @@ expectFixedWidthInt(ML::Parse_Context & context,
     return result;
 }
 
+
+/*****************************************************************************/
+/* CIVIL CALENDAR                                                            */
+/*****************************************************************************/
+
+/* Conversions between days since the epoch and dates of the proleptic
+   Gregorian calendar, using the days_from_civil and civil_from_days
+   algorithms from Howard Hinnant.  They are exact for any date and much
+   cheaper than going through gmtime_r() or boost::gregorian.
+*/
+
+int64_t daysFromCivil(int year, unsigned month, unsigned day)
+{
+    year -= month <= 2;
+    int64_t era = (year >= 0 ? year : year - 399) / 400;
+    unsigned yearOfEra = year - era * 400;
+    unsigned dayOfYear = (153 * (month > 2 ? month - 3 : month + 9) + 2) / 5
+        + day - 1;
+    unsigned dayOfEra = yearOfEra * 365 + yearOfEra / 4 - yearOfEra / 100
+        + dayOfYear;
+    return era * 146097 + int64_t(dayOfEra) - 719468;
+}
+
+void civilFromDays(int64_t days, int & year, int & month, int & day)
+{
+    days += 719468;
+    int64_t era = (days >= 0 ? days : days - 146096) / 146097;
+    unsigned dayOfEra = days - era * 146097;
+    unsigned yearOfEra = (dayOfEra - dayOfEra / 1460 + dayOfEra / 36524
+                          - dayOfEra / 146096) / 365;
+    unsigned dayOfYear = dayOfEra
+        - (365 * yearOfEra + yearOfEra / 4 - yearOfEra / 100);
+    unsigned mp = (5 * dayOfYear + 2) / 153;
+
+    day = dayOfYear - (153 * mp + 2) / 5 + 1;
+    month = mp < 10 ? mp + 3 : mp - 9;
+    year = yearOfEra + era * 400 + (month <= 2);
+}
+
+bool isLeapYear(int year)
+{
+    return year % 4 == 0 && (year % 100 != 0 || year % 400 == 0);
+}
+
+/** Days since the epoch of the given date, which is checked the same way
+    as boost::gregorian::date does it.
+*/
+int64_t daysFromValidDate(int year, int month, int day)
+{
+    static const int monthDays[12]
+        = { 31, 28, 31, 30, 31, 30, 31, 31, 30, 31, 30, 31 };
+
+    if (year < 1400 || year > 9999)
+        throw ML::Exception("Date: year %d out of range", year);
+    if (month < 1 || month > 12)
+        throw ML::Exception("Date: month %d out of range", month);
+    if (day < 1
+        || day > monthDays[month - 1] + (month == 2 && isLeapYear(year)))
+        throw ML::Exception("Date: day %d out of range for %d-%02d",
+                            day, year, month);
+
+    return daysFromCivil(year, month, day);
+}
+
+/** Date and time of day that gmtime_r() would return for the given
+    date, whose fractional seconds are truncated just like when it's
+    converted to a time_t.
+*/
+struct CivilTime {
+    CivilTime(double secondsSinceEpoch)
+    {
+        if (!std::isfinite(secondsSinceEpoch))
+            throw ML::Exception("Date: can't break down a date that is "
+                                "not finite");
+
+        int64_t seconds = secondsSinceEpoch;
+        int64_t days = seconds / 86400;
+        int secondOfDay = seconds % 86400;
+        if (secondOfDay < 0) {
+            secondOfDay += 86400;
+            days -= 1;
+        }
+
+        civilFromDays(days, year, month, day);
+        hour = secondOfDay / 3600;
+        minute = secondOfDay / 60 % 60;
+        second = secondOfDay % 60;
+        weekday = (days % 7 + 11) % 7;  // 1970-01-01 was a Thursday
+        yearDay = days - daysFromCivil(year, 1, 1);
+    }
+
+    int year, month, day;       ///< month and day start at 1
+    int hour, minute, second;
+    int weekday;                ///< 0 is Sunday
+    int yearDay;                ///< 0 is January 1st
+};
+
+
+/*****************************************************************************/
+/* TIMESTAMP PRINTING                                                        */
+/*****************************************************************************/
+
+/* Dates are printed without strftime().  As logging and event timestamps
+   come in bunches within the same second, the part of the date that
+   doesn't change within a second is kept for each format in a per thread
+   cache.
+*/
+
+enum PrintStyle {
+    PRINT_DEFAULT,              ///< %Y-%b-%d %H:%M:%S
+    PRINT_ISO8601,              ///< %Y-%m-%dT%H:%M:%S
+    PRINT_CLASSIC,              ///< %Y-%m-%d %H:%M:%S
+    PRINT_RFC2616,              ///< %a, %d %b %Y %H:%M:%S GMT
+    NUM_PRINT_STYLES
+};
+
+struct PrintedSecond {
+    int64_t second;
+    unsigned length;            ///< zero when nothing was printed yet
+    char text[32];
+};
+
+__thread PrintedSecond printedSeconds[NUM_PRINT_STYLES];
+
+const char monthNames[12][4] = {
+    "Jan", "Feb", "Mar", "Apr", "May", "Jun",
+    "Jul", "Aug", "Sep", "Oct", "Nov", "Dec"
+};
+
+const char dayNames[7][4] = {
+    "Sun", "Mon", "Tue", "Wed", "Thu", "Fri", "Sat"
+};
+
+inline char * printDigits(char * p, unsigned value, int digits)
+{
+    for (int i = digits - 1;  i >= 0;  --i, value /= 10)
+        p[i] = '0' + value % 10;
+    return p + digits;
+}
+
+inline char * printName(char * p, const char * name)
+{
+    p[0] = name[0];  p[1] = name[1];  p[2] = name[2];
+    return p + 3;
+}
+
+/** Returns the whole seconds of the date printed in the given style, or
+    null if the date is out of the range that we handle here (strftime()
+    will then have to do it).
+*/
+const PrintedSecond *
+printWholeSeconds(double secondsSinceEpoch, PrintStyle style)
+{
+    // Same limits as Date::print(format)
+    if (!(secondsSinceEpoch < 100000000000.0
+          && secondsSinceEpoch > -1000000000000.0))
+        return 0;
+
+    int64_t seconds = secondsSinceEpoch;
+    PrintedSecond & printed = printedSeconds[style];
+    if (printed.length != 0 && printed.second == seconds)
+        return &printed;
+
+    CivilTime time(secondsSinceEpoch);
+    if (time.year < 0 || time.year > 9999)
+        return 0;
+
+    char * p = printed.text;
+    if (style == PRINT_RFC2616) {
+        p = printName(p, dayNames[time.weekday]);
+        *p++ = ',';  *p++ = ' ';
+        p = printDigits(p, time.day, 2);
+        *p++ = ' ';
+        p = printName(p, monthNames[time.month - 1]);
+        *p++ = ' ';
+        p = printDigits(p, time.year, 4);
+        *p++ = ' ';
+    }
+    else {
+        p = printDigits(p, time.year, 4);
+        *p++ = '-';
+        if (style == PRINT_DEFAULT)
+            p = printName(p, monthNames[time.month - 1]);
+        else p = printDigits(p, time.month, 2);
+        *p++ = '-';
+        p = printDigits(p, time.day, 2);
+        *p++ = (style == PRINT_ISO8601 ? 'T' : ' ');
+    }
+
+    p = printDigits(p, time.hour, 2);
+    *p++ = ':';
+    p = printDigits(p, time.minute, 2);
+    *p++ = ':';
+    p = printDigits(p, time.second, 2);
+
+    if (style == PRINT_RFC2616) {
+        memcpy(p, " GMT", 4);
+        p += 4;
+    }
+
+    printed.second = seconds;
+    printed.length = p - printed.text;
+    return &printed;
+}
+
+/** Appends the fractional seconds with the given number of digits, rounded
+    the same way as printf() does it, including its habit of printing
+    "1.000" for a fraction that rounds up to a whole second, which the
+    callers have always turned into ".000".  Returns false if that can't
+    be done without printf().
+*/
+bool appendFraction(std::string & result, double fraction, unsigned digits)
+{
+    static const long double scales[10] = {
+        1e0L, 1e1L, 1e2L, 1e3L, 1e4L, 1e5L, 1e6L, 1e7L, 1e8L, 1e9L
+    };
+
+    if (std::signbit(fraction) || digits > 9)
+        return false;
+    if (digits == 0)
+        return true;
+
+    // Rounds half to even, as printf() does
+    uint64_t scaled = nearbyintl(fraction * scales[digits]);
+    if (scaled >= scales[digits])
+        scaled = 0;
+
+    char buf[10];
+    buf[0] = '.';
+    printDigits(buf + 1, scaled, digits);
+    result.append(buf, digits + 1);
+    return true;
+}
+
+
+/*****************************************************************************/
+/* ISO 8601 LAYOUT MATCHING                                                  */
+/*****************************************************************************/
+
+const uint64_t allBytes = 0x0101010101010101ULL;
+
+/** Loads 8 characters from an unaligned address; the first one ends up in
+    the lowest byte.
+*/
+inline uint64_t load8(const char * p)
+{
+    uint64_t result;
+    memcpy(&result, p, 8);
+    return result;
+}
+
+/** Mask of the bytes that are '0' in the layout, which stand for digits. */
+uint64_t digitBytes(const char * layout)
+{
+    uint64_t result = 0;
+    for (unsigned i = 0;  i < 8;  ++i)
+        if (layout[i] == '0')
+            result |= 0xffULL << (8 * i);
+    return result;
+}
+
+/** Matches a word of 8 characters against a layout such as "0000-00-",
+    whose zeros stand for any digit and other characters must be there as
+    is, with a handful of word operations.  On success, the digits are left
+    as values from 0 to 9 in their bytes.
+*/
+inline bool matchLayout(uint64_t word, uint64_t layout, uint64_t digitMask,
+                        uint64_t & digits)
+{
+    if ((word & ~digitMask) != (layout & ~digitMask))
+        return false;
+
+    // Digits are the bytes from 0x30 to 0x39; the other bytes are replaced
+    // with a zero digit so that nothing carries over from one byte to the
+    // next.
+    uint64_t d = (word & digitMask) | (0x30 * allBytes & ~digitMask);
+    if ((d & 0xf0 * allBytes) != 0x30 * allBytes
+        || ((d + 0x06 * allBytes) & 0xf0 * allBytes) != 0x30 * allBytes)
+        return false;
+
+    digits = d - 0x30 * allBytes;
+    return true;
+}
+
+inline int digitAt(uint64_t digits, int i)
+{
+    return (digits >> (8 * i)) & 0xff;
+}
+
+inline int twoDigitsAt(uint64_t digits, int i)
+{
+    return digitAt(digits, i) * 10 + digitAt(digits, i + 1);
+}
+
 }
 
 namespace Datacratic {
@@ -99,11 +393,9 @@ Date::
 Date(int year, int month, int day,
      int hour, int minute, int second,
      double fraction)
-    : secondsSinceEpoch_((boost::posix_time::ptime
-                            (boost::gregorian::date(year, month, day)) - epoch)
-                           .total_seconds()
-                           + 3600 * hour + 60 * minute + second
-                           + fraction)
+    : secondsSinceEpoch_(daysFromValidDate(year, month, day) * 86400
+                         + 3600 * hour + 60 * minute + second
+                         + fraction)
 {
 }
 
@@ -279,6 +571,14 @@ print(unsigned seconds_digits) const
         else return "-Inf";
     }
 
+    if (auto printed = printWholeSeconds(secondsSinceEpoch_, PRINT_DEFAULT)) {
+        string result;
+        result.reserve(printed->length + 1 + seconds_digits);
+        result.append(printed->text, printed->length);
+        if (appendFraction(result, fractionalSeconds(), seconds_digits))
+            return result;
+    }
+
     string result = print("%Y-%b-%d %H:%M:%S");
     if (seconds_digits == 0) return result;
 
@@ -303,6 +603,9 @@ printRfc2616() const
         else return "-Inf";
     }
 
+    if (auto printed = printWholeSeconds(secondsSinceEpoch_, PRINT_RFC2616))
+        return string(printed->text, printed->length);
+
     return print("%a, %d %b %Y %H:%M:%S GMT");
 }
 
@@ -320,6 +623,16 @@ printIso8601(unsigned int fraction) const
         else return "-Inf";
     }
 
+    if (auto printed = printWholeSeconds(secondsSinceEpoch_, PRINT_ISO8601)) {
+        string result;
+        result.reserve(printed->length + 2 + fraction);
+        result.append(printed->text, printed->length);
+        if (appendFraction(result, fractionalSeconds(), fraction)) {
+            result += 'Z';
+            return result;
+        }
+    }
+
     string result = print("%Y-%m-%dT%H:%M:%S");
 
     if (result == "Inf" || result == "-Inf" || result == "NaD")
@@ -347,6 +660,9 @@ printClassic() const
         else return "-Inf";
     }
 
+    if (auto printed = printWholeSeconds(secondsSinceEpoch_, PRINT_CLASSIC))
+        return string(printed->text, printed->length);
+
     return print("%Y-%m-%d %H:%M:%S");
 }
 
@@ -430,39 +746,21 @@ int
 Date::
 hour() const
 {
-    time_t t = secondsSinceEpoch();
-    tm time;
-
-    if (!gmtime_r(&t, &time))
-        throw Exception("problem with gmtime_r");
-
-    return time.tm_hour;
+    return CivilTime(secondsSinceEpoch_).hour;
 }
 
 int
 Date::
 minute() const
 {
-    time_t t = secondsSinceEpoch();
-    tm time;
-
-    if (!gmtime_r(&t, &time))
-        throw Exception("problem with gmtime_r");
-
-    return time.tm_min;
+    return CivilTime(secondsSinceEpoch_).minute;
 }
 
 int
 Date::
 second() const
 {
-    time_t t = secondsSinceEpoch();
-    tm time;
-
-    if (!gmtime_r(&t, &time))
-        throw Exception("problem with gmtime_r");
-
-    return time.tm_sec;
+    return CivilTime(secondsSinceEpoch_).second;
 }
 
 int
@@ -470,17 +768,7 @@ Date::
 weekday()
     const
 {
-    using namespace boost::gregorian;
-
-    int day_of_week;
-    try {
-        day_of_week = from_string(print()).day_of_week();
-    } catch (...) {
-        cerr << "order_date = " << *this << endl;
-        throw;
-    }
-
-    return day_of_week;
+    return CivilTime(secondsSinceEpoch_).weekday;
 }
 
 int
@@ -501,7 +789,7 @@ int
 Date::
 dayOfMonth() const
 {
-    return boost::gregorian::from_string(print()).day();
+    return CivilTime(secondsSinceEpoch_).day;
 }
 
 int
@@ -509,12 +797,7 @@ Date::
 dayOfYear()
     const
 {
-    time_t t = secondsSinceEpoch_;
-    struct tm time;
-
-    ::gmtime_r(&t, &time);
-
-    return time.tm_yday;
+    return CivilTime(secondsSinceEpoch_).yearDay;
 }
 
 int
@@ -554,27 +837,22 @@ int
 Date::
 monthOfYear() const
 {
-    return boost::gregorian::from_string(print()).month();
+    return CivilTime(secondsSinceEpoch_).month;
 }
 
 int
 Date::
 year() const
 {
-    return boost::gregorian::from_string(print()).year();
+    return CivilTime(secondsSinceEpoch_).year;
 }
 
 int
 Date::
 hourOfWeek() const
 {
-    time_t t = secondsSinceEpoch();
-    tm time;
-
-    if (!gmtime_r(&t, &time))
-        throw Exception("problem with gmtime_r");
-
-    return time.tm_wday * 24 + time.tm_hour;
+    CivilTime time(secondsSinceEpoch_);
+    return time.weekday * 24 + time.hour;
 }
 
 std::string
@@ -1259,6 +1537,94 @@ DB::Store_Reader & operator >> (ML::DB::Store_Reader & store, Date & date)
 /* ISO8601PARSER                                                             */
 /*****************************************************************************/
 
+bool
+Iso8601Parser::
+matchCommonDateTime(const char * str, size_t length, Date & result)
+{
+    static const uint64_t dateLayout = load8("0000-00-");
+    static const uint64_t dateDigits = digitBytes("0000-00-");
+    static const uint64_t dayLayout = load8("00T00:00");
+    static const uint64_t dayDigits = digitBytes("00T00:00");
+    static const uint64_t timeLayout = load8("00:00:00");
+    static const uint64_t timeDigits = digitBytes("00:00:00");
+
+    if (length < 19 || (str[10] != 'T' && str[10] != ' '))
+        return false;
+
+    // The date and time separator can be either; make it a 'T'
+    uint64_t dayWord = (load8(str + 8) & ~(0xffULL << 16))
+        | (uint64_t('T') << 16);
+
+    uint64_t date, day, time;
+    if (!matchLayout(load8(str), dateLayout, dateDigits, date)
+        || !matchLayout(dayWord, dayLayout, dayDigits, day)
+        || !matchLayout(load8(str + 11), timeLayout, timeDigits, time))
+        return false;
+
+    int year = twoDigitsAt(date, 0) * 100 + twoDigitsAt(date, 2);
+    int month = twoDigitsAt(date, 5);
+    int monthDay = twoDigitsAt(day, 0);
+    int hours = twoDigitsAt(time, 0);
+    int minutes = twoDigitsAt(time, 3);
+    int seconds = twoDigitsAt(time, 6);
+
+    // Same ranges as the generic parser
+    if (year < 1400 || month < 1 || month > 12 || monthDay < 1
+        || monthDay > 31 || hours > 23 || minutes > 59 || seconds > 60)
+        return false;
+
+    const char * p = str + 19;
+    const char * end = str + length;
+
+    int fraction = 0, fractionDigits = 0;
+    if (p < end && *p == '.') {
+        for (++p;  p < end && *p >= '0' && *p <= '9';  ++p) {
+            if (++fractionDigits > 9)
+                return false;
+            fraction = fraction * 10 + (*p - '0');
+        }
+        if (fractionDigits == 0)
+            return false;
+    }
+
+    int tzMinutes = 0;
+    if (p < end && *p == 'Z')
+        ++p;
+    else if (p < end && (*p == '+' || *p == '-')) {
+        int sign = (*p++ == '+' ? 1 : -1);
+        if (end - p < 2 || !isdigit(p[0]) || !isdigit(p[1]))
+            return false;
+        int tzHours = (p[0] - '0') * 10 + (p[1] - '0');
+        p += 2;
+        if (p < end && *p == ':')
+            ++p;
+        if (end - p >= 2 && isdigit(p[0]) && isdigit(p[1])) {
+            tzMinutes = (p[0] - '0') * 10 + (p[1] - '0');
+            p += 2;
+        }
+        if (tzHours > 23 || tzMinutes > 59)
+            return false;
+        tzMinutes = sign * (tzHours * 60 + tzMinutes);
+    }
+
+    if (p != end)
+        return false;
+
+    // Add things up in the same order as expectDateTime() so that we get
+    // exactly the same result.
+    Date timeOfDay;
+    timeOfDay.addHours(hours);
+    timeOfDay.addMinutes(minutes);
+    timeOfDay.addSeconds(seconds);
+    if (fractionDigits)
+        timeOfDay.addSeconds(double(fraction) / pow(10, fractionDigits));
+    timeOfDay.addMinutes(tzMinutes);
+
+    result = Date(year, month, monthDay);
+    result.addSeconds(timeOfDay.secondsSinceEpoch());
+    return true;
+}
+
 Date
 Iso8601Parser::
 expectDateTime()
@@ -433,10 +433,23 @@ struct Iso8601Parser : public ML::Parse_Context
 {
     static Date parseDateTimeString(const std::string & dateTimeStr)
     {
+        Date result;
+        if (matchCommonDateTime(dateTimeStr.c_str(), dateTimeStr.size(),
+                                result))
+            return result;
+
         Iso8601Parser parser(dateTimeStr);
         return parser.expectDateTime();
     }
 
+    /** Parses the "YYYY-MM-DDTHH:MM:SS[.sss][Z|+HH:MM]" layout that nearly
+        every date we see comes in, eight characters at a time.  Returns
+        false if the string has any other layout or an out of range field,
+        in which case it's up to the generic parser to accept or reject it.
+    */
+    static bool matchCommonDateTime(const char * str, size_t length,
+                                    Date & result);
+
     static Date parseTimeString(const std::string & timeStr)
     {
         Iso8601Parser parser(timeStr);
@@ -12,6 +12,10 @@
 #include "jml/utils/exc_assert.h"
 #include "soa/jsoncpp/value.h"
 
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
 using namespace ML;
 using namespace std;
 
@@ -24,8 +28,6 @@ namespace Datacratic {
 /*****************************************************************************/
 
 
-static const size_t max64_base10_len = sizeof("9223372036854775807") - 1;
-
 static const signed char hexToDecLookups[128] = {
     -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1,
     -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1,
@@ -94,6 +96,269 @@ inline int hexToDec2(int c)
     return v;
 }
 
+/*****************************************************************************/
+/* VECTORISED DECODING AND ENCODING                                          */
+/*****************************************************************************/
+
+/* Ids come in with every bid request, win and event, so the common formats
+   are decoded and encoded 16 characters at a time with SSE2, which every
+   x86-64 CPU has.  There are scalar versions of everything for other
+   architectures; both give exactly the same results.
+*/
+
+/** A range of characters of an alphabet, along with what to add to them to
+    get their value.
+*/
+struct CharRange {
+    char first, last;
+    signed char offset;
+};
+
+// Base64 alphabet of BASE64_96 ids, in ASCII order (see base64ToDecLookups)
+static const CharRange base64Ranges[5] = {
+    { '+', '+',  0 - '+' },
+    { '/', '/',  1 - '/' },
+    { '0', '9',  2 - '0' },
+    { 'A', 'Z', 12 - 'A' },
+    { 'a', 'z', 38 - 'a' }
+};
+
+// Base64 alphabet of GOOG128 ids
+static const CharRange googRanges[5] = {
+    { '0', '9',  0 - '0' },
+    { 'A', 'Z', 10 - 'A' },
+    { 'a', 'z', 36 - 'a' },
+    { '-', '-', 62 - '-' },
+    { '_', '_', 63 - '_' }
+};
+
+static const char hexDigits[] = "0123456789abcdef";
+
+static const char base64Digits[]
+    = "+/0123456789ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz";
+
+static const char googDigits[]
+    = "0123456789ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz-_";
+
+#ifdef __SSE2__
+
+/** Mask of the bytes of chars that are between first and last inclusive.
+    Bytes over 0x7f compare as negative and are never in a range.
+*/
+JML_ALWAYS_INLINE __m128i inRange(__m128i chars, char first, char last)
+{
+    return _mm_and_si128(_mm_cmpgt_epi8(chars, _mm_set1_epi8(first - 1)),
+                         _mm_cmplt_epi8(chars, _mm_set1_epi8(last + 1)));
+}
+
+/** Decodes 16 hex digits, upper or lower case, into a 64 bit value.
+    Returns false if any of them isn't a hex digit.
+*/
+static bool decodeHex16(const char * p, uint64_t & result)
+{
+    __m128i chars = _mm_loadu_si128((const __m128i *)p);
+    __m128i lower = _mm_or_si128(chars, _mm_set1_epi8(0x20));
+
+    __m128i digit = inRange(chars, '0', '9');
+    __m128i letter = inRange(lower, 'a', 'f');
+    if (_mm_movemask_epi8(_mm_or_si128(digit, letter)) != 0xffff)
+        return false;
+
+    __m128i nibbles
+        = _mm_or_si128(_mm_and_si128(digit,
+                                     _mm_sub_epi8(chars, _mm_set1_epi8('0'))),
+                       _mm_andnot_si128(digit,
+                                        _mm_sub_epi8(lower,
+                                                     _mm_set1_epi8('a' - 10))));
+
+    // Each pair of nibbles becomes a byte, first one in the high half
+    __m128i bytes = _mm_and_si128(_mm_or_si128(_mm_slli_epi16(nibbles, 4),
+                                               _mm_srli_epi16(nibbles, 8)),
+                                  _mm_set1_epi16(0xff));
+    bytes = _mm_packus_epi16(bytes, bytes);
+
+    uint64_t bigEndian;
+    _mm_storel_epi64((__m128i *)&bigEndian, bytes);
+    result = __builtin_bswap64(bigEndian);
+    return true;
+}
+
+/** Writes the 16 lowercase hex digits of a 64 bit value. */
+static void encodeHex16(uint64_t value, char * p)
+{
+    __m128i bytes = _mm_cvtsi64_si128(__builtin_bswap64(value));
+    __m128i low = _mm_and_si128(bytes, _mm_set1_epi8(0x0f));
+    __m128i high = _mm_and_si128(_mm_srli_epi16(bytes, 4),
+                                 _mm_set1_epi8(0x0f));
+    __m128i nibbles = _mm_unpacklo_epi8(high, low);
+
+    __m128i letters = _mm_and_si128(_mm_cmpgt_epi8(nibbles, _mm_set1_epi8(9)),
+                                    _mm_set1_epi8('a' - '0' - 10));
+    __m128i chars = _mm_add_epi8(_mm_add_epi8(nibbles, _mm_set1_epi8('0')),
+                                 letters);
+    _mm_storeu_si128((__m128i *)p, chars);
+}
+
+/** Maps 16 characters to their value in an alphabet made of the given
+    ranges.  Returns false if any of them isn't in the alphabet.
+*/
+static bool decodeChars16(const char * p, const CharRange (&ranges)[5],
+                          uint8_t * values)
+{
+    __m128i chars = _mm_loadu_si128((const __m128i *)p);
+    __m128i found = _mm_setzero_si128();
+    __m128i offsets = _mm_setzero_si128();
+
+    for (const CharRange & range: ranges) {
+        __m128i in = inRange(chars, range.first, range.last);
+        found = _mm_or_si128(found, in);
+        offsets = _mm_or_si128(offsets,
+                               _mm_and_si128(in, _mm_set1_epi8(range.offset)));
+    }
+
+    if (_mm_movemask_epi8(found) != 0xffff)
+        return false;
+
+    _mm_storeu_si128((__m128i *)values, _mm_add_epi8(chars, offsets));
+    return true;
+}
+
+/** Returns true if the 16 characters are all decimal digits. */
+static bool allDigits16(const char * p)
+{
+    __m128i chars = _mm_loadu_si128((const __m128i *)p);
+    return _mm_movemask_epi8(inRange(chars, '0', '9')) == 0xffff;
+}
+
+/** Value of 16 decimal digits; pairs of digits are combined, then pairs
+    of pairs with multiply-adds.
+*/
+static uint64_t decodeDecimal16(const char * p)
+{
+    __m128i digits = _mm_sub_epi8(_mm_loadu_si128((const __m128i *)p),
+                                  _mm_set1_epi8('0'));
+    __m128i zero = _mm_setzero_si128();
+    __m128i tens = _mm_set_epi16(1, 10, 1, 10, 1, 10, 1, 10);
+    __m128i hundreds = _mm_set_epi16(1, 100, 1, 100, 1, 100, 1, 100);
+
+    __m128i pairs
+        = _mm_packs_epi32(_mm_madd_epi16(_mm_unpacklo_epi8(digits, zero), tens),
+                          _mm_madd_epi16(_mm_unpackhi_epi8(digits, zero), tens));
+    __m128i quads = _mm_madd_epi16(pairs, hundreds);
+
+    uint32_t q[4];
+    _mm_storeu_si128((__m128i *)q, quads);
+    return (q[0] * 10000ULL + q[1]) * 100000000ULL + (q[2] * 10000ULL + q[3]);
+}
+
+#else // no SSE2
+
+static bool decodeHex16(const char * p, uint64_t & result)
+{
+    uint64_t val = 0;
+    for (unsigned i = 0;  i < 16;  ++i) {
+        int v = hexToDec(p[i]);
+        if (v == -1)
+            return false;
+        val = (val << 4) + v;
+    }
+    result = val;
+    return true;
+}
+
+static void encodeHex16(uint64_t value, char * p)
+{
+    for (int i = 15;  i >= 0;  --i, value >>= 4)
+        p[i] = hexDigits[value & 15];
+}
+
+static bool decodeChars16(const char * p, const CharRange (&ranges)[5],
+                          uint8_t * values)
+{
+    for (unsigned i = 0;  i < 16;  ++i) {
+        bool found = false;
+        for (const CharRange & range: ranges) {
+            if (p[i] >= range.first && p[i] <= range.last) {
+                values[i] = p[i] + range.offset;
+                found = true;
+                break;
+            }
+        }
+        if (!found)
+            return false;
+    }
+    return true;
+}
+
+static bool allDigits16(const char * p)
+{
+    for (unsigned i = 0;  i < 16;  ++i)
+        if (p[i] < '0' || p[i] > '9')
+            return false;
+    return true;
+}
+
+static uint64_t decodeDecimal16(const char * p)
+{
+    uint64_t result = 0;
+    for (unsigned i = 0;  i < 16;  ++i)
+        result = result * 10 + p[i] - '0';
+    return result;
+}
+
+#endif // __SSE2__
+
+/** Value of a string of decimal digits, which wraps around at 128 bits.
+    Returns false if there's anything else than digits in it.
+*/
+static bool decodeDecimal(const char * p, size_t len, __uint128_t & result)
+{
+    size_t head = len % 16;
+    __uint128_t val = 0;
+    for (unsigned i = 0;  i < head;  ++i) {
+        if (p[i] < '0' || p[i] > '9')
+            return false;
+        val = val * 10 + p[i] - '0';
+    }
+
+    for (const char * block = p + head;  block < p + len;  block += 16) {
+        if (!allDigits16(block))
+            return false;
+        val = val * 10000000000000000ULL + decodeDecimal16(block);
+    }
+
+    result = val;
+    return true;
+}
+
+/** Writes the decimal digits of a value, which is written backwards from
+    end, and returns where it starts.
+*/
+static char * encodeDecimal(uint64_t value, char * end)
+{
+    static const char pairs[] =
+        "00010203040506070809101112131415161718192021222324252627282930313233"
+        "34353637383940414243444546474849505152535455565758596061626364656667"
+        "68697071727374757677787980818283848586878889909192939495969798990";
+
+    char * p = end;
+    while (value >= 100) {
+        unsigned pair = value % 100;
+        value /= 100;
+        p -= 2;
+        p[0] = pairs[2 * pair];
+        p[1] = pairs[2 * pair + 1];
+    }
+    if (value >= 10) {
+        p -= 2;
+        p[0] = pairs[2 * value];
+        p[1] = pairs[2 * value + 1];
+    }
+    else *--p = '0' + value;
+
+    return p;
+}
+
 void
 Id::
 parse(const char * value, size_t len, Type type)
@@ -145,35 +410,21 @@ parse(const char * value, size_t len, Type type)
         if (value[18] != '-') break;
         if (value[23] != '-') break;
 
-        unsigned f1;
-        short f2, f3, f4;
-        unsigned long long f5;
-
-        const char * p = value;
-        bool failed = false;
-
-        auto scanRange = [&] (int start, int len) -> unsigned long long
-            {
-                unsigned long long val = 0;
-                for (unsigned i = start;  i != start + len;  ++i) {
-                    int c = p[i];
-                    int v = hexToDec(c);
-                    if (v == -1) {
-                        failed = true;
-                        return val;
-                    }
-                    val = (val << 4) + v;
-                }
-                return val;
-            };
-
-        f1 = scanRange(0, 8);
-        f2 = scanRange(9, 4);
-        f3 = scanRange(14, 4);
-        if (failed) break;
-        f4 = scanRange(19, 4);
-        f5 = scanRange(24, 12);
-        if (failed) break;
+        // Gather the 32 hex digits and decode them as two 64 bit halves
+        char digits[32];
+        memcpy(digits, value, 8);
+        memcpy(digits + 8, value + 9, 4);
+        memcpy(digits + 12, value + 14, 4);
+        memcpy(digits + 16, value + 19, 4);
+        memcpy(digits + 20, value + 24, 12);
+
+        uint64_t high, low;
+        if (!decodeHex16(digits, high) || !decodeHex16(digits + 16, low))
+            break;
+
+        unsigned f1 = high >> 32;
+        unsigned short f2 = high >> 16, f3 = high, f4 = low >> 48;
+        unsigned long long f5 = low & ((1ULL << 48) - 1);
 
         r.type = UUID;
         r.f1 = f1;  r.f2 = f2;  r.f3 = f3;  r.f4 = f4;  r.f5 = f5;
@@ -189,31 +440,15 @@ parse(const char * value, size_t len, Type type)
 
         // Google ID: --> CAESEAYra3NIxLT9C8twKrzqaA
 
-        __uint128_t res = 0;
-
-        auto b64Decode = [] (int c) -> int
-            {
-                if (c >= '0' && c <= '9')
-                    return c - '0';
-                else if (c >= 'A' && c <= 'Z')
-                    return 10 + c - 'A';
-                else if (c >= 'a' && c <= 'z')
-                    return 36 + c - 'a';
-                else if (c == '-')
-                    return 62;
-                else if (c == '_')
-                    return 63;
-                else return -1;
-            };
-
-        bool error = false;
-        for (unsigned i = 5;  i < 26 && !error;  ++i) {
-            int v = b64Decode(value[i]);
-            if (v == -1) error = true;
-            res = (res << 6) | v;
-        }
+        // 21 digits; the two blocks of 16 overlap
+        uint8_t digits[21];
+        if (decodeChars16(value + 5, googRanges, digits)
+            && decodeChars16(value + 10, googRanges, digits + 5)) {
+
+            __uint128_t res = 0;
+            for (unsigned i = 0;  i < 21;  ++i)
+                res = (res << 6) | digits[i];
 
-        if (!error) {
             r.type = GOOG128;
             r.val = res;
             finish();
@@ -225,60 +460,24 @@ parse(const char * value, size_t len, Type type)
         && value[0] != '0' && len < 40 /* TODO: better condition */) {
         // Try a big integer
         //ANID: --> 7394206091425759590
-        uint64_t res64(0);
-        bool error = false;
-
-        int maxLowLen = min(len, max64_base10_len);
-        for (unsigned i = 0; i < maxLowLen; ++i) {
-            if (!isdigit(value[i])) {
-                error = true;
-                break;
-            }
-            res64 = 10 * res64 + value[i] - '0';
-        }
-
-        if (!error) {
-            if (len <= max64_base10_len) {
-                r.type = BIGDEC;
-                r.val1 = res64;
-                finish();
-                return;
-            }
-            else {
-                __uint128_t res128 = res64;
-                for (unsigned i = maxLowLen; i < len; ++i) {
-                    if (!isdigit(value[i])) {
-                        error = true;
-                        break;
-                    }
-                    res128 = res128 * 10 + value[i] - '0';
-                }
-                if (!error) {
-                    r.type = BIGDEC;
-                    r.val = res128;
-                    finish();
-                    return;
-                }
-            }
+        __uint128_t res;
+        if (decodeDecimal(value, len, res)) {
+            r.type = BIGDEC;
+            r.val = res;
+            finish();
+            return;
         }
     }
 
     if ((type == UNKNOWN || type == BASE64_96) && len == 16) {
-        auto scanRange = [&] (const char * p, size_t l) -> int64_t
-            {
-                uint64_t res = 0;
-                for (unsigned i = 0;  i < l;  ++i) {
-                    int c = base64ToDec(p[i]);
-                    if (c == -1) return -1;
-                    res = res << 6 | c;
-                }
-                return res;
-            };
-        
-        int64_t high = scanRange(value, 8);
-        int64_t low  = scanRange(value + 8, 8);
-
-        if (low != -1 && high != -1) {
+        uint8_t digits[16];
+        if (decodeChars16(value, base64Ranges, digits)) {
+            uint64_t high = 0, low = 0;
+            for (unsigned i = 0;  i < 8;  ++i) {
+                high = high << 6 | digits[i];
+                low = low << 6 | digits[i + 8];
+            }
+
             __int128_t val = high;
             val <<= 48;
             val |= low;
@@ -293,45 +492,15 @@ parse(const char * value, size_t len, Type type)
     //cerr << "len = " << len
     //     << " value = " << value << " type = " << (int)type << endl;
 
-    while ((type == UNKNOWN || type == HEX128LC) && len == 32) {
+    if ((type == UNKNOWN || type == HEX128LC) && len == 32) {
         uint64_t high, low;
-
-        const char * p = value;
-        bool failed = false;
-
-        auto scanRange = [&] (int start, int len) -> unsigned long long
-            {
-                uint64_t val = 0;
-                for (unsigned i = start;  i != start + len;  ++i) {
-                    int c = p[i];
-                    int v = hexToDec(c);
-
-                    //cerr << "c = " << c << " " << p[i] << " v = " << v << endl;
-
-                    if (v == -1) {
-                        failed = true;
-                        return val;
-                    }
-                    val = (val << 4) + v;
-                }
-
-                //cerr << "val = " << val << " failed = " << failed << endl;
-
-                return val;
-            };
-
-        high = scanRange(0, 16);
-        if (failed)
-            break;
-        low = scanRange(16, 16);
-        if (failed)
-            break;
-
-        r.type = HEX128LC;
-        r.val1 = high;
-        r.val2 = low;
-        finish();
-        return;
+        if (decodeHex16(value, high) && decodeHex16(value + 16, low)) {
+            r.type = HEX128LC;
+            r.val1 = high;
+            r.val2 = low;
+            finish();
+            return;
+        }
     }
 
     // Fall back to string
@@ -370,90 +539,119 @@ std::string
 Id::
 toString() const
 {
+    if (type == STR)
+        return std::string(str, len);
+
+    char buffer[64];
+    size_t length = toString(buffer, sizeof(buffer));
+    if (length <= sizeof(buffer))
+        return std::string(buffer, length);
+
+    // Long compound ids
+    std::string result(length, '\0');
+    toString(&result[0], length);
+    return result;
+}
+
+size_t
+Id::
+toString(char * buffer, size_t capacity) const
+{
+    auto fits = [&] (size_t length) { return length <= capacity; };
+
     switch (type) {
     case NONE:
-        return "";
+        return 0;
     case NULLID:
-        return "null";
-    case UUID:
+        if (fits(4))
+            memcpy(buffer, "null", 4);
+        return 4;
+    case UUID: {
         // AGID: --> 0828398c-5965-11e0-84c8-0026b937c8e1
-        return ML::format("%08lx-%04x-%04x-%04x-%012llx",
-                          (unsigned)f1, (unsigned)f2, (unsigned)f3, (unsigned)f4,
-                          (unsigned long long)f5);
+        if (!fits(36))
+            return 36;
+        char digits[32];
+        encodeHex16((uint64_t(f1) << 32) | (uint64_t(f2) << 16) | f3, digits);
+        encodeHex16((uint64_t(f4) << 48) | f5, digits + 16);
+        memcpy(buffer, digits, 8);
+        buffer[8] = '-';
+        memcpy(buffer + 9, digits + 8, 4);
+        buffer[13] = '-';
+        memcpy(buffer + 14, digits + 12, 4);
+        buffer[18] = '-';
+        memcpy(buffer + 19, digits + 16, 4);
+        buffer[23] = '-';
+        memcpy(buffer + 24, digits + 20, 12);
+        return 36;
+    }
     case GOOG128: {
         // Google ID: --> CAESEAYra3NIxLT9C8twKrzqaA
-        string result = "CAESE                     ";
-
-        auto b64Encode = [] (unsigned i) -> int
-            {
-                if (i < 10) return i + '0';
-                if (i < 36) return i - 10 + 'A';
-                if (i < 62) return i - 36 + 'a';
-                if (i == 62) return '-';
-                if (i == 63) return '_';
-                throw ML::Exception("bad goog base64 char");
-            };
-
+        if (!fits(26))
+            return 26;
+        memcpy(buffer, "CAESE", 5);
         __uint128_t v = val;
         for (unsigned i = 0;  i < 21;  ++i) {
-            result[25 - i] = b64Encode(v & 63);  v = v >> 6;
+            buffer[25 - i] = googDigits[v & 63];  v = v >> 6;
         }
-        return result;
+        return 26;
     }
     case BIGDEC: {
-        string result;
-        if (val2 == 0) {
-            if (val1 == 0) {
-                return "0";
-            }
-            result.reserve(max64_base10_len);
-            uint64_t v = val1;
-            while (v) {
-                int c = v % 10;
-                v /= 10;
-                result += c + '0';
-            }
-        }
+        char digits[40];
+        char * end = digits + sizeof(digits);
+        char * p;
+        if (val2 == 0)
+            p = encodeDecimal(val1, end);
         else {
+            // Blocks of 19 digits, which fit in 64 bits
+            static const uint64_t blockSize = 10000000000000000000ULL;
             __uint128_t v = val;
-            result.reserve(32);
-            while (v) {
-                int c = v % 10;
-                v /= 10;
-                result += c + '0';
+            p = end;
+            while (v >> 64) {
+                char * blockStart = p - 19;
+                p = encodeDecimal(v % blockSize, p);
+                while (p > blockStart)
+                    *--p = '0';
+                v /= blockSize;
             }
+            p = encodeDecimal(v, p);
         }
-        std::reverse(result.begin(), result.end());
-        return result;
+
+        size_t length = end - p;
+        if (fits(length))
+            memcpy(buffer, p, length);
+        return length;
     }
     case BASE64_96: {
-        string result = "                ";
-
-        auto b64Encode = [] (unsigned i) -> int
-            {
-                if (i == 0) return '+';
-                if (i == 1) return '/';
-                if (i < 12) return '0' + i - 2;
-                if (i < 38) return 'A' + i - 12;
-                if (i < 64) return 'a' + i - 38;
-                throw ML::Exception("bad base64 char");
-            };
-
+        if (!fits(16))
+            return 16;
         __uint128_t v = val;
         for (unsigned i = 0;  i < 16;  ++i) {
-            result[15 - i] = b64Encode(v & 63);  v = v >> 6;
+            buffer[15 - i] = base64Digits[v & 63];  v = v >> 6;
         }
-        return result;
+        return 16;
     }
     case HEX128LC: {
-        return ML::format("%016llx%016llx",
-                          (unsigned long long)val1,
-                          (unsigned long long)val2);
+        if (!fits(32))
+            return 32;
+        encodeHex16(val1, buffer);
+        encodeHex16(val2, buffer + 16);
+        return 32;
+    }
+    case COMPOUND2: {
+        size_t length1 = compoundId1().toString(0, 0);
+        size_t length2 = compoundId2().toString(0, 0);
+        size_t length = length1 + 1 + length2;
+        if (!fits(length))
+            return length;
+        compoundId1().toString(buffer, length1);
+        buffer[length1] = ':';
+        compoundId2().toString(buffer + length1 + 1, length2);
+        return length;
     }
-    case COMPOUND2:
-        return compoundId1().toString() + ":" + compoundId2().toString();
     case STR:
-        return std::string(str, str + len);
+        if (fits(len))
+            memcpy(buffer, str, len);
+        return len;
     default:
         throw ML::Exception("unknown ID type");
     }
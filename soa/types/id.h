@@ -153,6 +153,18 @@ struct Id {
     
     std::string toString() const;
 
+    /** Writes the string form of the id into the buffer, which has room for
+        capacity characters, and returns its length without allocating
+        anything.  If it doesn't fit, nothing is written and the needed
+        length is returned, like snprintf() does.  The string form of every
+        id except STR and COMPOUND2 ids fits in MaxLength characters.
+    */
+    size_t toString(char * buffer, size_t capacity) const;
+
+    enum {
+        MaxLength = 40
+    };
+
     uint64_t toInt() const
     {
         if (type != BIGDEC)
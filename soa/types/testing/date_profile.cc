@@ -0,0 +1,91 @@
+/* date_profile.cc
+   Copyright (c) 2013 Datacratic.  All rights reserved.
+
+   Compares date printing, field extraction and ISO 8601 parsing with the
+   strftime(), boost::gregorian and generic parser versions that they
+   replaced.
+*/
+
+#include <iostream>
+#include <boost/date_time/gregorian/gregorian.hpp>
+#include "soa/types/date.h"
+#include "jml/arch/format.h"
+
+using namespace ML;
+using namespace std;
+using namespace Datacratic;
+
+/* What Date::print(5) used to do. */
+string oldPrint(Date date, unsigned digits)
+{
+    string result = date.print("%Y-%b-%d %H:%M:%S");
+    string fractional = format("%0.*f", digits, date.fractionalSeconds());
+    result.append(fractional, 1, -1);
+    return result;
+}
+
+/* What Date::dayOfMonth() and friends used to do. */
+int oldDayOfMonth(Date date)
+{
+    return boost::gregorian::from_string(date.print()).day();
+}
+
+template<typename Fn>
+void profile(const string & what, int n, Fn fn)
+{
+    Date before = Date::now();
+
+    for (unsigned i = 0;  i < n;  ++i)
+        fn(i);
+
+    Date after = Date::now();
+    double elapsed = after.secondsSince(before);
+
+    cerr << what << ": processed " << n << " in " << elapsed << "s ("
+         << 1.0 * n / elapsed << " per second)" << endl;
+}
+
+int main(int argc, char ** argv)
+{
+    int n = 1000000;
+
+    // Dates a millisecond apart, like log lines
+    Date start = Date::now();
+    size_t total = 0;
+
+    profile("print(5) strftime", n, [&] (int i) {
+            total += oldPrint(start.plusSeconds(i * 0.001), 5).size();
+        });
+    profile("print(5)", n, [&] (int i) {
+            total += start.plusSeconds(i * 0.001).print(5).size();
+        });
+
+    // Dates an hour and a bit apart so that nothing is cached
+    profile("dayOfMonth() boost", n, [&] (int i) {
+            total += oldDayOfMonth(start.plusSeconds(i * 3607.0));
+        });
+    profile("dayOfMonth()", n, [&] (int i) {
+            total += start.plusSeconds(i * 3607.0).dayOfMonth();
+        });
+    profile("hourOfWeek()", n, [&] (int i) {
+            total += start.plusSeconds(i * 3607.0).hourOfWeek();
+        });
+
+    string dates[4] = {
+        "2013-01-16T13:34:12.123Z",
+        "2013-05-01T00:00:00Z",
+        "2013-05-01 12:01:02.345678",
+        "2013-12-31T23:59:59.999+05:00"
+    };
+
+    profile("parse generic", n, [&] (int i) {
+            Iso8601Parser parser(dates[i % 4]);
+            total += parser.expectDateTime().secondsSinceEpoch();
+        });
+    profile("parse", n, [&] (int i) {
+            total += Iso8601Parser::parseDateTimeString(dates[i % 4])
+                .secondsSinceEpoch();
+        });
+
+    cerr << "checksum " << total << endl;
+}
@@ -572,3 +572,65 @@ BOOST_AUTO_TEST_CASE( test_second )
     }
 
 }
+
+BOOST_AUTO_TEST_CASE( test_common_iso8601_layout )
+{
+    // The common layout is matched without the generic parser, which has to
+    // agree on the result
+    for (string str: { "2013-04-01T09:08:07",
+                       "2013-04-01 09:08:07.123",
+                       "2013-04-01T09:08:07.123456Z",
+                       "2013-04-01T09:08:07-04:00",
+                       "2013-04-01T09:08:07+0130",
+                       "2012-02-29T23:59:60Z" }) {
+        Date date;
+        BOOST_CHECK(Iso8601Parser::matchCommonDateTime(str.c_str(), str.size(),
+                                                       date));
+        Iso8601Parser parser(str);
+        BOOST_CHECK_EQUAL(date.secondsSinceEpoch(),
+                          parser.expectDateTime().secondsSinceEpoch());
+    }
+
+    for (string str: { "2013-04-01",
+                       "20130401T090807",
+                       "2013-04-01T09:08",
+                       "2013-13-01T09:08:07",
+                       "2013-04-01T24:08:07",
+                       "2013-04-01T09:08:07X",
+                       "2013-04-01T09:08:07.Z",
+                       "2013/04/01T09:08:07" }) {
+        Date date;
+        BOOST_CHECK(!Iso8601Parser::matchCommonDateTime(str.c_str(),
+                                                        str.size(), date));
+    }
+
+    BOOST_CHECK_THROW(Date::parseIso8601DateTime("2013-02-29T00:00:00Z"),
+                      ML::Exception);
+}
+
+BOOST_AUTO_TEST_CASE( test_print_matches_strftime )
+{
+    // Dates are printed without strftime(); check against it
+    Date date = Date(2012, 2, 29, 23, 59, 59, 0.5);
+    for (unsigned i = 0;  i < 100;  ++i, date.addSeconds(86399.123)) {
+        BOOST_CHECK_EQUAL(date.print(), date.print("%Y-%b-%d %H:%M:%S"));
+        BOOST_CHECK_EQUAL(date.printClassic(), date.print("%Y-%m-%d %H:%M:%S"));
+        BOOST_CHECK_EQUAL(date.printRfc2616(),
+                          date.print("%a, %d %b %Y %H:%M:%S GMT"));
+        BOOST_CHECK_EQUAL(date.printIso8601(0),
+                          date.print("%Y-%m-%dT%H:%M:%SZ"));
+
+        tm time = date.toTm();
+        BOOST_CHECK_EQUAL(date.year(), time.tm_year + 1900);
+        BOOST_CHECK_EQUAL(date.monthOfYear(), time.tm_mon + 1);
+        BOOST_CHECK_EQUAL(date.dayOfMonth(), time.tm_mday);
+        BOOST_CHECK_EQUAL(date.dayOfYear(), time.tm_yday);
+        BOOST_CHECK_EQUAL(date.weekday(), time.tm_wday);
+        BOOST_CHECK_EQUAL(date.hour(), time.tm_hour);
+    }
+
+    BOOST_CHECK_EQUAL(Date(2013, 1, 2, 3, 4, 5, 0.999999).print(5),
+                      "2013-Jan-02 03:04:05.00000");
+    BOOST_CHECK_EQUAL(Date(2013, 1, 2, 3, 4, 5, 0.25).printIso8601(),
+                      "2013-01-02T03:04:05.250Z");
+}
@@ -5,6 +5,7 @@
 */
 
 #include <iostream>
+#include <vector>
 #include "soa/types/id.h"
 #include "soa/types/date.h"
 
@@ -105,37 +106,85 @@ void profile3()
          << 1.0 * n / elapsed << " per second)" << endl;
 }
 
-int main(int argc, char ** argv)
+template<typename Fn>
+void timeIt(const std::string & what, int n, Fn fn)
 {
-    //profile1();
-    //profile2();
-    //profile3();
-
-    string ids[5] = {
-        "2fa07c3c-1ac1-4001-15e8-42e6000003a1",
-        "a78e802f-1ac1-4001-15e8-c6b0000003a0",
-        "f8ece33b-1ac1-4001-15e8-42e6000003a1",
-        "e46ead3d-1ac1-4001-15e8-ade2000003a1",
-        "7081463e-1ac1-4001-15e8-01e8000003a0"
-    };
-
-    int nids = 5;
-
     Date before = Date::now();
-    
-    int n = 10000000;
-    
-    for (unsigned i = 0;  i < n;  ++i) {
-        Id id(ids[i % nids]);
-        //if (id.type != Id::UUID)
-        //    cerr << "bad type" << endl;
-        //if (id.toString() != ids[i % nids])
-        //    cerr << "bad parse" << endl;
-    }
+
+    for (unsigned i = 0;  i < n;  ++i)
+        fn(i);
 
     Date after = Date::now();
     double elapsed = after.secondsSince(before);
-    
-    cerr << "processed " << n << " in " << elapsed << "s ("
+
+    cerr << what << ": processed " << n << " in " << elapsed << "s ("
          << 1.0 * n / elapsed << " per second)" << endl;
 }
+
+/** Parses and prints ids of one type, with and without allocating. */
+void profileType(const std::string & name, const vector<string> & strings)
+{
+    int n = 10000000;
+    int nids = strings.size();
+
+    vector<Id> ids;
+    for (auto & s: strings)
+        ids.push_back(Id(s));
+
+    size_t total = 0;
+
+    timeIt(name + " parse", n, [&] (unsigned i)
+           {
+               Id id(strings[i % nids]);
+               total += id.val1;
+           });
+    timeIt(name + " toString", n, [&] (unsigned i)
+           {
+               total += ids[i % nids].toString().size();
+           });
+    timeIt(name + " toString(buffer)", n, [&] (unsigned i)
+           {
+               char buffer[Id::MaxLength];
+               total += ids[i % nids].toString(buffer, sizeof(buffer));
+           });
+
+    if (total == 0)
+        cerr << "nothing processed" << endl;
+}
+
+int main(int argc, char ** argv)
+{
+    //profile1();
+    //profile2();
+    //profile3();
+
+    profileType("UUID",
+                { "2fa07c3c-1ac1-4001-15e8-42e6000003a1",
+                  "a78e802f-1ac1-4001-15e8-c6b0000003a0",
+                  "f8ece33b-1ac1-4001-15e8-42e6000003a1",
+                  "e46ead3d-1ac1-4001-15e8-ade2000003a1",
+                  "7081463e-1ac1-4001-15e8-01e8000003a0" });
+
+    profileType("GOOG128",
+                { "CAESEAYra3NIxLT9C8twKrzqaA",
+                  "CAESEF0Fh4tUw3j1aVvJqlW-1b",
+                  "CAESEKbE_wZK0Yw3mSPvKl2cH6" });
+
+    profileType("BIGDEC",
+                { "7394206091425759590",
+                  "1234567",
+                  "340282366920938463463374607431768211455" });
+
+    profileType("BASE64_96",
+                { "++/9xTyW99YfSEBw",
+                  "++/ADUya99eTA3Cw",
+                  "++/Oek9K99e86Maw" });
+
+    profileType("HEX128LC",
+                { "0123456789abcdef0123456789abcdef",
+                  "8f1c2a9d3b7e4f6a0c5d9e8b7a6f5e4d" });
+
+    profileType("STR",
+                { "hello",
+                  "some-exchange-user-id-that-is-long" });
+}
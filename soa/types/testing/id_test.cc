@@ -329,3 +329,77 @@ BOOST_AUTO_TEST_CASE( test_compound_id )
 {
     Id id(Id("hello"), Id("world"));
 }
+
+BOOST_AUTO_TEST_CASE( test_compound_id_to_string )
+{
+    Id id(Id("hello"), Id("7394206091425759590"));
+    BOOST_CHECK_EQUAL(id.toString(), "hello:7394206091425759590");
+
+    char buffer[25];
+    BOOST_CHECK_EQUAL(id.toString(buffer, 10), 25);
+    BOOST_CHECK_EQUAL(id.toString(buffer, 25), 25);
+    BOOST_CHECK_EQUAL(string(buffer, 25), "hello:7394206091425759590");
+}
+
+BOOST_AUTO_TEST_CASE( test_id_round_trips )
+{
+    const char * ids[] = {
+        "0828398c-5965-11e0-84c8-0026b937c8e1",
+        "CAESEAYra3NIxLT9C8twKrzqaA",
+        "CAESE-_zzzzzzzzzzzzzzzzzzz",
+        "1",
+        "18446744073709551615",
+        "18446744073709551616",
+        "100000000000000000000000000000000000000",
+        "++/Oek9K99e86Maw",
+        "zzzzzzzzzzzzzzzz",
+        "0123456789abcdef0123456789abcdef",
+        "ffffffffffffffffffffffffffffffff"
+    };
+
+    for (const char * s: ids) {
+        Id id(s);
+        BOOST_CHECK_NE(id.type, Id::STR);
+        BOOST_CHECK_EQUAL(id.toString(), s);
+
+        char buffer[Id::MaxLength];
+        size_t length = id.toString(buffer, sizeof(buffer));
+        BOOST_CHECK_EQUAL(string(buffer, length), s);
+
+        // Nothing gets written when it doesn't fit
+        buffer[0] = '!';
+        BOOST_CHECK_EQUAL(id.toString(buffer, length - 1), length);
+        BOOST_CHECK_EQUAL(buffer[0], '!');
+    }
+}
+
+BOOST_AUTO_TEST_CASE( test_id_uppercase_hex )
+{
+    Id uuid("0828398C-5965-11E0-84C8-0026B937C8E1");
+    BOOST_CHECK_EQUAL(uuid.type, Id::UUID);
+    BOOST_CHECK_EQUAL(uuid, Id("0828398c-5965-11e0-84c8-0026b937c8e1"));
+
+    Id hex("0123456789ABCDEF0123456789ABCDEF");
+    BOOST_CHECK_EQUAL(hex.type, Id::HEX128LC);
+    BOOST_CHECK_EQUAL(hex.toString(), "0123456789abcdef0123456789abcdef");
+}
+
+BOOST_AUTO_TEST_CASE( test_id_invalid_chars_are_strings )
+{
+    const char * ids[] = {
+        "0828398c-5965-11e0-84c8-0026b937c8eg",
+        "0828398c-5965-11e0-84c8+0026b937c8e1",
+        "CAESEAYra3NIxLT9C8twKrzqa=",
+        "CAESE\xffYra3NIxLT9C8twKrzqaA",
+        "1844674407370955161a",
+        "++/Oek9K99e86Ma.",
+        "0123456789abcdef0123456789abcdeg",
+        "0123456789abcdef\x80" "123456789abcdef"
+    };
+
+    for (const char * s: ids) {
+        Id id(s);
+        BOOST_CHECK_EQUAL(id.type, Id::STR);
+        BOOST_CHECK_EQUAL(id.toString(), s);
+    }
+}
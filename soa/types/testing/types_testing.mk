@@ -6,4 +6,6 @@ $(eval $(call test,json_handling_test,types arch utils value_description,boost))
 $(eval $(call test,value_description_test,types arch utils value_description,boost))
 $(eval $(call test,value_instance_test,types arch utils value_description,boost))
 $(eval $(call test,periodic_utils_test,types,boost))
+$(eval $(call test,url_test,types,boost))
 $(eval $(call program,id_profile,types))
+$(eval $(call program,date_profile,types))
@@ -3,6 +3,7 @@
 
 #include "googleurl/src/gurl.h"
 #include "googleurl/src/url_util.h"
+#include "googleurl/src/url_canon.h"
 #include "jml/arch/exception.h"
 #include "jml/db/persistent.h"
 
@@ -26,7 +27,7 @@ struct Init {
 
 Url::
 Url()
-    : url(new GURL())
+    : valid_(false), empty_(true)
 {
 }
 
@@ -54,14 +55,147 @@ Url(const Utf32String & s_)
 void
 Url::init(std::string s)
 {
-    if (s == "") {
-        url.reset(new GURL(s));
+    url.reset();
+    spec_.clear();
+    scheme_ = host_ = path_ = query_ = Part();
+    valid_ = false;
+    empty_ = true;
+
+    if (s == "")
         return;
-    }
 
     if (s.find("://") == string::npos) {
         s = "http://" + s;
     }
+
+    if (parseSimple(s)) {
+        valid_ = true;
+        empty_ = false;
+        return;
+    }
+
+    parseFull(s);
+}
+
+namespace {
+
+inline bool isAlnum(char c)
+{
+    return (c >= 'a' && c <= 'z')
+        || (c >= 'A' && c <= 'Z')
+        || (c >= '0' && c <= '9');
+}
+
+/** Characters that GURL copies as is in a path.  It escapes or unescapes
+    some of the others, so we leave those to it.
+*/
+inline bool isPathChar(char c)
+{
+    if (isAlnum(c)) return true;
+
+    switch (c) {
+    case '-': case '.': case '_': case '~': case '!': case '$': case '&':
+    case '(': case ')': case '*': case '+': case ',': case ';': case '=':
+    case ':': case '@': case '/':
+        return true;
+    default:
+        return false;
+    }
+}
+
+/** Same thing for the query string, which keeps escapes as they are. */
+inline bool isQueryChar(char c)
+{
+    return isPathChar(c) || c == '?' || c == '%';
+}
+
+/** "." and ".." path segments are resolved by the canonicaliser. */
+inline bool isDotSegment(const char * begin, const char * end)
+{
+    return (end - begin == 1 && begin[0] == '.')
+        || (end - begin == 2 && begin[0] == '.' && begin[1] == '.');
+}
+
+} // file scope
+
+/** Handles URLs that are canonical already, give or take the case of the
+    host and a missing path, without going through GURL.  Returns false
+    if there is anything in the URL that GURL could change.
+*/
+bool
+Url::
+parseSimple(const std::string & s)
+{
+    int schemeLen;
+    if (s.compare(0, 7, "http://") == 0)
+        schemeLen = 4;
+    else if (s.compare(0, 8, "https://") == 0)
+        schemeLen = 5;
+    else return false;
+
+    const char * begin = s.data();
+    const char * end = begin + s.size();
+
+    // Host: plain labels only.  Ports, user info, IP addresses (which have
+    // a numeric last label), empty labels and trailing dots are all
+    // rewritten by GURL.
+    const char * hostBegin = begin + schemeLen + 3;
+    const char * label = hostBegin;
+    const char * p = hostBegin;
+    for (; p < end && *p != '/' && *p != '?'; ++p) {
+        if (*p == '.') {
+            if (p == label) return false;
+            label = p + 1;
+        }
+        else if (!isAlnum(*p) && *p != '-') return false;
+    }
+    const char * hostEnd = p;
+    if (label == hostEnd || (*label >= '0' && *label <= '9'))
+        return false;
+
+    // Path, without dot segments or characters that need escaping.
+    const char * pathBegin = p;
+    const char * segment = p + 1;
+    for (; p < end && *p != '?'; ++p) {
+        if (*p == '/') {
+            if (isDotSegment(segment, p)) return false;
+            segment = p + 1;
+        }
+        else if (!isPathChar(*p)) return false;
+    }
+    if (p > pathBegin && isDotSegment(segment, p))
+        return false;
+    const char * pathEnd = p;
+
+    // Query string, which takes everything up to the end (a fragment would
+    // need to be split off).
+    for (const char * q = p; q < end; ++q) {
+        if (q > p && !isQueryChar(*q)) return false;
+    }
+
+    spec_.reserve(s.size() + 1);
+    spec_.assign(begin, hostEnd);
+    for (size_t i = hostBegin - begin;  i < spec_.size();  ++i)
+        spec_[i] = tolower(spec_[i]);
+    if (pathBegin == pathEnd)
+        spec_ += '/';
+    else spec_.append(pathBegin, pathEnd);
+    int queryBegin = spec_.size() + 1;
+    spec_.append(pathEnd, end);
+
+    scheme_ = Part(0, schemeLen);
+    host_ = Part(hostBegin - begin, hostEnd - hostBegin);
+    path_ = Part(host_.begin + host_.len, queryBegin - 1 - host_.begin - host_.len);
+    if (pathEnd != end)
+        query_ = Part(queryBegin, spec_.size() - queryBegin);
+
+    return true;
+}
+
+void
+Url::
+parseFull(const std::string & s)
+{
     url.reset(new GURL(s));
 
     if (url->possibly_invalid_spec().empty()) {
@@ -72,6 +206,21 @@ Url::init(std::string s)
             url.reset(new GURL("http://" + s + "/"));
         }
     }
+
+    spec_ = url->possibly_invalid_spec();
+    valid_ = url->is_valid();
+    empty_ = url->is_empty();
+
+    const url_parse::Parsed & parsed = url->parsed_for_possibly_invalid_spec();
+    auto toPart = [] (const url_parse::Component & c)
+        {
+            return c.is_nonempty() ? Part(c.begin, c.len) : Part();
+        };
+
+    scheme_ = toPart(parsed.scheme);
+    host_ = toPart(parsed.host);
+    path_ = toPart(parsed.path);
+    query_ = toPart(parsed.query);
 }
 
 Url::
@@ -102,7 +251,7 @@ Url::
 c_str() const
 {
     if (valid())
-        return url->spec().c_str();
+        return spec_.c_str();
     return original.c_str();
 }
 
@@ -110,14 +259,14 @@ bool
 Url::
 valid() const
 {
-    return url->is_valid();
+    return valid_;
 }
 
 bool
 Url::
 empty() const
 {
-    return url->is_empty();
+    return empty_;
 }
 
 std::string
@@ -125,70 +274,95 @@ Url::
 canonical() const
 {
     if (!valid()) return "";
-    return url->spec();
+    return spec_;
 }
 
 std::string
 Url::
 scheme() const
 {
-    return url->scheme();
+    return part(scheme_);
 }
 
 std::string
 Url::
 username() const
 {
-    return url->username();
+    return url ? url->username() : "";
 }
 
 std::string
 Url::
 password() const
 {
-    return url->password();
+    return url ? url->password() : "";
 }
 
 std::string
 Url::
 host() const
 {
-    return url->host();
+    return part(host_);
 }
 
 bool
 Url::
 hostIsIpAddress() const
 {
-    return url->HostIsIPAddress();
+    return url && url->HostIsIPAddress();
 }
 
 bool
 Url::
 domainMatches(const std::string & str) const
 {
-    return url->DomainIs(str.c_str(), str.length());
+    if (url)
+        return url->DomainIs(str.c_str(), str.length());
+
+    // Same as GURL::DomainIs(), knowing that the host is lowercase and has
+    // no trailing dot.
+    int len = str.length();
+    if (!valid_ || len == 0 || len > host_.len)
+        return false;
+
+    const char * start = spec_.data() + host_.begin + host_.len - len;
+    if (str.compare(0, len, start, len) != 0)
+        return false;
+
+    return str[0] == '.' || host_.len == len || start[-1] == '.';
 }
 
 int
 Url::
 port() const
 {
-    return url->IntPort();
+    return url ? url->IntPort() : url_parse::PORT_UNSPECIFIED;
+}
+
+int
+Url::
+effectivePort() const
+{
+    if (url)
+        return url->EffectiveIntPort();
+    if (!valid_)
+        return url_parse::PORT_UNSPECIFIED;
+    return url_canon::DefaultPortForScheme(spec_.data() + scheme_.begin,
+                                           scheme_.len);
 }
 
 std::string
 Url::
 path() const
 {
-    return url->path();
+    return part(path_);
 }
 
 std::string
 Url::
 query() const
 {
-    return url->query();
+    return part(query_);
 }
 
 uint64_t
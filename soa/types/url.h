@@ -16,6 +16,17 @@ class GURL;
 
 namespace Datacratic {
 
+/** A URL, parsed once into slices of its canonical form.
+
+    Most URLs that come in with bid requests are already canonical (a
+    lowercase http or https scheme, a plain host name, no port and a path
+    and query string that need no escaping).  Those are parsed with a single
+    scan of the string and only cost one buffer; the host is lowercased in
+    place and every component is an offset into that buffer.  Anything
+    else (IP addresses, ports, user info, non ASCII characters, escapes, dot
+    segments, ...) goes through the full GURL canonicalisation, whose result
+    is kept around for the less common accessors.
+*/
 struct Url {
     Url();
     explicit Url(const std::string & s);
@@ -41,17 +52,59 @@ struct Url {
     bool hostIsIpAddress() const;
     bool domainMatches(const std::string & str) const;
     int port() const;
+    int effectivePort() const;  ///< port() or the scheme's default port
     std::string path() const;
     std::string query() const;
 
+    /** Calls onDomain(domain, length) with every domain that the host is
+        part of, from the top level domain to the host itself: "com",
+        "google.com" then "www.google.com".  The strings point inside the
+        url and nothing is allocated.
+    */
+    template<typename Fn>
+    void forEachDomain(Fn && onDomain) const
+    {
+        const char * start = spec_.data() + host_.begin;
+        for (int i = host_.len - 1; i >= 0; --i) {
+            if (start[i] == '.')
+                onDomain(start + i + 1, size_t(host_.len - i - 1));
+        }
+        if (host_.len > 0)
+            onDomain(start, size_t(host_.len));
+    }
+
     uint64_t urlHash();
     uint64_t hostHash();
 
-    std::shared_ptr<GURL> url;
     std::string original;
 
     void serialize(ML::DB::Store_Writer & store) const;
     void reconstitute(ML::DB::Store_Reader & store);
+
+private:
+    struct Part {
+        Part() : begin(0), len(0) {}
+        Part(int begin, int len) : begin(begin), len(len) {}
+
+        int begin;
+        int len;
+    };
+
+    bool parseSimple(const std::string & s);
+    void parseFull(const std::string & s);
+
+    std::string part(const Part & p) const
+    {
+        return std::string(spec_, p.begin, p.len);
+    }
+
+    std::string spec_;          ///< canonical form (possibly invalid)
+    Part scheme_, host_, path_, query_;
+    bool valid_;
+    bool empty_;
+
+    /// Full parse; only there for URLs that aren't simple.
+    std::shared_ptr<GURL> url;
 };
 
 inline std::ostream & operator << (std::ostream & stream, const Url & url)